@@ -0,0 +1,21 @@
+#!/bin/sh
+# Builds clox once and times every benchmark script on the stack backend and on the register backend.
+#
+# Usage: bench/backends.sh [script.lox...]
+# Build with --copt=-DDEBUG_COUNT_INSTRUCTIONS to also get the number of dispatched instructions on stderr.
+
+set -e
+
+if [ $# -eq 0 ]; then
+    set -- "$(dirname "$0")"/*.lox
+fi
+
+bazel build -c opt //clox >/dev/null 2>&1
+binary="$(bazel info -c opt bazel-bin)/clox/clox"
+
+for script in "$@"; do
+    elapsed=$("$binary" "$script" | tail -n 1)
+    printf '%-32s %-10s %s\n' "$(basename "$script")" stack "$elapsed"
+    elapsed=$("$binary" --register "$script" | tail -n 1)
+    printf '%-32s %-10s %s\n' "$(basename "$script")" register "$elapsed"
+done
@@ -0,0 +1,41 @@
+#!/bin/sh
+# Builds clox twice with different copts and times every benchmark script with both binaries.
+#
+# Usage: bench/compare.sh "<copts A>" "<copts B>" [script.lox...]
+# Example: bench/compare.sh "" "-DTOS_CACHING" bench/arithmetic.lox bench/locals.lox
+
+set -e
+
+if [ $# -lt 2 ]; then
+    echo "Usage: $0 \"<copts A>\" \"<copts B>\" [script.lox...]" >&2
+    exit 64
+fi
+
+copts_a=$1
+copts_b=$2
+shift 2
+if [ $# -eq 0 ]; then
+    set -- "$(dirname "$0")"/*.lox
+fi
+
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+
+build() {
+    flags=""
+    for copt in $2; do
+        flags="$flags --copt=$copt"
+    done
+    bazel build -c opt $flags //clox >/dev/null 2>&1
+    cp "$(bazel info -c opt bazel-bin)/clox/clox" "$out/$1"
+}
+
+build a "$copts_a"
+build b "$copts_b"
+
+for script in "$@"; do
+    for binary in a b; do
+        elapsed=$("$out/$binary" "$script" | tail -n 1)
+        printf '%-32s %s %s\n' "$(basename "$script")" "$binary" "$elapsed"
+    done
+done
@@ -72,6 +72,26 @@ int main(int argc, const char *argv[])
     Vm vm;
     init_vm(&vm);
 
+    while (argc > 1 && strncmp(argv[1], "--", 2) == 0)
+    {
+        if (strcmp(argv[1], "--register") == 0)
+        {
+            vm.backend = BACKEND_REGISTER;
+        }
+#ifdef BASELINE_JIT
+        else if (strcmp(argv[1], "--no-jit") == 0)
+        {
+            vm.jit_enabled = false;
+        }
+#endif
+        else
+        {
+            break;
+        }
+        argc--;
+        argv++;
+    }
+
     if (argc == 1)
     {
         repl(&vm);
@@ -82,7 +102,7 @@ int main(int argc, const char *argv[])
     }
     else
     {
-        fprintf(stderr, "Usage: clox [path]\n");
+        fprintf(stderr, "Usage: clox [--register] [--no-jit] [path]\n");
         free_vm(&vm);
         exit(64);
     }
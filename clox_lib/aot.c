@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <string.h>
+#include "aot.h"
+#include "memory.h"
+
+typedef struct
+{
+    const AotProgram *program;
+    ObjFunction **functions;
+    ObjClosure **closures;
+} Loader;
+
+static ObjFunction *load_function(Vm *vm, Loader *loader, int index);
+
+static Value load_constant(Vm *vm, Loader *loader, const AotConstant *constant)
+{
+    switch (constant->type)
+    {
+    case AOT_BOOL:
+        return BOOL_VAL(constant->index != 0);
+    case AOT_NUMBER:
+        return NUMBER_VAL(constant->number);
+    case AOT_STRING:
+        return OBJ_VAL(copy_string(vm, constant->chars, constant->length));
+    case AOT_FUNCTION:
+        return OBJ_VAL(load_function(vm, loader, constant->index));
+    case AOT_CLOSURE:
+        // Every constant made from the same closure is that one closure.
+        if (loader->closures[constant->index] == NULL)
+        {
+            ObjFunction *function = load_function(vm, loader, constant->index);
+            push(vm, OBJ_VAL(function));
+            loader->closures[constant->index] = new_closure(vm, function);
+            pop(vm);
+        }
+        return OBJ_VAL(loader->closures[constant->index]);
+    case AOT_NIL:
+        break;
+    }
+    return NIL_VAL;
+}
+
+// Functions are reachable from the constants of the function that declares them by the time it is loaded, and the
+// script from the stack.
+static ObjFunction *load_function(Vm *vm, Loader *loader, int index)
+{
+    if (loader->functions[index] != NULL)
+    {
+        return loader->functions[index];
+    }
+    const AotFunction *data = &loader->program->functions[index];
+    ObjFunction *function = new_function(vm);
+    loader->functions[index] = function;
+    push(vm, OBJ_VAL(function));
+    function->arity = data->arity;
+    function->upvalue_count = data->upvalue_count;
+    function->max_slots = data->max_slots;
+    function->captures_locals = data->captures_locals;
+    function->is_leaf = data->is_leaf;
+    function->compiled = data->entry;
+    if (data->name != NULL)
+    {
+        function->name = copy_string(vm, data->name, (int)strlen(data->name));
+    }
+
+    Chunk *chunk = &function->chunk;
+    chunk->code = ALLOCATE(uint8_t, data->code_count);
+    memcpy(chunk->code, data->code, (size_t)data->code_count);
+    chunk->count = data->code_count;
+    chunk->capacity = data->code_count;
+    for (int i = 0; i < data->line_count; i++)
+    {
+        write_line_start_array(vm, &chunk->lines, data->lines[i].offset, data->lines[i].line);
+    }
+    for (int i = 0; i < data->constant_count; i++)
+    {
+        add_constant(vm, chunk, load_constant(vm, loader, &data->constants[i]));
+    }
+    for (int i = 0; i < data->cache_count; i++)
+    {
+        int cache = add_inline_cache(vm, chunk, AS_STRING(chunk->constants.values[data->caches[i].name]));
+        chunk->caches[cache].predicted = data->caches[i].predicted;
+    }
+    for (int i = 0; i < data->invoke_cache_count; i++)
+    {
+        add_invoke_cache(vm, chunk, AS_STRING(chunk->constants.values[data->invoke_caches[i]]));
+    }
+    pop(vm);
+    return function;
+}
+
+// The globals get their slots in the order the compiler gave them out, which the operands of the global instructions
+// refer to. The natives the VM defines come first either way.
+static bool load_globals(Vm *vm, const AotProgram *program)
+{
+    for (int i = 0; i < program->global_count; i++)
+    {
+        push(vm, OBJ_VAL(copy_string(vm, program->globals[i], (int)strlen(program->globals[i]))));
+        int slot = global_slot(vm, AS_STRING(vm->stack_top[-1]));
+        pop(vm);
+        if (slot != i)
+        {
+            fprintf(stderr, "Compiled code does not match the runtime.\n");
+            return false;
+        }
+    }
+    for (int i = 0; i < INTRINSIC_COUNT; i++)
+    {
+        if (!program->intrinsic_intact[i])
+        {
+            invalidate_intrinsic(vm, vm->intrinsic_names[i]);
+        }
+    }
+    return true;
+}
+
+static InterpretResult interpret_program(Vm *vm, const AotProgram *program)
+{
+    if (!load_globals(vm, program))
+    {
+        return INTERPRET_COMPILE_ERROR;
+    }
+    Loader loader;
+    loader.program = program;
+    loader.functions = ALLOCATE(ObjFunction *, program->function_count);
+    loader.closures = ALLOCATE(ObjClosure *, program->function_count);
+    for (int i = 0; i < program->function_count; i++)
+    {
+        loader.functions[i] = NULL;
+        loader.closures[i] = NULL;
+    }
+    ObjFunction *script = load_function(vm, &loader, 0);
+    push(vm, OBJ_VAL(script));
+    FREE_ARRAY(ObjFunction *, loader.functions, program->function_count);
+    FREE_ARRAY(ObjClosure *, loader.closures, program->function_count);
+    return interpret_function(vm, script);
+}
+
+int aot_main(const AotProgram *program)
+{
+    Vm vm;
+    init_vm(&vm);
+    InterpretResult result = interpret_program(&vm, program);
+    free_vm(&vm);
+
+    if (result == INTERPRET_COMPILE_ERROR)
+    {
+        return 65;
+    }
+    if (result == INTERPRET_RUNTIME_ERROR)
+    {
+        return 70;
+    }
+    return 0;
+}
@@ -0,0 +1,230 @@
+#ifndef CLOX_AOT_H
+#define CLOX_AOT_H
+
+#include "chunk.h"
+#include "common.h"
+#include "intrinsic.h"
+#include "jit.h"
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+
+// Support for the C that loxc generates. Every Lox function becomes a NativeEntry that works on its frame's stack
+// window, where the locals and temporaries stay so closures can capture them and the GC sees them. loxc knows the
+// stack depth at every instruction, so all of them are fixed slot indices. Whatever needs the runtime goes through the
+// jit_* slow paths after AOT_SYNC has published the ip and stack top they expect. A call may move the stacks, so
+// AOT_RELOAD finds the frame and its slots again afterwards.
+//
+// The bytecode, constants and line numbers the functions refer to come along as static data, an AotProgram, that
+// aot_main turns back into functions without running the compiler.
+
+typedef enum
+{
+    AOT_NIL,
+    AOT_BOOL,
+    AOT_NUMBER,
+    AOT_STRING,
+    AOT_FUNCTION,
+    AOT_CLOSURE,
+} AotConstantType;
+
+// A constant of a compiled function. Booleans keep their value in index, and functions and the closures the compiler
+// made of them the index of the function in the program.
+typedef struct
+{
+    AotConstantType type;
+    int index;
+    double number;
+    const char *chars;
+    int length;
+} AotConstant;
+
+// An inline cache for the name in the constant name.
+typedef struct
+{
+    int name;
+    int predicted;
+} AotCache;
+
+typedef struct
+{
+    // NULL for the script.
+    const char *name;
+    int arity;
+    int upvalue_count;
+    int max_slots;
+    bool captures_locals;
+    bool is_leaf;
+    NativeEntry entry;
+    const uint8_t *code;
+    int code_count;
+    const LineStart *lines;
+    int line_count;
+    const AotConstant *constants;
+    int constant_count;
+    const AotCache *caches;
+    int cache_count;
+    // The constant that names each invoke cache.
+    const int *invoke_caches;
+    int invoke_cache_count;
+} AotFunction;
+
+// The functions in the order list_functions finds them, the script first, and the names of the globals by slot as
+// the compiler handed the slots out.
+typedef struct
+{
+    const AotFunction *functions;
+    int function_count;
+    const char *const *globals;
+    int global_count;
+    bool intrinsic_intact[INTRINSIC_COUNT];
+} AotProgram;
+
+#define AOT_ENTER()                                  \
+    Chunk *chunk = &frame->closure->function->chunk; \
+    Value *constants = chunk->constants.values;      \
+    Value *slots = frame->slots;                     \
+    (void)constants
+
+#define AOT_SYNC(offset, depth) (frame->ip = code_at(chunk, (offset)) + 1, vm->stack_top = slots + (depth))
+
+// Returns from a function without captured locals, which has no upvalues to close: the result moves into the callee's
+// slot inline instead of going through jit_return.
+#define AOT_RETURN(depth)              \
+    do                                 \
+    {                                  \
+        slots[0] = slots[(depth) - 1]; \
+        vm->stack_top = slots + 1;     \
+        vm->frame_count--;             \
+        return true;                   \
+    } while (false)
+
+#define AOT_RELOAD() (frame = &vm->frames[vm->frame_count - 1], slots = frame->slots)
+
+#define AOT_DO(offset, depth, helper) \
+    do                                \
+    {                                 \
+        AOT_SYNC(offset, depth);      \
+        helper;                       \
+    } while (false)
+
+#define AOT_TRY(offset, depth, helper) \
+    do                                 \
+    {                                  \
+        AOT_SYNC(offset, depth);       \
+        if (!(helper))                 \
+        {                              \
+            return false;              \
+        }                              \
+    } while (false)
+
+#define AOT_CALL(offset, depth, helper) \
+    do                                  \
+    {                                   \
+        AOT_TRY(offset, depth, helper); \
+        AOT_RELOAD();                   \
+    } while (false)
+
+#define AOT_FAIL(offset, depth, helper) \
+    do                                  \
+    {                                   \
+        AOT_SYNC(offset, depth);        \
+        return helper;                  \
+    } while (false)
+
+#define AOT_STRING(index) AS_STRING(constants[index])
+#define AOT_GLOBAL(offset) index_operand(chunk->code, (offset))
+#define AOT_CACHE(index) (&chunk->caches[index])
+#define AOT_INVOKE_CACHE(index) (&chunk->invoke_caches[index])
+#define AOT_UPVALUE(index) (*frame->closure->upvalues[index]->location)
+#define AOT_FALSEY(value) (IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value)))
+#define AOT_NUMBERS(a, b) (IS_NUMBER(a) && IS_NUMBER(b))
+
+// The operands of binary instructions are the two values below depth.
+#define AOT_BINARY(offset, depth, op, slow)                                                                  \
+    do                                                                                                       \
+    {                                                                                                        \
+        if (AOT_NUMBERS(slots[(depth) - 2], slots[(depth) - 1]))                                             \
+        {                                                                                                    \
+            slots[(depth) - 2] = NUMBER_VAL(AS_NUMBER(slots[(depth) - 2]) op AS_NUMBER(slots[(depth) - 1])); \
+        }                                                                                                    \
+        else                                                                                                 \
+        {                                                                                                    \
+            AOT_TRY(offset, depth, slow);                                                                    \
+        }                                                                                                    \
+    } while (false)
+
+#define AOT_LOCALS_BINARY(offset, depth, a, b, op, slow)                           \
+    do                                                                             \
+    {                                                                              \
+        if (AOT_NUMBERS(slots[a], slots[b]))                                       \
+        {                                                                          \
+            slots[depth] = NUMBER_VAL(AS_NUMBER(slots[a]) op AS_NUMBER(slots[b])); \
+        }                                                                          \
+        else                                                                       \
+        {                                                                          \
+            slots[depth] = slots[a];                                               \
+            slots[(depth) + 1] = slots[b];                                         \
+            AOT_TRY(offset, (depth) + 2, slow);                                    \
+        }                                                                          \
+    } while (false)
+
+#define AOT_NUMBER_OPERANDS(offset, depth)                        \
+    do                                                            \
+    {                                                             \
+        if (!AOT_NUMBERS(slots[(depth) - 2], slots[(depth) - 1])) \
+        {                                                         \
+            AOT_FAIL(offset, depth, jit_numbers_error(vm));       \
+        }                                                         \
+    } while (false)
+
+#define AOT_HOLDS(depth, op) (AS_NUMBER(slots[(depth) - 2]) op AS_NUMBER(slots[(depth) - 1]))
+
+#define AOT_COMPARE(offset, depth, op)                       \
+    do                                                       \
+    {                                                        \
+        AOT_NUMBER_OPERANDS(offset, depth);                  \
+        slots[(depth) - 2] = BOOL_VAL(AOT_HOLDS(depth, op)); \
+    } while (false)
+
+#define AOT_COMPARE_NOT(offset, depth, op)                    \
+    do                                                        \
+    {                                                         \
+        AOT_NUMBER_OPERANDS(offset, depth);                   \
+        slots[(depth) - 2] = BOOL_VAL(!AOT_HOLDS(depth, op)); \
+    } while (false)
+
+#define AOT_JUMP_IF_COMPARE(offset, depth, op, label) \
+    do                                                \
+    {                                                 \
+        AOT_NUMBER_OPERANDS(offset, depth);           \
+        if (AOT_HOLDS(depth, op))                     \
+        {                                             \
+            goto label;                               \
+        }                                             \
+    } while (false)
+
+#define AOT_JUMP_IF_NOT_COMPARE(offset, depth, op, label) \
+    do                                                    \
+    {                                                     \
+        AOT_NUMBER_OPERANDS(offset, depth);               \
+        if (!AOT_HOLDS(depth, op))                        \
+        {                                                 \
+            goto label;                                   \
+        }                                                 \
+    } while (false)
+
+#define AOT_NEGATE(offset, depth)                                        \
+    do                                                                   \
+    {                                                                    \
+        if (!IS_NUMBER(slots[(depth) - 1]))                              \
+        {                                                                \
+            AOT_FAIL(offset, depth, jit_number_error(vm));               \
+        }                                                                \
+        slots[(depth) - 1] = NUMBER_VAL(-AS_NUMBER(slots[(depth) - 1])); \
+    } while (false)
+
+// Runs a program loxc compiled, the way clox runs a script, and returns clox's exit status.
+int aot_main(const AotProgram *program);
+
+#endif
@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include "chunk.h"
 #include "memory.h"
+#include "object.h"
 #include "vm.h"
 
 void init_line_start_array(Vm *vm, LineStartArray *array)
@@ -41,6 +42,23 @@ void init_chunk(Vm *vm, Chunk *chunk)
     chunk->code = NULL;
     init_line_start_array(vm, &chunk->lines);
     init_value_array(vm, &chunk->constants);
+    chunk->cache_count = 0;
+    chunk->cache_capacity = 0;
+    chunk->caches = NULL;
+    chunk->invoke_cache_count = 0;
+    chunk->invoke_cache_capacity = 0;
+    chunk->invoke_caches = NULL;
+    chunk->cell_count = 0;
+    chunk->cells = NULL;
+    chunk->cell_offsets = NULL;
+    init_register_code(vm, &chunk->registers);
+#ifdef BASELINE_JIT
+    init_native_code(&chunk->native);
+    init_native_code(&chunk->retired);
+#endif
+#ifdef TRACING_JIT
+    init_loop_traces(&chunk->loops);
+#endif
 }
 
 void free_chunk(Vm *vm, Chunk *chunk)
@@ -48,6 +66,18 @@ void free_chunk(Vm *vm, Chunk *chunk)
     FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
     free_line_start_array(vm, &chunk->lines);
     free_value_array(vm, &chunk->constants);
+    FREE_ARRAY(InlineCache, chunk->caches, chunk->cache_capacity);
+    FREE_ARRAY(InvokeCache, chunk->invoke_caches, chunk->invoke_cache_capacity);
+    FREE_ARRAY(Cell, chunk->cells, chunk->cell_count);
+    FREE_ARRAY(int, chunk->cell_offsets, chunk->cell_count);
+    free_register_code(vm, &chunk->registers);
+#ifdef BASELINE_JIT
+    free_native_code(vm, &chunk->native);
+    free_native_code(vm, &chunk->retired);
+#endif
+#ifdef TRACING_JIT
+    free_loop_traces(vm, &chunk->loops);
+#endif
     init_chunk(vm, chunk);
 }
 
@@ -64,9 +94,8 @@ void write_chunk(Vm *vm, Chunk *chunk, uint8_t byte, int line)
     chunk->count++;
 }
 
-void write_constant(Vm *vm, Chunk *chunk, Value value, int line)
+void write_constant(Vm *vm, Chunk *chunk, int index, int line)
 {
-    int index = add_constant(vm, chunk, value);
     if (index < 256)
     {
         write_chunk(vm, chunk, OP_CONSTANT, line);
@@ -81,6 +110,15 @@ void write_constant(Vm *vm, Chunk *chunk, Value value, int line)
     }
 }
 
+void truncate_chunk(Vm *vm, Chunk *chunk, int count)
+{
+    chunk->count = count;
+    while (chunk->lines.count > 0 && chunk->lines.values[chunk->lines.count - 1].offset >= count)
+    {
+        chunk->lines.count--;
+    }
+}
+
 int add_constant(Vm *vm, Chunk *chunk, Value value)
 {
     push(vm, value);
@@ -89,6 +127,49 @@ int add_constant(Vm *vm, Chunk *chunk, Value value)
     return chunk->constants.count - 1;
 }
 
+// name has to be reachable from the chunk's constants: the cache does not keep it alive.
+int add_inline_cache(Vm *vm, Chunk *chunk, ObjString *name)
+{
+    if (chunk->cache_capacity < chunk->cache_count + 1)
+    {
+        int old_capacity = chunk->cache_capacity;
+        chunk->cache_capacity = GROW_CAPACITY(old_capacity);
+        chunk->caches = GROW_ARRAY(InlineCache, chunk->caches, old_capacity, chunk->cache_capacity);
+    }
+    InlineCache *cache = &chunk->caches[chunk->cache_count];
+    cache->name = name;
+    cache->shape = NULL;
+    cache->slot = -1;
+    cache->transition = NULL;
+    cache->method = NIL_VAL;
+    cache->predicted = -1;
+#ifdef DEBUG_COUNT_INLINE_CACHES
+    cache->hits = 0;
+    cache->misses = 0;
+#endif
+    return chunk->cache_count++;
+}
+
+// Like add_inline_cache, name has to be reachable from the chunk's constants.
+int add_invoke_cache(Vm *vm, Chunk *chunk, ObjString *name)
+{
+    if (chunk->invoke_cache_capacity < chunk->invoke_cache_count + 1)
+    {
+        int old_capacity = chunk->invoke_cache_capacity;
+        chunk->invoke_cache_capacity = GROW_CAPACITY(old_capacity);
+        chunk->invoke_caches =
+            GROW_ARRAY(InvokeCache, chunk->invoke_caches, old_capacity, chunk->invoke_cache_capacity);
+    }
+    InvokeCache *cache = &chunk->invoke_caches[chunk->invoke_cache_count];
+    cache->name = name;
+    cache->count = 0;
+#ifdef DEBUG_COUNT_INLINE_CACHES
+    cache->hits = 0;
+    cache->misses = 0;
+#endif
+    return chunk->invoke_cache_count++;
+}
+
 int get_line(Chunk *chunk, int offset)
 {
     int l = 0;
@@ -111,3 +192,389 @@ int get_line(Chunk *chunk, int offset)
     }
     return -1;
 }
+
+static bool takes_cache(uint8_t op)
+{
+    switch (op)
+    {
+    case OP_GET_PROPERTY:
+    case OP_SET_PROPERTY:
+    case OP_GET_THIS_PROPERTY:
+    case OP_SET_THIS_PROPERTY:
+    case OP_INVOKE:
+    case OP_SUPER_INVOKE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static int operand_cells(Chunk *chunk, int offset, int *length)
+{
+    switch (chunk->code[offset])
+    {
+    case OP_CONSTANT:
+    case OP_GET_LOCAL:
+    case OP_SET_LOCAL:
+    case OP_GET_GLOBAL:
+    case OP_DEFINE_GLOBAL:
+    case OP_SET_GLOBAL:
+    case OP_GET_UPVALUE:
+    case OP_SET_UPVALUE:
+    case OP_GET_SUPER:
+    case OP_CALL:
+    case OP_TAIL_CALL:
+    case OP_CALL_CLOSURE:
+    case OP_CLASS:
+    case OP_METHOD:
+    case OP_FIELD:
+    case OP_GET_INTRINSIC:
+        *length = 2;
+        return 1;
+    case OP_GET_PROPERTY:
+    case OP_SET_PROPERTY:
+    case OP_GET_FIELD:
+    case OP_GET_THIS_PROPERTY:
+    case OP_SET_THIS_PROPERTY:
+        *length = 4;
+        return 2;
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+    case OP_LOOP:
+    case OP_POP_JUMP_IF_FALSE:
+    case OP_JUMP_IF_EQUAL:
+    case OP_JUMP_IF_NOT_EQUAL:
+    case OP_JUMP_IF_GREATER:
+    case OP_JUMP_IF_NOT_GREATER:
+    case OP_JUMP_IF_LESS:
+    case OP_JUMP_IF_NOT_LESS:
+        *length = 3;
+        return 1;
+    case OP_ADD_LOCALS:
+    case OP_SUBTRACT_LOCALS:
+    case OP_MULTIPLY_LOCALS:
+    case OP_DIVIDE_LOCALS:
+        *length = 3;
+        return 2;
+    case OP_CONSTANT_LONG:
+        *length = 4;
+        return 1;
+    case OP_INVOKE:
+    case OP_SUPER_INVOKE:
+        *length = 5;
+        return 3;
+    case OP_INTRINSIC:
+        *length = 3;
+        return 2;
+    case OP_CLOSURE:
+    {
+        ObjFunction *function = AS_FUNCTION(chunk->constants.values[chunk->code[offset + 1]]);
+        *length = 2 + 2 * function->upvalue_count;
+        return 1 + 2 * function->upvalue_count;
+    }
+    case OP_WIDE:
+    {
+        if (chunk->code[offset + 1] == OP_CLOSURE)
+        {
+            ObjFunction *function = AS_FUNCTION(chunk->constants.values[index_operand(chunk->code, offset)]);
+            *length = 5 + 4 * function->upvalue_count;
+            return 1 + 2 * function->upvalue_count;
+        }
+        // The prefix and the two extra bytes of the index, one more for a cache index, or the one extra byte of a jump
+        // distance.
+        uint8_t op = chunk->code[offset + 1];
+        int cells = operand_cells(chunk, offset + 1, length);
+        *length += is_jump(op) ? 2 : takes_cache(op) ? 4 : 3;
+        return cells;
+    }
+    default:
+        *length = 1;
+        return 0;
+    }
+}
+
+int instruction_length(Chunk *chunk, int offset)
+{
+    int length;
+    operand_cells(chunk, offset, &length);
+    return length;
+}
+
+// How many values an instruction leaves on the stack compared to before it.
+int stack_effect(Chunk *chunk, int offset)
+{
+    switch (opcode_at(chunk->code, offset))
+    {
+    case OP_CONSTANT:
+    case OP_CONSTANT_LONG:
+    case OP_NIL:
+    case OP_TRUE:
+    case OP_FALSE:
+    case OP_GET_LOCAL:
+    case OP_GET_GLOBAL:
+    case OP_GET_UPVALUE:
+    case OP_GET_THIS_PROPERTY:
+    case OP_ADD_LOCALS:
+    case OP_SUBTRACT_LOCALS:
+    case OP_MULTIPLY_LOCALS:
+    case OP_DIVIDE_LOCALS:
+    case OP_CLOSURE:
+    case OP_CLASS:
+    case OP_GET_INTRINSIC:
+        return 1;
+    case OP_POP:
+    case OP_DEFINE_GLOBAL:
+    case OP_SET_PROPERTY:
+    case OP_GET_SUPER:
+    case OP_EQUAL:
+    case OP_NOT_EQUAL:
+    case OP_GREATER:
+    case OP_NOT_GREATER:
+    case OP_LESS:
+    case OP_NOT_LESS:
+    case OP_ADD:
+    case OP_ADD_NUM:
+    case OP_ADD_STR:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_PRINT:
+    case OP_POP_JUMP_IF_FALSE:
+    case OP_CLOSE_UPVALUE:
+    case OP_RETURN:
+    case OP_INHERIT:
+    case OP_METHOD:
+        return -1;
+    case OP_JUMP_IF_EQUAL:
+    case OP_JUMP_IF_NOT_EQUAL:
+    case OP_JUMP_IF_GREATER:
+    case OP_JUMP_IF_NOT_GREATER:
+    case OP_JUMP_IF_LESS:
+    case OP_JUMP_IF_NOT_LESS:
+        return -2;
+    case OP_CALL:
+    case OP_TAIL_CALL:
+    case OP_CALL_CLOSURE:
+        return -chunk->code[offset + 1];
+    case OP_INVOKE:
+    case OP_INTRINSIC:
+        return -chunk->code[after_index(chunk->code, offset)];
+    case OP_SUPER_INVOKE:
+        return -chunk->code[after_index(chunk->code, offset)] - 1;
+    default:
+        return 0;
+    }
+}
+
+bool is_forward_jump(uint8_t op)
+{
+    switch (op)
+    {
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+    case OP_POP_JUMP_IF_FALSE:
+    case OP_JUMP_IF_EQUAL:
+    case OP_JUMP_IF_NOT_EQUAL:
+    case OP_JUMP_IF_GREATER:
+    case OP_JUMP_IF_NOT_GREATER:
+    case OP_JUMP_IF_LESS:
+    case OP_JUMP_IF_NOT_LESS:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool is_jump(uint8_t op)
+{
+    return op == OP_LOOP || is_forward_jump(op);
+}
+
+// The deepest the stack of a frame running the chunk gets, replaying the code with a static depth. Code after an
+// unconditional jump continues at the depth of the forward jump that reaches it. The *_LOCALS instructions count two
+// slots because string operands are pushed before they are concatenated.
+int max_stack_depth(Vm *vm, Chunk *chunk, int arity)
+{
+    int *depths = ALLOCATE(int, chunk->count + 1);
+    for (int offset = 0; offset <= chunk->count; offset++)
+    {
+        depths[offset] = -1;
+    }
+
+    int depth = arity + 1;
+    int max = depth;
+    bool reachable = true;
+    for (int offset = 0; offset < chunk->count; offset += instruction_length(chunk, offset))
+    {
+        if (!reachable && depths[offset] >= 0)
+        {
+            depth = depths[offset];
+        }
+        reachable = true;
+
+        uint8_t op = opcode_at(chunk->code, offset);
+        int peak = depth + stack_effect(chunk, offset);
+        if (op == OP_ADD_LOCALS || op == OP_SUBTRACT_LOCALS || op == OP_MULTIPLY_LOCALS || op == OP_DIVIDE_LOCALS)
+        {
+            peak++;
+        }
+        if (peak > max)
+        {
+            max = peak;
+        }
+        depth += stack_effect(chunk, offset);
+        if (is_forward_jump(op))
+        {
+            depths[jump_target(chunk->code, offset)] = depth;
+        }
+        if (op == OP_JUMP || op == OP_LOOP || op == OP_RETURN)
+        {
+            reachable = false;
+        }
+    }
+
+    FREE_ARRAY(int, depths, chunk->count + 1);
+    return max;
+}
+
+void predecode_chunk(Vm *vm, Chunk *chunk, const void *const *handlers)
+{
+    int *cell_index = ALLOCATE(int, chunk->count + 1);
+    int cell_count = 0;
+    for (int offset = 0; offset < chunk->count;)
+    {
+        int length;
+        cell_index[offset] = cell_count;
+        cell_count += 1 + operand_cells(chunk, offset, &length);
+        offset += length;
+    }
+    cell_index[chunk->count] = cell_count;
+
+    Cell *cells = ALLOCATE(Cell, cell_count);
+    int *cell_offsets = ALLOCATE(int, cell_count);
+    uint8_t *code = chunk->code;
+    Value *constants = chunk->constants.values;
+    Cell *cell = cells;
+    for (int offset = 0; offset < chunk->count;)
+    {
+        int length;
+        int count = 1 + operand_cells(chunk, offset, &length);
+        for (int i = 0; i < count; i++)
+        {
+            cell_offsets[cell - cells + i] = offset;
+        }
+
+        // A wide instruction runs the handler of the instruction it widens.
+        uint8_t instruction = opcode_at(code, offset);
+        int index = length > 1 ? index_operand(code, offset) : 0;
+        cell->handler = handlers[instruction];
+        switch (instruction)
+        {
+        case OP_CONSTANT:
+            cell[1].value = constants[index];
+            break;
+        case OP_CONSTANT_LONG:
+            cell->handler = handlers[OP_CONSTANT];
+            cell[1].value = constants[code[offset + 1] | code[offset + 2] << 8 | code[offset + 3] << 16];
+            break;
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_CALL:
+        case OP_TAIL_CALL:
+        case OP_CALL_CLOSURE:
+        case OP_GET_INTRINSIC:
+        case OP_GET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_GLOBAL:
+            cell[1].operand = index;
+            break;
+        case OP_GET_SUPER:
+        case OP_CLASS:
+        case OP_METHOD:
+        case OP_FIELD:
+            cell[1].string = AS_STRING(constants[index]);
+            break;
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+        case OP_GET_FIELD:
+        case OP_GET_THIS_PROPERTY:
+        case OP_SET_THIS_PROPERTY:
+            cell[1].string = AS_STRING(constants[index]);
+            cell[2].cache = cache_operand(chunk, offset);
+            break;
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_POP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_EQUAL:
+        case OP_JUMP_IF_NOT_EQUAL:
+        case OP_JUMP_IF_GREATER:
+        case OP_JUMP_IF_NOT_GREATER:
+        case OP_JUMP_IF_LESS:
+        case OP_JUMP_IF_NOT_LESS:
+        case OP_LOOP:
+            cell[1].target = cells + cell_index[jump_target(code, offset)];
+            break;
+        case OP_INVOKE:
+        case OP_SUPER_INVOKE:
+            cell[1].string = AS_STRING(constants[index]);
+            cell[2].operand = code[after_index(code, offset)];
+            cell[3].invoke_cache = invoke_cache_operand(chunk, offset);
+            break;
+        case OP_ADD_LOCALS:
+        case OP_SUBTRACT_LOCALS:
+        case OP_MULTIPLY_LOCALS:
+        case OP_DIVIDE_LOCALS:
+        case OP_INTRINSIC:
+            cell[1].operand = code[offset + 1];
+            cell[2].operand = code[offset + 2];
+            break;
+        case OP_CLOSURE:
+            cell[1].value = constants[index];
+            for (int i = 0; 2 + 2 * i < count; i++)
+            {
+                bool is_local;
+                cell[3 + 2 * i].operand = capture_operand(code, offset, i, &is_local);
+                cell[2 + 2 * i].operand = is_local;
+            }
+            break;
+        default:
+            break;
+        }
+
+        cell += count;
+        offset += length;
+    }
+
+    FREE_ARRAY(int, cell_index, chunk->count + 1);
+    FREE_ARRAY(Cell, chunk->cells, chunk->cell_count);
+    FREE_ARRAY(int, chunk->cell_offsets, chunk->cell_count);
+    chunk->cells = cells;
+    chunk->cell_offsets = cell_offsets;
+    chunk->cell_count = cell_count;
+}
+
+// The inverse of code_offset: where ip points when the instruction at offset is next.
+Code *code_at(Chunk *chunk, int offset)
+{
+#ifdef DIRECT_THREADING
+    int low = 0;
+    int high = chunk->cell_count;
+    while (low < high)
+    {
+        int middle = (low + high) / 2;
+        if (chunk->cell_offsets[middle] < offset)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return chunk->cells + low;
+#else
+    return chunk->code + offset;
+#endif
+}
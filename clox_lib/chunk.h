@@ -2,6 +2,9 @@
 #define CLOX_CHUNK_H
 
 #include "common.h"
+#include "jit.h"
+#include "registers.h"
+#include "trace.h"
 #include "value.h"
 
 typedef enum
@@ -36,6 +39,7 @@ typedef enum
     OP_JUMP_IF_FALSE,
     OP_LOOP,
     OP_CALL,
+    OP_TAIL_CALL,
     OP_INVOKE,
     OP_SUPER_INVOKE,
     OP_CLOSURE,
@@ -44,6 +48,31 @@ typedef enum
     OP_CLASS,
     OP_INHERIT,
     OP_METHOD,
+    OP_FIELD,
+    OP_NOT_EQUAL,
+    OP_NOT_GREATER,
+    OP_NOT_LESS,
+    OP_POP_JUMP_IF_FALSE,
+    OP_JUMP_IF_EQUAL,
+    OP_JUMP_IF_NOT_EQUAL,
+    OP_JUMP_IF_GREATER,
+    OP_JUMP_IF_NOT_GREATER,
+    OP_JUMP_IF_LESS,
+    OP_JUMP_IF_NOT_LESS,
+    OP_GET_THIS_PROPERTY,
+    OP_SET_THIS_PROPERTY,
+    OP_ADD_LOCALS,
+    OP_SUBTRACT_LOCALS,
+    OP_MULTIPLY_LOCALS,
+    OP_DIVIDE_LOCALS,
+    OP_ADD_NUM,
+    OP_ADD_STR,
+    OP_GET_FIELD,
+    OP_CALL_CLOSURE,
+    OP_GET_INTRINSIC,
+    OP_INTRINSIC,
+    OP_WIDE,
+    OPCODE_COUNT,
 } OpCode;
 
 typedef struct
@@ -63,20 +92,221 @@ void init_line_start_array(Vm *vm, LineStartArray *array);
 void free_line_start_array(Vm *vm, LineStartArray *array);
 void write_line_start_array(Vm *vm, LineStartArray *array, int offset, int line);
 
-typedef struct
+typedef struct ObjClosure ObjClosure;
+typedef struct ObjShape ObjShape;
+
+// What one property access site saw last: the receiver's shape, and either the slot the name has in it or, with slot
+// -1, the method the receiver's class supplied. A store that added the field also remembers the shape the instance
+// moved to. Property instructions name their cache with a 16-bit operand after the name constant, or a 24-bit one
+// behind OP_WIDE.
+typedef struct InlineCache
+{
+    ObjString *name;
+    ObjShape *shape;
+    int slot;
+    ObjShape *transition;
+    Value method;
+    // For sites on this, the slot the compiler predicts the field has in instances of the class, or -1.
+    int predicted;
+#ifdef DEBUG_COUNT_INLINE_CACHES
+    uint64_t hits;
+    uint64_t misses;
+#endif
+} InlineCache;
+
+// How many receiver shapes one invoke site tells apart before it turns megamorphic.
+#define INVOKE_CACHE_ENTRIES 4
+
+// The methods one invoke site has called, by the shape of the receiver. A shape without a field of the invoked name
+// has no field to shadow the method, so a matching shape is the whole guard. Super invokes key on the root shape of
+// the superclass. Once all entries are taken, misses go through the VM's megamorphic method cache. Invoke instructions
+// name their cache with a 16-bit operand after the argument count, or a 24-bit one behind OP_WIDE.
+typedef struct InvokeCache
+{
+    ObjString *name;
+    int count;
+    struct
+    {
+        ObjShape *shape;
+        ObjClosure *method;
+    } entries[INVOKE_CACHE_ENTRIES];
+#ifdef DEBUG_COUNT_INLINE_CACHES
+    uint64_t hits;
+    uint64_t misses;
+#endif
+} InvokeCache;
+
+#define MAX_INLINE_CACHES (WIDE_INDEX_MAX + 1)
+
+typedef union Cell
+{
+    const void *handler;
+    Value value;
+    ObjString *string;
+    union Cell *target;
+    InlineCache *cache;
+    InvokeCache *invoke_cache;
+    int operand;
+} Cell;
+
+#ifdef DIRECT_THREADING
+typedef Cell Code;
+#else
+typedef uint8_t Code;
+#endif
+
+typedef struct Chunk
 {
     int count;
     int capacity;
     uint8_t *code;
     LineStartArray lines;
     ValueArray constants;
+    int cache_count;
+    int cache_capacity;
+    InlineCache *caches;
+    int invoke_cache_count;
+    int invoke_cache_capacity;
+    InvokeCache *invoke_caches;
+    int cell_count;
+    Cell *cells;
+    int *cell_offsets;
+    RegisterCode registers;
+#ifdef BASELINE_JIT
+    NativeCode native;
+    // Speculative code replaced after a deoptimization. Activations that entered it may still be running it.
+    NativeCode retired;
+#endif
+#ifdef TRACING_JIT
+    LoopTraces loops;
+#endif
 } Chunk;
 
 void init_chunk(Vm *vm, Chunk *chunk);
 void free_chunk(Vm *vm, Chunk *chunk);
 void write_chunk(Vm *vm, Chunk *chunk, uint8_t byte, int line);
-void write_constant(Vm *vm, Chunk *chunk, Value value, int line);
+// Writes the instruction that pushes the constant at index.
+void write_constant(Vm *vm, Chunk *chunk, int index, int line);
+void truncate_chunk(Vm *vm, Chunk *chunk, int count);
 int add_constant(Vm *vm, Chunk *chunk, Value value);
+int add_inline_cache(Vm *vm, Chunk *chunk, ObjString *name);
+int add_invoke_cache(Vm *vm, Chunk *chunk, ObjString *name);
+
+// OP_WIDE in front of an instruction widens its first operand, a constant, slot or upvalue index, from one byte to
+// three, least significant first, like the index of OP_CONSTANT_LONG. The operands after it follow as usual. The
+// compiler only emits it for indices that do not fit in a byte.
+#define WIDE_INDEX_MAX 0xffffff
+
+static inline uint8_t opcode_at(const uint8_t *code, int offset)
+{
+    return code[offset] == OP_WIDE ? code[offset + 1] : code[offset];
+}
+
+// The first operand of the instruction at offset.
+static inline int index_operand(const uint8_t *code, int offset)
+{
+    if (code[offset] == OP_WIDE)
+    {
+        return code[offset + 2] | code[offset + 3] << 8 | code[offset + 4] << 16;
+    }
+    return code[offset + 1];
+}
+
+// Where the operands after the first one start.
+static inline int after_index(const uint8_t *code, int offset)
+{
+    return offset + (code[offset] == OP_WIDE ? 5 : 2);
+}
+
+// Jumps take their distance in two bytes, most significant first, counted from the end of the instruction: forward,
+// or backward for OP_LOOP. A jump too long for that goes behind OP_WIDE, which gives it three bytes like any index.
+#define JUMP_MAX 0xffffff
+
+static inline int jump_length(const uint8_t *code, int offset)
+{
+    return code[offset] == OP_WIDE ? 5 : 3;
+}
+
+// Where the jump instruction at offset goes.
+static inline int jump_target(const uint8_t *code, int offset)
+{
+    int distance = code[offset] == OP_WIDE ? index_operand(code, offset) : code[offset + 1] << 8 | code[offset + 2];
+    int end = offset + jump_length(code, offset);
+    return opcode_at(code, offset) == OP_LOOP ? end - distance : end + distance;
+}
+
+// Capture i of the closure instruction at offset: whether it is a local of the enclosing function, and the index of
+// that local or upvalue, as wide as the function constant.
+static inline int capture_operand(const uint8_t *code, int offset, int i, bool *is_local)
+{
+    if (code[offset] == OP_WIDE)
+    {
+        const uint8_t *capture = &code[offset + 5 + 4 * i];
+        *is_local = capture[0];
+        return capture[1] | capture[2] << 8 | capture[3] << 16;
+    }
+    *is_local = code[offset + 2 + 2 * i];
+    return code[offset + 3 + 2 * i];
+}
+
+// The cache index after the name of a property or invoke instruction: two bytes, most significant first, or three
+// behind OP_WIDE, least significant first like the wide name.
+static inline int cache_index_at(const uint8_t *code, int offset, int at)
+{
+    if (code[offset] == OP_WIDE)
+    {
+        return code[at] | code[at + 1] << 8 | code[at + 2] << 16;
+    }
+    return code[at] << 8 | code[at + 1];
+}
+
+// The cache of the property instruction at offset.
+static inline int cache_index(const uint8_t *code, int offset)
+{
+    return cache_index_at(code, offset, after_index(code, offset));
+}
+
+static inline InlineCache *cache_operand(Chunk *chunk, int offset)
+{
+    return &chunk->caches[cache_index(chunk->code, offset)];
+}
+
+// The cache of the invoke instruction at offset.
+static inline int invoke_cache_index(const uint8_t *code, int offset)
+{
+    return cache_index_at(code, offset, after_index(code, offset) + 1);
+}
+
+static inline InvokeCache *invoke_cache_operand(Chunk *chunk, int offset)
+{
+    return &chunk->invoke_caches[invoke_cache_index(chunk->code, offset)];
+}
+
 int get_line(Chunk *chunk, int offset);
+int instruction_length(Chunk *chunk, int offset);
+int stack_effect(Chunk *chunk, int offset);
+bool is_forward_jump(uint8_t op);
+bool is_jump(uint8_t op);
+int max_stack_depth(Vm *vm, Chunk *chunk, int arity);
+void predecode_chunk(Vm *vm, Chunk *chunk, const void *const *handlers);
+Code *code_at(Chunk *chunk, int offset);
+
+static inline Code *chunk_entry(Chunk *chunk)
+{
+#ifdef DIRECT_THREADING
+    return chunk->cells;
+#else
+    return chunk->code;
+#endif
+}
+
+static inline int code_offset(Chunk *chunk, Code *ip)
+{
+#ifdef DIRECT_THREADING
+    return chunk->cell_offsets[ip - chunk->cells];
+#else
+    return (int)(ip - chunk->code);
+#endif
+}
 
 #endif
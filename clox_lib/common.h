@@ -2,13 +2,33 @@
 #define CLOX_COMMON_H
 
 #define NAN_BOXING
+#ifdef __GNUC__
+#define THREADED_DISPATCH
+#endif
+#if defined(__x86_64__) && defined(__linux__) && defined(NAN_BOXING)
+#define BASELINE_JIT
+#define TRACING_JIT
+#endif
+// #define TOS_CACHING
+// #define DIRECT_THREADING
+#define QUICKENING
 #define DEBUG_PRINT_CODE
 // #define DEBUG_STRESS_GC
 // #define DEBUG_LOG_GC
 // #define DEBUG_TRACE_EXECUTION
+// #define DEBUG_COUNT_INSTRUCTIONS
+// #define DEBUG_COUNT_OPCODE_PAIRS
+// #define DEBUG_COUNT_SPECIALIZATIONS
+// #define DEBUG_COUNT_INLINE_CACHES
+// #define DEBUG_COUNT_TRACES
+// #define DEBUG_COUNT_TIERS
 
 #define UINT8_COUNT (UINT8_MAX + 1)
 
+#if defined(DIRECT_THREADING) && !defined(THREADED_DISPATCH)
+#error "DIRECT_THREADING requires THREADED_DISPATCH."
+#endif
+
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -105,29 +105,109 @@ static void emit_byte(Compiler *compiler, uint8_t byte)
     write_chunk(compiler->vm, current_chunk(compiler), byte, compiler->parser->previous.line);
 }
 
-static void emit_bytes(Compiler *compiler, uint8_t byte1, uint8_t byte2)
+static void emit_op(Compiler *compiler, uint8_t op)
 {
-    emit_byte(compiler, byte1);
-    emit_byte(compiler, byte2);
+    compiler->previous_instruction = compiler->last_instruction;
+    compiler->last_instruction = current_chunk(compiler)->count;
+    emit_byte(compiler, op);
+}
+
+static void emit_bytes(Compiler *compiler, uint8_t op, uint8_t operand)
+{
+    emit_op(compiler, op);
+    emit_byte(compiler, operand);
+}
+
+static void emit_op_bytes(Compiler *compiler, uint8_t op, uint8_t operand1, uint8_t operand2)
+{
+    emit_op(compiler, op);
+    emit_byte(compiler, operand1);
+    emit_byte(compiler, operand2);
+}
+
+// Emits op behind OP_WIDE, with a three byte index.
+static void emit_wide_operand(Compiler *compiler, int operand)
+{
+    emit_byte(compiler, (uint8_t)(operand & 0xff));
+    emit_byte(compiler, (uint8_t)((operand >> 8) & 0xff));
+    emit_byte(compiler, (uint8_t)((operand >> 16) & 0xff));
+}
+
+static void emit_wide(Compiler *compiler, uint8_t op, int index)
+{
+    if (index > WIDE_INDEX_MAX)
+    {
+        error(compiler, "Too many constants in one chunk.");
+        return;
+    }
+    emit_op(compiler, OP_WIDE);
+    emit_byte(compiler, op);
+    emit_wide_operand(compiler, index);
+}
+
+// Emits an instruction whose first operand is a constant, slot or upvalue index, wide if the index does not fit in a
+// byte. The peepholes only match narrow instructions, since a wide one starts with OP_WIDE.
+static void emit_indexed(Compiler *compiler, uint8_t op, int index)
+{
+    if (index <= UINT8_MAX)
+    {
+        emit_bytes(compiler, op, (uint8_t)index);
+    }
+    else
+    {
+        emit_wide(compiler, op, index);
+    }
+}
+
+static int mark_jump_target(Compiler *compiler)
+{
+    compiler->jump_target = current_chunk(compiler)->count;
+    return compiler->jump_target;
+}
+
+// Superinstructions rewrite the tail of the emitted code. The instruction starting at offset can be rewritten only if
+// it is known and no jump lands after its start.
+static bool can_fuse(Compiler *compiler, int offset)
+{
+    return offset >= 0 && offset >= compiler->jump_target;
+}
+
+static uint8_t instruction_at(Compiler *compiler, int offset)
+{
+    return current_chunk(compiler)->code[offset];
+}
+
+static void rewind_code(Compiler *compiler, int offset)
+{
+    truncate_chunk(compiler->vm, current_chunk(compiler), offset);
+    compiler->last_instruction = -1;
+    compiler->previous_instruction = -1;
 }
 
 static void emit_loop(Compiler *compiler, int loop_start)
 {
-    emit_byte(compiler, OP_LOOP);
+    int offset = current_chunk(compiler)->count - loop_start + 3;
+    if (offset <= UINT16_MAX)
+    {
+        emit_op(compiler, OP_LOOP);
+        emit_byte(compiler, (offset >> 8) & 0xff);
+        emit_byte(compiler, offset & 0xff);
+        return;
+    }
 
-    int offset = current_chunk(compiler)->count - loop_start + 2;
-    if (offset > UINT16_MAX)
+    // The prefix and the third byte of the distance.
+    offset += 2;
+    if (offset > JUMP_MAX)
     {
         error(compiler, "Loop body too large.");
+        return;
     }
-
-    emit_byte(compiler, (offset >> 8) & 0xff);
-    emit_byte(compiler, offset & 0xff);
+    emit_wide(compiler, OP_LOOP, offset);
 }
 
 static int emit_jump(Compiler *compiler, uint8_t instruction)
 {
-    emit_byte(compiler, instruction);
+    emit_op(compiler, instruction);
     emit_byte(compiler, 0xff);
     emit_byte(compiler, 0xff);
     return current_chunk(compiler)->count - 2;
@@ -141,14 +221,152 @@ static void emit_return(Compiler *compiler)
     }
     else
     {
-        emit_byte(compiler, OP_NIL);
+        emit_op(compiler, OP_NIL);
+    }
+    emit_op(compiler, OP_RETURN);
+}
+
+// Numbers are the same constant only if their bits are, which keeps 0 apart from -0.
+static uint64_t constant_bits(Value value)
+{
+    if (IS_NUMBER(value))
+    {
+        double number = AS_NUMBER(value);
+        uint64_t bits;
+        memcpy(&bits, &number, sizeof(bits));
+        return bits;
+    }
+    return (uint64_t)(uintptr_t)AS_OBJ(value);
+}
+
+static bool same_constant(Value a, Value b)
+{
+    return IS_NUMBER(a) == IS_NUMBER(b) && constant_bits(a) == constant_bits(b);
+}
+
+static int *find_constant_entry(Compiler *compiler, Value value)
+{
+    Value *constants = current_chunk(compiler)->constants.values;
+    int mask = compiler->constant_index_capacity - 1;
+    uint64_t bits = constant_bits(value);
+    uint32_t index = (uint32_t)((bits ^ (bits >> 29)) * 0x9e3779b97f4a7c15ull >> 32) & mask;
+    for (;;)
+    {
+        int *entry = &compiler->constant_index[index];
+        if (*entry == -1 || same_constant(constants[*entry], value))
+        {
+            return entry;
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+static void grow_constant_index(Compiler *compiler)
+{
+    Vm *vm = compiler->vm;
+    FREE_ARRAY(int, compiler->constant_index, compiler->constant_index_capacity);
+    compiler->constant_index_capacity = GROW_CAPACITY(compiler->constant_index_capacity);
+    compiler->constant_index = ALLOCATE(int, compiler->constant_index_capacity);
+    for (int i = 0; i < compiler->constant_index_capacity; i++)
+    {
+        compiler->constant_index[i] = -1;
+    }
+    ValueArray *constants = &current_chunk(compiler)->constants;
+    for (int i = 0; i < constants->count; i++)
+    {
+        if (IS_NUMBER(constants->values[i]) || IS_OBJ(constants->values[i]))
+        {
+            int *entry = find_constant_entry(compiler, constants->values[i]);
+            if (*entry == -1)
+            {
+                *entry = i;
+            }
+        }
+    }
+}
+
+// The index of value among the chunk's constants, which numbers and objects get once however often they are used.
+static int make_constant(Compiler *compiler, Value value)
+{
+    Chunk *chunk = current_chunk(compiler);
+    if (!IS_NUMBER(value) && !IS_OBJ(value))
+    {
+        return add_constant(compiler->vm, chunk, value);
+    }
+    if (compiler->constant_index_capacity > 0)
+    {
+        int *entry = find_constant_entry(compiler, value);
+        if (*entry != -1)
+        {
+            return *entry;
+        }
+    }
+    int index = add_constant(compiler->vm, chunk, value);
+    if (chunk->constants.count > compiler->constant_index_capacity * 3 / 4)
+    {
+        grow_constant_index(compiler);
+    }
+    else
+    {
+        *find_constant_entry(compiler, value) = index;
     }
-    emit_byte(compiler, OP_RETURN);
+    return index;
 }
 
 static void emit_constant(Compiler *compiler, Value value)
 {
-    write_constant(compiler->vm, current_chunk(compiler), value, compiler->parser->previous.line);
+    int index = make_constant(compiler, value);
+    compiler->previous_instruction = compiler->last_instruction;
+    compiler->last_instruction = current_chunk(compiler)->count;
+    write_constant(compiler->vm, current_chunk(compiler), index, compiler->parser->previous.line);
+}
+
+// Pushes a value the compiler knows, with the instruction for it if there is one.
+static void emit_value(Compiler *compiler, Value value)
+{
+    if (IS_NIL(value))
+    {
+        emit_op(compiler, OP_NIL);
+    }
+    else if (IS_BOOL(value))
+    {
+        emit_op(compiler, AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+    }
+    else
+    {
+        emit_constant(compiler, value);
+    }
+}
+
+// Whether the instruction at offset pushes a value known at compile time, and which.
+static bool constant_instruction(Compiler *compiler, int offset, Value *value)
+{
+    if (!can_fuse(compiler, offset))
+    {
+        return false;
+    }
+    Chunk *chunk = current_chunk(compiler);
+    uint8_t *code = &chunk->code[offset];
+    switch (code[0])
+    {
+    case OP_CONSTANT:
+        *value = chunk->constants.values[code[1]];
+        return true;
+    case OP_CONSTANT_LONG:
+        *value = chunk->constants.values[code[1] | code[2] << 8 | code[3] << 16];
+        return true;
+    case OP_NIL:
+        *value = NIL_VAL;
+        return true;
+    case OP_TRUE:
+        *value = BOOL_VAL(true);
+        return true;
+    case OP_FALSE:
+        *value = BOOL_VAL(false);
+        return true;
+    default:
+        return false;
+    }
 }
 
 static void patch_jump(Compiler *compiler, int offset)
@@ -157,21 +375,183 @@ static void patch_jump(Compiler *compiler, int offset)
 
     if (jump > UINT16_MAX)
     {
-        error(compiler, "Too much code to jump over.");
+        Vm *vm = compiler->vm;
+        if (compiler->long_jump_capacity < compiler->long_jump_count + 1)
+        {
+            int old_capacity = compiler->long_jump_capacity;
+            compiler->long_jump_capacity = GROW_CAPACITY(old_capacity);
+            compiler->long_jumps =
+                GROW_ARRAY(LongJump, compiler->long_jumps, old_capacity, compiler->long_jump_capacity);
+        }
+        compiler->long_jumps[compiler->long_jump_count++] = (LongJump){offset - 1, current_chunk(compiler)->count};
+        jump = 0;
     }
 
     current_chunk(compiler)->code[offset] = (jump >> 8) & 0xff;
     current_chunk(compiler)->code[offset + 1] = jump & 0xff;
+    mark_jump_target(compiler);
+}
+
+// Forward jumps are emitted short before their distance is known. This rewrites the chunk with those patch_jump found
+// too long behind OP_WIDE. The room they take moves the code after them, which can push other jumps out of reach in
+// turn, so the new offsets are recomputed until no more jumps widen.
+static void relax_jumps(Compiler *compiler)
+{
+    Vm *vm = compiler->vm;
+    Chunk *chunk = current_chunk(compiler);
+    Chunk old = *chunk;
+    int *targets = ALLOCATE(int, old.count + 1);
+    int *moved = ALLOCATE(int, old.count + 1);
+    bool *wide = ALLOCATE(bool, old.count + 1);
+    for (int offset = 0; offset < old.count; offset += instruction_length(&old, offset))
+    {
+        targets[offset] = is_jump(opcode_at(old.code, offset)) ? jump_target(old.code, offset) : -1;
+        wide[offset] = old.code[offset] == OP_WIDE;
+    }
+    for (int i = 0; i < compiler->long_jump_count; i++)
+    {
+        targets[compiler->long_jumps[i].offset] = compiler->long_jumps[i].target;
+        wide[compiler->long_jumps[i].offset] = true;
+    }
+
+    bool widened = true;
+    while (widened)
+    {
+        int shift = 0;
+        for (int offset = 0; offset < old.count; offset += instruction_length(&old, offset))
+        {
+            moved[offset] = offset + shift;
+            shift += wide[offset] && old.code[offset] != OP_WIDE ? 2 : 0;
+        }
+        moved[old.count] = old.count + shift;
+
+        widened = false;
+        for (int offset = 0; offset < old.count; offset += instruction_length(&old, offset))
+        {
+            if (targets[offset] >= 0 && !wide[offset] && abs(moved[targets[offset]] - moved[offset] - 3) > UINT16_MAX)
+            {
+                wide[offset] = true;
+                widened = true;
+            }
+        }
+    }
+
+    chunk->count = 0;
+    chunk->capacity = 0;
+    chunk->code = NULL;
+    init_line_start_array(vm, &chunk->lines);
+    for (int offset = 0; offset < old.count; offset += instruction_length(&old, offset))
+    {
+        int line = get_line(&old, offset);
+        if (targets[offset] < 0)
+        {
+            for (int i = 0; i < instruction_length(&old, offset); i++)
+            {
+                write_chunk(vm, chunk, old.code[offset + i], get_line(&old, offset + i));
+            }
+            continue;
+        }
+
+        uint8_t op = opcode_at(old.code, offset);
+        int end = moved[offset] + (wide[offset] ? 5 : 3);
+        int distance = op == OP_LOOP ? end - moved[targets[offset]] : moved[targets[offset]] - end;
+        if (distance > JUMP_MAX)
+        {
+            error(compiler, op == OP_LOOP ? "Loop body too large." : "Too much code to jump over.");
+        }
+        if (wide[offset])
+        {
+            write_chunk(vm, chunk, OP_WIDE, line);
+            write_chunk(vm, chunk, op, line);
+            write_chunk(vm, chunk, distance & 0xff, line);
+            write_chunk(vm, chunk, (distance >> 8) & 0xff, line);
+            write_chunk(vm, chunk, (distance >> 16) & 0xff, line);
+        }
+        else
+        {
+            write_chunk(vm, chunk, op, line);
+            write_chunk(vm, chunk, (distance >> 8) & 0xff, line);
+            write_chunk(vm, chunk, distance & 0xff, line);
+        }
+    }
+
+    FREE_ARRAY(bool, wide, old.count + 1);
+    FREE_ARRAY(int, moved, old.count + 1);
+    FREE_ARRAY(int, targets, old.count + 1);
+    FREE_ARRAY(uint8_t, old.code, old.capacity);
+    free_line_start_array(vm, &old.lines);
+}
+
+static int emit_jump_if_false(Compiler *compiler)
+{
+    int last = compiler->last_instruction;
+    uint8_t fused = OP_POP_JUMP_IF_FALSE;
+    if (can_fuse(compiler, last))
+    {
+        switch (instruction_at(compiler, last))
+        {
+        case OP_EQUAL:
+            fused = OP_JUMP_IF_NOT_EQUAL;
+            break;
+        case OP_GREATER:
+            fused = OP_JUMP_IF_NOT_GREATER;
+            break;
+        case OP_LESS:
+            fused = OP_JUMP_IF_NOT_LESS;
+            break;
+        case OP_NOT_EQUAL:
+            fused = OP_JUMP_IF_EQUAL;
+            break;
+        case OP_NOT_GREATER:
+            fused = OP_JUMP_IF_GREATER;
+            break;
+        case OP_NOT_LESS:
+            fused = OP_JUMP_IF_LESS;
+            break;
+        default:
+            break;
+        }
+    }
+    if (fused != OP_POP_JUMP_IF_FALSE)
+    {
+        rewind_code(compiler, last);
+    }
+    return emit_jump(compiler, fused);
+}
+
+static void emit_arithmetic(Compiler *compiler, uint8_t op, uint8_t fused)
+{
+    int left = compiler->previous_instruction;
+    int right = compiler->last_instruction;
+    if (can_fuse(compiler, left) && instruction_at(compiler, left) == OP_GET_LOCAL &&
+        instruction_at(compiler, right) == OP_GET_LOCAL)
+    {
+        uint8_t left_slot = current_chunk(compiler)->code[left + 1];
+        uint8_t right_slot = current_chunk(compiler)->code[right + 1];
+        rewind_code(compiler, left);
+        emit_op_bytes(compiler, fused, left_slot, right_slot);
+        return;
+    }
+    emit_op(compiler, op);
 }
 
 static ObjFunction *end_compiler(Compiler *compiler)
 {
     emit_return(compiler);
     ObjFunction *function = compiler->function;
+    if (!compiler->parser->had_error && compiler->long_jump_count > 0)
+    {
+        relax_jumps(compiler);
+    }
+    if (!compiler->parser->had_error)
+    {
+        function->max_slots = max_stack_depth(compiler->vm, current_chunk(compiler), function->arity);
+    }
 #ifdef DEBUG_PRINT_CODE
     if (!compiler->parser->had_error)
     {
-        disassemble_chunk(current_chunk(compiler), function->name != NULL ? function->name->chars : "<script>");
+        disassemble_chunk(compiler->vm, current_chunk(compiler),
+                          function->name != NULL ? function->name->chars : "<script>");
     }
 #endif
     return function;
@@ -190,11 +570,11 @@ static void end_scope(Compiler *compiler)
     {
         if (compiler->locals[compiler->local_count - 1].is_captured)
         {
-            emit_byte(compiler, OP_CLOSE_UPVALUE);
+            emit_op(compiler, OP_CLOSE_UPVALUE);
         }
         else
         {
-            emit_byte(compiler, OP_POP);
+            emit_op(compiler, OP_POP);
         }
         compiler->local_count--;
     }
@@ -225,9 +605,24 @@ static void parse_precedence(Compiler *compiler, Precedence precedence)
     }
 }
 
-static uint8_t identifier_constant(Compiler *compiler, Token *name)
+static int identifier_constant(Compiler *compiler, Token *name)
 {
-    return add_constant(compiler->vm, current_chunk(compiler), OBJ_VAL(copy_string(compiler->vm, name->start, name->length)));
+    return make_constant(compiler, OBJ_VAL(copy_string(compiler->vm, name->start, name->length)));
+}
+
+// The slot of the global variable called name, which the instructions on it take as their operand.
+static int global_variable(Compiler *compiler, Token *name)
+{
+    Vm *vm = compiler->vm;
+    push(vm, OBJ_VAL(copy_string(vm, name->start, name->length)));
+    int slot = global_slot(vm, AS_STRING(vm->stack_top[-1]));
+    pop(vm);
+    return slot;
+}
+
+static ObjString *global_name_at(Compiler *compiler, int slot)
+{
+    return AS_STRING(compiler->vm->global_names.values[slot]);
 }
 
 static bool identifiers_equal(Token *a, Token *b)
@@ -256,8 +651,28 @@ static int resolve_local(Compiler *compiler, Token *name)
     return -1;
 }
 
-static int add_upvalue(Compiler *compiler, uint8_t index, bool is_local)
+// Finds a constant with a known value among the locals of an enclosing function, which a closure can use without
+// capturing it.
+static bool enclosing_constant(Compiler *compiler, Token *name, Value *value)
+{
+    for (; compiler != NULL; compiler = compiler->enclosing)
+    {
+        for (int i = compiler->local_count - 1; i >= 0; i--)
+        {
+            Local *local = &compiler->locals[i];
+            if (identifiers_equal(name, &local->name))
+            {
+                *value = local->constant;
+                return !IS_UNDEFINED(local->constant);
+            }
+        }
+    }
+    return false;
+}
+
+static int add_upvalue(Compiler *compiler, int index, bool is_local, bool is_const)
 {
+    Vm *vm = compiler->vm;
     int upvalue_count = compiler->function->upvalue_count;
 
     for (int i = 0; i < upvalue_count; i++)
@@ -269,14 +684,21 @@ static int add_upvalue(Compiler *compiler, uint8_t index, bool is_local)
         }
     }
 
-    if (upvalue_count == UINT8_COUNT)
+    if (upvalue_count == UPVALUES_MAX)
     {
         error(compiler, "Too many closure variables in function.");
         return 0;
     }
+    if (compiler->upvalue_capacity < upvalue_count + 1)
+    {
+        int old_capacity = compiler->upvalue_capacity;
+        compiler->upvalue_capacity = GROW_CAPACITY(old_capacity);
+        compiler->upvalues = GROW_ARRAY(Upvalue, compiler->upvalues, old_capacity, compiler->upvalue_capacity);
+    }
 
     compiler->upvalues[upvalue_count].is_local = is_local;
     compiler->upvalues[upvalue_count].index = index;
+    compiler->upvalues[upvalue_count].is_const = is_const;
     return compiler->function->upvalue_count++;
 }
 
@@ -291,30 +713,46 @@ static int resolve_upvalue(Compiler *compiler, Token *name)
     if (local != -1)
     {
         compiler->enclosing->locals[local].is_captured = true;
-        return add_upvalue(compiler, (uint8_t)local, true);
+        compiler->enclosing->function->captures_locals = true;
+        return add_upvalue(compiler, local, true, compiler->enclosing->locals[local].is_const);
     }
 
     int upvalue = resolve_upvalue(compiler->enclosing, name);
     if (upvalue != -1)
     {
-        return add_upvalue(compiler, (uint8_t)upvalue, false);
+        return add_upvalue(compiler, upvalue, false, compiler->enclosing->upvalues[upvalue].is_const);
     }
 
     return -1;
 }
 
+// Makes room for one more local and returns it, uninitialized.
+static Local *push_local(Compiler *compiler)
+{
+    Vm *vm = compiler->vm;
+    if (compiler->local_capacity < compiler->local_count + 1)
+    {
+        int old_capacity = compiler->local_capacity;
+        compiler->local_capacity = GROW_CAPACITY(old_capacity);
+        compiler->locals = GROW_ARRAY(Local, compiler->locals, old_capacity, compiler->local_capacity);
+    }
+    return &compiler->locals[compiler->local_count++];
+}
+
 static void add_local(Compiler *compiler, Token name)
 {
-    if (compiler->local_count == UINT8_COUNT)
+    if (compiler->local_count == LOCALS_MAX)
     {
         error(compiler, "Too many local variables in function.");
         return;
     }
 
-    Local *local = &compiler->locals[compiler->local_count++];
+    Local *local = push_local(compiler);
     local->name = name;
     local->depth = -1;
     local->is_captured = false;
+    local->is_const = false;
+    local->constant = UNDEFINED_VAL;
 }
 
 static void declare_variable(Compiler *compiler)
@@ -339,7 +777,49 @@ static void declare_variable(Compiler *compiler)
     add_local(compiler, *name);
 }
 
-static uint8_t parse_variable(Compiler *compiler, const char *error_message)
+// Remembers how the flags of name were, before the script changes them.
+static void flag_global(Compiler *compiler, ObjString *name)
+{
+    while (compiler->enclosing != NULL)
+    {
+        compiler = compiler->enclosing;
+    }
+    Vm *vm = compiler->vm;
+    if (compiler->flagged_capacity < compiler->flagged_count + 1)
+    {
+        int old_capacity = compiler->flagged_capacity;
+        compiler->flagged_capacity = GROW_CAPACITY(old_capacity);
+        compiler->flagged_globals =
+            GROW_ARRAY(GlobalFlags, compiler->flagged_globals, old_capacity, compiler->flagged_capacity);
+    }
+    GlobalFlags *flags = &compiler->flagged_globals[compiler->flagged_count++];
+    flags->name = name;
+    flags->assigned = name->assigned;
+    flags->constant = name->constant;
+}
+
+static void mark_assigned(Compiler *compiler, ObjString *name)
+{
+    if (!name->assigned)
+    {
+        flag_global(compiler, name);
+        name->assigned = true;
+    }
+}
+
+// The slot of a global being declared. A global constant can't be declared again: code compiled since has its value
+// built in.
+static int global_name(Compiler *compiler)
+{
+    int global = global_variable(compiler, &compiler->parser->previous);
+    if (global_name_at(compiler, global)->constant)
+    {
+        error(compiler, "Already a constant with this name.");
+    }
+    return global;
+}
+
+static int parse_variable(Compiler *compiler, const char *error_message)
 {
     consume(compiler, TOKEN_IDENTIFIER, error_message);
     declare_variable(compiler);
@@ -347,7 +827,7 @@ static uint8_t parse_variable(Compiler *compiler, const char *error_message)
     {
         return 0;
     }
-    return identifier_constant(compiler, &compiler->parser->previous);
+    return global_name(compiler);
 }
 
 static void mark_initialized(Compiler *compiler)
@@ -359,14 +839,55 @@ static void mark_initialized(Compiler *compiler)
     compiler->locals[compiler->local_count - 1].depth = compiler->scope_depth;
 }
 
-static void define_variable(Compiler *compiler, uint8_t global)
+static void define_variable(Compiler *compiler, int global)
 {
     if (compiler->scope_depth > 0)
     {
         mark_initialized(compiler);
         return;
     }
-    emit_bytes(compiler, OP_DEFINE_GLOBAL, global);
+    ObjString *name = global_name_at(compiler, global);
+    invalidate_intrinsic(compiler->vm, name);
+    mark_assigned(compiler, name);
+    emit_indexed(compiler, OP_DEFINE_GLOBAL, global);
+}
+
+// A global can only be declared const while nothing defines or assigns it, neither code compiled so far nor the host.
+static void check_new_constant(Compiler *compiler, int global)
+{
+    if (compiler->scope_depth > 0)
+    {
+        return;
+    }
+    ObjString *name = global_name_at(compiler, global);
+    if (!name->constant && (name->assigned || !IS_UNDEFINED(compiler->vm->global_values.values[global])))
+    {
+        error(compiler, "Already a variable with this name.");
+    }
+}
+
+// Defines a constant, whose value is known if it is not UNDEFINED_VAL.
+static void define_constant(Compiler *compiler, int global, Value value)
+{
+    if (compiler->scope_depth > 0)
+    {
+        define_variable(compiler, global);
+        Local *local = &compiler->locals[compiler->local_count - 1];
+        local->is_const = true;
+        local->constant = value;
+        return;
+    }
+    ObjString *name = global_name_at(compiler, global);
+    if (name->constant)
+    {
+        // Declared again, which global_name has reported.
+        define_variable(compiler, global);
+        return;
+    }
+    flag_global(compiler, name);
+    define_variable(compiler, global);
+    name->constant = true;
+    table_set(compiler->vm, &compiler->vm->global_constants, name, value);
 }
 
 static uint8_t argument_list(Compiler *compiler)
@@ -388,10 +909,33 @@ static uint8_t argument_list(Compiler *compiler)
     return arg_count;
 }
 
+static void emit_invoke(Compiler *compiler, uint8_t op, int name, uint8_t arg_count)
+{
+    Chunk *chunk = current_chunk(compiler);
+    if (chunk->invoke_cache_count == MAX_INLINE_CACHES)
+    {
+        error(compiler, "Too many method calls in one function.");
+        return;
+    }
+    int cache = add_invoke_cache(compiler->vm, chunk, AS_STRING(chunk->constants.values[name]));
+    compiler->function->is_leaf = false;
+    if (name > UINT8_MAX || cache > UINT16_MAX)
+    {
+        emit_wide(compiler, op, name);
+        emit_byte(compiler, arg_count);
+        emit_wide_operand(compiler, cache);
+        return;
+    }
+    emit_bytes(compiler, op, (uint8_t)name);
+    emit_byte(compiler, arg_count);
+    emit_byte(compiler, (uint8_t)(cache >> 8));
+    emit_byte(compiler, (uint8_t)(cache & 0xff));
+}
+
 static void and_(Compiler *compiler, bool can_assign)
 {
     int end_jump = emit_jump(compiler, OP_JUMP_IF_FALSE);
-    emit_byte(compiler, OP_POP);
+    emit_op(compiler, OP_POP);
     parse_precedence(compiler, PREC_AND);
     patch_jump(compiler, end_jump);
 }
@@ -401,7 +945,7 @@ static void or_(Compiler *compiler, bool can_assign)
     int else_jump = emit_jump(compiler, OP_JUMP_IF_FALSE);
     int end_jump = emit_jump(compiler, OP_JUMP);
     patch_jump(compiler, else_jump);
-    emit_byte(compiler, OP_POP);
+    emit_op(compiler, OP_POP);
     parse_precedence(compiler, PREC_OR);
     patch_jump(compiler, end_jump);
 }
@@ -440,7 +984,7 @@ static void function(Compiler *compiler, FunctionType type)
             {
                 error_at_current(&sub_compiler, "Can't have more than 255 parameters.");
             }
-            uint8_t constant = parse_variable(&sub_compiler, "Expect parameter name.");
+            int constant = parse_variable(&sub_compiler, "Expect parameter name.");
             define_variable(&sub_compiler, constant);
         } while (match(&sub_compiler, TOKEN_COMMA));
     }
@@ -450,20 +994,41 @@ static void function(Compiler *compiler, FunctionType type)
 
     ObjFunction *function = end_compiler(&sub_compiler);
     compiler->vm->compiler = compiler;
-    free_compiler(&sub_compiler);
 
-    emit_bytes(compiler, OP_CLOSURE, add_constant(compiler->vm, current_chunk(compiler), OBJ_VAL(function)));
+    // The captures are as wide as the closure instruction, which has to be wide if any of them is.
+    int constant = make_constant(compiler, OBJ_VAL(function));
+    bool wide = constant > UINT8_MAX;
+    for (int i = 0; i < function->upvalue_count; i++)
+    {
+        wide = wide || sub_compiler.upvalues[i].index > UINT8_MAX;
+    }
+    if (wide)
+    {
+        emit_wide(compiler, OP_CLOSURE, constant);
+    }
+    else
+    {
+        emit_bytes(compiler, OP_CLOSURE, (uint8_t)constant);
+    }
     for (int i = 0; i < function->upvalue_count; i++)
     {
+        int index = sub_compiler.upvalues[i].index;
         emit_byte(compiler, sub_compiler.upvalues[i].is_local ? 1 : 0);
-        emit_byte(compiler, sub_compiler.upvalues[i].index);
+        emit_byte(compiler, (uint8_t)(index & 0xff));
+        if (wide)
+        {
+            emit_byte(compiler, (uint8_t)((index >> 8) & 0xff));
+            emit_byte(compiler, (uint8_t)((index >> 16) & 0xff));
+        }
     }
+    free_compiler(&sub_compiler);
 }
 
 static void method(Compiler *compiler)
 {
     consume(compiler, TOKEN_IDENTIFIER, "Expect method name.");
-    uint8_t constant = identifier_constant(compiler, &compiler->parser->previous);
+    int constant = identifier_constant(compiler, &compiler->parser->previous);
+    intern_selector(compiler->vm, AS_STRING(current_chunk(compiler)->constants.values[constant]));
 
     FunctionType type = TYPE_METHOD;
     if (compiler->parser->previous.length == 4 && memcmp(compiler->parser->previous.start, "init", 4) == 0)
@@ -472,7 +1037,7 @@ static void method(Compiler *compiler)
     }
     function(compiler, type);
 
-    emit_bytes(compiler, OP_METHOD, constant);
+    emit_indexed(compiler, OP_METHOD, constant);
 }
 
 static Token synthetic_token(Compiler *compiler, const char *text)
@@ -495,35 +1060,86 @@ static void super_(Compiler *compiler, bool can_assign)
     }
     consume(compiler, TOKEN_DOT, "Expect '.' after 'super'.");
     consume(compiler, TOKEN_IDENTIFIER, "Expect superclass method name.");
-    uint8_t name = identifier_constant(compiler, &compiler->parser->previous);
+    int name = identifier_constant(compiler, &compiler->parser->previous);
     named_variable(compiler, synthetic_token(compiler, "this"), false);
     if (match(compiler, TOKEN_LEFT_PAREN))
     {
         uint8_t arg_count = argument_list(compiler);
         named_variable(compiler, synthetic_token(compiler, "super"), false);
-        emit_bytes(compiler, OP_SUPER_INVOKE, name);
-        emit_byte(compiler, arg_count);
+        emit_invoke(compiler, OP_SUPER_INVOKE, name, arg_count);
     }
     else
     {
         named_variable(compiler, synthetic_token(compiler, "super"), false);
-        emit_bytes(compiler, OP_GET_SUPER, name);
+        emit_indexed(compiler, OP_GET_SUPER, name);
+    }
+}
+
+static int predicted_slot(ObjString **fields, int field_count, ObjString *name)
+{
+    for (int i = 0; i < field_count; i++)
+    {
+        if (fields[i] == name)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Predicts the fields instances of the class get from the fields its methods assign to this: those init assigns in
+// the order it does, then those other methods assign. Every site on this learns its field's slot, and the class its
+// layout from the OP_FIELD instructions that follow the methods.
+static void predict_fields(Compiler *compiler, ClassCompiler *klass)
+{
+    ObjString *fields[SHAPE_MAX_SLOTS];
+    int field_count = 0;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (int i = 0; i < klass->field_site_count && field_count < SHAPE_MAX_SLOTS; i++)
+        {
+            FieldSite *site = &klass->field_sites[i];
+            if (site->is_store && site->in_initializer == (pass == 0))
+            {
+                ObjString *name = site->function->chunk.caches[site->cache].name;
+                if (predicted_slot(fields, field_count, name) == -1)
+                {
+                    fields[field_count++] = name;
+                }
+            }
+        }
     }
+
+    for (int i = 0; i < klass->field_site_count; i++)
+    {
+        InlineCache *cache = &klass->field_sites[i].function->chunk.caches[klass->field_sites[i].cache];
+        cache->predicted = predicted_slot(fields, field_count, cache->name);
+    }
+    for (int i = 0; i < field_count; i++)
+    {
+        emit_indexed(compiler, OP_FIELD, make_constant(compiler, OBJ_VAL(fields[i])));
+    }
+    Vm *vm = compiler->vm;
+    FREE_ARRAY(FieldSite, klass->field_sites, klass->field_site_capacity);
 }
 
 static void class_declaration(Compiler *compiler)
 {
     consume(compiler, TOKEN_IDENTIFIER, "Expect class name.");
     Token class_name = compiler->parser->previous;
-    uint8_t name_constant = identifier_constant(compiler, &compiler->parser->previous);
+    int name_constant = identifier_constant(compiler, &compiler->parser->previous);
+    int global = compiler->scope_depth > 0 ? 0 : global_name(compiler);
     declare_variable(compiler);
 
-    emit_bytes(compiler, OP_CLASS, name_constant);
-    define_variable(compiler, name_constant);
+    emit_indexed(compiler, OP_CLASS, name_constant);
+    define_variable(compiler, global);
 
     ClassCompiler class_compiler;
     class_compiler.enclosing = compiler->current_class;
     class_compiler.has_superclass = false;
+    class_compiler.field_sites = NULL;
+    class_compiler.field_site_count = 0;
+    class_compiler.field_site_capacity = 0;
 
     compiler->current_class = &class_compiler;
 
@@ -541,7 +1157,7 @@ static void class_declaration(Compiler *compiler)
         define_variable(compiler, 0);
 
         named_variable(compiler, class_name, false);
-        emit_byte(compiler, OP_INHERIT);
+        emit_op(compiler, OP_INHERIT);
 
         compiler->current_class->has_superclass = true;
     }
@@ -555,7 +1171,8 @@ static void class_declaration(Compiler *compiler)
     }
 
     consume(compiler, TOKEN_RIGHT_BRACE, "Expect '}' before class body.");
-    emit_byte(compiler, OP_POP);
+    predict_fields(compiler, &class_compiler);
+    emit_op(compiler, OP_POP);
 
     if (compiler->current_class->has_superclass)
     {
@@ -567,7 +1184,7 @@ static void class_declaration(Compiler *compiler)
 
 static void fun_declaration(Compiler *compiler)
 {
-    uint8_t global = parse_variable(compiler, "Expect function name.");
+    int global = parse_variable(compiler, "Expect function name.");
     mark_initialized(compiler);
     function(compiler, TYPE_FUNCTION);
     define_variable(compiler, global);
@@ -575,7 +1192,7 @@ static void fun_declaration(Compiler *compiler)
 
 static void var_declaration(Compiler *compiler)
 {
-    uint8_t global = parse_variable(compiler, "Expect variable name.");
+    int global = parse_variable(compiler, "Expect variable name.");
 
     if (match(compiler, TOKEN_EQUAL))
     {
@@ -583,18 +1200,63 @@ static void var_declaration(Compiler *compiler)
     }
     else
     {
-        emit_byte(compiler, OP_NIL);
+        emit_op(compiler, OP_NIL);
     }
     consume(compiler, TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
 
     define_variable(compiler, global);
 }
 
+// A function without upvalues behaves the same in every closure, so the one made at compile time can stand in for the
+// constant everywhere.
+static void const_function_declaration(Compiler *compiler)
+{
+    int global = parse_variable(compiler, "Expect function name.");
+    check_new_constant(compiler, global);
+    mark_initialized(compiler);
+    function(compiler, TYPE_FUNCTION);
+
+    Value value = UNDEFINED_VAL;
+    int last = compiler->last_instruction;
+    Chunk *chunk = current_chunk(compiler);
+    ObjFunction *compiled =
+        can_fuse(compiler, last) ? AS_FUNCTION(chunk->constants.values[index_operand(chunk->code, last)]) : NULL;
+    if (compiled != NULL && compiled->upvalue_count == 0)
+    {
+        value = OBJ_VAL(new_closure(compiler->vm, compiled));
+        rewind_code(compiler, last);
+        emit_constant(compiler, value);
+    }
+    define_constant(compiler, global, value);
+}
+
+static void const_declaration(Compiler *compiler)
+{
+    if (match(compiler, TOKEN_FUN))
+    {
+        const_function_declaration(compiler);
+        return;
+    }
+    int global = parse_variable(compiler, "Expect constant name.");
+    check_new_constant(compiler, global);
+    consume(compiler, TOKEN_EQUAL, "Expect '=' after constant name.");
+    int start = current_chunk(compiler)->count;
+    expression(compiler);
+    consume(compiler, TOKEN_SEMICOLON, "Expect ';' after constant declaration.");
+
+    Value value = UNDEFINED_VAL;
+    if (compiler->last_instruction != start || !constant_instruction(compiler, start, &value))
+    {
+        value = UNDEFINED_VAL;
+    }
+    define_constant(compiler, global, value);
+}
+
 static void expression_statement(Compiler *compiler)
 {
     expression(compiler);
     consume(compiler, TOKEN_SEMICOLON, "Expect ';' after expression.");
-    emit_byte(compiler, OP_POP);
+    emit_op(compiler, OP_POP);
 }
 
 static void if_statement(Compiler *compiler)
@@ -603,38 +1265,36 @@ static void if_statement(Compiler *compiler)
     expression(compiler);
     consume(compiler, TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
 
-    int then_jump = emit_jump(compiler, OP_JUMP_IF_FALSE);
-    emit_byte(compiler, OP_POP);
+    int then_jump = emit_jump_if_false(compiler);
 
     statement(compiler);
 
-    int else_jump = emit_jump(compiler, OP_JUMP);
-    patch_jump(compiler, then_jump);
-    emit_byte(compiler, OP_POP);
-
     if (match(compiler, TOKEN_ELSE))
     {
+        int else_jump = emit_jump(compiler, OP_JUMP);
+        patch_jump(compiler, then_jump);
         statement(compiler);
+        patch_jump(compiler, else_jump);
+    }
+    else
+    {
+        patch_jump(compiler, then_jump);
     }
-
-    patch_jump(compiler, else_jump);
 }
 
 static void while_statement(Compiler *compiler)
 {
-    int loop_start = current_chunk(compiler)->count;
+    int loop_start = mark_jump_target(compiler);
 
     consume(compiler, TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
     expression(compiler);
     consume(compiler, TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
 
-    int exit_jump = emit_jump(compiler, OP_JUMP_IF_FALSE);
-    emit_byte(compiler, OP_POP);
+    int exit_jump = emit_jump_if_false(compiler);
     statement(compiler);
     emit_loop(compiler, loop_start);
 
     patch_jump(compiler, exit_jump);
-    emit_byte(compiler, OP_POP);
 }
 
 static void for_statement(Compiler *compiler)
@@ -655,22 +1315,21 @@ static void for_statement(Compiler *compiler)
         expression_statement(compiler);
     }
 
-    int loop_start = current_chunk(compiler)->count;
+    int loop_start = mark_jump_target(compiler);
     int exit_jump = -1;
     if (!match(compiler, TOKEN_SEMICOLON))
     {
         expression(compiler);
         consume(compiler, TOKEN_SEMICOLON, "Expect ';' after loop condition");
-        exit_jump = emit_jump(compiler, OP_JUMP_IF_FALSE);
-        emit_byte(compiler, OP_POP);
+        exit_jump = emit_jump_if_false(compiler);
     }
 
     if (!match(compiler, TOKEN_RIGHT_PAREN))
     {
         int body_jump = emit_jump(compiler, OP_JUMP);
-        int increment_start = current_chunk(compiler)->count;
+        int increment_start = mark_jump_target(compiler);
         expression(compiler);
-        emit_byte(compiler, OP_POP);
+        emit_op(compiler, OP_POP);
         consume(compiler, TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
 
         emit_loop(compiler, loop_start);
@@ -684,7 +1343,6 @@ static void for_statement(Compiler *compiler)
     if (exit_jump != -1)
     {
         patch_jump(compiler, exit_jump);
-        emit_byte(compiler, OP_POP);
     }
 
     end_scope(compiler);
@@ -694,7 +1352,7 @@ static void print_statement(Compiler *compiler)
 {
     expression(compiler);
     consume(compiler, TOKEN_SEMICOLON, "Expect ';' after value.");
-    emit_byte(compiler, OP_PRINT);
+    emit_op(compiler, OP_PRINT);
 }
 
 static void return_statement(Compiler *compiler)
@@ -716,7 +1374,14 @@ static void return_statement(Compiler *compiler)
         }
         expression(compiler);
         consume(compiler, TOKEN_SEMICOLON, "Expect ';' after return value.");
-        emit_byte(compiler, OP_RETURN);
+        // A call in tail position lets the callee take over the frame. The OP_RETURN stays for callees that are not
+        // closures.
+        int last = compiler->last_instruction;
+        if (can_fuse(compiler, last) && instruction_at(compiler, last) == OP_CALL)
+        {
+            current_chunk(compiler)->code[last] = OP_TAIL_CALL;
+        }
+        emit_op(compiler, OP_RETURN);
     }
 }
 
@@ -733,6 +1398,7 @@ static void synchronize(Compiler *compiler)
         switch (parser->current.type)
         {
         case TOKEN_CLASS:
+        case TOKEN_CONST:
         case TOKEN_FUN:
         case TOKEN_VAR:
         case TOKEN_FOR:
@@ -761,6 +1427,10 @@ static void declaration(Compiler *compiler)
     {
         var_declaration(compiler);
     }
+    else if (match(compiler, TOKEN_CONST))
+    {
+        const_declaration(compiler);
+    }
     else
     {
         statement(compiler);
@@ -826,31 +1496,58 @@ static void named_variable(Compiler *compiler, Token name, bool can_assign)
 {
     uint8_t get_op;
     uint8_t set_op;
+    bool is_const = false;
+    Value constant = UNDEFINED_VAL;
     int arg = resolve_local(compiler, &name);
     if (arg != -1)
     {
         get_op = OP_GET_LOCAL;
         set_op = OP_SET_LOCAL;
+        is_const = compiler->locals[arg].is_const;
+        constant = compiler->locals[arg].constant;
+    }
+    else if (enclosing_constant(compiler->enclosing, &name, &constant))
+    {
+        // Known constants of enclosing functions are not captured.
+        arg = 0;
+        is_const = true;
+        get_op = OP_GET_UPVALUE;
+        set_op = OP_SET_UPVALUE;
     }
     else if ((arg = resolve_upvalue(compiler, &name)) != -1)
     {
         get_op = OP_GET_UPVALUE;
         set_op = OP_SET_UPVALUE;
+        is_const = compiler->upvalues[arg].is_const;
     }
     else
     {
-        arg = identifier_constant(compiler, &name);
+        arg = global_variable(compiler, &name);
+        is_const = table_get(&compiler->vm->global_constants, global_name_at(compiler, arg), &constant);
         get_op = OP_GET_GLOBAL;
         set_op = OP_SET_GLOBAL;
     }
     if (can_assign && match(compiler, TOKEN_EQUAL))
     {
+        if (is_const)
+        {
+            error(compiler, "Can't assign to a constant.");
+        }
         expression(compiler);
-        emit_bytes(compiler, set_op, arg);
+        if (set_op == OP_SET_GLOBAL)
+        {
+            invalidate_intrinsic(compiler->vm, global_name_at(compiler, arg));
+            mark_assigned(compiler, global_name_at(compiler, arg));
+        }
+        emit_indexed(compiler, set_op, arg);
+    }
+    else if (!IS_UNDEFINED(constant))
+    {
+        emit_value(compiler, constant);
     }
     else
     {
-        emit_bytes(compiler, get_op, arg);
+        emit_indexed(compiler, get_op, arg);
     }
 }
 
@@ -869,17 +1566,111 @@ static void this_(Compiler *compiler, bool can_assign)
     variable(compiler, false);
 }
 
+static bool falsey_constant(Value value)
+{
+    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
+// Replaces an operator applied to an operand the compiler knows with its result. Operands the operator would reject at
+// run time are left for it to.
+static bool fold_unary(Compiler *compiler, TokenType operator_type)
+{
+    int operand = compiler->last_instruction;
+    Value value;
+    if (!constant_instruction(compiler, operand, &value))
+    {
+        return false;
+    }
+    if (operator_type == TOKEN_BANG)
+    {
+        value = BOOL_VAL(falsey_constant(value));
+    }
+    else if (IS_NUMBER(value))
+    {
+        value = NUMBER_VAL(-AS_NUMBER(value));
+    }
+    else
+    {
+        return false;
+    }
+    rewind_code(compiler, operand);
+    emit_value(compiler, value);
+    return true;
+}
+
+static bool fold_binary(Compiler *compiler, TokenType operator_type)
+{
+    int left = compiler->previous_instruction;
+    int right = compiler->last_instruction;
+    Value a;
+    Value b;
+    if (!constant_instruction(compiler, left, &a) || !constant_instruction(compiler, right, &b))
+    {
+        return false;
+    }
+    Value value;
+    if (operator_type == TOKEN_EQUAL_EQUAL || operator_type == TOKEN_BANG_EQUAL)
+    {
+        value = BOOL_VAL(values_equal(a, b) == (operator_type == TOKEN_EQUAL_EQUAL));
+    }
+    else if (!IS_NUMBER(a) || !IS_NUMBER(b))
+    {
+        return false;
+    }
+    else
+    {
+        double x = AS_NUMBER(a);
+        double y = AS_NUMBER(b);
+        switch (operator_type)
+        {
+        case TOKEN_PLUS:
+            value = NUMBER_VAL(x + y);
+            break;
+        case TOKEN_MINUS:
+            value = NUMBER_VAL(x - y);
+            break;
+        case TOKEN_STAR:
+            value = NUMBER_VAL(x * y);
+            break;
+        case TOKEN_SLASH:
+            value = NUMBER_VAL(x / y);
+            break;
+        case TOKEN_GREATER:
+            value = BOOL_VAL(x > y);
+            break;
+        case TOKEN_GREATER_EQUAL:
+            value = BOOL_VAL(!(x < y));
+            break;
+        case TOKEN_LESS:
+            value = BOOL_VAL(x < y);
+            break;
+        case TOKEN_LESS_EQUAL:
+            value = BOOL_VAL(!(x > y));
+            break;
+        default:
+            return false;
+        }
+    }
+    rewind_code(compiler, left);
+    emit_value(compiler, value);
+    return true;
+}
+
 static void unary(Compiler *compiler, bool can_assign)
 {
     TokenType operator_type = compiler->parser->previous.type;
     parse_precedence(compiler, PREC_UNARY);
+    if (fold_unary(compiler, operator_type))
+    {
+        return;
+    }
     switch (operator_type)
     {
     case TOKEN_MINUS:
-        emit_byte(compiler, OP_NEGATE);
+        emit_op(compiler, OP_NEGATE);
         break;
     case TOKEN_BANG:
-        emit_byte(compiler, OP_NOT);
+        emit_op(compiler, OP_NOT);
         break;
     default:
         break;
@@ -891,68 +1682,160 @@ static void binary(Compiler *compiler, bool can_assign)
     TokenType operator_type = compiler->parser->previous.type;
     ParseRule *rule = get_rule(operator_type);
     parse_precedence(compiler, (Precedence)(rule->precedence + 1));
+    if (fold_binary(compiler, operator_type))
+    {
+        return;
+    }
     switch (operator_type)
     {
     case TOKEN_PLUS:
-        emit_byte(compiler, OP_ADD);
+        emit_arithmetic(compiler, OP_ADD, OP_ADD_LOCALS);
         break;
     case TOKEN_MINUS:
-        emit_byte(compiler, OP_SUBTRACT);
+        emit_arithmetic(compiler, OP_SUBTRACT, OP_SUBTRACT_LOCALS);
         break;
     case TOKEN_STAR:
-        emit_byte(compiler, OP_MULTIPLY);
+        emit_arithmetic(compiler, OP_MULTIPLY, OP_MULTIPLY_LOCALS);
         break;
     case TOKEN_SLASH:
-        emit_byte(compiler, OP_DIVIDE);
+        emit_arithmetic(compiler, OP_DIVIDE, OP_DIVIDE_LOCALS);
         break;
     case TOKEN_BANG_EQUAL:
-        emit_bytes(compiler, OP_EQUAL, OP_NOT);
+        emit_op(compiler, OP_NOT_EQUAL);
         break;
     case TOKEN_EQUAL_EQUAL:
-        emit_byte(compiler, OP_EQUAL);
+        emit_op(compiler, OP_EQUAL);
         break;
     case TOKEN_GREATER:
-        emit_byte(compiler, OP_GREATER);
+        emit_op(compiler, OP_GREATER);
         break;
     case TOKEN_GREATER_EQUAL:
-        emit_bytes(compiler, OP_LESS, OP_NOT);
+        emit_op(compiler, OP_NOT_LESS);
         break;
     case TOKEN_LESS:
-        emit_byte(compiler, OP_LESS);
+        emit_op(compiler, OP_LESS);
         break;
     case TOKEN_LESS_EQUAL:
-        emit_bytes(compiler, OP_GREATER, OP_NOT);
+        emit_op(compiler, OP_NOT_GREATER);
         break;
     default:
         break;
     }
 }
 
+// A global that still holds the intrinsic it started with. The callee is loaded by OP_GET_INTRINSIC, so the call
+// keeps working if the global is assigned afterwards, and OP_INTRINSIC runs the builtin in place when the callee is
+// still the builtin. Running in place leaves the interpreter's state unpublished, so builtins that allocate are
+// called the ordinary way.
+static int callee_intrinsic(Compiler *compiler, int callee)
+{
+    if (!can_fuse(compiler, callee) || instruction_at(compiler, callee) != OP_GET_GLOBAL)
+    {
+        return -1;
+    }
+    int intrinsic = find_intrinsic(compiler->vm, global_name_at(compiler, current_chunk(compiler)->code[callee + 1]));
+    return intrinsic != -1 && (intrinsic_info[intrinsic].flags & NATIVE_NO_ALLOC) ? intrinsic : -1;
+}
+
 static void call(Compiler *compiler, bool can_assign)
 {
+    int callee = compiler->last_instruction;
+    int intrinsic = callee_intrinsic(compiler, callee);
     uint8_t arg_count = argument_list(compiler);
+    compiler->function->is_leaf = false;
+    if (intrinsic != -1 && arg_count >= intrinsic_info[intrinsic].min_arity &&
+        (intrinsic_info[intrinsic].max_arity == NATIVE_VARIADIC || arg_count <= intrinsic_info[intrinsic].max_arity))
+    {
+        current_chunk(compiler)->code[callee] = OP_GET_INTRINSIC;
+        current_chunk(compiler)->code[callee + 1] = (uint8_t)intrinsic;
+        emit_op_bytes(compiler, OP_INTRINSIC, (uint8_t)intrinsic, arg_count);
+        return;
+    }
     emit_bytes(compiler, OP_CALL, arg_count);
 }
 
+// Records a property instruction on this in a method of the class being compiled, for predict_fields.
+static void add_field_site(Compiler *compiler, int cache, bool is_store)
+{
+    Vm *vm = compiler->vm;
+    ClassCompiler *klass = compiler->current_class;
+    if (klass == NULL)
+    {
+        return;
+    }
+    if (klass->field_site_capacity < klass->field_site_count + 1)
+    {
+        int old_capacity = klass->field_site_capacity;
+        klass->field_site_capacity = GROW_CAPACITY(old_capacity);
+        klass->field_sites =
+            GROW_ARRAY(FieldSite, klass->field_sites, old_capacity, klass->field_site_capacity);
+    }
+    FieldSite *site = &klass->field_sites[klass->field_site_count++];
+    site->function = compiler->function;
+    site->cache = cache;
+    site->is_store = is_store;
+    site->in_initializer = compiler->type == TYPE_INITIALIZER;
+}
+
+// Every property instruction gets an inline cache of its own.
+static void emit_property(Compiler *compiler, uint8_t op, int name)
+{
+    Chunk *chunk = current_chunk(compiler);
+    if (chunk->cache_count == MAX_INLINE_CACHES)
+    {
+        error(compiler, "Too many property accesses in one function.");
+        return;
+    }
+    int cache = add_inline_cache(compiler->vm, chunk, AS_STRING(chunk->constants.values[name]));
+    if (op == OP_GET_THIS_PROPERTY || op == OP_SET_THIS_PROPERTY)
+    {
+        add_field_site(compiler, cache, op == OP_SET_THIS_PROPERTY);
+    }
+    if (name > UINT8_MAX || cache > UINT16_MAX)
+    {
+        emit_wide(compiler, op, name);
+        emit_wide_operand(compiler, cache);
+        return;
+    }
+    emit_bytes(compiler, op, (uint8_t)name);
+    emit_byte(compiler, (uint8_t)(cache >> 8));
+    emit_byte(compiler, (uint8_t)(cache & 0xff));
+}
+
 static void dot(Compiler *compiler, bool can_assign)
 {
     consume(compiler, TOKEN_IDENTIFIER, "Expect property name after '.'.");
-    uint8_t name = identifier_constant(compiler, &compiler->parser->previous);
+    int name = identifier_constant(compiler, &compiler->parser->previous);
+
+    int receiver = compiler->last_instruction;
+    bool on_this = can_fuse(compiler, receiver) && instruction_at(compiler, receiver) == OP_GET_LOCAL &&
+                   current_chunk(compiler)->code[receiver + 1] == 0;
 
     if (can_assign && match(compiler, TOKEN_EQUAL))
     {
+        if (on_this)
+        {
+            rewind_code(compiler, receiver);
+            expression(compiler);
+            emit_property(compiler, OP_SET_THIS_PROPERTY, name);
+            return;
+        }
         expression(compiler);
-        emit_bytes(compiler, OP_SET_PROPERTY, name);
+        emit_property(compiler, OP_SET_PROPERTY, name);
     }
     else if (match(compiler, TOKEN_LEFT_PAREN))
     {
         uint8_t arg_count = argument_list(compiler);
-        emit_bytes(compiler, OP_INVOKE, name);
-        emit_byte(compiler, arg_count);
+        emit_invoke(compiler, OP_INVOKE, name, arg_count);
+    }
+    else if (on_this)
+    {
+        rewind_code(compiler, receiver);
+        emit_property(compiler, OP_GET_THIS_PROPERTY, name);
     }
     else
     {
-        emit_bytes(compiler, OP_GET_PROPERTY, name);
+        emit_property(compiler, OP_GET_PROPERTY, name);
     }
 }
 
@@ -961,13 +1844,13 @@ static void literal(Compiler *compiler, bool can_assign)
     switch (compiler->parser->previous.type)
     {
     case TOKEN_FALSE:
-        emit_byte(compiler, OP_FALSE);
+        emit_op(compiler, OP_FALSE);
         break;
     case TOKEN_TRUE:
-        emit_byte(compiler, OP_TRUE);
+        emit_op(compiler, OP_TRUE);
         break;
     case TOKEN_NIL:
-        emit_byte(compiler, OP_NIL);
+        emit_op(compiler, OP_NIL);
         break;
     default:
         return; // Unreachable.
@@ -999,6 +1882,7 @@ static ParseRule rules[] = {
     [TOKEN_NUMBER] = {number, NULL, PREC_NONE},
     [TOKEN_AND] = {NULL, and_, PREC_AND},
     [TOKEN_CLASS] = {NULL, NULL, PREC_NONE},
+    [TOKEN_CONST] = {NULL, NULL, PREC_NONE},
     [TOKEN_ELSE] = {NULL, NULL, PREC_NONE},
     [TOKEN_FALSE] = {literal, NULL, PREC_NONE},
     [TOKEN_FOR] = {NULL, NULL, PREC_NONE},
@@ -1040,20 +1924,30 @@ void init_compiler(Compiler *compiler, Scanner *scanner, Parser *parser, Vm *vm,
     compiler->parser = parser;
     compiler->vm = vm;
     compiler->type = type;
+    compiler->locals = NULL;
     compiler->local_count = 0;
+    compiler->local_capacity = 0;
+    compiler->upvalues = NULL;
+    compiler->upvalue_capacity = 0;
+    compiler->constant_index = NULL;
+    compiler->constant_index_capacity = 0;
+    compiler->flagged_globals = NULL;
+    compiler->flagged_count = 0;
+    compiler->flagged_capacity = 0;
+    compiler->long_jumps = NULL;
+    compiler->long_jump_count = 0;
+    compiler->long_jump_capacity = 0;
     compiler->scope_depth = 0;
-    compiler->function = new_function(vm);
+    compiler->last_instruction = -1;
+    compiler->previous_instruction = -1;
+    compiler->jump_target = 0;
 
-    if (type != TYPE_SCRIPT)
-    {
-        push(vm, OBJ_VAL(compiler->function));
-        compiler->function->name = copy_string(compiler->vm, compiler->parser->previous.start, compiler->parser->previous.length);
-        pop(vm);
-    }
-
-    Local *local = &compiler->locals[compiler->local_count++];
+    // The receiver's slot is allocated before the function, which nothing would keep alive through a collection.
+    Local *local = push_local(compiler);
     local->depth = 0;
     local->is_captured = false;
+    local->is_const = false;
+    local->constant = UNDEFINED_VAL;
     if (type != TYPE_FUNCTION)
     {
         local->name.start = "this";
@@ -1064,10 +1958,24 @@ void init_compiler(Compiler *compiler, Scanner *scanner, Parser *parser, Vm *vm,
         local->name.start = "";
         local->name.length = 0;
     }
+
+    compiler->function = new_function(vm);
+    if (type != TYPE_SCRIPT)
+    {
+        push(vm, OBJ_VAL(compiler->function));
+        compiler->function->name = copy_string(compiler->vm, compiler->parser->previous.start, compiler->parser->previous.length);
+        pop(vm);
+    }
 }
 
 void free_compiler(Compiler *compiler)
 {
+    Vm *vm = compiler->vm;
+    FREE_ARRAY(Local, compiler->locals, compiler->local_capacity);
+    FREE_ARRAY(Upvalue, compiler->upvalues, compiler->upvalue_capacity);
+    FREE_ARRAY(int, compiler->constant_index, compiler->constant_index_capacity);
+    FREE_ARRAY(GlobalFlags, compiler->flagged_globals, compiler->flagged_capacity);
+    FREE_ARRAY(LongJump, compiler->long_jumps, compiler->long_jump_capacity);
 }
 
 Chunk *current_chunk(Compiler *compiler)
@@ -1083,8 +1991,23 @@ ObjFunction *compile(Compiler *compiler)
         declaration(compiler);
     }
     ObjFunction *function = end_compiler(compiler);
+    if (!compiler->parser->had_error)
+    {
+        return function;
+    }
 
-    return compiler->parser->had_error ? NULL : function;
+    // Code that failed to compile never runs, so the globals it names are left as they were, latest change first.
+    for (int i = compiler->flagged_count - 1; i >= 0; i--)
+    {
+        GlobalFlags *flags = &compiler->flagged_globals[i];
+        if (flags->name->constant && !flags->constant)
+        {
+            table_delete(&compiler->vm->global_constants, flags->name);
+        }
+        flags->name->assigned = flags->assigned;
+        flags->name->constant = flags->constant;
+    }
+    return NULL;
 }
 
 void mark_compiler_roots(Compiler *compiler)
@@ -33,19 +33,44 @@ typedef enum
     PREC_PRIMARY,
 } Precedence;
 
+// The locals and upvalues of a function grow on demand, up to these; the indices past a byte take wide instructions.
+#define LOCALS_MAX (UINT16_MAX + 1)
+#define UPVALUES_MAX (UINT16_MAX + 1)
+
 typedef struct
 {
     Token name;
     int depth;
     bool is_captured;
+    // Constants can't be assigned. The compiler puts the value of those it knows, in constant, in place of reading
+    // them; it is UNDEFINED_VAL for the rest.
+    bool is_const;
+    Value constant;
 } Local;
 
 typedef struct
 {
-    uint8_t index;
+    int index;
     bool is_local;
+    bool is_const;
 } Upvalue;
 
+// The flags of a global name before the script being compiled changed them.
+typedef struct
+{
+    ObjString *name;
+    bool assigned;
+    bool constant;
+} GlobalFlags;
+
+// A forward jump too long for its two bytes, from the jump instruction at offset to target. end_compiler makes room
+// for its distance once the function is complete.
+typedef struct
+{
+    int offset;
+    int target;
+} LongJump;
+
 typedef enum
 {
     TYPE_FUNCTION,
@@ -63,16 +88,44 @@ typedef struct Compiler
     Vm *vm;
     ObjFunction *function;
     FunctionType type;
-    Local locals[UINT8_COUNT];
+    Local *locals;
     int local_count;
-    Upvalue upvalues[UINT8_COUNT];
+    int local_capacity;
+    Upvalue *upvalues;
+    int upvalue_capacity;
+    // A side index into the chunk's constants, so that each number or object is added once: an open addressed table
+    // of constant indices, -1 where empty.
+    int *constant_index;
+    int constant_index_capacity;
+    // Only the script's compiler keeps these, which compile restores if the script fails to compile.
+    GlobalFlags *flagged_globals;
+    int flagged_count;
+    int flagged_capacity;
+    LongJump *long_jumps;
+    int long_jump_count;
+    int long_jump_capacity;
     int scope_depth;
+    int last_instruction;
+    int previous_instruction;
+    int jump_target;
 } Compiler;
 
+// A property access on this in a method, whose cache gets the predicted slot once the whole class has been compiled.
+typedef struct
+{
+    ObjFunction *function;
+    int cache;
+    bool is_store;
+    bool in_initializer;
+} FieldSite;
+
 typedef struct ClassCompiler
 {
     struct ClassCompiler *enclosing;
     bool has_superclass;
+    FieldSite *field_sites;
+    int field_site_count;
+    int field_site_capacity;
 } ClassCompiler;
 
 void init_compiler(Compiler *compiler, Scanner *scanner, Parser *parser, Vm *vm, FunctionType type);
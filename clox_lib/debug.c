@@ -1,7 +1,10 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include "debug.h"
+#include "intrinsic.h"
 #include "object.h"
 #include "value.h"
+#include "vm.h"
 
 static int simple_instruction(const char *name, int offset)
 {
@@ -11,34 +14,72 @@ static int simple_instruction(const char *name, int offset)
 
 static int byte_instruction(const char *name, Chunk *chunk, int offset)
 {
-    uint8_t slot = chunk->code[offset + 1];
+    int slot = index_operand(chunk->code, offset);
     printf("%-16s %4d\n", name, slot);
-    return offset + 2;
+    return after_index(chunk->code, offset);
 }
 
-static int jump_instruction(const char *name, int sign, Chunk *chunk, int offset)
+static int locals_instruction(const char *name, Chunk *chunk, int offset)
 {
-    uint16_t jump = (uint16_t)(chunk->code[offset + 1] << 8 | chunk->code[offset + 2]);
-    printf("%-16s %4d -> %d\n", name, offset, offset + 3 + sign * jump);
+    uint8_t left = chunk->code[offset + 1];
+    uint8_t right = chunk->code[offset + 2];
+    printf("%-16s %4d %4d\n", name, left, right);
     return offset + 3;
 }
 
+static int jump_instruction(const char *name, Chunk *chunk, int offset)
+{
+    printf("%-16s %4d -> %d\n", name, offset, jump_target(chunk->code, offset));
+    return offset + jump_length(chunk->code, offset);
+}
+
 static int constant_instruction(const char *name, Chunk *chunk, int offset)
 {
-    uint8_t index = chunk->code[offset + 1];
+    int index = index_operand(chunk->code, offset);
     printf("%-16s %4d '", name, index);
     print_value(chunk->constants.values[index]);
     printf("'\n");
-    return offset + 2;
+    return after_index(chunk->code, offset);
+}
+
+static int global_instruction(const char *name, Vm *vm, Chunk *chunk, int offset)
+{
+    int slot = index_operand(chunk->code, offset);
+    printf("%-16s %4d '%s'\n", name, slot, AS_CSTRING(vm->global_names.values[slot]));
+    return after_index(chunk->code, offset);
+}
+
+static int property_instruction(const char *name, Chunk *chunk, int offset)
+{
+    int constant = index_operand(chunk->code, offset);
+    printf("%-16s %4d '", name, constant);
+    print_value(chunk->constants.values[constant]);
+    printf("' cache %d\n", cache_index(chunk->code, offset));
+    return offset + instruction_length(chunk, offset);
 }
 
 static int invoke_instruction(const char *name, Chunk *chunk, int offset)
 {
-    uint8_t constant = chunk->code[offset + 1];
-    uint8_t arg_count = chunk->code[offset + 2];
+    int constant = index_operand(chunk->code, offset);
+    uint8_t arg_count = chunk->code[after_index(chunk->code, offset)];
     printf("%-16s (%d args) %4d '", name, arg_count, constant);
     print_value(chunk->constants.values[constant]);
-    printf("'\n");
+    printf("' cache %d\n", invoke_cache_index(chunk->code, offset));
+    return offset + instruction_length(chunk, offset);
+}
+
+static int intrinsic_instruction(const char *name, Chunk *chunk, int offset)
+{
+    uint8_t intrinsic = chunk->code[offset + 1];
+    printf("%-16s %4d '%s'\n", name, intrinsic, intrinsic_info[intrinsic].name);
+    return offset + 2;
+}
+
+static int intrinsic_call_instruction(const char *name, Chunk *chunk, int offset)
+{
+    uint8_t intrinsic = chunk->code[offset + 1];
+    uint8_t arg_count = chunk->code[offset + 2];
+    printf("%-16s (%d args) %4d '%s'\n", name, arg_count, intrinsic, intrinsic_info[intrinsic].name);
     return offset + 3;
 }
 
@@ -52,12 +93,12 @@ static int constant_long_instruction(const char *name, Chunk *chunk, int offset)
     return offset + 4;
 }
 
-void disassemble_chunk(Chunk *chunk, const char *name)
+void disassemble_chunk(Vm *vm, Chunk *chunk, const char *name)
 {
     printf("== %s ==\n", name);
     for (int offset = 0; offset < chunk->count;)
     {
-        offset = disassemble_instruction(chunk, offset);
+        offset = disassemble_instruction(vm, chunk, offset);
     }
     printf("Constants:\n");
     for (int i = 0; i < chunk->constants.count; ++i)
@@ -69,7 +110,7 @@ void disassemble_chunk(Chunk *chunk, const char *name)
     printf("== %s end ==\n", name);
 }
 
-int disassemble_instruction(Chunk *chunk, int offset)
+int disassemble_instruction(Vm *vm, Chunk *chunk, int offset)
 {
     printf("%04d ", offset);
 
@@ -83,7 +124,8 @@ int disassemble_instruction(Chunk *chunk, int offset)
         printf("%4d ", line);
     }
 
-    uint8_t instruction = chunk->code[offset];
+    // A wide instruction prints like the instruction it widens, with its wide index.
+    uint8_t instruction = opcode_at(chunk->code, offset);
     switch (instruction)
     {
     case OP_CONSTANT:
@@ -103,19 +145,19 @@ int disassemble_instruction(Chunk *chunk, int offset)
     case OP_SET_LOCAL:
         return byte_instruction("OP_SET_LOCAL", chunk, offset);
     case OP_GET_GLOBAL:
-        return constant_instruction("OP_GET_GLOBAL", chunk, offset);
+        return global_instruction("OP_GET_GLOBAL", vm, chunk, offset);
     case OP_DEFINE_GLOBAL:
-        return constant_instruction("OP_DEFINE_GLOBAL", chunk, offset);
+        return global_instruction("OP_DEFINE_GLOBAL", vm, chunk, offset);
     case OP_SET_GLOBAL:
-        return constant_instruction("OP_SET_GLOBAL", chunk, offset);
+        return global_instruction("OP_SET_GLOBAL", vm, chunk, offset);
     case OP_GET_UPVALUE:
         return byte_instruction("OP_GET_UPVALUE", chunk, offset);
     case OP_SET_UPVALUE:
         return byte_instruction("OP_SET_UPVALUE", chunk, offset);
     case OP_GET_PROPERTY:
-        return constant_instruction("OP_GET_PROPERTY", chunk, offset);
+        return property_instruction("OP_GET_PROPERTY", chunk, offset);
     case OP_SET_PROPERTY:
-        return constant_instruction("OP_SET_PROPERTY", chunk, offset);
+        return property_instruction("OP_SET_PROPERTY", chunk, offset);
     case OP_GET_SUPER:
         return constant_instruction("OP_GET_SUPER", chunk, offset);
     case OP_EQUAL:
@@ -139,35 +181,38 @@ int disassemble_instruction(Chunk *chunk, int offset)
     case OP_PRINT:
         return simple_instruction("OP_PRINT", offset);
     case OP_JUMP:
-        return jump_instruction("OP_JUMP", 1, chunk, offset);
+        return jump_instruction("OP_JUMP", chunk, offset);
     case OP_JUMP_IF_FALSE:
-        return jump_instruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
+        return jump_instruction("OP_JUMP_IF_FALSE", chunk, offset);
     case OP_LOOP:
-        return jump_instruction("OP_LOOP", -1, chunk, offset);
+        return jump_instruction("OP_LOOP", chunk, offset);
     case OP_CALL:
         return byte_instruction("OP_CALL", chunk, offset);
+    case OP_TAIL_CALL:
+        return byte_instruction("OP_TAIL_CALL", chunk, offset);
     case OP_INVOKE:
         return invoke_instruction("OP_INVOKE", chunk, offset);
     case OP_SUPER_INVOKE:
         return invoke_instruction("OP_SUPER_INVOKE", chunk, offset);
     case OP_CLOSURE:
     {
-        offset++;
-        uint8_t constant = chunk->code[offset++];
+        int constant = index_operand(chunk->code, offset);
         printf("%-16s %4d ", "OP_CLOSURE", constant);
         print_value(chunk->constants.values[constant]);
         printf("\n");
 
         ObjFunction *function = AS_FUNCTION(chunk->constants.values[constant]);
+        int capture = after_index(chunk->code, offset);
         for (int j = 0; j < function->upvalue_count; j++)
         {
-            int is_local = chunk->code[offset++];
-            int index = chunk->code[offset++];
+            bool is_local;
+            int index = capture_operand(chunk->code, offset, j, &is_local);
             printf("%04d      |                     %s %d\n",
-                   offset - 2, is_local ? "local" : "upvalue", index);
+                   capture, is_local ? "local" : "upvalue", index);
+            capture += chunk->code[offset] == OP_WIDE ? 4 : 2;
         }
 
-        return offset;
+        return capture;
     }
     case OP_CLOSE_UPVALUE:
         return simple_instruction("OP_CLOSE_UPVALUE", offset);
@@ -179,8 +224,526 @@ int disassemble_instruction(Chunk *chunk, int offset)
         return simple_instruction("OP_INHERIT", offset);
     case OP_METHOD:
         return constant_instruction("OP_METHOD", chunk, offset);
+    case OP_FIELD:
+        return constant_instruction("OP_FIELD", chunk, offset);
+    case OP_NOT_EQUAL:
+        return simple_instruction("OP_NOT_EQUAL", offset);
+    case OP_NOT_GREATER:
+        return simple_instruction("OP_NOT_GREATER", offset);
+    case OP_NOT_LESS:
+        return simple_instruction("OP_NOT_LESS", offset);
+    case OP_POP_JUMP_IF_FALSE:
+        return jump_instruction("OP_POP_JUMP_IF_FALSE", chunk, offset);
+    case OP_JUMP_IF_EQUAL:
+        return jump_instruction("OP_JUMP_IF_EQUAL", chunk, offset);
+    case OP_JUMP_IF_NOT_EQUAL:
+        return jump_instruction("OP_JUMP_IF_NOT_EQUAL", chunk, offset);
+    case OP_JUMP_IF_GREATER:
+        return jump_instruction("OP_JUMP_IF_GREATER", chunk, offset);
+    case OP_JUMP_IF_NOT_GREATER:
+        return jump_instruction("OP_JUMP_IF_NOT_GREATER", chunk, offset);
+    case OP_JUMP_IF_LESS:
+        return jump_instruction("OP_JUMP_IF_LESS", chunk, offset);
+    case OP_JUMP_IF_NOT_LESS:
+        return jump_instruction("OP_JUMP_IF_NOT_LESS", chunk, offset);
+    case OP_GET_THIS_PROPERTY:
+        return property_instruction("OP_GET_THIS_PROPERTY", chunk, offset);
+    case OP_SET_THIS_PROPERTY:
+        return property_instruction("OP_SET_THIS_PROPERTY", chunk, offset);
+    case OP_ADD_LOCALS:
+        return locals_instruction("OP_ADD_LOCALS", chunk, offset);
+    case OP_SUBTRACT_LOCALS:
+        return locals_instruction("OP_SUBTRACT_LOCALS", chunk, offset);
+    case OP_MULTIPLY_LOCALS:
+        return locals_instruction("OP_MULTIPLY_LOCALS", chunk, offset);
+    case OP_DIVIDE_LOCALS:
+        return locals_instruction("OP_DIVIDE_LOCALS", chunk, offset);
+    case OP_ADD_NUM:
+        return simple_instruction("OP_ADD_NUM", offset);
+    case OP_ADD_STR:
+        return simple_instruction("OP_ADD_STR", offset);
+    case OP_GET_FIELD:
+        return property_instruction("OP_GET_FIELD", chunk, offset);
+    case OP_CALL_CLOSURE:
+        return byte_instruction("OP_CALL_CLOSURE", chunk, offset);
+    case OP_GET_INTRINSIC:
+        return intrinsic_instruction("OP_GET_INTRINSIC", chunk, offset);
+    case OP_INTRINSIC:
+        return intrinsic_call_instruction("OP_INTRINSIC", chunk, offset);
     default:
         printf("Unknown opcode %d\n", instruction);
         return offset + 1;
     }
 }
+
+static void register_operands(const char *name, const char *format, RegInstruction *instruction)
+{
+    printf("%-26s", name);
+    for (const char *operand = format; *operand != '\0'; operand++)
+    {
+        switch (*operand)
+        {
+        case 'a':
+            printf(" r%-3d", instruction->a);
+            break;
+        case 'b':
+            printf(" r%-3d", instruction->b);
+            break;
+        case 'c':
+            printf(" r%-3d", instruction->c);
+            break;
+        case 'n':
+            printf(" %4d", instruction->b);
+            break;
+        }
+    }
+}
+
+static void register_constant(Chunk *chunk, int index)
+{
+    printf(" %4d '", index);
+    print_value(chunk->constants.values[index]);
+    printf("'");
+}
+
+static void register_global(Vm *vm, int slot)
+{
+    printf(" %4d '%s'", slot, AS_CSTRING(vm->global_names.values[slot]));
+}
+
+static void register_cache(Chunk *chunk, int index)
+{
+    printf(" %4d '%s'", index, chunk->caches[index].name->chars);
+}
+
+static void register_invoke_cache(Chunk *chunk, int index)
+{
+    printf(" %4d '%s'", index, chunk->invoke_caches[index].name->chars);
+}
+
+int disassemble_register_instruction(Vm *vm, Chunk *chunk, int index)
+{
+    RegInstruction *instruction = &chunk->registers.code[index];
+    int offset = chunk->registers.offsets[index];
+    printf("%04d ", index);
+    if (index > 0 && offset == chunk->registers.offsets[index - 1])
+    {
+        printf("   | ");
+    }
+    else
+    {
+        printf("%4d ", offset);
+    }
+
+    switch (instruction->op)
+    {
+    case ROP_MOVE:
+        register_operands("ROP_MOVE", "ab", instruction);
+        break;
+    case ROP_LOAD_CONSTANT:
+        register_operands("ROP_LOAD_CONSTANT", "a", instruction);
+        register_constant(chunk, instruction->k);
+        break;
+    case ROP_NIL:
+        register_operands("ROP_NIL", "a", instruction);
+        break;
+    case ROP_TRUE:
+        register_operands("ROP_TRUE", "a", instruction);
+        break;
+    case ROP_FALSE:
+        register_operands("ROP_FALSE", "a", instruction);
+        break;
+    case ROP_GET_GLOBAL:
+        register_operands("ROP_GET_GLOBAL", "a", instruction);
+        register_global(vm, instruction->k);
+        break;
+    case ROP_DEFINE_GLOBAL:
+        register_operands("ROP_DEFINE_GLOBAL", "a", instruction);
+        register_global(vm, instruction->k);
+        break;
+    case ROP_SET_GLOBAL:
+        register_operands("ROP_SET_GLOBAL", "a", instruction);
+        register_global(vm, instruction->k);
+        break;
+    case ROP_GET_UPVALUE:
+        register_operands("ROP_GET_UPVALUE", "an", instruction);
+        break;
+    case ROP_SET_UPVALUE:
+        register_operands("ROP_SET_UPVALUE", "an", instruction);
+        break;
+    case ROP_GET_PROPERTY:
+        register_operands("ROP_GET_PROPERTY", "ab", instruction);
+        register_cache(chunk, instruction->k);
+        break;
+    case ROP_SET_PROPERTY:
+        register_operands("ROP_SET_PROPERTY", "abc", instruction);
+        register_cache(chunk, instruction->k);
+        break;
+    case ROP_GET_SUPER:
+        register_operands("ROP_GET_SUPER", "abc", instruction);
+        register_constant(chunk, instruction->k);
+        break;
+    case ROP_GET_THIS_PROPERTY:
+        register_operands("ROP_GET_THIS_PROPERTY", "a", instruction);
+        register_cache(chunk, instruction->k);
+        break;
+    case ROP_SET_THIS_PROPERTY:
+        register_operands("ROP_SET_THIS_PROPERTY", "a", instruction);
+        register_cache(chunk, instruction->k);
+        break;
+    case ROP_EQUAL:
+        register_operands("ROP_EQUAL", "abc", instruction);
+        break;
+    case ROP_NOT_EQUAL:
+        register_operands("ROP_NOT_EQUAL", "abc", instruction);
+        break;
+    case ROP_GREATER:
+        register_operands("ROP_GREATER", "abc", instruction);
+        break;
+    case ROP_NOT_GREATER:
+        register_operands("ROP_NOT_GREATER", "abc", instruction);
+        break;
+    case ROP_LESS:
+        register_operands("ROP_LESS", "abc", instruction);
+        break;
+    case ROP_NOT_LESS:
+        register_operands("ROP_NOT_LESS", "abc", instruction);
+        break;
+    case ROP_ADD:
+        register_operands("ROP_ADD", "abc", instruction);
+        break;
+    case ROP_SUBTRACT:
+        register_operands("ROP_SUBTRACT", "abc", instruction);
+        break;
+    case ROP_MULTIPLY:
+        register_operands("ROP_MULTIPLY", "abc", instruction);
+        break;
+    case ROP_DIVIDE:
+        register_operands("ROP_DIVIDE", "abc", instruction);
+        break;
+    case ROP_ADD_K:
+        register_operands("ROP_ADD_K", "ab", instruction);
+        register_constant(chunk, instruction->k);
+        break;
+    case ROP_SUBTRACT_K:
+        register_operands("ROP_SUBTRACT_K", "ab", instruction);
+        register_constant(chunk, instruction->k);
+        break;
+    case ROP_MULTIPLY_K:
+        register_operands("ROP_MULTIPLY_K", "ab", instruction);
+        register_constant(chunk, instruction->k);
+        break;
+    case ROP_DIVIDE_K:
+        register_operands("ROP_DIVIDE_K", "ab", instruction);
+        register_constant(chunk, instruction->k);
+        break;
+    case ROP_NOT:
+        register_operands("ROP_NOT", "ab", instruction);
+        break;
+    case ROP_NEGATE:
+        register_operands("ROP_NEGATE", "ab", instruction);
+        break;
+    case ROP_PRINT:
+        register_operands("ROP_PRINT", "a", instruction);
+        break;
+    case ROP_JUMP:
+        register_operands("ROP_JUMP", "", instruction);
+        printf(" -> %d", instruction->k);
+        break;
+    case ROP_JUMP_IF_FALSE:
+        register_operands("ROP_JUMP_IF_FALSE", "a", instruction);
+        printf(" -> %d", instruction->k);
+        break;
+    case ROP_JUMP_IF_EQUAL:
+        register_operands("ROP_JUMP_IF_EQUAL", "ab", instruction);
+        printf(" -> %d", instruction->k);
+        break;
+    case ROP_JUMP_IF_NOT_EQUAL:
+        register_operands("ROP_JUMP_IF_NOT_EQUAL", "ab", instruction);
+        printf(" -> %d", instruction->k);
+        break;
+    case ROP_JUMP_IF_GREATER:
+        register_operands("ROP_JUMP_IF_GREATER", "ab", instruction);
+        printf(" -> %d", instruction->k);
+        break;
+    case ROP_JUMP_IF_NOT_GREATER:
+        register_operands("ROP_JUMP_IF_NOT_GREATER", "ab", instruction);
+        printf(" -> %d", instruction->k);
+        break;
+    case ROP_JUMP_IF_LESS:
+        register_operands("ROP_JUMP_IF_LESS", "ab", instruction);
+        printf(" -> %d", instruction->k);
+        break;
+    case ROP_JUMP_IF_NOT_LESS:
+        register_operands("ROP_JUMP_IF_NOT_LESS", "ab", instruction);
+        printf(" -> %d", instruction->k);
+        break;
+    case ROP_JUMP_IF_EQUAL_K:
+        register_operands("ROP_JUMP_IF_EQUAL_K", "a", instruction);
+        register_constant(chunk, instruction->c);
+        printf(" -> %d", instruction->k);
+        break;
+    case ROP_JUMP_IF_NOT_EQUAL_K:
+        register_operands("ROP_JUMP_IF_NOT_EQUAL_K", "a", instruction);
+        register_constant(chunk, instruction->c);
+        printf(" -> %d", instruction->k);
+        break;
+    case ROP_JUMP_IF_GREATER_K:
+        register_operands("ROP_JUMP_IF_GREATER_K", "a", instruction);
+        register_constant(chunk, instruction->c);
+        printf(" -> %d", instruction->k);
+        break;
+    case ROP_JUMP_IF_NOT_GREATER_K:
+        register_operands("ROP_JUMP_IF_NOT_GREATER_K", "a", instruction);
+        register_constant(chunk, instruction->c);
+        printf(" -> %d", instruction->k);
+        break;
+    case ROP_JUMP_IF_LESS_K:
+        register_operands("ROP_JUMP_IF_LESS_K", "a", instruction);
+        register_constant(chunk, instruction->c);
+        printf(" -> %d", instruction->k);
+        break;
+    case ROP_JUMP_IF_NOT_LESS_K:
+        register_operands("ROP_JUMP_IF_NOT_LESS_K", "a", instruction);
+        register_constant(chunk, instruction->c);
+        printf(" -> %d", instruction->k);
+        break;
+    case ROP_CALL:
+        register_operands("ROP_CALL", "an", instruction);
+        break;
+    case ROP_TAIL_CALL:
+        register_operands("ROP_TAIL_CALL", "an", instruction);
+        break;
+    case ROP_INVOKE:
+        register_operands("ROP_INVOKE", "an", instruction);
+        register_invoke_cache(chunk, instruction->k);
+        break;
+    case ROP_SUPER_INVOKE:
+        register_operands("ROP_SUPER_INVOKE", "anc", instruction);
+        register_invoke_cache(chunk, instruction->k);
+        break;
+    case ROP_CLOSURE:
+        register_operands("ROP_CLOSURE", "a", instruction);
+        register_constant(chunk, instruction->k);
+        break;
+    case ROP_CAPTURE:
+        register_operands("ROP_CAPTURE", "", instruction);
+        printf(" %s %d", instruction->a ? "local" : "upvalue", instruction->b);
+        break;
+    case ROP_CLOSE_UPVALUE:
+        register_operands("ROP_CLOSE_UPVALUE", "a", instruction);
+        break;
+    case ROP_RETURN:
+        register_operands("ROP_RETURN", "a", instruction);
+        break;
+    case ROP_CLASS:
+        register_operands("ROP_CLASS", "a", instruction);
+        register_constant(chunk, instruction->k);
+        break;
+    case ROP_INHERIT:
+        register_operands("ROP_INHERIT", "ab", instruction);
+        break;
+    case ROP_METHOD:
+        register_operands("ROP_METHOD", "ab", instruction);
+        register_constant(chunk, instruction->k);
+        break;
+    case ROP_FIELD:
+        register_operands("ROP_FIELD", "a", instruction);
+        register_constant(chunk, instruction->k);
+        break;
+    case ROP_GET_INTRINSIC:
+        register_operands("ROP_GET_INTRINSIC", "a", instruction);
+        printf(" %4d '%s'", instruction->k, intrinsic_info[instruction->k].name);
+        break;
+    case ROP_INTRINSIC:
+        register_operands("ROP_INTRINSIC", "an", instruction);
+        printf(" %4d '%s'", instruction->c, intrinsic_info[instruction->c].name);
+        break;
+    default:
+        printf("Unknown register opcode %d", instruction->op);
+        break;
+    }
+    printf("\n");
+    return index + 1;
+}
+
+void disassemble_register_code(Vm *vm, Chunk *chunk, const char *name)
+{
+    printf("== %s registers (%d) ==\n", name, chunk->registers.frame_size);
+    for (int index = 0; index < chunk->registers.count;)
+    {
+        index = disassemble_register_instruction(vm, chunk, index);
+    }
+    printf("== %s registers end ==\n", name);
+}
+
+#if defined(DEBUG_COUNT_OPCODE_PAIRS) || defined(DEBUG_COUNT_SPECIALIZATIONS) || defined(DEBUG_COUNT_INLINE_CACHES)
+static const char *opcode_names[OPCODE_COUNT] = {
+    [OP_CONSTANT] = "OP_CONSTANT",
+    [OP_CONSTANT_LONG] = "OP_CONSTANT_LONG",
+    [OP_NIL] = "OP_NIL",
+    [OP_TRUE] = "OP_TRUE",
+    [OP_FALSE] = "OP_FALSE",
+    [OP_POP] = "OP_POP",
+    [OP_GET_LOCAL] = "OP_GET_LOCAL",
+    [OP_SET_LOCAL] = "OP_SET_LOCAL",
+    [OP_GET_GLOBAL] = "OP_GET_GLOBAL",
+    [OP_DEFINE_GLOBAL] = "OP_DEFINE_GLOBAL",
+    [OP_SET_GLOBAL] = "OP_SET_GLOBAL",
+    [OP_GET_UPVALUE] = "OP_GET_UPVALUE",
+    [OP_SET_UPVALUE] = "OP_SET_UPVALUE",
+    [OP_GET_PROPERTY] = "OP_GET_PROPERTY",
+    [OP_SET_PROPERTY] = "OP_SET_PROPERTY",
+    [OP_GET_SUPER] = "OP_GET_SUPER",
+    [OP_EQUAL] = "OP_EQUAL",
+    [OP_GREATER] = "OP_GREATER",
+    [OP_LESS] = "OP_LESS",
+    [OP_ADD] = "OP_ADD",
+    [OP_SUBTRACT] = "OP_SUBTRACT",
+    [OP_MULTIPLY] = "OP_MULTIPLY",
+    [OP_DIVIDE] = "OP_DIVIDE",
+    [OP_NOT] = "OP_NOT",
+    [OP_NEGATE] = "OP_NEGATE",
+    [OP_PRINT] = "OP_PRINT",
+    [OP_JUMP] = "OP_JUMP",
+    [OP_JUMP_IF_FALSE] = "OP_JUMP_IF_FALSE",
+    [OP_LOOP] = "OP_LOOP",
+    [OP_CALL] = "OP_CALL",
+    [OP_TAIL_CALL] = "OP_TAIL_CALL",
+    [OP_INVOKE] = "OP_INVOKE",
+    [OP_SUPER_INVOKE] = "OP_SUPER_INVOKE",
+    [OP_CLOSURE] = "OP_CLOSURE",
+    [OP_CLOSE_UPVALUE] = "OP_CLOSE_UPVALUE",
+    [OP_RETURN] = "OP_RETURN",
+    [OP_CLASS] = "OP_CLASS",
+    [OP_INHERIT] = "OP_INHERIT",
+    [OP_METHOD] = "OP_METHOD",
+    [OP_FIELD] = "OP_FIELD",
+    [OP_NOT_EQUAL] = "OP_NOT_EQUAL",
+    [OP_NOT_GREATER] = "OP_NOT_GREATER",
+    [OP_NOT_LESS] = "OP_NOT_LESS",
+    [OP_POP_JUMP_IF_FALSE] = "OP_POP_JUMP_IF_FALSE",
+    [OP_JUMP_IF_EQUAL] = "OP_JUMP_IF_EQUAL",
+    [OP_JUMP_IF_NOT_EQUAL] = "OP_JUMP_IF_NOT_EQUAL",
+    [OP_JUMP_IF_GREATER] = "OP_JUMP_IF_GREATER",
+    [OP_JUMP_IF_NOT_GREATER] = "OP_JUMP_IF_NOT_GREATER",
+    [OP_JUMP_IF_LESS] = "OP_JUMP_IF_LESS",
+    [OP_JUMP_IF_NOT_LESS] = "OP_JUMP_IF_NOT_LESS",
+    [OP_GET_THIS_PROPERTY] = "OP_GET_THIS_PROPERTY",
+    [OP_SET_THIS_PROPERTY] = "OP_SET_THIS_PROPERTY",
+    [OP_ADD_LOCALS] = "OP_ADD_LOCALS",
+    [OP_SUBTRACT_LOCALS] = "OP_SUBTRACT_LOCALS",
+    [OP_MULTIPLY_LOCALS] = "OP_MULTIPLY_LOCALS",
+    [OP_DIVIDE_LOCALS] = "OP_DIVIDE_LOCALS",
+    [OP_ADD_NUM] = "OP_ADD_NUM",
+    [OP_ADD_STR] = "OP_ADD_STR",
+    [OP_GET_FIELD] = "OP_GET_FIELD",
+    [OP_CALL_CLOSURE] = "OP_CALL_CLOSURE",
+    [OP_GET_INTRINSIC] = "OP_GET_INTRINSIC",
+    [OP_INTRINSIC] = "OP_INTRINSIC",
+    [OP_WIDE] = "OP_WIDE",
+};
+#endif
+
+#ifdef DEBUG_COUNT_OPCODE_PAIRS
+
+typedef struct
+{
+    uint64_t count;
+    uint8_t first;
+    uint8_t second;
+} OpcodePair;
+
+static int compare_opcode_pairs(const void *a, const void *b)
+{
+    uint64_t count_a = ((const OpcodePair *)a)->count;
+    uint64_t count_b = ((const OpcodePair *)b)->count;
+    return (count_a < count_b) - (count_a > count_b);
+}
+
+// Prints the most frequently executed pairs of consecutive opcodes, the candidates for new superinstructions.
+void print_opcode_pairs(uint64_t pairs[OPCODE_COUNT][OPCODE_COUNT], int limit)
+{
+    static OpcodePair sorted[OPCODE_COUNT * OPCODE_COUNT];
+    int count = 0;
+    uint64_t total = 0;
+    for (int first = 0; first < OPCODE_COUNT; first++)
+    {
+        for (int second = 0; second < OPCODE_COUNT; second++)
+        {
+            if (pairs[first][second] > 0)
+            {
+                sorted[count++] = (OpcodePair){pairs[first][second], (uint8_t)first, (uint8_t)second};
+                total += pairs[first][second];
+            }
+        }
+    }
+    qsort(sorted, count, sizeof(OpcodePair), compare_opcode_pairs);
+
+    fprintf(stderr, "== opcode pairs (%llu total) ==\n", (unsigned long long)total);
+    for (int i = 0; i < count && i < limit; i++)
+    {
+        fprintf(stderr, "%12llu %6.2f%%  %-24s %s\n", (unsigned long long)sorted[i].count,
+                100.0 * sorted[i].count / total, opcode_names[sorted[i].first], opcode_names[sorted[i].second]);
+    }
+}
+#endif
+
+#ifdef DEBUG_COUNT_SPECIALIZATIONS
+// Prints how often each specialized opcode was installed and how often its guard failed and it fell back to the
+// generic one.
+void print_specializations(uint64_t specialized[OPCODE_COUNT], uint64_t guard_failures[OPCODE_COUNT])
+{
+    fprintf(stderr, "== specializations ==\n");
+    for (int op = 0; op < OPCODE_COUNT; op++)
+    {
+        if (specialized[op] > 0 || guard_failures[op] > 0)
+        {
+            fprintf(stderr, "%-24s %12llu specialized %12llu guard failures\n", opcode_names[op],
+                    (unsigned long long)specialized[op], (unsigned long long)guard_failures[op]);
+        }
+    }
+}
+#endif
+
+#ifdef DEBUG_COUNT_INLINE_CACHES
+// Prints the hits and misses of every property access and invoke site of a chunk that has run.
+void print_inline_caches(Chunk *chunk, const char *name)
+{
+    for (int offset = 0; offset < chunk->count; offset += instruction_length(chunk, offset))
+    {
+        switch (opcode_at(chunk->code, offset))
+        {
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+        case OP_GET_FIELD:
+        case OP_GET_THIS_PROPERTY:
+        case OP_SET_THIS_PROPERTY:
+        {
+            InlineCache *cache = cache_operand(chunk, offset);
+            if (cache->hits > 0 || cache->misses > 0)
+            {
+                fprintf(stderr, "%-16s %04d %-24s %-16s %12llu hits %12llu misses\n", name, offset,
+                        opcode_names[opcode_at(chunk->code, offset)], cache->name->chars,
+                        (unsigned long long)cache->hits, (unsigned long long)cache->misses);
+            }
+            break;
+        }
+        case OP_INVOKE:
+        case OP_SUPER_INVOKE:
+        {
+            InvokeCache *cache = invoke_cache_operand(chunk, offset);
+            if (cache->hits > 0 || cache->misses > 0)
+            {
+                fprintf(stderr, "%-16s %04d %-24s %-16s %12llu hits %12llu misses %d shapes\n", name, offset,
+                        opcode_names[opcode_at(chunk->code, offset)], cache->name->chars,
+                        (unsigned long long)cache->hits, (unsigned long long)cache->misses, cache->count);
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+}
+#endif
@@ -3,7 +3,18 @@
 
 #include "chunk.h"
 
-void disassemble_chunk(Chunk *chunk, const char *name);
-int disassemble_instruction(Chunk *chunk, int offset);
+void disassemble_chunk(Vm *vm, Chunk *chunk, const char *name);
+int disassemble_instruction(Vm *vm, Chunk *chunk, int offset);
+void disassemble_register_code(Vm *vm, Chunk *chunk, const char *name);
+int disassemble_register_instruction(Vm *vm, Chunk *chunk, int index);
+#ifdef DEBUG_COUNT_OPCODE_PAIRS
+void print_opcode_pairs(uint64_t pairs[OPCODE_COUNT][OPCODE_COUNT], int limit);
+#endif
+#ifdef DEBUG_COUNT_SPECIALIZATIONS
+void print_specializations(uint64_t specialized[OPCODE_COUNT], uint64_t guard_failures[OPCODE_COUNT]);
+#endif
+#ifdef DEBUG_COUNT_INLINE_CACHES
+void print_inline_caches(Chunk *chunk, const char *name);
+#endif
 
 #endif
@@ -0,0 +1,175 @@
+#include "intrinsic.h"
+
+#include "vm.h"
+
+#include <string.h>
+#include <time.h>
+
+static const char *clock_native(Vm *vm, int arg_count, Value *args, Value *result)
+{
+    *result = NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
+    return NULL;
+}
+
+static const char *has_field_native(Vm *vm, int arg_count, Value *args, Value *result)
+{
+    if (!IS_INSTANCE(args[0]))
+    {
+        return "Expect instance.";
+    }
+    if (!IS_STRING(args[1]))
+    {
+        return "Expect string.";
+    }
+    ObjInstance *instance = AS_INSTANCE(args[0]);
+    Value dummy;
+    *result = BOOL_VAL(instance_get(instance, AS_STRING(args[1]), &dummy));
+    return NULL;
+}
+
+static const char *delete_field_native(Vm *vm, int arg_count, Value *args, Value *result)
+{
+    if (!IS_INSTANCE(args[0]))
+    {
+        return "Expect instance.";
+    }
+    if (!IS_STRING(args[1]))
+    {
+        return "Expect string.";
+    }
+    ObjInstance *instance = AS_INSTANCE(args[0]);
+    instance_delete(vm, instance, AS_STRING(args[1]));
+    *result = NIL_VAL;
+    return NULL;
+}
+
+static const char *sqrt_native(Vm *vm, int arg_count, Value *args, Value *result)
+{
+    if (!IS_NUMBER(args[0]))
+    {
+        return "Operand must be a number.";
+    }
+    *result = NUMBER_VAL(sqrt(AS_NUMBER(args[0])));
+    return NULL;
+}
+
+static const char *floor_native(Vm *vm, int arg_count, Value *args, Value *result)
+{
+    if (!IS_NUMBER(args[0]))
+    {
+        return "Operand must be a number.";
+    }
+    *result = NUMBER_VAL(floor(AS_NUMBER(args[0])));
+    return NULL;
+}
+
+static const char *abs_native(Vm *vm, int arg_count, Value *args, Value *result)
+{
+    if (!IS_NUMBER(args[0]))
+    {
+        return "Operand must be a number.";
+    }
+    *result = NUMBER_VAL(fabs(AS_NUMBER(args[0])));
+    return NULL;
+}
+
+static const char *min_native(Vm *vm, int arg_count, Value *args, Value *result)
+{
+    for (int i = 0; i < arg_count; i++)
+    {
+        if (!IS_NUMBER(args[i]))
+        {
+            return "Operands must be numbers.";
+        }
+    }
+    Value min = args[0];
+    for (int i = 1; i < arg_count; i++)
+    {
+        if (AS_NUMBER(args[i]) < AS_NUMBER(min))
+        {
+            min = args[i];
+        }
+    }
+    *result = min;
+    return NULL;
+}
+
+static const char *max_native(Vm *vm, int arg_count, Value *args, Value *result)
+{
+    for (int i = 0; i < arg_count; i++)
+    {
+        if (!IS_NUMBER(args[i]))
+        {
+            return "Operands must be numbers.";
+        }
+    }
+    Value max = args[0];
+    for (int i = 1; i < arg_count; i++)
+    {
+        if (AS_NUMBER(args[i]) > AS_NUMBER(max))
+        {
+            max = args[i];
+        }
+    }
+    *result = max;
+    return NULL;
+}
+
+static const char *columnar_native(Vm *vm, int arg_count, Value *args, Value *result)
+{
+    if (!IS_CLASS(args[0]))
+    {
+        return "Expect class.";
+    }
+    make_columnar(vm, AS_CLASS(args[0]));
+    *result = NIL_VAL;
+    return NULL;
+}
+
+const IntrinsicInfo intrinsic_info[INTRINSIC_COUNT] = {
+    [INTRINSIC_CLOCK] = {"clock", 0, 0, NATIVE_NO_ALLOC, clock_native},
+    [INTRINSIC_HAS_FIELD] = {"has_field", 2, 2, NATIVE_NO_ALLOC, has_field_native},
+    [INTRINSIC_DELETE_FIELD] = {"delete_field", 2, 2, 0, delete_field_native},
+    [INTRINSIC_SQRT] = {"sqrt", 1, 1, NATIVE_NO_ALLOC, sqrt_native},
+    [INTRINSIC_FLOOR] = {"floor", 1, 1, NATIVE_NO_ALLOC, floor_native},
+    [INTRINSIC_ABS] = {"abs", 1, 1, NATIVE_NO_ALLOC, abs_native},
+    [INTRINSIC_MIN] = {"min", 1, NATIVE_VARIADIC, NATIVE_NO_ALLOC, min_native},
+    [INTRINSIC_MAX] = {"max", 1, NATIVE_VARIADIC, NATIVE_NO_ALLOC, max_native},
+    [INTRINSIC_COLUMNAR] = {"columnar", 1, 1, NATIVE_NO_ALLOC, columnar_native},
+};
+
+void define_intrinsics(Vm *vm)
+{
+    for (int i = 0; i < INTRINSIC_COUNT; i++)
+    {
+        const IntrinsicInfo *info = &intrinsic_info[i];
+        define_native(vm, info->name, info->min_arity, info->max_arity, info->flags, info->function);
+        ObjString *name = copy_string(vm, info->name, (int)strlen(info->name));
+        vm->intrinsics[i] = AS_NATIVE(vm->global_values.values[name->global]);
+        vm->intrinsic_names[i] = name;
+        vm->intrinsic_intact[i] = true;
+    }
+}
+
+void invalidate_intrinsic(Vm *vm, ObjString *name)
+{
+    for (int i = 0; i < INTRINSIC_COUNT; i++)
+    {
+        if (vm->intrinsic_names[i] == name)
+        {
+            vm->intrinsic_intact[i] = false;
+        }
+    }
+}
+
+int find_intrinsic(Vm *vm, ObjString *name)
+{
+    for (int i = 0; i < INTRINSIC_COUNT; i++)
+    {
+        if (vm->intrinsic_names[i] == name)
+        {
+            return vm->intrinsic_intact[i] ? i : -1;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,89 @@
+#ifndef CLOX_INTRINSIC_H
+#define CLOX_INTRINSIC_H
+
+#include <math.h>
+#include "common.h"
+#include "object.h"
+#include "value.h"
+
+// Builtins the compiler calls without a global lookup, as long as nothing has assigned their global. The order
+// is part of the bytecode: OP_GET_INTRINSIC and OP_INTRINSIC name them by index.
+typedef enum
+{
+    INTRINSIC_CLOCK,
+    INTRINSIC_HAS_FIELD,
+    INTRINSIC_DELETE_FIELD,
+    INTRINSIC_SQRT,
+    INTRINSIC_FLOOR,
+    INTRINSIC_ABS,
+    INTRINSIC_MIN,
+    INTRINSIC_MAX,
+    INTRINSIC_COLUMNAR,
+    INTRINSIC_COUNT,
+} Intrinsic;
+
+typedef struct
+{
+    const char *name;
+    int min_arity;
+    int max_arity;
+    uint8_t flags;
+    NativeFn function;
+} IntrinsicInfo;
+
+extern const IntrinsicInfo intrinsic_info[INTRINSIC_COUNT];
+
+// Defines every intrinsic as a native global.
+void define_intrinsics(Vm *vm);
+// Called whenever code may assign the global name, which stops the compiler from treating it as an intrinsic.
+void invalidate_intrinsic(Vm *vm, ObjString *name);
+// The intrinsic the global name still holds, or -1.
+int find_intrinsic(Vm *vm, ObjString *name);
+
+// Runs an intrinsic the caller has already checked the arity of. The common math cases skip the native call.
+static inline const char *run_intrinsic(Vm *vm, int intrinsic, int arg_count, Value *args, Value *result)
+{
+    switch (intrinsic)
+    {
+    case INTRINSIC_SQRT:
+        if (IS_NUMBER(args[0]))
+        {
+            *result = NUMBER_VAL(sqrt(AS_NUMBER(args[0])));
+            return NULL;
+        }
+        break;
+    case INTRINSIC_FLOOR:
+        if (IS_NUMBER(args[0]))
+        {
+            *result = NUMBER_VAL(floor(AS_NUMBER(args[0])));
+            return NULL;
+        }
+        break;
+    case INTRINSIC_ABS:
+        if (IS_NUMBER(args[0]))
+        {
+            *result = NUMBER_VAL(fabs(AS_NUMBER(args[0])));
+            return NULL;
+        }
+        break;
+    case INTRINSIC_MIN:
+        if (arg_count == 2 && IS_NUMBER(args[0]) && IS_NUMBER(args[1]))
+        {
+            *result = AS_NUMBER(args[1]) < AS_NUMBER(args[0]) ? args[1] : args[0];
+            return NULL;
+        }
+        break;
+    case INTRINSIC_MAX:
+        if (arg_count == 2 && IS_NUMBER(args[0]) && IS_NUMBER(args[1]))
+        {
+            *result = AS_NUMBER(args[1]) > AS_NUMBER(args[0]) ? args[1] : args[0];
+            return NULL;
+        }
+        break;
+    default:
+        break;
+    }
+    return intrinsic_info[intrinsic].function(vm, arg_count, args, result);
+}
+
+#endif
@@ -0,0 +1,1306 @@
+#include <stddef.h>
+#include <sys/mman.h>
+#include "chunk.h"
+#include "jit.h"
+#include "memory.h"
+#include "object.h"
+#include "vm.h"
+
+#ifdef BASELINE_JIT
+
+void init_native_code(NativeCode *code)
+{
+    code->entry = NULL;
+    code->memory = NULL;
+    code->size = 0;
+    code->failed = false;
+    code->osr_count = 0;
+    code->osr = NULL;
+}
+
+void free_native_code(Vm *vm, NativeCode *code)
+{
+    if (code->memory != NULL)
+    {
+        munmap(code->memory, code->size);
+    }
+    FREE_ARRAY(OsrEntry, code->osr, code->osr_count);
+    init_native_code(code);
+}
+
+NativeEntry jit_osr_entry(NativeCode *code, int offset)
+{
+    for (int i = 0; i < code->osr_count; i++)
+    {
+        if (code->osr[i].offset == offset)
+        {
+            return code->osr[i].entry;
+        }
+    }
+    return NULL;
+}
+
+// The native code keeps the interpreter state in callee-saved registers: rbx is the stack top, r12 the frame's slots,
+// r13 the vm and r14 the frame. Values are NaN-boxed 64-bit words, so numbers move between rax/rcx and xmm0/xmm1
+// without conversion.
+typedef enum
+{
+    RAX,
+    RCX,
+    RDX,
+    RBX,
+    RSP,
+    RBP,
+    RSI,
+    RDI,
+    R8,
+    R9,
+    R10,
+    R11,
+    R12,
+    R13,
+    R14,
+    R15,
+} Register;
+
+#define STACK_TOP RBX
+#define SLOTS R12
+#define VM R13
+#define FRAME R14
+
+typedef enum
+{
+    CC_B = 0x2,
+    CC_AE = 0x3,
+    CC_E = 0x4,
+    CC_NE = 0x5,
+    CC_BE = 0x6,
+    CC_A = 0x7,
+} Condition;
+
+typedef struct
+{
+    int at;
+    int target;
+} Patch;
+
+// A guard of a trace that leaves it for the interpreter at ip.
+typedef struct
+{
+    int at;
+    Code *ip;
+} Exit;
+
+typedef struct
+{
+    Vm *vm;
+    ObjFunction *function;
+    Chunk *chunk;
+    uint8_t *code;
+    int count;
+    int capacity;
+    int *labels;
+    Patch *patches;
+    int patch_count;
+    int patch_capacity;
+    int error_exit;
+    Code *ip;
+    bool speculate;
+    Exit *exits;
+    int exit_count;
+    int exit_capacity;
+    Patch *osr;
+    int osr_count;
+} Assembler;
+
+static void emit_byte(Assembler *as, uint8_t byte)
+{
+    Vm *vm = as->vm;
+    if (as->capacity < as->count + 1)
+    {
+        int old_capacity = as->capacity;
+        as->capacity = GROW_CAPACITY(old_capacity);
+        as->code = GROW_ARRAY(uint8_t, as->code, old_capacity, as->capacity);
+    }
+    as->code[as->count++] = byte;
+}
+
+static void emit_u32(Assembler *as, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        emit_byte(as, (uint8_t)(value >> (8 * i)));
+    }
+}
+
+static void emit_u64(Assembler *as, uint64_t value)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        emit_byte(as, (uint8_t)(value >> (8 * i)));
+    }
+}
+
+static void patch_u32(Assembler *as, int at, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        as->code[at + i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+static void emit_rex(Assembler *as, Register reg, Register rm)
+{
+    emit_byte(as, 0x48 | ((reg >> 3) << 2) | (rm >> 3));
+}
+
+static void emit_modrm_disp(Assembler *as, Register reg, Register base, int32_t disp)
+{
+    emit_byte(as, 0x80 | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == RSP)
+    {
+        emit_byte(as, 0x24);
+    }
+    emit_u32(as, (uint32_t)disp);
+}
+
+// mov dst, [base + disp]
+static void emit_load(Assembler *as, Register dst, Register base, int32_t disp)
+{
+    emit_rex(as, dst, base);
+    emit_byte(as, 0x8b);
+    emit_modrm_disp(as, dst, base, disp);
+}
+
+// mov [base + disp], src
+static void emit_store(Assembler *as, Register base, int32_t disp, Register src)
+{
+    emit_rex(as, src, base);
+    emit_byte(as, 0x89);
+    emit_modrm_disp(as, src, base, disp);
+}
+
+// op dst, src for the two-operand ALU forms: 0x89 mov, 0x01 add, 0x21 and, 0x31 xor, 0x39 cmp.
+static void emit_alu(Assembler *as, uint8_t opcode, Register dst, Register src)
+{
+    emit_rex(as, src, dst);
+    emit_byte(as, opcode);
+    emit_byte(as, 0xc0 | ((src & 7) << 3) | (dst & 7));
+}
+
+static void emit_move(Assembler *as, Register dst, Register src)
+{
+    emit_alu(as, 0x89, dst, src);
+}
+
+static void emit_move_imm(Assembler *as, Register dst, uint64_t value)
+{
+    emit_rex(as, 0, dst);
+    emit_byte(as, 0xb8 | (dst & 7));
+    emit_u64(as, value);
+}
+
+static void emit_add_imm(Assembler *as, Register reg, int32_t value)
+{
+    emit_rex(as, 0, reg);
+    emit_byte(as, 0x81);
+    emit_byte(as, 0xc0 | (reg & 7));
+    emit_u32(as, (uint32_t)value);
+}
+
+static void emit_push_register(Assembler *as, Register reg)
+{
+    if (reg >= R8)
+    {
+        emit_byte(as, 0x41);
+    }
+    emit_byte(as, 0x50 | (reg & 7));
+}
+
+static void emit_pop_register(Assembler *as, Register reg)
+{
+    if (reg >= R8)
+    {
+        emit_byte(as, 0x41);
+    }
+    emit_byte(as, 0x58 | (reg & 7));
+}
+
+// movq xmm, reg
+static void emit_to_xmm(Assembler *as, int xmm, Register reg)
+{
+    emit_byte(as, 0x66);
+    emit_rex(as, xmm, reg);
+    emit_byte(as, 0x0f);
+    emit_byte(as, 0x6e);
+    emit_byte(as, 0xc0 | (xmm << 3) | (reg & 7));
+}
+
+// movq reg, xmm
+static void emit_from_xmm(Assembler *as, Register reg, int xmm)
+{
+    emit_byte(as, 0x66);
+    emit_rex(as, xmm, reg);
+    emit_byte(as, 0x0f);
+    emit_byte(as, 0x7e);
+    emit_byte(as, 0xc0 | (xmm << 3) | (reg & 7));
+}
+
+// addsd/subsd/mulsd/divsd xmm0, xmm1
+static void emit_double_op(Assembler *as, uint8_t opcode)
+{
+    emit_byte(as, 0xf2);
+    emit_byte(as, 0x0f);
+    emit_byte(as, opcode);
+    emit_byte(as, 0xc1);
+}
+
+// ucomisd xmm(left), xmm(right)
+static void emit_compare_doubles(Assembler *as, int left, int right)
+{
+    emit_byte(as, 0x66);
+    emit_byte(as, 0x0f);
+    emit_byte(as, 0x2e);
+    emit_byte(as, 0xc0 | (left << 3) | right);
+}
+
+// setcc al; movzx eax, al
+static void emit_set_condition(Assembler *as, Condition condition)
+{
+    emit_byte(as, 0x0f);
+    emit_byte(as, 0x90 | condition);
+    emit_byte(as, 0xc0);
+    emit_byte(as, 0x0f);
+    emit_byte(as, 0xb6);
+    emit_byte(as, 0xc0);
+}
+
+static void emit_test_al(Assembler *as)
+{
+    emit_byte(as, 0x84);
+    emit_byte(as, 0xc0);
+}
+
+// Emits a jump with a 32-bit displacement and returns the position of the displacement.
+static int emit_jump_rel(Assembler *as, int condition)
+{
+    if (condition < 0)
+    {
+        emit_byte(as, 0xe9);
+    }
+    else
+    {
+        emit_byte(as, 0x0f);
+        emit_byte(as, 0x80 | condition);
+    }
+    emit_u32(as, 0);
+    return as->count - 4;
+}
+
+static void patch_jump_to(Assembler *as, int at, int target)
+{
+    patch_u32(as, at, (uint32_t)(target - (at + 4)));
+}
+
+static void patch_jump_here(Assembler *as, int at)
+{
+    patch_jump_to(as, at, as->count);
+}
+
+// Jumps to the native code of a bytecode offset, which may not have been emitted yet.
+static void emit_jump_to_offset(Assembler *as, int condition, int target)
+{
+    Vm *vm = as->vm;
+    int at = emit_jump_rel(as, condition);
+    if (as->patch_capacity < as->patch_count + 1)
+    {
+        int old_capacity = as->patch_capacity;
+        as->patch_capacity = GROW_CAPACITY(old_capacity);
+        as->patches = GROW_ARRAY(Patch, as->patches, old_capacity, as->patch_capacity);
+    }
+    as->patches[as->patch_count++] = (Patch){at, target};
+}
+
+static void emit_jump_to_error(Assembler *as, int condition)
+{
+    patch_jump_to(as, emit_jump_rel(as, condition), as->error_exit);
+}
+
+// Makes the jump at at leave the trace for the interpreter, which continues at ip.
+static void add_exit(Assembler *as, int at, Code *ip)
+{
+    Vm *vm = as->vm;
+    if (as->exit_capacity < as->exit_count + 1)
+    {
+        int old_capacity = as->exit_capacity;
+        as->exit_capacity = GROW_CAPACITY(old_capacity);
+        as->exits = GROW_ARRAY(Exit, as->exits, old_capacity, as->exit_capacity);
+    }
+    as->exits[as->exit_count++] = (Exit){at, ip};
+}
+
+static void emit_exit(Assembler *as, int condition, Code *ip)
+{
+    add_exit(as, emit_jump_rel(as, condition), ip);
+}
+
+static void emit_epilogue(Assembler *as)
+{
+    emit_add_imm(as, RSP, 8);
+    emit_pop_register(as, R14);
+    emit_pop_register(as, R13);
+    emit_pop_register(as, R12);
+    emit_pop_register(as, RBX);
+    emit_byte(as, 0xc3);
+}
+
+static void emit_push_value(Assembler *as, Register reg)
+{
+    emit_store(as, STACK_TOP, 0, reg);
+    emit_add_imm(as, STACK_TOP, (int32_t)sizeof(Value));
+}
+
+static void emit_peek(Assembler *as, Register dst, int distance)
+{
+    emit_load(as, dst, STACK_TOP, -(int32_t)sizeof(Value) * (distance + 1));
+}
+
+// lea rbx, [rbx - 8 * count], which leaves the flags alone so a drop can sit between a compare and its jump.
+static void emit_drop(Assembler *as, int count)
+{
+    emit_rex(as, STACK_TOP, STACK_TOP);
+    emit_byte(as, 0x8d);
+    emit_modrm_disp(as, STACK_TOP, STACK_TOP, -(int32_t)sizeof(Value) * count);
+}
+
+// Points the frame and slots registers at the frame on top again after a call, which may have moved both stacks.
+static void emit_reload_frame(Assembler *as)
+{
+    emit_load(as, FRAME, VM, (int32_t)offsetof(Vm, frames));
+    // movsxd rax, dword [vm + frame_count]; imul rax, rax, sizeof(CallFrame)
+    emit_rex(as, RAX, VM);
+    emit_byte(as, 0x63);
+    emit_modrm_disp(as, RAX, VM, (int32_t)offsetof(Vm, frame_count));
+    emit_rex(as, RAX, RAX);
+    emit_byte(as, 0x69);
+    emit_byte(as, 0xc0);
+    emit_u32(as, (uint32_t)sizeof(CallFrame));
+    emit_alu(as, 0x01, FRAME, RAX);
+    emit_add_imm(as, FRAME, -(int32_t)sizeof(CallFrame));
+    emit_load(as, SLOTS, FRAME, (int32_t)offsetof(CallFrame, slots));
+}
+
+// op dword [vm + frame_count], imm32 for the group 1 forms: /0 add, /7 cmp.
+static void emit_frame_count_op(Assembler *as, int extension, int32_t value)
+{
+    emit_byte(as, 0x41);
+    emit_byte(as, 0x81);
+    emit_modrm_disp(as, (Register)extension, VM, (int32_t)offsetof(Vm, frame_count));
+    emit_u32(as, (uint32_t)value);
+}
+
+// Jumps to slow when reg does not hold a number. Clobbers rsi; rdx must hold QNAN.
+static void emit_number_guard(Assembler *as, Register reg, int *slow, int *slow_count)
+{
+    emit_move(as, RSI, reg);
+    emit_alu(as, 0x21, RSI, RDX);
+    emit_alu(as, 0x39, RSI, RDX);
+    slow[(*slow_count)++] = emit_jump_rel(as, CC_E);
+}
+
+// Publishes the stack top and the ip of the current instruction, calls a runtime helper with up to three extra
+// arguments and reloads the stack top. The helper's bool result is left in al.
+static void emit_call_helper(Assembler *as, void *helper, int arg_count, uint64_t arg1, uint64_t arg2, uint64_t arg3)
+{
+    emit_store(as, VM, (int32_t)offsetof(Vm, stack_top), STACK_TOP);
+    emit_move_imm(as, RAX, (uint64_t)(uintptr_t)as->ip);
+    emit_store(as, FRAME, (int32_t)offsetof(CallFrame, ip), RAX);
+    emit_move(as, RDI, VM);
+    if (arg_count > 0)
+    {
+        emit_move_imm(as, RSI, arg1);
+    }
+    if (arg_count > 1)
+    {
+        emit_move_imm(as, RDX, arg2);
+    }
+    if (arg_count > 2)
+    {
+        emit_move_imm(as, RCX, arg3);
+    }
+    emit_move_imm(as, RAX, (uint64_t)(uintptr_t)helper);
+    emit_byte(as, 0xff);
+    emit_byte(as, 0xd0);
+    emit_load(as, STACK_TOP, VM, (int32_t)offsetof(Vm, stack_top));
+}
+
+// Pops the frame on top the way jit_return does. Without captured locals there are no upvalues to close, so the result
+// moves from the top of the stack into the callee's slot inline.
+static void emit_return(Assembler *as)
+{
+    if (as->function->captures_locals)
+    {
+        emit_call_helper(as, (void *)jit_return, 0, 0, 0, 0);
+        return;
+    }
+    emit_load(as, RAX, STACK_TOP, -(int32_t)sizeof(Value));
+    emit_store(as, SLOTS, 0, RAX);
+    // lea rbx, [r12 + 8]
+    emit_rex(as, STACK_TOP, SLOTS);
+    emit_byte(as, 0x8d);
+    emit_modrm_disp(as, STACK_TOP, SLOTS, (int32_t)sizeof(Value));
+    emit_store(as, VM, (int32_t)offsetof(Vm, stack_top), STACK_TOP);
+    emit_frame_count_op(as, 0, -1);
+}
+
+static void emit_fallible_helper(Assembler *as, void *helper, int arg_count, uint64_t arg1, uint64_t arg2)
+{
+    emit_call_helper(as, helper, arg_count, arg1, arg2, 0);
+    emit_test_al(as);
+    emit_jump_to_error(as, CC_E);
+}
+
+// Number fast path for two operands already loaded into rax and rcx. The slow path pushes nothing; the operands are
+// still where the helper expects them. Without a helper, code that speculates on numbers deoptimizes instead.
+static void emit_arithmetic(Assembler *as, uint8_t opcode, int drop, void *slow_helper)
+{
+    int slow[2];
+    int slow_count = 0;
+    emit_move_imm(as, RDX, QNAN);
+    emit_number_guard(as, RAX, slow, &slow_count);
+    emit_number_guard(as, RCX, slow, &slow_count);
+    emit_to_xmm(as, 0, RAX);
+    emit_to_xmm(as, 1, RCX);
+    emit_double_op(as, opcode);
+    emit_from_xmm(as, RAX, 0);
+    emit_drop(as, drop);
+    emit_push_value(as, RAX);
+    if (slow_helper == NULL)
+    {
+        for (int i = 0; i < slow_count; i++)
+        {
+            add_exit(as, slow[i], as->ip - 1);
+        }
+        return;
+    }
+    int done = emit_jump_rel(as, -1);
+
+    for (int i = 0; i < slow_count; i++)
+    {
+        patch_jump_here(as, slow[i]);
+    }
+    emit_fallible_helper(as, slow_helper, 0, 0, 0);
+    patch_jump_here(as, done);
+}
+
+static void emit_binary(Assembler *as, uint8_t opcode, void *slow_helper)
+{
+    emit_peek(as, RAX, 1);
+    emit_peek(as, RCX, 0);
+    emit_arithmetic(as, opcode, 2, slow_helper);
+}
+
+static void emit_locals_binary(Assembler *as, uint8_t opcode, int left, int right)
+{
+    emit_load(as, RAX, SLOTS, (int32_t)sizeof(Value) * left);
+    emit_load(as, RCX, SLOTS, (int32_t)sizeof(Value) * right);
+    if (opcode != 0x58)
+    {
+        emit_arithmetic(as, opcode, 0, (void *)jit_numbers_error);
+        return;
+    }
+
+    // Strings are concatenated by the generic helper, which wants both operands on the stack.
+    int slow[2];
+    int slow_count = 0;
+    emit_move_imm(as, RDX, QNAN);
+    emit_number_guard(as, RAX, slow, &slow_count);
+    emit_number_guard(as, RCX, slow, &slow_count);
+    emit_to_xmm(as, 0, RAX);
+    emit_to_xmm(as, 1, RCX);
+    emit_double_op(as, opcode);
+    emit_from_xmm(as, RAX, 0);
+    emit_push_value(as, RAX);
+    int done = emit_jump_rel(as, -1);
+
+    for (int i = 0; i < slow_count; i++)
+    {
+        patch_jump_here(as, slow[i]);
+    }
+    emit_push_value(as, RAX);
+    emit_push_value(as, RCX);
+    emit_fallible_helper(as, (void *)jit_add, 0, 0, 0);
+    patch_jump_here(as, done);
+}
+
+// Loads both operands, checks that they are numbers and compares them without dropping them. The flags are left for a
+// ucomisd that is "above" when the comparison holds, so greater compares a with b and less compares b with a.
+static void emit_compare(Assembler *as, bool less, int *slow, int *slow_count)
+{
+    emit_peek(as, RAX, 1);
+    emit_peek(as, RCX, 0);
+    emit_move_imm(as, RDX, QNAN);
+    emit_number_guard(as, RAX, slow, slow_count);
+    emit_number_guard(as, RCX, slow, slow_count);
+    emit_to_xmm(as, 0, RAX);
+    emit_to_xmm(as, 1, RCX);
+    if (less)
+    {
+        emit_compare_doubles(as, 1, 0);
+    }
+    else
+    {
+        emit_compare_doubles(as, 0, 1);
+    }
+}
+
+static void emit_compare_slow_path(Assembler *as, int *slow, int slow_count, int done)
+{
+    for (int i = 0; i < slow_count; i++)
+    {
+        patch_jump_here(as, slow[i]);
+    }
+    emit_call_helper(as, (void *)jit_numbers_error, 0, 0, 0, 0);
+    emit_jump_to_error(as, -1);
+    patch_jump_here(as, done);
+}
+
+static void emit_comparison(Assembler *as, bool less, bool negate)
+{
+    int slow[2];
+    int slow_count = 0;
+    emit_compare(as, less, slow, &slow_count);
+    emit_set_condition(as, negate ? CC_BE : CC_A);
+    emit_drop(as, 2);
+    emit_move_imm(as, RCX, FALSE_VAL);
+    emit_alu(as, 0x01, RAX, RCX);
+    emit_push_value(as, RAX);
+    int done = emit_jump_rel(as, -1);
+    emit_compare_slow_path(as, slow, slow_count, done);
+}
+
+static void emit_compare_and_jump(Assembler *as, bool less, bool jump_if, int target)
+{
+    int slow[2];
+    int slow_count = 0;
+    emit_compare(as, less, slow, &slow_count);
+    emit_drop(as, 2);
+    emit_jump_to_offset(as, jump_if ? CC_A : CC_BE, target);
+    int done = emit_jump_rel(as, -1);
+    emit_compare_slow_path(as, slow, slow_count, done);
+}
+
+// Calls values_equal on the two top values, leaving them on the stack. al holds the result.
+static void emit_values_equal(Assembler *as)
+{
+    emit_peek(as, RDI, 1);
+    emit_peek(as, RSI, 0);
+    emit_move_imm(as, RAX, (uint64_t)(uintptr_t)values_equal);
+    emit_byte(as, 0xff);
+    emit_byte(as, 0xd0);
+}
+
+static void emit_equality(Assembler *as, bool negate)
+{
+    emit_values_equal(as);
+    emit_test_al(as);
+    emit_set_condition(as, negate ? CC_E : CC_NE);
+    emit_drop(as, 2);
+    emit_move_imm(as, RCX, FALSE_VAL);
+    emit_alu(as, 0x01, RAX, RCX);
+    emit_push_value(as, RAX);
+}
+
+// Jumps to target when rax holds nil or false.
+static void emit_jump_if_falsey(Assembler *as, int target)
+{
+    emit_move_imm(as, RCX, NIL_VAL);
+    emit_alu(as, 0x39, RAX, RCX);
+    emit_jump_to_offset(as, CC_E, target);
+    emit_move_imm(as, RCX, FALSE_VAL);
+    emit_alu(as, 0x39, RAX, RCX);
+    emit_jump_to_offset(as, CC_E, target);
+}
+
+static void emit_upvalue_location(Assembler *as, int index)
+{
+    emit_load(as, RAX, FRAME, (int32_t)offsetof(CallFrame, closure));
+    emit_load(as, RAX, RAX, (int32_t)offsetof(ObjClosure, upvalues));
+    emit_load(as, RAX, RAX, (int32_t)sizeof(ObjUpvalue *) * index);
+    emit_load(as, RAX, RAX, (int32_t)offsetof(ObjUpvalue, location));
+}
+
+// Objects from the constant table are passed to helpers as raw pointers.
+static uint64_t object_operand(Value value)
+{
+    return (uint64_t)(uintptr_t)AS_OBJ(value);
+}
+
+// The instruction as the interpreter last left it, which may be a quickened form. Direct threading quickens the
+// handlers of the predecoded cells and leaves the bytecode alone.
+static uint8_t observed_opcode(Assembler *as, int offset)
+{
+#ifdef DIRECT_THREADING
+    const void *handler = code_at(as->chunk, offset)->handler;
+    for (int op = 0; op < OPCODE_COUNT; op++)
+    {
+        if (as->vm->handlers[op] == handler)
+        {
+            return (uint8_t)op;
+        }
+    }
+#endif
+    return as->chunk->code[offset];
+}
+
+static bool emit_instruction(Assembler *as, int offset)
+{
+    Chunk *chunk = as->chunk;
+    uint8_t *code = chunk->code;
+    Value *constants = chunk->constants.values;
+    int operand = instruction_length(chunk, offset) > 1 ? index_operand(code, offset) : 0;
+    // The ip stored into the frame before a helper runs is one past the start of the instruction, as the interpreter
+    // would have it after reading the opcode, so runtime_error finds the right line.
+    as->ip = code_at(chunk, offset) + 1;
+
+    switch (opcode_at(code, offset))
+    {
+    case OP_CONSTANT:
+        emit_move_imm(as, RAX, constants[operand]);
+        emit_push_value(as, RAX);
+        return true;
+    case OP_CONSTANT_LONG:
+        emit_move_imm(as, RAX, constants[code[offset + 1] | code[offset + 2] << 8 | code[offset + 3] << 16]);
+        emit_push_value(as, RAX);
+        return true;
+    case OP_NIL:
+        emit_move_imm(as, RAX, NIL_VAL);
+        emit_push_value(as, RAX);
+        return true;
+    case OP_TRUE:
+        emit_move_imm(as, RAX, TRUE_VAL);
+        emit_push_value(as, RAX);
+        return true;
+    case OP_FALSE:
+        emit_move_imm(as, RAX, FALSE_VAL);
+        emit_push_value(as, RAX);
+        return true;
+    case OP_POP:
+        emit_drop(as, 1);
+        return true;
+    case OP_GET_LOCAL:
+        emit_load(as, RAX, SLOTS, (int32_t)sizeof(Value) * operand);
+        emit_push_value(as, RAX);
+        return true;
+    case OP_SET_LOCAL:
+        emit_peek(as, RAX, 0);
+        emit_store(as, SLOTS, (int32_t)sizeof(Value) * operand, RAX);
+        return true;
+    case OP_GET_GLOBAL:
+        emit_fallible_helper(as, (void *)jit_get_global, 1, (uint64_t)operand, 0);
+        return true;
+    case OP_DEFINE_GLOBAL:
+        emit_call_helper(as, (void *)jit_define_global, 1, (uint64_t)operand, 0, 0);
+        return true;
+    case OP_SET_GLOBAL:
+        emit_fallible_helper(as, (void *)jit_set_global, 1, (uint64_t)operand, 0);
+        return true;
+    case OP_GET_UPVALUE:
+        emit_upvalue_location(as, operand);
+        emit_load(as, RAX, RAX, 0);
+        emit_push_value(as, RAX);
+        return true;
+    case OP_SET_UPVALUE:
+        emit_upvalue_location(as, operand);
+        emit_peek(as, RCX, 0);
+        emit_store(as, RAX, 0, RCX);
+        return true;
+    case OP_GET_PROPERTY:
+    case OP_GET_FIELD:
+        emit_fallible_helper(as, (void *)jit_get_property, 1, (uint64_t)(uintptr_t)cache_operand(chunk, offset), 0);
+        return true;
+    case OP_SET_PROPERTY:
+        emit_fallible_helper(as, (void *)jit_set_property, 1, (uint64_t)(uintptr_t)cache_operand(chunk, offset), 0);
+        return true;
+    case OP_GET_SUPER:
+        emit_fallible_helper(as, (void *)jit_get_super, 1, object_operand(constants[operand]), 0);
+        return true;
+    case OP_GET_THIS_PROPERTY:
+        emit_load(as, RAX, SLOTS, 0);
+        emit_push_value(as, RAX);
+        emit_fallible_helper(as, (void *)jit_get_property, 1, (uint64_t)(uintptr_t)cache_operand(chunk, offset), 0);
+        return true;
+    case OP_SET_THIS_PROPERTY:
+        emit_fallible_helper(as, (void *)jit_set_this_property, 1, (uint64_t)(uintptr_t)cache_operand(chunk, offset),
+                             0);
+        return true;
+    case OP_EQUAL:
+        emit_equality(as, false);
+        return true;
+    case OP_NOT_EQUAL:
+        emit_equality(as, true);
+        return true;
+    case OP_GREATER:
+        emit_comparison(as, false, false);
+        return true;
+    case OP_NOT_GREATER:
+        emit_comparison(as, false, true);
+        return true;
+    case OP_LESS:
+        emit_comparison(as, true, false);
+        return true;
+    case OP_NOT_LESS:
+        emit_comparison(as, true, true);
+        return true;
+    case OP_ADD:
+    case OP_ADD_NUM:
+    case OP_ADD_STR:
+        // An addition the interpreter has only seen numbers at leaves the native code if it sees anything else.
+        emit_binary(as, 0x58, as->speculate && observed_opcode(as, offset) == OP_ADD_NUM ? NULL : (void *)jit_add);
+        return true;
+    case OP_SUBTRACT:
+        emit_binary(as, 0x5c, (void *)jit_numbers_error);
+        return true;
+    case OP_MULTIPLY:
+        emit_binary(as, 0x59, (void *)jit_numbers_error);
+        return true;
+    case OP_DIVIDE:
+        emit_binary(as, 0x5e, (void *)jit_numbers_error);
+        return true;
+    case OP_ADD_LOCALS:
+        emit_locals_binary(as, 0x58, operand, code[offset + 2]);
+        return true;
+    case OP_SUBTRACT_LOCALS:
+        emit_locals_binary(as, 0x5c, operand, code[offset + 2]);
+        return true;
+    case OP_MULTIPLY_LOCALS:
+        emit_locals_binary(as, 0x59, operand, code[offset + 2]);
+        return true;
+    case OP_DIVIDE_LOCALS:
+        emit_locals_binary(as, 0x5e, operand, code[offset + 2]);
+        return true;
+    case OP_NOT:
+    {
+        emit_peek(as, RAX, 0);
+        emit_move_imm(as, RCX, NIL_VAL);
+        emit_alu(as, 0x39, RAX, RCX);
+        int is_nil = emit_jump_rel(as, CC_E);
+        emit_move_imm(as, RCX, FALSE_VAL);
+        emit_alu(as, 0x39, RAX, RCX);
+        int is_false = emit_jump_rel(as, CC_E);
+        emit_move_imm(as, RAX, FALSE_VAL);
+        int done = emit_jump_rel(as, -1);
+        patch_jump_here(as, is_nil);
+        patch_jump_here(as, is_false);
+        emit_move_imm(as, RAX, TRUE_VAL);
+        patch_jump_here(as, done);
+        emit_store(as, STACK_TOP, -(int32_t)sizeof(Value), RAX);
+        return true;
+    }
+    case OP_NEGATE:
+    {
+        int slow[1];
+        int slow_count = 0;
+        emit_peek(as, RAX, 0);
+        emit_move_imm(as, RDX, QNAN);
+        emit_number_guard(as, RAX, slow, &slow_count);
+        emit_move_imm(as, RCX, SIGN_BIT);
+        emit_alu(as, 0x31, RAX, RCX);
+        emit_store(as, STACK_TOP, -(int32_t)sizeof(Value), RAX);
+        int done = emit_jump_rel(as, -1);
+        patch_jump_here(as, slow[0]);
+        emit_call_helper(as, (void *)jit_number_error, 0, 0, 0, 0);
+        emit_jump_to_error(as, -1);
+        patch_jump_here(as, done);
+        return true;
+    }
+    case OP_PRINT:
+        emit_call_helper(as, (void *)jit_print, 0, 0, 0, 0);
+        return true;
+    case OP_JUMP:
+        emit_jump_to_offset(as, -1, jump_target(code, offset));
+        return true;
+    case OP_LOOP:
+        emit_jump_to_offset(as, -1, jump_target(code, offset));
+        return true;
+    case OP_JUMP_IF_FALSE:
+        emit_peek(as, RAX, 0);
+        emit_jump_if_falsey(as, jump_target(code, offset));
+        return true;
+    case OP_POP_JUMP_IF_FALSE:
+        emit_peek(as, RAX, 0);
+        emit_drop(as, 1);
+        emit_jump_if_falsey(as, jump_target(code, offset));
+        return true;
+    case OP_JUMP_IF_EQUAL:
+        emit_values_equal(as);
+        emit_test_al(as);
+        emit_drop(as, 2);
+        emit_jump_to_offset(as, CC_NE, jump_target(code, offset));
+        return true;
+    case OP_JUMP_IF_NOT_EQUAL:
+        emit_values_equal(as);
+        emit_test_al(as);
+        emit_drop(as, 2);
+        emit_jump_to_offset(as, CC_E, jump_target(code, offset));
+        return true;
+    case OP_JUMP_IF_GREATER:
+        emit_compare_and_jump(as, false, true, jump_target(code, offset));
+        return true;
+    case OP_JUMP_IF_NOT_GREATER:
+        emit_compare_and_jump(as, false, false, jump_target(code, offset));
+        return true;
+    case OP_JUMP_IF_LESS:
+        emit_compare_and_jump(as, true, true, jump_target(code, offset));
+        return true;
+    case OP_JUMP_IF_NOT_LESS:
+        emit_compare_and_jump(as, true, false, jump_target(code, offset));
+        return true;
+    case OP_CALL:
+    case OP_CALL_CLOSURE:
+        emit_fallible_helper(as, (void *)jit_call, 1, operand, 0);
+        emit_reload_frame(as);
+        return true;
+    case OP_TAIL_CALL:
+        // The callee now owns the frame, or has already returned from it.
+        emit_fallible_helper(as, (void *)jit_tail_call, 1, operand, 0);
+        emit_byte(as, 0xb8);
+        emit_u32(as, 1);
+        emit_epilogue(as);
+        return true;
+    case OP_GET_INTRINSIC:
+    {
+        // cmp byte [vm + intrinsic_intact + operand], 0
+        emit_byte(as, 0x41);
+        emit_byte(as, 0x80);
+        emit_modrm_disp(as, (Register)7, VM, (int32_t)(offsetof(Vm, intrinsic_intact) + operand));
+        emit_byte(as, 0);
+        int slow = emit_jump_rel(as, CC_E);
+        emit_move_imm(as, RAX, OBJ_VAL(as->vm->intrinsics[operand]));
+        emit_push_value(as, RAX);
+        int done = emit_jump_rel(as, -1);
+        patch_jump_here(as, slow);
+        emit_fallible_helper(as, (void *)jit_get_intrinsic, 1, operand, 0);
+        patch_jump_here(as, done);
+        return true;
+    }
+    case OP_INTRINSIC:
+        emit_fallible_helper(as, (void *)jit_intrinsic, 2, operand, code[offset + 2]);
+        emit_reload_frame(as);
+        return true;
+    case OP_INVOKE:
+        emit_fallible_helper(as, (void *)jit_invoke, 2, (uint64_t)(uintptr_t)invoke_cache_operand(chunk, offset),
+                             code[after_index(code, offset)]);
+        emit_reload_frame(as);
+        return true;
+    case OP_SUPER_INVOKE:
+        emit_fallible_helper(as, (void *)jit_super_invoke, 2,
+                             (uint64_t)(uintptr_t)invoke_cache_operand(chunk, offset), code[after_index(code, offset)]);
+        emit_reload_frame(as);
+        return true;
+    case OP_CLOSURE:
+        emit_call_helper(as, (void *)jit_closure, 2, object_operand(constants[operand]),
+                         (uint64_t)(uintptr_t)&code[offset], 0);
+        return true;
+    case OP_CLOSE_UPVALUE:
+        emit_call_helper(as, (void *)jit_close_upvalue, 0, 0, 0, 0);
+        return true;
+    case OP_RETURN:
+        emit_return(as);
+        emit_byte(as, 0xb8);
+        emit_u32(as, 1);
+        emit_epilogue(as);
+        return true;
+    case OP_CLASS:
+        emit_call_helper(as, (void *)jit_class, 1, object_operand(constants[operand]), 0, 0);
+        return true;
+    case OP_INHERIT:
+        emit_fallible_helper(as, (void *)jit_inherit, 0, 0, 0);
+        return true;
+    case OP_METHOD:
+        emit_call_helper(as, (void *)jit_method, 1, object_operand(constants[operand]), 0, 0);
+        return true;
+    case OP_FIELD:
+        emit_call_helper(as, (void *)jit_field, 1, object_operand(constants[operand]), 0, 0);
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void emit_prologue(Assembler *as)
+{
+    emit_push_register(as, RBX);
+    emit_push_register(as, R12);
+    emit_push_register(as, R13);
+    emit_push_register(as, R14);
+    emit_add_imm(as, RSP, -8);
+    emit_move(as, VM, RDI);
+    emit_move(as, FRAME, RSI);
+    emit_load(as, SLOTS, FRAME, (int32_t)offsetof(CallFrame, slots));
+    emit_load(as, STACK_TOP, VM, (int32_t)offsetof(Vm, stack_top));
+}
+
+static void emit_error_exit(Assembler *as)
+{
+    as->error_exit = as->count;
+    emit_byte(as, 0x31);
+    emit_byte(as, 0xc0);
+    emit_epilogue(as);
+}
+
+// Leaving before the frame is done: each stub publishes the stack top and the ip the interpreter continues at, lets the
+// runtime know through helper and returns true with the frame still in place.
+static void emit_exit_stubs(Assembler *as, void *helper)
+{
+    for (int i = 0; i < as->exit_count; i++)
+    {
+        patch_jump_here(as, as->exits[i].at);
+        emit_store(as, VM, (int32_t)offsetof(Vm, stack_top), STACK_TOP);
+        emit_move_imm(as, RAX, (uint64_t)(uintptr_t)as->exits[i].ip);
+        emit_store(as, FRAME, (int32_t)offsetof(CallFrame, ip), RAX);
+        emit_move(as, RDI, VM);
+        emit_move_imm(as, RAX, (uint64_t)(uintptr_t)helper);
+        emit_byte(as, 0xff);
+        emit_byte(as, 0xd0);
+        emit_byte(as, 0xb8);
+        emit_u32(as, 1);
+        emit_epilogue(as);
+    }
+}
+
+// Native code layout: the shared error exit comes first so that every guard can jump backwards to it, followed by the
+// entry point, the instructions in bytecode order, one entry per loop header for on-stack replacement and the
+// deoptimization stubs.
+static bool assemble(Assembler *as)
+{
+    Chunk *chunk = as->chunk;
+
+    emit_error_exit(as);
+    as->labels[chunk->count] = as->count;
+    emit_prologue(as);
+
+    for (int offset = 0; offset < chunk->count; offset += instruction_length(chunk, offset))
+    {
+        as->labels[offset] = as->count;
+        if (!emit_instruction(as, offset))
+        {
+            return false;
+        }
+    }
+
+    // A loop entry sets up the registers like the function entry and jumps to the loop header. at is the entry, target
+    // the header.
+    for (int offset = 0; offset < chunk->count; offset += instruction_length(chunk, offset))
+    {
+        if (opcode_at(chunk->code, offset) == OP_LOOP)
+        {
+            as->osr[as->osr_count++] = (Patch){as->count, jump_target(chunk->code, offset)};
+            emit_prologue(as);
+            emit_jump_to_offset(as, -1, jump_target(chunk->code, offset));
+        }
+    }
+    emit_exit_stubs(as, (void *)jit_deoptimize);
+
+    for (int i = 0; i < as->patch_count; i++)
+    {
+        patch_jump_to(as, as->patches[i].at, as->labels[as->patches[i].target]);
+    }
+    return true;
+}
+
+static void init_assembler(Assembler *as, Vm *vm, ObjFunction *function)
+{
+    as->vm = vm;
+    as->function = function;
+    as->chunk = &function->chunk;
+    as->code = NULL;
+    as->count = 0;
+    as->capacity = 0;
+    as->labels = NULL;
+    as->patches = NULL;
+    as->patch_count = 0;
+    as->patch_capacity = 0;
+    as->error_exit = 0;
+    as->ip = NULL;
+    as->speculate = false;
+    as->exits = NULL;
+    as->exit_count = 0;
+    as->exit_capacity = 0;
+    as->osr = NULL;
+    as->osr_count = 0;
+}
+
+static void free_assembler(Assembler *as)
+{
+    Vm *vm = as->vm;
+    FREE_ARRAY(uint8_t, as->code, as->capacity);
+    FREE_ARRAY(Patch, as->patches, as->patch_capacity);
+    FREE_ARRAY(Exit, as->exits, as->exit_capacity);
+}
+
+// Copies the assembled code into executable memory. entry is the position of the prologue.
+static void install(Assembler *as, NativeCode *native, int entry)
+{
+    size_t size = (size_t)as->count;
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        return;
+    }
+    memcpy(memory, as->code, size);
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(memory, size);
+        return;
+    }
+    native->memory = memory;
+    native->size = size;
+    native->entry = (NativeEntry)((uint8_t *)memory + entry);
+}
+
+// With speculate, instructions the interpreter has quickened are compiled for the types it saw and deoptimize when
+// they meet others.
+bool jit_compile(Vm *vm, ObjFunction *function, bool speculate)
+{
+    Chunk *chunk = &function->chunk;
+    NativeCode *native = &chunk->native;
+    if (native->failed)
+    {
+        return false;
+    }
+
+    int loop_count = 0;
+    for (int offset = 0; offset < chunk->count; offset += instruction_length(chunk, offset))
+    {
+        loop_count += opcode_at(chunk->code, offset) == OP_LOOP;
+    }
+
+    Assembler as;
+    init_assembler(&as, vm, function);
+    as.speculate = speculate;
+    as.labels = ALLOCATE(int, chunk->count + 1);
+    as.osr = ALLOCATE(Patch, loop_count);
+    if (assemble(&as))
+    {
+        install(&as, native, as.labels[chunk->count]);
+    }
+    native->failed = native->entry == NULL;
+    if (native->entry != NULL)
+    {
+        native->osr = ALLOCATE(OsrEntry, as.osr_count);
+        native->osr_count = as.osr_count;
+        for (int i = 0; i < as.osr_count; i++)
+        {
+            native->osr[i].offset = as.osr[i].target;
+            native->osr[i].entry = (NativeEntry)((uint8_t *)native->memory + as.osr[i].at);
+        }
+    }
+
+    FREE_ARRAY(int, as.labels, chunk->count + 1);
+    FREE_ARRAY(Patch, as.osr, loop_count);
+    free_assembler(&as);
+    return native->entry != NULL;
+}
+
+#ifdef TRACING_JIT
+
+// A branch of a trace keeps going the way it went while recording and leaves the trace otherwise. The exit comes
+// before the instruction has changed the stack, so the interpreter executes it again and takes the other way.
+static void emit_trace_branch(Assembler *as, TraceStep *step)
+{
+    Code *exit_ip = code_at(as->chunk, step->offset);
+    switch (step->op)
+    {
+    case OP_JUMP_IF_FALSE:
+    case OP_POP_JUMP_IF_FALSE:
+    {
+        emit_peek(as, RAX, 0);
+        emit_move_imm(as, RCX, NIL_VAL);
+        emit_alu(as, 0x39, RAX, RCX);
+        if (step->taken)
+        {
+            int is_nil = emit_jump_rel(as, CC_E);
+            emit_move_imm(as, RCX, FALSE_VAL);
+            emit_alu(as, 0x39, RAX, RCX);
+            emit_exit(as, CC_NE, exit_ip);
+            patch_jump_here(as, is_nil);
+        }
+        else
+        {
+            emit_exit(as, CC_E, exit_ip);
+            emit_move_imm(as, RCX, FALSE_VAL);
+            emit_alu(as, 0x39, RAX, RCX);
+            emit_exit(as, CC_E, exit_ip);
+        }
+        if (step->op == OP_POP_JUMP_IF_FALSE)
+        {
+            emit_drop(as, 1);
+        }
+        return;
+    }
+    case OP_JUMP_IF_EQUAL:
+    case OP_JUMP_IF_NOT_EQUAL:
+    {
+        // The condition under which the instruction jumps; the opposite x86 condition differs in the lowest bit.
+        Condition jumps = step->op == OP_JUMP_IF_EQUAL ? CC_NE : CC_E;
+        emit_values_equal(as);
+        emit_test_al(as);
+        emit_exit(as, step->taken ? jumps ^ 1 : jumps, exit_ip);
+        emit_drop(as, 2);
+        return;
+    }
+    default:
+    {
+        bool less = step->op == OP_JUMP_IF_LESS || step->op == OP_JUMP_IF_NOT_LESS;
+        bool jump_if = step->op == OP_JUMP_IF_GREATER || step->op == OP_JUMP_IF_LESS;
+        Condition jumps = jump_if ? CC_A : CC_BE;
+        int slow[2];
+        int slow_count = 0;
+        emit_compare(as, less, slow, &slow_count);
+        emit_exit(as, step->taken ? jumps ^ 1 : jumps, exit_ip);
+        emit_drop(as, 2);
+        for (int i = 0; i < slow_count; i++)
+        {
+            add_exit(as, slow[i], exit_ip);
+        }
+        return;
+    }
+    }
+}
+
+// Pushes the frame of an inlined call the way call() would, once the callee is the closure that was recorded. When
+// the stacks would have to grow, the trace exits and leaves the call to the interpreter.
+static void emit_trace_call(Assembler *as, TraceStep *step)
+{
+    int arg_count = as->chunk->code[step->offset + 1];
+    Code *exit_ip = code_at(as->chunk, step->offset);
+    emit_peek(as, RAX, arg_count);
+    emit_move_imm(as, RCX, step->callee);
+    emit_alu(as, 0x39, RAX, RCX);
+    emit_exit(as, CC_NE, exit_ip);
+    // mov eax, [vm + frame_count]; cmp eax, [vm + frame_capacity]
+    emit_byte(as, 0x41);
+    emit_byte(as, 0x8b);
+    emit_modrm_disp(as, RAX, VM, (int32_t)offsetof(Vm, frame_count));
+    emit_byte(as, 0x41);
+    emit_byte(as, 0x3b);
+    emit_modrm_disp(as, RAX, VM, (int32_t)offsetof(Vm, frame_capacity));
+    emit_exit(as, CC_AE, exit_ip);
+    // lea rax, [rbx + end of the callee's slots]; cmp rax, [vm + stack_limit]
+    int max_slots = AS_CLOSURE(step->callee)->function->max_slots;
+    emit_rex(as, RAX, STACK_TOP);
+    emit_byte(as, 0x8d);
+    emit_modrm_disp(as, RAX, STACK_TOP, (int32_t)sizeof(Value) * (max_slots - arg_count - 1));
+    emit_rex(as, RAX, VM);
+    emit_byte(as, 0x3b);
+    emit_modrm_disp(as, RAX, VM, (int32_t)offsetof(Vm, stack_limit));
+    emit_exit(as, CC_A, exit_ip);
+
+    emit_move_imm(as, RAX, (uint64_t)(uintptr_t)code_at(as->chunk, step->offset + 2));
+    emit_store(as, FRAME, (int32_t)offsetof(CallFrame, ip), RAX);
+    emit_add_imm(as, FRAME, (int32_t)sizeof(CallFrame));
+    emit_move_imm(as, RAX, object_operand(step->callee));
+    emit_store(as, FRAME, (int32_t)offsetof(CallFrame, closure), RAX);
+    emit_move(as, SLOTS, STACK_TOP);
+    emit_add_imm(as, SLOTS, -(int32_t)sizeof(Value) * (arg_count + 1));
+    emit_store(as, FRAME, (int32_t)offsetof(CallFrame, slots), SLOTS);
+    emit_frame_count_op(as, 0, 1);
+}
+
+static bool emit_trace_step(Assembler *as, TraceStep *step)
+{
+    as->function = step->function;
+    as->chunk = &step->function->chunk;
+    as->ip = code_at(as->chunk, step->offset) + 1;
+    uint8_t *code = as->chunk->code + step->offset;
+
+    switch (step->op)
+    {
+    case OP_JUMP:
+    case OP_LOOP:
+        return true;
+    case OP_JUMP_IF_FALSE:
+    case OP_POP_JUMP_IF_FALSE:
+    case OP_JUMP_IF_EQUAL:
+    case OP_JUMP_IF_NOT_EQUAL:
+    case OP_JUMP_IF_GREATER:
+    case OP_JUMP_IF_NOT_GREATER:
+    case OP_JUMP_IF_LESS:
+    case OP_JUMP_IF_NOT_LESS:
+        emit_trace_branch(as, step);
+        return true;
+    case OP_ADD:
+    case OP_ADD_LOCALS:
+        if (!step->strings)
+        {
+            break;
+        }
+        if (step->op == OP_ADD_LOCALS)
+        {
+            emit_load(as, RAX, SLOTS, (int32_t)sizeof(Value) * code[1]);
+            emit_push_value(as, RAX);
+            emit_load(as, RAX, SLOTS, (int32_t)sizeof(Value) * code[2]);
+            emit_push_value(as, RAX);
+        }
+        emit_fallible_helper(as, (void *)jit_add, 0, 0, 0);
+        return true;
+    case OP_CALL:
+        if (!step->inlined)
+        {
+            break;
+        }
+        emit_trace_call(as, step);
+        return true;
+    case OP_RETURN:
+        emit_return(as);
+        emit_add_imm(as, FRAME, -(int32_t)sizeof(CallFrame));
+        emit_load(as, SLOTS, FRAME, (int32_t)offsetof(CallFrame, slots));
+        return true;
+    default:
+        break;
+    }
+    return emit_instruction(as, step->offset);
+}
+
+// Trace layout: the error exit, the entry point, the recorded instructions as one straight line that jumps back to
+// its start, and one stub per side exit. The interpreter picks up where a side exit left, possibly in the frame of
+// an inlined call.
+bool jit_compile_trace(Vm *vm, TraceRecorder *recorder)
+{
+    LoopTrace *loop = recorder->loop;
+    Assembler as;
+    init_assembler(&as, vm, recorder->steps[0].function);
+
+    emit_error_exit(&as);
+    int entry = as.count;
+    emit_prologue(&as);
+    int loop_start = as.count;
+    bool assembled = true;
+    for (int i = 0; i < recorder->count && assembled; i++)
+    {
+        assembled = emit_trace_step(&as, &recorder->steps[i]);
+    }
+    patch_jump_to(&as, emit_jump_rel(&as, -1), loop_start);
+    emit_exit_stubs(&as, (void *)jit_trace_exit);
+
+    if (assembled)
+    {
+        install(&as, &loop->trace, entry);
+    }
+    free_assembler(&as);
+
+    // The trace compares callees with the closures it inlined, which must stay alive for as long as it does.
+    for (int i = 0; i < recorder->count && loop->trace.entry != NULL; i++)
+    {
+        if (recorder->steps[i].inlined)
+        {
+            write_value_array(vm, &loop->roots, recorder->steps[i].callee);
+        }
+    }
+    return loop->trace.entry != NULL;
+}
+
+#endif
+
+#endif
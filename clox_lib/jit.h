@@ -0,0 +1,75 @@
+#ifndef CLOX_JIT_H
+#define CLOX_JIT_H
+
+#include "common.h"
+#include "value.h"
+
+typedef struct CallFrame CallFrame;
+typedef struct ObjFunction ObjFunction;
+typedef struct InlineCache InlineCache;
+typedef struct InvokeCache InvokeCache;
+
+// Runs the frame on top of vm->frames to completion, like OP_RETURN would leave it, or until it deoptimizes, which
+// leaves the frame in place with its ip at the instruction the interpreter continues with. Returns false after a
+// runtime error has been reported. Both the JIT and the C that loxc generates produce these.
+typedef bool (*NativeEntry)(Vm *vm, CallFrame *frame);
+
+// Slow paths of the native code, implemented by the runtime in vm.c. The native code stores vm->stack_top and the
+// frame's ip before calling any of them, so they see the same state the interpreter would.
+bool jit_get_global(Vm *vm, int slot);
+void jit_define_global(Vm *vm, int slot);
+bool jit_set_global(Vm *vm, int slot);
+bool jit_get_property(Vm *vm, InlineCache *cache);
+bool jit_set_property(Vm *vm, InlineCache *cache);
+bool jit_get_super(Vm *vm, ObjString *name);
+bool jit_set_this_property(Vm *vm, InlineCache *cache);
+bool jit_add(Vm *vm);
+bool jit_numbers_error(Vm *vm);
+bool jit_number_error(Vm *vm);
+void jit_print(Vm *vm);
+bool jit_call(Vm *vm, int arg_count);
+bool jit_get_intrinsic(Vm *vm, int intrinsic);
+bool jit_intrinsic(Vm *vm, int intrinsic, int arg_count);
+bool jit_tail_call(Vm *vm, int arg_count);
+bool jit_invoke(Vm *vm, InvokeCache *cache, int arg_count);
+bool jit_super_invoke(Vm *vm, InvokeCache *cache, int arg_count);
+// instruction is the closure instruction, which lists the captures.
+void jit_closure(Vm *vm, ObjFunction *function, const uint8_t *instruction);
+void jit_close_upvalue(Vm *vm);
+void jit_return(Vm *vm);
+void jit_class(Vm *vm, ObjString *name);
+bool jit_inherit(Vm *vm);
+void jit_method(Vm *vm, ObjString *name);
+void jit_field(Vm *vm, ObjString *name);
+
+#ifdef BASELINE_JIT
+
+// Hotness, counted in calls and loop iterations, after which a function is compiled to native code.
+#define JIT_THRESHOLD 100
+
+// Where native code can be entered in the middle of a function: the header of one of its loops.
+typedef struct
+{
+    int offset;
+    NativeEntry entry;
+} OsrEntry;
+
+typedef struct
+{
+    NativeEntry entry;
+    void *memory;
+    size_t size;
+    bool failed;
+    int osr_count;
+    OsrEntry *osr;
+} NativeCode;
+
+void init_native_code(NativeCode *code);
+void free_native_code(Vm *vm, NativeCode *code);
+bool jit_compile(Vm *vm, ObjFunction *function, bool speculate);
+NativeEntry jit_osr_entry(NativeCode *code, int offset);
+void jit_deoptimize(Vm *vm);
+
+#endif
+
+#endif
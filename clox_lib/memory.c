@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include "memory.h"
 #include "compiler.h"
 #include "vm.h"
@@ -77,7 +78,10 @@ static void free_object(Vm *vm, Obj *object)
     case OBJ_CLASS:
     {
         ObjClass *klass = (ObjClass *)object;
-        free_table(vm, &klass->methods);
+        FREE_ARRAY(MethodEntry, klass->methods, klass->method_capacity);
+        FREE_ARRAY(ObjShape *, klass->layout, klass->layout_count);
+        FREE_ARRAY(Value, klass->columns, (size_t)klass->column_count * (size_t)klass->row_capacity);
+        FREE_ARRAY(ObjInstance *, klass->rows, klass->row_capacity);
         FREE(ObjClass, object);
         break;
     }
@@ -91,8 +95,15 @@ static void free_object(Vm *vm, Obj *object)
     case OBJ_INSTANCE:
     {
         ObjInstance *instance = (ObjInstance *)object;
-        free_table(vm, &instance->fields);
-        FREE(ObjInstance, object);
+        // A row in the columns of the class is dropped when the collector finds the instance dead.
+        FREE_ARRAY(Value, instance->overflow, instance->overflow_capacity);
+        free_table(vm, &instance->dictionary);
+        reallocate(vm, object, sizeof(ObjInstance) + sizeof(Value) * (size_t)instance->inline_capacity, 0);
+        break;
+    }
+    case OBJ_SHAPE:
+    {
+        FREE(ObjShape, object);
         break;
     }
     case OBJ_NATIVE:
@@ -122,6 +133,14 @@ static void free_object(Vm *vm, Obj *object)
     }
 }
 
+static void mark_array(Vm *vm, ValueArray *array)
+{
+    for (int i = 0; i < array->count; i++)
+    {
+        mark_value(vm, array->values[i]);
+    }
+}
+
 static void mark_roots(Vm *vm)
 {
     for (Value *slot = vm->stack; slot < vm->stack_top; slot++)
@@ -136,17 +155,19 @@ static void mark_roots(Vm *vm)
     {
         mark_object(vm, (Obj *)upvalue);
     }
-    mark_table(vm, &vm->globals);
+    mark_array(vm, &vm->global_values);
+    mark_array(vm, &vm->global_names);
+    mark_table(vm, &vm->global_constants);
     mark_compiler_roots(vm->compiler);
     mark_object(vm, (Obj *)vm->init_string);
-}
-
-static void mark_array(Vm *vm, ValueArray *array)
-{
-    for (int i = 0; i < array->count; i++)
+    for (int i = 0; i < INTRINSIC_COUNT; i++)
     {
-        mark_value(vm, array->values[i]);
+        mark_object(vm, (Obj *)vm->intrinsics[i]);
+        mark_object(vm, (Obj *)vm->intrinsic_names[i]);
     }
+#ifdef TRACING_JIT
+    mark_trace_recorder(vm, &vm->recorder);
+#endif
 }
 
 static void blacken_object(Vm *vm, Obj *object)
@@ -169,14 +190,35 @@ static void blacken_object(Vm *vm, Obj *object)
     {
         ObjClass *klass = (ObjClass *)object;
         mark_object(vm, (Obj *)klass->name);
-        mark_table(vm, &klass->methods);
+        for (int i = 0; i < klass->method_capacity; i++)
+        {
+            mark_object(vm, (Obj *)klass->methods[i].method);
+        }
+        mark_object(vm, (Obj *)klass->shape);
         break;
     }
     case OBJ_INSTANCE:
     {
         ObjInstance *instance = (ObjInstance *)object;
         mark_object(vm, (Obj *)instance->klass);
-        mark_table(vm, &instance->fields);
+        if (instance->shape != NULL)
+        {
+            mark_object(vm, (Obj *)instance->shape);
+            for (int i = 0; i < instance->shape->slot_count; i++)
+            {
+                mark_value(vm, *instance_slot(instance, i));
+            }
+        }
+        mark_table(vm, &instance->dictionary);
+        break;
+    }
+    case OBJ_SHAPE:
+    {
+        ObjShape *shape = (ObjShape *)object;
+        mark_object(vm, (Obj *)shape->parent);
+        mark_object(vm, (Obj *)shape->name);
+        mark_object(vm, (Obj *)shape->children);
+        mark_object(vm, (Obj *)shape->sibling);
         break;
     }
     case OBJ_CLOSURE:
@@ -194,6 +236,24 @@ static void blacken_object(Vm *vm, Obj *object)
         ObjFunction *function = (ObjFunction *)object;
         mark_object(vm, (Obj *)function->name);
         mark_array(vm, (&function->chunk.constants));
+        for (int i = 0; i < function->chunk.cache_count; i++)
+        {
+            mark_object(vm, (Obj *)function->chunk.caches[i].shape);
+            mark_object(vm, (Obj *)function->chunk.caches[i].transition);
+            mark_value(vm, function->chunk.caches[i].method);
+        }
+        for (int i = 0; i < function->chunk.invoke_cache_count; i++)
+        {
+            InvokeCache *cache = &function->chunk.invoke_caches[i];
+            for (int j = 0; j < cache->count; j++)
+            {
+                mark_object(vm, (Obj *)cache->entries[j].shape);
+                mark_object(vm, (Obj *)cache->entries[j].method);
+            }
+        }
+#ifdef TRACING_JIT
+        mark_loop_traces(vm, &function->chunk.loops);
+#endif
         break;
     }
     case OBJ_UPVALUE:
@@ -216,6 +276,45 @@ static void trace_references(Vm *vm)
     }
 }
 
+// Drops the rows of the instances about to be freed from the columns of their classes, moving the rows after them up,
+// and forgets the columnar classes about to be freed themselves.
+static void compact_columns(Vm *vm)
+{
+    ObjClass **link = &vm->columnar_classes;
+    while (*link != NULL)
+    {
+        ObjClass *klass = *link;
+        if (!klass->obj.is_marked)
+        {
+            *link = klass->next_columnar;
+            continue;
+        }
+        int count = 0;
+        for (int row = 0; row < klass->row_count; row++)
+        {
+            ObjInstance *instance = klass->rows[row];
+            if (instance == NULL || !instance->obj.is_marked)
+            {
+                continue;
+            }
+            if (row != count)
+            {
+                for (int column = 0; column < instance->shape->slot_count; column++)
+                {
+                    Value *values = klass->columns + column * klass->row_capacity;
+                    values[count] = values[row];
+                }
+                klass->rows[count] = instance;
+                instance->row = count;
+                instance->values = klass->columns + count;
+            }
+            count++;
+        }
+        klass->row_count = count;
+        link = &klass->next_columnar;
+    }
+}
+
 static void sweep(Vm *vm)
 {
     Obj *previous = NULL;
@@ -290,9 +389,11 @@ void collect_garbage(Vm *vm)
     print_objects(vm);
 #endif
 
+    memset(vm->method_cache, 0, sizeof(vm->method_cache));
     mark_roots(vm);
     trace_references(vm);
     table_remove_white(&vm->strings);
+    compact_columns(vm);
     sweep(vm);
 
     vm->next_gc = vm->bytes_allocated * GC_HEAP_GROW_FACTOR;
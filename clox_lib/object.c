@@ -27,6 +27,10 @@ static ObjString *allocate_string(Vm *vm, char *chars, int length, uint32_t hash
     string->length = length;
     string->hash = hash;
     string->chars = chars;
+    string->selector = -1;
+    string->global = -1;
+    string->assigned = false;
+    string->constant = false;
     push(vm, OBJ_VAL(string));
     table_set(vm, &vm->strings, string, NIL_VAL);
     pop(vm);
@@ -66,32 +70,404 @@ ObjClass *new_class(Vm *vm, ObjString *name)
 {
     ObjClass *klass = ALLOCATE_OBJ(vm, ObjClass, OBJ_CLASS);
     klass->name = name;
-    init_table(vm, &klass->methods);
+    klass->methods = NULL;
+    klass->method_count = 0;
+    klass->method_capacity = 0;
+    klass->initializer = NULL;
+    klass->shape = NULL;
+    klass->layout = NULL;
+    klass->layout_count = 0;
+    klass->instance_slots = 0;
+    klass->instances_sampled = 0;
+    memset(klass->reached, 0, sizeof(klass->reached));
+    klass->columnar = false;
+    klass->columns = NULL;
+    klass->rows = NULL;
+    klass->column_count = 0;
+    klass->row_count = 0;
+    klass->row_capacity = 0;
+    klass->next_columnar = NULL;
+    push(vm, OBJ_VAL(klass));
+    klass->shape = new_shape(vm, NULL, NULL);
+    pop(vm);
     return klass;
 }
 
+// Selectors are handed out in the order names first name a method and never reused. A method keeps its name alive
+// through its function, so a string that has been collected named no method any class still has.
+int intern_selector(Vm *vm, ObjString *name)
+{
+    if (name->selector == -1)
+    {
+        name->selector = vm->selector_count++;
+    }
+    return name->selector;
+}
+
+// The entry for selector in a method table, or the free entry where it would go.
+static MethodEntry *find_method_entry(MethodEntry *methods, int capacity, int selector)
+{
+    int mask = capacity - 1;
+    for (int index = selector & mask;; index = (index + 1) & mask)
+    {
+        if (methods[index].selector == selector || methods[index].selector == -1)
+        {
+            return &methods[index];
+        }
+    }
+}
+
+static void grow_methods(Vm *vm, ObjClass *klass)
+{
+    int capacity = GROW_CAPACITY(klass->method_capacity);
+    MethodEntry *methods = ALLOCATE(MethodEntry, capacity);
+    for (int i = 0; i < capacity; i++)
+    {
+        methods[i] = (MethodEntry){-1, NULL};
+    }
+    for (int i = 0; i < klass->method_capacity; i++)
+    {
+        if (klass->methods[i].selector != -1)
+        {
+            *find_method_entry(methods, capacity, klass->methods[i].selector) = klass->methods[i];
+        }
+    }
+    FREE_ARRAY(MethodEntry, klass->methods, klass->method_capacity);
+    klass->methods = methods;
+    klass->method_capacity = capacity;
+}
+
+void define_class_method(Vm *vm, ObjClass *klass, ObjString *name, ObjClosure *method)
+{
+    int selector = intern_selector(vm, name);
+    if (klass->method_count + 1 > klass->method_capacity * 3 / 4)
+    {
+        grow_methods(vm, klass);
+    }
+    MethodEntry *entry = find_method_entry(klass->methods, klass->method_capacity, selector);
+    if (entry->selector == -1)
+    {
+        klass->method_count++;
+    }
+    *entry = (MethodEntry){selector, method};
+    if (name == vm->init_string)
+    {
+        klass->initializer = method;
+    }
+}
+
+void inherit_methods(Vm *vm, ObjClass *subclass, ObjClass *superclass)
+{
+    // The subclass has no methods of its own yet, so it starts from a copy of the superclass's table.
+    if (superclass->method_capacity > 0)
+    {
+        MethodEntry *methods = ALLOCATE(MethodEntry, superclass->method_capacity);
+        memcpy(methods, superclass->methods, sizeof(MethodEntry) * (size_t)superclass->method_capacity);
+        FREE_ARRAY(MethodEntry, subclass->methods, subclass->method_capacity);
+        subclass->methods = methods;
+        subclass->method_count = superclass->method_count;
+        subclass->method_capacity = superclass->method_capacity;
+    }
+    subclass->initializer = superclass->initializer;
+    for (int i = 1; i < superclass->layout_count; i++)
+    {
+        define_class_field(vm, subclass, superclass->layout[i]->name);
+    }
+}
+
+void define_class_field(Vm *vm, ObjClass *klass, ObjString *name)
+{
+    if (klass->layout_count == 0)
+    {
+        klass->layout = GROW_ARRAY(ObjShape *, klass->layout, 0, 1);
+        klass->layout[0] = klass->shape;
+        klass->layout_count = 1;
+    }
+    ObjShape *last = klass->layout[klass->layout_count - 1];
+    if (last->slot_count == SHAPE_MAX_SLOTS || shape_slot(last, name) != -1)
+    {
+        return;
+    }
+    // The root shape keeps the predicted shapes alive as its descendants.
+    ObjShape *next = shape_transition(vm, last, name);
+    klass->layout = GROW_ARRAY(ObjShape *, klass->layout, klass->layout_count, klass->layout_count + 1);
+    klass->layout[klass->layout_count++] = next;
+    if (next->slot_count <= INSTANCE_INLINE_MAX)
+    {
+        klass->instance_slots = next->slot_count;
+    }
+}
+
+void make_columnar(Vm *vm, ObjClass *klass)
+{
+    if (klass->columnar)
+    {
+        return;
+    }
+    klass->columnar = true;
+    klass->next_columnar = vm->columnar_classes;
+    vm->columnar_classes = klass;
+}
+
+// Moves the columns to a table of the given size and points the instance in every row at its new place. The sizes
+// never shrink.
+static void resize_columns(Vm *vm, ObjClass *klass, int column_count, int row_capacity)
+{
+    Value *columns = ALLOCATE(Value, (size_t)column_count * (size_t)row_capacity);
+    // The allocation may have collected the instances of some rows and moved the rows after them up.
+    for (int column = 0; column < klass->column_count; column++)
+    {
+        memcpy(columns + column * row_capacity, klass->columns + column * klass->row_capacity,
+               sizeof(Value) * (size_t)klass->row_count);
+    }
+    FREE_ARRAY(Value, klass->columns, (size_t)klass->column_count * (size_t)klass->row_capacity);
+    klass->columns = columns;
+    klass->column_count = column_count;
+    klass->row_capacity = row_capacity;
+    for (int row = 0; row < klass->row_count; row++)
+    {
+        ObjInstance *instance = klass->rows[row];
+        if (instance != NULL)
+        {
+            instance->values = columns + row;
+            instance->stride = row_capacity;
+            instance->capacity = column_count;
+        }
+    }
+}
+
+static void add_row(Vm *vm, ObjClass *klass, ObjInstance *instance)
+{
+    push(vm, OBJ_VAL(instance));
+    int column_count = klass->column_count;
+    if (column_count < klass->instance_slots)
+    {
+        column_count = klass->instance_slots;
+    }
+    if (column_count == 0)
+    {
+        column_count = 1;
+    }
+    if (klass->row_count == klass->row_capacity)
+    {
+        int row_capacity = GROW_CAPACITY(klass->row_capacity);
+        klass->rows = GROW_ARRAY(ObjInstance *, klass->rows, klass->row_capacity, row_capacity);
+        resize_columns(vm, klass, column_count, row_capacity);
+    }
+    else if (column_count > klass->column_count)
+    {
+        resize_columns(vm, klass, column_count, klass->row_capacity);
+    }
+    int row = klass->row_count++;
+    klass->rows[row] = instance;
+    instance->row = row;
+    instance->values = klass->columns + row;
+    instance->stride = klass->row_capacity;
+    instance->capacity = klass->column_count;
+    pop(vm);
+}
+
+// Reserves the field count at least half the sampled instances reached, the median, once the sample is complete.
+static void sample_instance(ObjClass *klass)
+{
+    if (klass->layout_count != 0 || ++klass->instances_sampled < INSTANCE_SAMPLE)
+    {
+        return;
+    }
+    int slots = 0;
+    while (slots < INSTANCE_INLINE_MAX && klass->reached[slots] * 2 >= INSTANCE_SAMPLE)
+    {
+        slots++;
+    }
+    klass->instance_slots = slots;
+    klass->instances_sampled = 0;
+    memset(klass->reached, 0, sizeof(klass->reached));
+}
+
 ObjInstance *new_instance(Vm *vm, ObjClass *klass)
 {
-    ObjInstance *instance = ALLOCATE_OBJ(vm, ObjInstance, OBJ_INSTANCE);
+    sample_instance(klass);
+    int inline_capacity = klass->columnar ? 0 : klass->instance_slots;
+    ObjInstance *instance = (ObjInstance *)allocate_object(
+        vm, sizeof(ObjInstance) + sizeof(Value) * (size_t)inline_capacity, OBJ_INSTANCE);
     instance->klass = klass;
-    init_table(vm, &instance->fields);
+    instance->shape = klass->shape;
+    instance->values = instance->inline_values;
+    instance->stride = 1;
+    instance->row = -1;
+    instance->capacity = inline_capacity;
+    instance->inline_capacity = inline_capacity;
+    instance->overflow = NULL;
+    instance->overflow_capacity = 0;
+    init_table(vm, &instance->dictionary);
+    if (klass->columnar)
+    {
+        add_row(vm, klass, instance);
+    }
     return instance;
 }
 
+ObjShape *new_shape(Vm *vm, ObjShape *parent, ObjString *name)
+{
+    ObjShape *shape = ALLOCATE_OBJ(vm, ObjShape, OBJ_SHAPE);
+    shape->parent = parent;
+    shape->name = name;
+    shape->slot_count = parent == NULL ? 0 : parent->slot_count + 1;
+    shape->children = NULL;
+    shape->sibling = NULL;
+    return shape;
+}
+
+int shape_slot(ObjShape *shape, ObjString *name)
+{
+    for (; shape->name != NULL; shape = shape->parent)
+    {
+        if (shape->name == name)
+        {
+            return shape->slot_count - 1;
+        }
+    }
+    return -1;
+}
+
+ObjShape *shape_transition(Vm *vm, ObjShape *shape, ObjString *name)
+{
+    for (ObjShape *child = shape->children; child != NULL; child = child->sibling)
+    {
+        if (child->name == name)
+        {
+            return child;
+        }
+    }
+    // The parent keeps its children alive, and is itself reachable from the instance that is about to move.
+    ObjShape *child = new_shape(vm, shape, name);
+    child->sibling = shape->children;
+    shape->children = child;
+    return child;
+}
+
+bool instance_get(ObjInstance *instance, ObjString *name, Value *value)
+{
+    if (instance->shape == NULL)
+    {
+        return table_get(&instance->dictionary, name, value);
+    }
+    int slot = shape_slot(instance->shape, name);
+    if (slot == -1)
+    {
+        return false;
+    }
+    *value = *instance_slot(instance, slot);
+    return true;
+}
+
+// Moves the fields out of the shaped slots into the dictionary for good.
+static void make_dictionary(Vm *vm, ObjInstance *instance)
+{
+    for (ObjShape *shape = instance->shape; shape->name != NULL; shape = shape->parent)
+    {
+        table_set(vm, &instance->dictionary, shape->name, *instance_slot(instance, shape->slot_count - 1));
+    }
+    if (instance->row != -1)
+    {
+        // The next collection closes the gap.
+        instance->klass->rows[instance->row] = NULL;
+        instance->row = -1;
+    }
+    FREE_ARRAY(Value, instance->overflow, instance->overflow_capacity);
+    instance->overflow = NULL;
+    instance->overflow_capacity = 0;
+    instance->shape = NULL;
+    instance->values = instance->inline_values;
+    instance->stride = 1;
+    instance->capacity = instance->inline_capacity;
+}
+
+static void reserve_slots(Vm *vm, ObjInstance *instance, int count)
+{
+    if (count <= instance->capacity)
+    {
+        return;
+    }
+    if (instance->row != -1)
+    {
+        // Every row gets the new columns.
+        resize_columns(vm, instance->klass, count, instance->klass->row_capacity);
+        return;
+    }
+    // The inline values stay put; only the fields past them spill.
+    int overflow = count - instance->capacity;
+    if (overflow <= instance->overflow_capacity)
+    {
+        return;
+    }
+    int capacity = GROW_CAPACITY(instance->overflow_capacity);
+    instance->overflow = GROW_ARRAY(Value, instance->overflow, instance->overflow_capacity, capacity);
+    instance->overflow_capacity = capacity;
+}
+
+void instance_set(Vm *vm, ObjInstance *instance, ObjString *name, Value value)
+{
+    if (instance->shape != NULL)
+    {
+        int slot = shape_slot(instance->shape, name);
+        if (slot != -1)
+        {
+            *instance_slot(instance, slot) = value;
+            return;
+        }
+        if (instance->shape->slot_count < SHAPE_MAX_SLOTS)
+        {
+            ObjShape *shape = shape_transition(vm, instance->shape, name);
+            reserve_slots(vm, instance, shape->slot_count);
+            *instance_slot(instance, shape->slot_count - 1) = value;
+            instance->shape = shape;
+            count_fields(instance->klass, shape->slot_count);
+            return;
+        }
+        make_dictionary(vm, instance);
+    }
+    table_set(vm, &instance->dictionary, name, value);
+}
+
+bool instance_delete(Vm *vm, ObjInstance *instance, ObjString *name)
+{
+    if (instance->shape != NULL)
+    {
+        if (shape_slot(instance->shape, name) == -1)
+        {
+            return false;
+        }
+        make_dictionary(vm, instance);
+    }
+    return table_delete(&instance->dictionary, name);
+}
+
 ObjFunction *new_function(Vm *vm)
 {
     ObjFunction *function = ALLOCATE_OBJ(vm, ObjFunction, OBJ_FUNCTION);
     function->arity = 0;
     function->upvalue_count = 0;
+    function->max_slots = 0;
+    function->captures_locals = false;
+    function->is_leaf = true;
+    function->tier = TIER_INTERPRETED;
+    function->hotness = 0;
+#ifdef BASELINE_JIT
+    function->deopts = 0;
+#endif
+    function->compiled = NULL;
     function->name = NULL;
     init_chunk(vm, &function->chunk);
     return function;
 }
 
-ObjNative *new_native(Vm *vm, int arity, NativeFn function)
+ObjNative *new_native(Vm *vm, int min_arity, int max_arity, uint8_t flags, NativeFn function)
 {
     ObjNative *native = ALLOCATE_OBJ(vm, ObjNative, OBJ_NATIVE);
-    native->arity = arity;
+    native->min_arity = min_arity;
+    native->max_arity = max_arity;
+    native->flags = flags;
     native->function = function;
     return native;
 }
@@ -161,6 +537,9 @@ void print_object(Value value)
     case OBJ_INSTANCE:
         printf("%s instance", AS_INSTANCE(value)->klass->name->chars);
         break;
+    case OBJ_SHAPE:
+        printf("shape");
+        break;
     case OBJ_NATIVE:
         printf("<native fn>");
         break;
@@ -8,10 +8,11 @@
 
 #define OBJ_TYPE(value) (AS_OBJ(value)->type)
 
-#define IS_BOUND_METHOD(value) is_obj_type(value, OBJ_BOUND_METHOD);
+#define IS_BOUND_METHOD(value) is_obj_type(value, OBJ_BOUND_METHOD)
 #define IS_CLASS(value) is_obj_type(value, OBJ_CLASS)
 #define IS_FUNCTION(value) is_obj_type(value, OBJ_FUNCTION)
 #define IS_INSTANCE(value) is_obj_type(value, OBJ_INSTANCE)
+#define IS_SHAPE(value) is_obj_type(value, OBJ_SHAPE)
 #define IS_NATIVE(value) is_obj_type(value, OBJ_NATIVE)
 #define IS_CLOSURE(value) is_obj_type(value, OBJ_CLOSURE)
 #define IS_STRING(value) is_obj_type(value, OBJ_STRING)
@@ -33,6 +34,7 @@ typedef enum
     OBJ_CLASS,
     OBJ_FUNCTION,
     OBJ_INSTANCE,
+    OBJ_SHAPE,
     OBJ_NATIVE,
     OBJ_CLOSURE,
     OBJ_STRING,
@@ -46,22 +48,57 @@ typedef struct Obj
     struct Obj *next;
 } Obj;
 
+// The tiers a function moves through as it gets hot: see tier.h.
+typedef enum
+{
+    TIER_INTERPRETED,
+    TIER_QUICKENED,
+    TIER_NATIVE,
+} Tier;
+
 typedef struct ObjFunction
 {
     Obj obj;
     int arity;
     int upvalue_count;
+    // Stack slots a frame of the function uses at most, counting the callee and its arguments. call() makes sure they
+    // are there, so nothing that runs in the frame has to check for overflow.
+    int max_slots;
+    // Whether a closure of the function captures one of its locals, without which returning has no upvalues to close,
+    // and whether it is a leaf that calls nothing, so its frame never has another one on top.
+    bool captures_locals;
+    bool is_leaf;
+    Tier tier;
+    int hotness;
+#ifdef BASELINE_JIT
+    int deopts;
+#endif
+    // C generated for the function ahead of time by loxc, which call() runs instead of its bytecode.
+    NativeEntry compiled;
     Chunk chunk;
     ObjString *name;
 } ObjFunction;
 
 typedef struct Vm Vm;
-typedef bool (*NativeFn)(Vm *vm, int arg_count, Value *args);
+
+// A native gets its arguments in args and leaves its result in *result, the slot that held the callee. It returns NULL,
+// or the message of a runtime error. The message has to outlive the call, like a string literal does, so failing
+// allocates nothing.
+typedef const char *(*NativeFn)(Vm *vm, int arg_count, Value *args, Value *result);
+
+// A native that never allocates cannot start a collection, so the interpreter calls it without publishing its state
+// first.
+#define NATIVE_NO_ALLOC 0x1
+
+// max_arity for a native that takes any number of arguments from min_arity on.
+#define NATIVE_VARIADIC -1
 
 typedef struct ObjNative
 {
     Obj obj;
-    int arity;
+    int min_arity;
+    int max_arity;
+    uint8_t flags;
     NativeFn function;
 } ObjNative;
 
@@ -81,18 +118,87 @@ typedef struct ObjClosure
     int upvalue_count;
 } ObjClosure;
 
+// Instances of a class that gained the same fields in the same order share a shape, which knows the slot of each of
+// their fields. Adding a field moves an instance from its shape to a child shape, which is created the first time and
+// reused from then on, so the shapes of a class form a tree rooted at an empty shape.
+typedef struct ObjShape
+{
+    Obj obj;
+    struct ObjShape *parent;
+    // The field this shape adds to its parent, which lives in the last slot. NULL in a root shape.
+    ObjString *name;
+    int slot_count;
+    // The shapes that add one more field to this one, linked through sibling.
+    struct ObjShape *children;
+    struct ObjShape *sibling;
+} ObjShape;
+
+// Wider instances switch to dictionary mode, as do instances that lose a field.
+#define SHAPE_MAX_SLOTS 64
+
+// The most fields new instances reserve inline. Classes without a predicted layout re-decide their reservation after
+// every INSTANCE_SAMPLE new instances.
+#define INSTANCE_INLINE_MAX 8
+#define INSTANCE_SAMPLE 32
+
+// A method of a class under the selector of its name. Free entries have selector -1 and no method.
+typedef struct
+{
+    int selector;
+    ObjClosure *method;
+} MethodEntry;
+
 typedef struct ObjClass
 {
     Obj obj;
     ObjString *name;
-    Table methods;
+    // The methods the class defines or inherits: an open addressed table of method_capacity entries, a power of two,
+    // keyed by selector. It holds method_count methods and grows with them, not with the selectors of the program.
+    MethodEntry *methods;
+    int method_count;
+    int method_capacity;
+    ObjClosure *initializer;
+    ObjShape *shape;
+    // The shapes instances are predicted to go through, one field at a time from shape, as the compiler inferred them
+    // from the assignments to this in the class's methods. Empty when it inferred none.
+    ObjShape **layout;
+    int layout_count;
+    // How many fields new instances reserve inline: those of the predicted layout, or else the most fields at least
+    // half the instances reached in the last sample, at most INSTANCE_INLINE_MAX either way. reached counts how many
+    // instances got to each field count up to the cap since instances_sampled was last reset.
+    int instance_slots;
+    int instances_sampled;
+    int reached[INSTANCE_INLINE_MAX];
+    // Columnar classes keep the fields of their new instances in rows of a table they own: column_count columns of
+    // row_capacity values each, back to back, so the values of one slot across all instances are contiguous. rows
+    // holds the instance in each row without keeping it alive; collections drop the rows of dead instances and close
+    // the gaps. Columnar classes are linked through next_columnar.
+    bool columnar;
+    Value *columns;
+    struct ObjInstance **rows;
+    int column_count;
+    int row_count;
+    int row_capacity;
+    struct ObjClass *next_columnar;
 } ObjClass;
 
 typedef struct ObjInstance
 {
     Obj obj;
     ObjClass *klass;
-    Table fields;
+    // NULL in dictionary mode, where the fields live in dictionary instead of values.
+    ObjShape *shape;
+    // The values of the first capacity fields, in the slots the shape assigns, stride values apart: inline_values, or
+    // the instance's row in its class's columns, a column apart. The fields past them live in overflow on the heap.
+    Value *values;
+    int stride;
+    int row;
+    int capacity;
+    int inline_capacity;
+    Value *overflow;
+    int overflow_capacity;
+    Table dictionary;
+    Value inline_values[];
 } ObjInstance;
 
 typedef struct ObjBoundMethod
@@ -108,6 +214,14 @@ typedef struct ObjString
     int length;
     uint32_t hash;
     char *chars;
+    // The key of every method called this in the method tables of classes, or -1 until a method is.
+    int selector;
+    // The slot of the global variable called this in the vm's global_values, or -1 until code names one.
+    int global;
+    // Whether code compiled so far defines or assigns that variable, and whether it was declared const. A variable can
+    // only be declared const before anything assigns it, so no code that runs can assign a constant.
+    bool assigned;
+    bool constant;
 } ObjString;
 
 static inline bool is_obj_type(Value value, ObjType type)
@@ -115,11 +229,65 @@ static inline bool is_obj_type(Value value, ObjType type)
     return IS_OBJ(value) && OBJ_TYPE(value) == type;
 }
 
+static inline Value *instance_slot(ObjInstance *instance, int slot)
+{
+    if (slot < instance->capacity)
+    {
+        return &instance->values[slot * instance->stride];
+    }
+    return &instance->overflow[slot - instance->capacity];
+}
+
+// Counts an instance of a class without a predicted layout reaching count fields.
+static inline void count_fields(ObjClass *klass, int count)
+{
+    if (klass->layout_count == 0 && count <= INSTANCE_INLINE_MAX)
+    {
+        klass->reached[count - 1]++;
+    }
+}
+
+// The method of klass called name, or NULL. Selectors are consecutive, so they spread over the table unhashed.
+static inline ObjClosure *class_method(ObjClass *klass, ObjString *name)
+{
+    if (name->selector < 0 || klass->method_count == 0)
+    {
+        return NULL;
+    }
+    int mask = klass->method_capacity - 1;
+    for (int index = name->selector & mask;; index = (index + 1) & mask)
+    {
+        MethodEntry *entry = &klass->methods[index];
+        if (entry->selector == name->selector || entry->selector == -1)
+        {
+            return entry->method;
+        }
+    }
+}
+
 ObjBoundMethod *new_bound_method(Vm *vm, Value receiver, ObjClosure *method);
 ObjClass *new_class(Vm *vm, ObjString *name);
+int intern_selector(Vm *vm, ObjString *name);
+// The class and method have to be reachable: the method table may grow.
+void define_class_method(Vm *vm, ObjClass *klass, ObjString *name, ObjClosure *method);
+// Gives a new subclass the methods of its superclass, which its own methods are defined over afterwards.
+void inherit_methods(Vm *vm, ObjClass *subclass, ObjClass *superclass);
+// Predicts that instances of the class get a field called name next. The class has to be reachable.
+void define_class_field(Vm *vm, ObjClass *klass, ObjString *name);
+// Gives the instances the class creates from now on rows in its columns.
+void make_columnar(Vm *vm, ObjClass *klass);
 ObjFunction *new_function(Vm *vm);
 ObjInstance *new_instance(Vm *vm, ObjClass *klass);
-ObjNative *new_native(Vm *vm, int arity, NativeFn function);
+ObjShape *new_shape(Vm *vm, ObjShape *parent, ObjString *name);
+// The slot of a field in a shape, or -1.
+int shape_slot(ObjShape *shape, ObjString *name);
+// The child of shape that adds name.
+ObjShape *shape_transition(Vm *vm, ObjShape *shape, ObjString *name);
+bool instance_get(ObjInstance *instance, ObjString *name, Value *value);
+// The instance and value have to be reachable: adding a field may allocate.
+void instance_set(Vm *vm, ObjInstance *instance, ObjString *name, Value value);
+bool instance_delete(Vm *vm, ObjInstance *instance, ObjString *name);
+ObjNative *new_native(Vm *vm, int min_arity, int max_arity, uint8_t flags, NativeFn function);
 ObjClosure *new_closure(Vm *vm, ObjFunction *function);
 ObjString *take_string(Vm *vm, char *chars, int length);
 ObjString *copy_string(Vm *vm, const char *chars, int length);
@@ -0,0 +1,570 @@
+#include <stdlib.h>
+#include "chunk.h"
+#include "memory.h"
+#include "object.h"
+#include "registers.h"
+#include "vm.h"
+
+void init_register_code(Vm *vm, RegisterCode *code)
+{
+    code->count = 0;
+    code->capacity = 0;
+    code->code = NULL;
+    code->offsets = NULL;
+    code->frame_size = 0;
+}
+
+void free_register_code(Vm *vm, RegisterCode *code)
+{
+    FREE_ARRAY(RegInstruction, code->code, code->capacity);
+    FREE_ARRAY(int, code->offsets, code->capacity);
+    init_register_code(vm, code);
+}
+
+// The translator replays the stack bytecode with a static stack depth. Stack position n is register n. Pushes of
+// locals and constants are not copied right away: the position remembers where its value is and later instructions
+// read it from there. Such pending values are materialized into their own slot before anything that could observe the
+// stack: calls, closures, jumps and jump targets.
+typedef enum
+{
+    OPERAND_SLOT,
+    OPERAND_REGISTER,
+    OPERAND_CONSTANT,
+} OperandKind;
+
+typedef struct
+{
+    OperandKind kind;
+    int index;
+} Operand;
+
+typedef struct
+{
+    Vm *vm;
+    Chunk *chunk;
+    RegisterCode *code;
+    int offset;
+    Operand stack[UINT8_COUNT];
+    int depth;
+    int last_result;
+    bool overflow;
+} Translator;
+
+static int emit(Translator *translator, uint8_t op, int a, int b, int c, int k)
+{
+    Vm *vm = translator->vm;
+    RegisterCode *code = translator->code;
+    if (code->capacity < code->count + 1)
+    {
+        int old_capacity = code->capacity;
+        code->capacity = GROW_CAPACITY(old_capacity);
+        code->code = GROW_ARRAY(RegInstruction, code->code, old_capacity, code->capacity);
+        code->offsets = GROW_ARRAY(int, code->offsets, old_capacity, code->capacity);
+    }
+    code->code[code->count] = (RegInstruction){op, (uint8_t)a, (uint8_t)b, (uint8_t)c, k};
+    code->offsets[code->count] = translator->offset;
+    translator->last_result = -1;
+    return code->count++;
+}
+
+static void push_operand(Translator *translator, OperandKind kind, int index)
+{
+    if (translator->depth == UINT8_COUNT)
+    {
+        translator->overflow = true;
+        return;
+    }
+    translator->stack[translator->depth] = (Operand){kind, kind == OPERAND_SLOT ? translator->depth : index};
+    translator->depth++;
+    if (translator->depth > translator->code->frame_size)
+    {
+        translator->code->frame_size = translator->depth;
+    }
+}
+
+static void materialize(Translator *translator, int position)
+{
+    Operand *operand = &translator->stack[position];
+    if (operand->kind == OPERAND_REGISTER)
+    {
+        emit(translator, ROP_MOVE, position, operand->index, 0, 0);
+    }
+    else if (operand->kind == OPERAND_CONSTANT)
+    {
+        emit(translator, ROP_LOAD_CONSTANT, position, 0, 0, operand->index);
+    }
+    operand->kind = OPERAND_SLOT;
+    operand->index = position;
+}
+
+static void flush(Translator *translator)
+{
+    for (int position = 0; position < translator->depth; position++)
+    {
+        materialize(translator, position);
+    }
+}
+
+// Returns the register holding the value at a stack position.
+static int reg(Translator *translator, int position)
+{
+    if (translator->stack[position].kind == OPERAND_CONSTANT)
+    {
+        materialize(translator, position);
+    }
+    return translator->stack[position].index;
+}
+
+static int top(Translator *translator)
+{
+    return translator->depth - 1;
+}
+
+static void push_result(Translator *translator, uint8_t op, int b, int c, int k)
+{
+    push_operand(translator, OPERAND_SLOT, 0);
+    translator->last_result = emit(translator, op, top(translator), b, c, k);
+}
+
+static void get_local(Translator *translator, int slot)
+{
+    Operand local = translator->stack[slot];
+    push_operand(translator, local.kind == OPERAND_SLOT ? OPERAND_REGISTER : local.kind, local.index);
+}
+
+static void set_local(Translator *translator, int slot)
+{
+    int value = top(translator);
+    Operand operand = translator->stack[value];
+    if (operand.kind == OPERAND_REGISTER && operand.index == slot)
+    {
+        return;
+    }
+
+    bool aliased = false;
+    for (int position = 0; position < value; position++)
+    {
+        Operand *alias = &translator->stack[position];
+        aliased = aliased || (alias->kind == OPERAND_REGISTER && alias->index == slot);
+    }
+
+    // If the value was just computed into its stack slot, compute it straight into the local instead.
+    if (operand.kind == OPERAND_SLOT && translator->last_result >= 0 && !aliased)
+    {
+        translator->code->code[translator->last_result].a = (uint8_t)slot;
+    }
+    else
+    {
+        for (int position = 0; position < value; position++)
+        {
+            Operand *alias = &translator->stack[position];
+            if (alias->kind == OPERAND_REGISTER && alias->index == slot)
+            {
+                materialize(translator, position);
+            }
+        }
+        if (operand.kind == OPERAND_CONSTANT)
+        {
+            emit(translator, ROP_LOAD_CONSTANT, slot, 0, 0, operand.index);
+        }
+        else
+        {
+            emit(translator, ROP_MOVE, slot, operand.index, 0, 0);
+        }
+    }
+    translator->stack[slot] = (Operand){OPERAND_SLOT, slot};
+    translator->stack[value] = (Operand){OPERAND_REGISTER, slot};
+}
+
+static void binary(Translator *translator, uint8_t op, int op_k)
+{
+    int left = translator->depth - 2;
+    Operand right = translator->stack[translator->depth - 1];
+    int b = reg(translator, left);
+    if (right.kind == OPERAND_CONSTANT && op_k >= 0)
+    {
+        translator->depth -= 2;
+        push_result(translator, (uint8_t)op_k, b, 0, right.index);
+        return;
+    }
+    int c = reg(translator, translator->depth - 1);
+    translator->depth -= 2;
+    push_result(translator, op, b, c, 0);
+}
+
+static void unary(Translator *translator, uint8_t op)
+{
+    int b = reg(translator, top(translator));
+    translator->depth--;
+    push_result(translator, op, b, 0, 0);
+}
+
+// Slot and upvalue indices go in 8-bit operands, so functions with wide ones get no register code and run on the stack
+// interpreter instead.
+static bool fits_operand(Translator *translator, int index)
+{
+    translator->overflow = translator->overflow || index > UINT8_MAX;
+    return !translator->overflow;
+}
+
+static void compare_and_jump(Translator *translator, uint8_t op, uint8_t op_k, int target)
+{
+    int left = translator->depth - 2;
+    Operand right = translator->stack[translator->depth - 1];
+    int a = reg(translator, left);
+    int b = 0;
+    int c = 0;
+    if (right.kind == OPERAND_CONSTANT && right.index < UINT8_COUNT)
+    {
+        op = op_k;
+        c = right.index;
+    }
+    else
+    {
+        b = reg(translator, translator->depth - 1);
+    }
+    translator->depth -= 2;
+    flush(translator);
+    emit(translator, op, a, b, c, target);
+}
+
+bool translate_chunk(Vm *vm, Chunk *chunk, int arity)
+{
+    Translator translator;
+    translator.vm = vm;
+    translator.chunk = chunk;
+    translator.code = &chunk->registers;
+    translator.depth = 0;
+    translator.last_result = -1;
+    translator.overflow = false;
+    free_register_code(vm, translator.code);
+
+    int *labels = ALLOCATE(int, chunk->count + 1);
+    int *depths = ALLOCATE(int, chunk->count + 1);
+    for (int offset = 0; offset <= chunk->count; offset++)
+    {
+        labels[offset] = -1;
+        depths[offset] = -1;
+    }
+    for (int offset = 0; offset < chunk->count; offset += instruction_length(chunk, offset))
+    {
+        if (is_jump(opcode_at(chunk->code, offset)))
+        {
+            labels[jump_target(chunk->code, offset)] = 0;
+        }
+    }
+
+    for (int slot = 0; slot <= arity; slot++)
+    {
+        push_operand(&translator, OPERAND_SLOT, 0);
+    }
+
+    Translator *t = &translator;
+    bool reachable = true;
+    uint8_t *code = chunk->code;
+    for (int offset = 0; offset < chunk->count && !t->overflow; offset += instruction_length(chunk, offset))
+    {
+        t->offset = offset;
+        if (!reachable && depths[offset] >= 0)
+        {
+            t->depth = depths[offset];
+            for (int position = 0; position < t->depth; position++)
+            {
+                t->stack[position] = (Operand){OPERAND_SLOT, position};
+            }
+        }
+        if (labels[offset] >= 0)
+        {
+            flush(t);
+            labels[offset] = t->code->count;
+            t->last_result = -1;
+        }
+        reachable = true;
+
+        uint8_t instruction = opcode_at(code, offset);
+        int index = instruction_length(chunk, offset) > 1 ? index_operand(code, offset) : 0;
+        switch (instruction)
+        {
+        case OP_CONSTANT:
+            push_operand(t, OPERAND_CONSTANT, index);
+            break;
+        case OP_CONSTANT_LONG:
+            push_operand(t, OPERAND_CONSTANT, code[offset + 1] | code[offset + 2] << 8 | code[offset + 3] << 16);
+            break;
+        case OP_NIL:
+            push_result(t, ROP_NIL, 0, 0, 0);
+            break;
+        case OP_TRUE:
+            push_result(t, ROP_TRUE, 0, 0, 0);
+            break;
+        case OP_FALSE:
+            push_result(t, ROP_FALSE, 0, 0, 0);
+            break;
+        case OP_POP:
+            t->depth--;
+            break;
+        case OP_GET_LOCAL:
+            if (fits_operand(t, index))
+            {
+                get_local(t, index);
+            }
+            break;
+        case OP_SET_LOCAL:
+            if (fits_operand(t, index))
+            {
+                set_local(t, index);
+            }
+            break;
+        case OP_GET_GLOBAL:
+            push_result(t, ROP_GET_GLOBAL, 0, 0, index);
+            break;
+        case OP_DEFINE_GLOBAL:
+            emit(t, ROP_DEFINE_GLOBAL, reg(t, top(t)), 0, 0, index);
+            t->depth--;
+            break;
+        case OP_SET_GLOBAL:
+            emit(t, ROP_SET_GLOBAL, reg(t, top(t)), 0, 0, index);
+            break;
+        case OP_GET_UPVALUE:
+            if (fits_operand(t, index))
+            {
+                push_result(t, ROP_GET_UPVALUE, index, 0, 0);
+            }
+            break;
+        case OP_SET_UPVALUE:
+            if (fits_operand(t, index))
+            {
+                emit(t, ROP_SET_UPVALUE, reg(t, top(t)), index, 0, 0);
+            }
+            break;
+        case OP_GET_PROPERTY:
+            unary(t, ROP_GET_PROPERTY);
+            t->code->code[t->last_result].k = cache_index(code, offset);
+            break;
+        case OP_SET_PROPERTY:
+        {
+            int instance = reg(t, t->depth - 2);
+            int value = reg(t, t->depth - 1);
+            t->depth -= 2;
+            push_result(t, ROP_SET_PROPERTY, instance, value, cache_index(code, offset));
+            break;
+        }
+        case OP_GET_SUPER:
+        {
+            int receiver = reg(t, t->depth - 2);
+            int superclass = reg(t, t->depth - 1);
+            t->depth -= 2;
+            push_result(t, ROP_GET_SUPER, receiver, superclass, index);
+            break;
+        }
+        case OP_GET_THIS_PROPERTY:
+            push_result(t, ROP_GET_THIS_PROPERTY, 0, 0, cache_index(code, offset));
+            break;
+        case OP_SET_THIS_PROPERTY:
+            emit(t, ROP_SET_THIS_PROPERTY, reg(t, top(t)), 0, 0, cache_index(code, offset));
+            break;
+        case OP_EQUAL:
+            binary(t, ROP_EQUAL, -1);
+            break;
+        case OP_NOT_EQUAL:
+            binary(t, ROP_NOT_EQUAL, -1);
+            break;
+        case OP_GREATER:
+            binary(t, ROP_GREATER, -1);
+            break;
+        case OP_NOT_GREATER:
+            binary(t, ROP_NOT_GREATER, -1);
+            break;
+        case OP_LESS:
+            binary(t, ROP_LESS, -1);
+            break;
+        case OP_NOT_LESS:
+            binary(t, ROP_NOT_LESS, -1);
+            break;
+        case OP_ADD:
+            binary(t, ROP_ADD, ROP_ADD_K);
+            break;
+        case OP_SUBTRACT:
+            binary(t, ROP_SUBTRACT, ROP_SUBTRACT_K);
+            break;
+        case OP_MULTIPLY:
+            binary(t, ROP_MULTIPLY, ROP_MULTIPLY_K);
+            break;
+        case OP_DIVIDE:
+            binary(t, ROP_DIVIDE, ROP_DIVIDE_K);
+            break;
+        case OP_ADD_LOCALS:
+            get_local(t, code[offset + 1]);
+            get_local(t, code[offset + 2]);
+            binary(t, ROP_ADD, ROP_ADD_K);
+            break;
+        case OP_SUBTRACT_LOCALS:
+            get_local(t, code[offset + 1]);
+            get_local(t, code[offset + 2]);
+            binary(t, ROP_SUBTRACT, ROP_SUBTRACT_K);
+            break;
+        case OP_MULTIPLY_LOCALS:
+            get_local(t, code[offset + 1]);
+            get_local(t, code[offset + 2]);
+            binary(t, ROP_MULTIPLY, ROP_MULTIPLY_K);
+            break;
+        case OP_DIVIDE_LOCALS:
+            get_local(t, code[offset + 1]);
+            get_local(t, code[offset + 2]);
+            binary(t, ROP_DIVIDE, ROP_DIVIDE_K);
+            break;
+        case OP_NOT:
+            unary(t, ROP_NOT);
+            break;
+        case OP_NEGATE:
+            unary(t, ROP_NEGATE);
+            break;
+        case OP_PRINT:
+            emit(t, ROP_PRINT, reg(t, top(t)), 0, 0, 0);
+            t->depth--;
+            break;
+        case OP_JUMP:
+        case OP_LOOP:
+            flush(t);
+            emit(t, ROP_JUMP, 0, 0, 0, jump_target(code, offset));
+            depths[jump_target(code, offset)] = t->depth;
+            reachable = false;
+            break;
+        case OP_JUMP_IF_FALSE:
+            flush(t);
+            emit(t, ROP_JUMP_IF_FALSE, top(t), 0, 0, jump_target(code, offset));
+            depths[jump_target(code, offset)] = t->depth;
+            break;
+        case OP_POP_JUMP_IF_FALSE:
+        {
+            int condition = reg(t, top(t));
+            t->depth--;
+            flush(t);
+            emit(t, ROP_JUMP_IF_FALSE, condition, 0, 0, jump_target(code, offset));
+            depths[jump_target(code, offset)] = t->depth;
+            break;
+        }
+        case OP_JUMP_IF_EQUAL:
+            compare_and_jump(t, ROP_JUMP_IF_EQUAL, ROP_JUMP_IF_EQUAL_K, jump_target(code, offset));
+            depths[jump_target(code, offset)] = t->depth;
+            break;
+        case OP_JUMP_IF_NOT_EQUAL:
+            compare_and_jump(t, ROP_JUMP_IF_NOT_EQUAL, ROP_JUMP_IF_NOT_EQUAL_K, jump_target(code, offset));
+            depths[jump_target(code, offset)] = t->depth;
+            break;
+        case OP_JUMP_IF_GREATER:
+            compare_and_jump(t, ROP_JUMP_IF_GREATER, ROP_JUMP_IF_GREATER_K, jump_target(code, offset));
+            depths[jump_target(code, offset)] = t->depth;
+            break;
+        case OP_JUMP_IF_NOT_GREATER:
+            compare_and_jump(t, ROP_JUMP_IF_NOT_GREATER, ROP_JUMP_IF_NOT_GREATER_K, jump_target(code, offset));
+            depths[jump_target(code, offset)] = t->depth;
+            break;
+        case OP_JUMP_IF_LESS:
+            compare_and_jump(t, ROP_JUMP_IF_LESS, ROP_JUMP_IF_LESS_K, jump_target(code, offset));
+            depths[jump_target(code, offset)] = t->depth;
+            break;
+        case OP_JUMP_IF_NOT_LESS:
+            compare_and_jump(t, ROP_JUMP_IF_NOT_LESS, ROP_JUMP_IF_NOT_LESS_K, jump_target(code, offset));
+            depths[jump_target(code, offset)] = t->depth;
+            break;
+        case OP_CALL:
+        case OP_TAIL_CALL:
+        {
+            int arg_count = code[offset + 1];
+            flush(t);
+            emit(t, code[offset] == OP_CALL ? ROP_CALL : ROP_TAIL_CALL, t->depth - arg_count - 1, arg_count, 0, 0);
+            t->depth -= arg_count;
+            break;
+        }
+        case OP_INTRINSIC:
+        {
+            int arg_count = code[offset + 2];
+            flush(t);
+            emit(t, ROP_INTRINSIC, t->depth - arg_count - 1, arg_count, code[offset + 1], 0);
+            t->depth -= arg_count;
+            break;
+        }
+        case OP_INVOKE:
+        {
+            int arg_count = code[after_index(code, offset)];
+            flush(t);
+            emit(t, ROP_INVOKE, t->depth - arg_count - 1, arg_count, 0, invoke_cache_index(code, offset));
+            t->depth -= arg_count;
+            break;
+        }
+        case OP_SUPER_INVOKE:
+        {
+            int arg_count = code[after_index(code, offset)];
+            flush(t);
+            emit(t, ROP_SUPER_INVOKE, t->depth - arg_count - 2, arg_count, top(t), invoke_cache_index(code, offset));
+            t->depth -= arg_count + 1;
+            break;
+        }
+        case OP_CLOSURE:
+        {
+            ObjFunction *function = AS_FUNCTION(chunk->constants.values[index]);
+            flush(t);
+            push_operand(t, OPERAND_SLOT, 0);
+            emit(t, ROP_CLOSURE, top(t), 0, 0, index);
+            for (int i = 0; i < function->upvalue_count; i++)
+            {
+                bool is_local;
+                int captured = capture_operand(code, offset, i, &is_local);
+                if (fits_operand(t, captured))
+                {
+                    emit(t, ROP_CAPTURE, is_local, captured, 0, 0);
+                }
+            }
+            break;
+        }
+        case OP_CLOSE_UPVALUE:
+            flush(t);
+            emit(t, ROP_CLOSE_UPVALUE, top(t), 0, 0, 0);
+            t->depth--;
+            break;
+        case OP_RETURN:
+            emit(t, ROP_RETURN, reg(t, top(t)), 0, 0, 0);
+            t->depth--;
+            reachable = false;
+            break;
+        case OP_CLASS:
+            push_result(t, ROP_CLASS, 0, 0, index);
+            break;
+        case OP_GET_INTRINSIC:
+            push_result(t, ROP_GET_INTRINSIC, 0, 0, index);
+            break;
+        case OP_INHERIT:
+            emit(t, ROP_INHERIT, reg(t, t->depth - 2), reg(t, t->depth - 1), 0, 0);
+            t->depth--;
+            break;
+        case OP_METHOD:
+            emit(t, ROP_METHOD, reg(t, t->depth - 2), reg(t, t->depth - 1), 0, index);
+            t->depth--;
+            break;
+        case OP_FIELD:
+            emit(t, ROP_FIELD, reg(t, t->depth - 1), 0, 0, index);
+            break;
+        default:
+            t->overflow = true;
+            break;
+        }
+    }
+
+    for (int i = 0; i < t->code->count; i++)
+    {
+        RegInstruction *instruction = &t->code->code[i];
+        if (instruction->op >= ROP_JUMP && instruction->op <= ROP_JUMP_IF_NOT_LESS_K)
+        {
+            instruction->k = labels[instruction->k];
+        }
+    }
+
+    FREE_ARRAY(int, depths, chunk->count + 1);
+    FREE_ARRAY(int, labels, chunk->count + 1);
+    if (t->overflow)
+    {
+        free_register_code(vm, t->code);
+    }
+    return !t->overflow;
+}
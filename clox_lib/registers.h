@@ -0,0 +1,100 @@
+#ifndef CLOX_REGISTERS_H
+#define CLOX_REGISTERS_H
+
+#include "common.h"
+#include "value.h"
+
+// Three-address instructions over the frame's slot window. Register n is slot n of the frame, so locals keep their
+// slots and temporaries live where the stack machine would have pushed them. Opcodes ending in _K take a constant as
+// their right operand.
+typedef enum
+{
+    ROP_MOVE,          // a = b
+    ROP_LOAD_CONSTANT, // a = constants[k]
+    ROP_NIL,           // a = nil
+    ROP_TRUE,          // a = true
+    ROP_FALSE,         // a = false
+    ROP_GET_GLOBAL,    // a = globals[k]
+    ROP_DEFINE_GLOBAL, // globals[k] = a
+    ROP_SET_GLOBAL,    // globals[k] = a
+    ROP_GET_UPVALUE,   // a = upvalues[b]
+    ROP_SET_UPVALUE,   // upvalues[b] = a
+    ROP_GET_PROPERTY,  // a = b.caches[k].name
+    ROP_SET_PROPERTY,  // b.caches[k].name = c; a = c
+    ROP_GET_SUPER,     // a = super(c).constants[k] bound to b
+    ROP_GET_THIS_PROPERTY, // a = this.caches[k].name
+    ROP_SET_THIS_PROPERTY, // this.caches[k].name = a
+    ROP_EQUAL,         // a = b == c
+    ROP_NOT_EQUAL,     // a = b != c
+    ROP_GREATER,       // a = b > c
+    ROP_NOT_GREATER,   // a = !(b > c)
+    ROP_LESS,          // a = b < c
+    ROP_NOT_LESS,      // a = !(b < c)
+    ROP_ADD,           // a = b + c
+    ROP_SUBTRACT,      // a = b - c
+    ROP_MULTIPLY,      // a = b * c
+    ROP_DIVIDE,        // a = b / c
+    ROP_ADD_K,         // a = b + constants[k]
+    ROP_SUBTRACT_K,    // a = b - constants[k]
+    ROP_MULTIPLY_K,    // a = b * constants[k]
+    ROP_DIVIDE_K,      // a = b / constants[k]
+    ROP_NOT,           // a = !b
+    ROP_NEGATE,        // a = -b
+    ROP_PRINT,         // print a
+    ROP_JUMP,          // goto k
+    ROP_JUMP_IF_FALSE, // if (!a) goto k
+    ROP_JUMP_IF_EQUAL,       // if (a == b) goto k
+    ROP_JUMP_IF_NOT_EQUAL,   // if (a != b) goto k
+    ROP_JUMP_IF_GREATER,     // if (a > b) goto k
+    ROP_JUMP_IF_NOT_GREATER, // if (!(a > b)) goto k
+    ROP_JUMP_IF_LESS,        // if (a < b) goto k
+    ROP_JUMP_IF_NOT_LESS,    // if (!(a < b)) goto k
+    ROP_JUMP_IF_EQUAL_K,       // if (a == constants[c]) goto k
+    ROP_JUMP_IF_NOT_EQUAL_K,   // if (a != constants[c]) goto k
+    ROP_JUMP_IF_GREATER_K,     // if (a > constants[c]) goto k
+    ROP_JUMP_IF_NOT_GREATER_K, // if (!(a > constants[c])) goto k
+    ROP_JUMP_IF_LESS_K,        // if (a < constants[c]) goto k
+    ROP_JUMP_IF_NOT_LESS_K,    // if (!(a < constants[c])) goto k
+    ROP_CALL,          // a = a(a + 1, ..., a + b)
+    ROP_TAIL_CALL,     // a = a(a + 1, ..., a + b), in this frame if a is a closure
+    ROP_INVOKE,        // a = a.invoke_caches[k].name(a + 1, ..., a + b)
+    ROP_SUPER_INVOKE,  // a = super(c).invoke_caches[k].name(a + 1, ..., a + b) bound to a
+    ROP_CLOSURE,       // a = closure(constants[k]), followed by one ROP_CAPTURE per upvalue
+    ROP_CAPTURE,       // upvalue descriptor of the preceding ROP_CLOSURE: local b if a, else enclosing upvalue b
+    ROP_CLOSE_UPVALUE, // close upvalues from a upwards
+    ROP_RETURN,        // return a
+    ROP_CLASS,         // a = class constants[k]
+    ROP_INHERIT,       // copy the methods of a into b
+    ROP_METHOD,        // a.methods[constants[k]] = b
+    ROP_FIELD,         // predict field constants[k] next in instances of a
+    ROP_GET_INTRINSIC, // a = intrinsic k
+    ROP_INTRINSIC,     // a = intrinsic c(a + 1, ..., a + b) if a holds it, else a = a(a + 1, ..., a + b)
+    REGISTER_OPCODE_COUNT,
+} RegOpCode;
+
+typedef struct
+{
+    uint8_t op;
+    uint8_t a;
+    uint8_t b;
+    uint8_t c;
+    int k;
+} RegInstruction;
+
+typedef struct
+{
+    int count;
+    int capacity;
+    RegInstruction *code;
+    int *offsets;
+    int frame_size;
+} RegisterCode;
+
+typedef struct Chunk Chunk;
+
+void init_register_code(Vm *vm, RegisterCode *code);
+void free_register_code(Vm *vm, RegisterCode *code);
+// Returns false and leaves the chunk without register code if it has instructions the backend cannot express.
+bool translate_chunk(Vm *vm, Chunk *chunk, int arity);
+
+#endif
@@ -131,7 +131,16 @@ static TokenType identifier_type(Scanner *scanner)
     case 'a':
         return check_keyword(scanner, 1, 2, "nd", TOKEN_AND);
     case 'c':
-        return check_keyword(scanner, 1, 4, "lass", TOKEN_CLASS);
+        if (scanner->current - scanner->start > 1)
+        {
+            switch (scanner->start[1])
+            {
+            case 'l':
+                return check_keyword(scanner, 2, 3, "ass", TOKEN_CLASS);
+            case 'o':
+                return check_keyword(scanner, 2, 3, "nst", TOKEN_CONST);
+            }
+        }
     case 'e':
         return check_keyword(scanner, 1, 3, "lse", TOKEN_ELSE);
     case 'f':
@@ -0,0 +1,90 @@
+#include "tier.h"
+#include "vm.h"
+
+#ifdef BASELINE_JIT
+
+static bool compile(Vm *vm, ObjFunction *function)
+{
+    if (function->tier == TIER_NATIVE)
+    {
+        return true;
+    }
+    // Code that deoptimized once is compiled again without speculating, so it cannot deoptimize again.
+    if (!jit_compile(vm, function, function->deopts == 0))
+    {
+        return false;
+    }
+    function->tier = TIER_NATIVE;
+    vm->tier_stats.compiled++;
+    return true;
+}
+
+// Returns the native code a call should run instead of interpreting the function, if it has some by now. The script
+// is left alone: it is only called once, by interpret(), which goes on to run it.
+NativeEntry tier_up_call(Vm *vm, ObjFunction *function)
+{
+    warm_up(function);
+    if (function->tier == TIER_NATIVE)
+    {
+        return function->chunk.native.entry;
+    }
+    if (function->hotness < JIT_THRESHOLD || !vm->jit_enabled || vm->backend != BACKEND_STACK ||
+        function->name == NULL || !compile(vm, function))
+    {
+        return NULL;
+    }
+    return function->chunk.native.entry;
+}
+
+// Returns native code to continue a running loop in: its trace, or, for a loop that cannot be traced, the function's
+// native code entered at the loop header. Either may return with the frame still running, and the interpreter
+// continues it from frame->ip.
+NativeEntry tier_up_loop(Vm *vm, ObjFunction *function, int header)
+{
+    warm_up(function);
+    if (!vm->jit_enabled)
+    {
+        return NULL;
+    }
+#ifdef TRACING_JIT
+    if (vm->recorder.active)
+    {
+        return NULL;
+    }
+    LoopTrace *loop = find_loop(vm, &function->chunk, header);
+    if (loop_traceable(loop))
+    {
+        if (loop->trace.entry == NULL)
+        {
+            loop_back_edge(vm, loop);
+        }
+        return loop->trace.entry;
+    }
+#endif
+    if (function->hotness < JIT_THRESHOLD || !compile(vm, function))
+    {
+        return NULL;
+    }
+    vm->tier_stats.osr_entries++;
+    return jit_osr_entry(&function->chunk.native, header);
+}
+
+// Native code calls this after a speculative guard failed and it has written the frame's ip and the stack top back.
+// The interpreter continues the frame. The function drops back to the quickened tier, where the interpreter
+// despecializes the instruction that failed, until it is hot enough to be compiled again.
+void jit_deoptimize(Vm *vm)
+{
+    ObjFunction *function = vm->frames[vm->frame_count - 1].closure->function;
+    vm->tier_stats.deoptimized++;
+    if (function->deopts++ > 0)
+    {
+        return;
+    }
+    Chunk *chunk = &function->chunk;
+    chunk->retired = chunk->native;
+    init_native_code(&chunk->native);
+    function->tier = TIER_QUICKENED;
+    function->hotness = 0;
+}
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef CLOX_TIER_H
+#define CLOX_TIER_H
+
+#include <limits.h>
+#include "common.h"
+#include "jit.h"
+#include "object.h"
+
+// Hotness a function needs before its generic instructions quicken themselves. Calls and loop iterations both count,
+// so code that runs once, like most of a script's setup, keeps its generic instructions.
+#define TIER_QUICKEN_THRESHOLD 8
+
+// Counts a call or a loop iteration.
+static inline void warm_up(ObjFunction *function)
+{
+    if (function->hotness < INT_MAX)
+    {
+        function->hotness++;
+    }
+    if (function->tier == TIER_INTERPRETED && function->hotness >= TIER_QUICKEN_THRESHOLD)
+    {
+        function->tier = TIER_QUICKENED;
+    }
+}
+
+#ifdef BASELINE_JIT
+
+typedef struct
+{
+    uint64_t compiled;
+    uint64_t osr_entries;
+    uint64_t deoptimized;
+} TierStats;
+
+NativeEntry tier_up_call(Vm *vm, ObjFunction *function);
+NativeEntry tier_up_loop(Vm *vm, ObjFunction *function, int header);
+
+#endif
+
+#endif
@@ -0,0 +1,365 @@
+#include "chunk.h"
+#include "memory.h"
+#include "object.h"
+#include "trace.h"
+#include "vm.h"
+
+#ifdef TRACING_JIT
+
+void init_loop_traces(LoopTraces *loops)
+{
+    loops->count = 0;
+    loops->loops = NULL;
+}
+
+void free_loop_traces(Vm *vm, LoopTraces *loops)
+{
+    for (int i = 0; i < loops->count; i++)
+    {
+        free_native_code(vm, &loops->loops[i].trace);
+        free_value_array(vm, &loops->loops[i].roots);
+    }
+    FREE_ARRAY(LoopTrace, loops->loops, loops->count);
+    init_loop_traces(loops);
+}
+
+void mark_loop_traces(Vm *vm, LoopTraces *loops)
+{
+    for (int i = 0; i < loops->count; i++)
+    {
+        ValueArray *roots = &loops->loops[i].roots;
+        for (int j = 0; j < roots->count; j++)
+        {
+            mark_value(vm, roots->values[j]);
+        }
+    }
+}
+
+void mark_trace_recorder(Vm *vm, TraceRecorder *recorder)
+{
+    if (!recorder->active)
+    {
+        return;
+    }
+    for (int i = 0; i < recorder->count; i++)
+    {
+        mark_object(vm, (Obj *)recorder->steps[i].function);
+        mark_value(vm, recorder->steps[i].callee);
+    }
+}
+
+// Creates the loop table of a chunk the first time one of its back-edges is taken.
+static void find_loops(Vm *vm, Chunk *chunk)
+{
+    LoopTraces *loops = &chunk->loops;
+    int count = 0;
+    for (int offset = 0; offset < chunk->count; offset += instruction_length(chunk, offset))
+    {
+        count += opcode_at(chunk->code, offset) == OP_LOOP;
+    }
+
+    LoopTrace *found = ALLOCATE(LoopTrace, count);
+    int index = 0;
+    for (int offset = 0; offset < chunk->count; offset += instruction_length(chunk, offset))
+    {
+        if (opcode_at(chunk->code, offset) == OP_LOOP)
+        {
+            LoopTrace *loop = &found[index++];
+            loop->header = jump_target(chunk->code, offset);
+            loop->hotness = 0;
+            loop->aborts = 0;
+            init_native_code(&loop->trace);
+            init_value_array(vm, &loop->roots);
+        }
+    }
+    loops->loops = found;
+    loops->count = count;
+}
+
+LoopTrace *find_loop(Vm *vm, Chunk *chunk, int header)
+{
+    if (chunk->loops.loops == NULL)
+    {
+        find_loops(vm, chunk);
+    }
+    for (int i = 0; i < chunk->loops.count; i++)
+    {
+        if (chunk->loops.loops[i].header == header)
+        {
+            return &chunk->loops.loops[i];
+        }
+    }
+    return NULL;
+}
+
+bool loop_traceable(LoopTrace *loop)
+{
+    return loop->trace.entry != NULL || loop->aborts < TRACE_MAX_ABORTS;
+}
+
+// Counts a back-edge of a loop that has no trace yet and starts recording once the loop is hot.
+void loop_back_edge(Vm *vm, LoopTrace *loop)
+{
+    if (loop->aborts < TRACE_MAX_ABORTS && ++loop->hotness >= TRACE_HOT_LOOP)
+    {
+        TraceRecorder *recorder = &vm->recorder;
+        recorder->active = true;
+        recorder->loop = loop;
+        recorder->base_frame_count = vm->frame_count;
+        recorder->skip_above = FRAMES_MAX;
+        recorder->pending_call = -1;
+        recorder->count = 0;
+    }
+}
+
+void stop_recording(Vm *vm)
+{
+    vm->recorder.active = false;
+}
+
+void jit_trace_exit(Vm *vm)
+{
+    vm->trace_stats.exits++;
+}
+
+static void abort_trace(Vm *vm)
+{
+    TraceRecorder *recorder = &vm->recorder;
+    recorder->loop->aborts++;
+    recorder->loop->hotness = 0;
+    vm->trace_stats.aborted++;
+    stop_recording(vm);
+}
+
+static void finish_trace(Vm *vm)
+{
+    TraceRecorder *recorder = &vm->recorder;
+    if (!jit_compile_trace(vm, recorder))
+    {
+        abort_trace(vm);
+        return;
+    }
+    vm->trace_stats.recorded++;
+    stop_recording(vm);
+}
+
+static bool is_falsey_value(Value value)
+{
+    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
+// A for loop's body jumps back to its increment, which jumps back to the condition, so a trace may pass more than one
+// back-edge. One that returns to an instruction the trace already went through closes an inner loop, which gets a
+// trace of its own instead of being unrolled.
+static bool closes_inner_loop(TraceRecorder *recorder, int target)
+{
+    for (int i = 0; i < recorder->count; i++)
+    {
+        if (recorder->steps[i].depth == 0 && recorder->steps[i].offset == target && target != recorder->loop->header)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint8_t generic_opcode(uint8_t op)
+{
+    switch (op)
+    {
+    case OP_ADD_NUM:
+    case OP_ADD_STR:
+        return OP_ADD;
+    case OP_GET_FIELD:
+        return OP_GET_PROPERTY;
+    case OP_CALL_CLOSURE:
+        return OP_CALL;
+    default:
+        return op;
+    }
+}
+
+// Called before every instruction run() dispatches while a loop is being recorded. The instruction has not executed
+// yet, so its operands are still on the stack and decide the types the trace is specialized for.
+void record_instruction(Vm *vm)
+{
+    TraceRecorder *recorder = &vm->recorder;
+    if (vm->frame_count > recorder->skip_above)
+    {
+        return;
+    }
+    recorder->skip_above = FRAMES_MAX;
+
+    int depth = vm->frame_count - recorder->base_frame_count;
+    if (recorder->pending_call >= 0)
+    {
+        // A call recorded as inlined must continue in the callee. If it did not, it ran elsewhere, for example as
+        // native code, and stays a call in the trace.
+        TraceStep *call = &recorder->steps[recorder->pending_call];
+        recorder->pending_call = -1;
+        if (depth != call->depth + 1)
+        {
+            call->inlined = false;
+            if (depth > call->depth)
+            {
+                recorder->skip_above = recorder->base_frame_count + call->depth;
+                return;
+            }
+        }
+    }
+
+    CallFrame *frame = &vm->frames[vm->frame_count - 1];
+    ObjFunction *function = frame->closure->function;
+    Chunk *chunk = &function->chunk;
+    int offset = code_offset(chunk, frame->ip);
+    if (recorder->count > 0)
+    {
+        // A quickened instruction whose guard failed turns back into its generic form and is dispatched again. It
+        // is the same step.
+        TraceStep *last = &recorder->steps[recorder->count - 1];
+        if (last->offset == offset && last->function == function && last->depth == depth)
+        {
+            return;
+        }
+    }
+    if (depth == 0 && offset == recorder->loop->header && recorder->count > 0)
+    {
+        finish_trace(vm);
+        return;
+    }
+    if (depth < 0 || recorder->count == TRACE_MAX_LENGTH)
+    {
+        abort_trace(vm);
+        return;
+    }
+
+    TraceStep *step = &recorder->steps[recorder->count++];
+    step->op = generic_opcode(opcode_at(chunk->code, offset));
+    step->inlined = false;
+    step->taken = false;
+    step->strings = false;
+    step->depth = depth;
+    step->offset = offset;
+    step->function = function;
+    step->callee = NIL_VAL;
+
+    Value *top = vm->stack_top;
+    switch (step->op)
+    {
+    case OP_ADD:
+        step->strings = IS_STRING(top[-1]) && IS_STRING(top[-2]);
+        if (!step->strings && (!IS_NUMBER(top[-1]) || !IS_NUMBER(top[-2])))
+        {
+            abort_trace(vm);
+        }
+        break;
+    case OP_ADD_LOCALS:
+    {
+        Value a = frame->slots[chunk->code[offset + 1]];
+        Value b = frame->slots[chunk->code[offset + 2]];
+        step->strings = IS_STRING(a) && IS_STRING(b);
+        if (!step->strings && (!IS_NUMBER(a) || !IS_NUMBER(b)))
+        {
+            abort_trace(vm);
+        }
+        break;
+    }
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_GREATER:
+    case OP_LESS:
+    case OP_NOT_GREATER:
+    case OP_NOT_LESS:
+        if (!IS_NUMBER(top[-1]) || !IS_NUMBER(top[-2]))
+        {
+            abort_trace(vm);
+        }
+        break;
+    case OP_SUBTRACT_LOCALS:
+    case OP_MULTIPLY_LOCALS:
+    case OP_DIVIDE_LOCALS:
+        if (!IS_NUMBER(frame->slots[chunk->code[offset + 1]]) || !IS_NUMBER(frame->slots[chunk->code[offset + 2]]))
+        {
+            abort_trace(vm);
+        }
+        break;
+    case OP_NEGATE:
+        if (!IS_NUMBER(top[-1]))
+        {
+            abort_trace(vm);
+        }
+        break;
+    case OP_JUMP_IF_FALSE:
+    case OP_POP_JUMP_IF_FALSE:
+        step->taken = is_falsey_value(top[-1]);
+        break;
+    case OP_JUMP_IF_EQUAL:
+        step->taken = values_equal(top[-2], top[-1]);
+        break;
+    case OP_JUMP_IF_NOT_EQUAL:
+        step->taken = !values_equal(top[-2], top[-1]);
+        break;
+    case OP_JUMP_IF_GREATER:
+    case OP_JUMP_IF_NOT_GREATER:
+    case OP_JUMP_IF_LESS:
+    case OP_JUMP_IF_NOT_LESS:
+    {
+        if (!IS_NUMBER(top[-1]) || !IS_NUMBER(top[-2]))
+        {
+            abort_trace(vm);
+            break;
+        }
+        double a = AS_NUMBER(top[-2]);
+        double b = AS_NUMBER(top[-1]);
+        bool greater = step->op == OP_JUMP_IF_GREATER || step->op == OP_JUMP_IF_NOT_GREATER;
+        bool holds = greater ? a > b : a < b;
+        step->taken = step->op == OP_JUMP_IF_GREATER || step->op == OP_JUMP_IF_LESS ? holds : !holds;
+        break;
+    }
+    case OP_LOOP:
+    {
+        int target = jump_target(chunk->code, offset);
+        if (depth != 0 || closes_inner_loop(recorder, target))
+        {
+            abort_trace(vm);
+        }
+        break;
+    }
+    case OP_CALL:
+    {
+        int arg_count = chunk->code[offset + 1];
+        Value callee = top[-1 - arg_count];
+        if (IS_CLOSURE(callee) && AS_CLOSURE(callee)->function->arity == arg_count && depth + 1 < TRACE_MAX_DEPTH)
+        {
+            step->inlined = true;
+            step->callee = callee;
+            recorder->pending_call = recorder->count - 1;
+        }
+        else
+        {
+            recorder->skip_above = vm->frame_count;
+        }
+        break;
+    }
+    case OP_INVOKE:
+    case OP_SUPER_INVOKE:
+    case OP_INTRINSIC:
+        recorder->skip_above = vm->frame_count;
+        break;
+    case OP_TAIL_CALL:
+        // Replaces the frame the trace is running in.
+        abort_trace(vm);
+        break;
+    case OP_RETURN:
+        if (depth == 0)
+        {
+            abort_trace(vm);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+#endif
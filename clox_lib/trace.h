@@ -0,0 +1,80 @@
+#ifndef CLOX_TRACE_H
+#define CLOX_TRACE_H
+
+#include "common.h"
+#include "jit.h"
+#include "value.h"
+
+#ifdef TRACING_JIT
+
+// Back-edges taken before a loop is recorded.
+#define TRACE_HOT_LOOP 50
+// Longest trace in instructions, deepest inlined call and number of failed recordings before a loop is given up on.
+#define TRACE_MAX_LENGTH 512
+#define TRACE_MAX_DEPTH 8
+#define TRACE_MAX_ABORTS 4
+
+typedef struct Chunk Chunk;
+
+// A loop of a chunk, keyed by the offset of its header, which is the target of its OP_LOOP.
+typedef struct
+{
+    int header;
+    int hotness;
+    int aborts;
+    NativeCode trace;
+    ValueArray roots;
+} LoopTrace;
+
+typedef struct
+{
+    int count;
+    LoopTrace *loops;
+} LoopTraces;
+
+// One instruction as the interpreter executed it while recording.
+typedef struct
+{
+    uint8_t op;
+    bool inlined;
+    bool taken;
+    bool strings;
+    int depth;
+    int offset;
+    ObjFunction *function;
+    Value callee;
+} TraceStep;
+
+typedef struct
+{
+    bool active;
+    LoopTrace *loop;
+    int base_frame_count;
+    int skip_above;
+    int pending_call;
+    int count;
+    TraceStep steps[TRACE_MAX_LENGTH];
+} TraceRecorder;
+
+typedef struct
+{
+    uint64_t recorded;
+    uint64_t aborted;
+    uint64_t exits;
+} TraceStats;
+
+void init_loop_traces(LoopTraces *loops);
+void free_loop_traces(Vm *vm, LoopTraces *loops);
+void mark_loop_traces(Vm *vm, LoopTraces *loops);
+void mark_trace_recorder(Vm *vm, TraceRecorder *recorder);
+LoopTrace *find_loop(Vm *vm, Chunk *chunk, int header);
+bool loop_traceable(LoopTrace *loop);
+void loop_back_edge(Vm *vm, LoopTrace *loop);
+void record_instruction(Vm *vm);
+void stop_recording(Vm *vm);
+bool jit_compile_trace(Vm *vm, TraceRecorder *recorder);
+void jit_trace_exit(Vm *vm);
+
+#endif
+
+#endif
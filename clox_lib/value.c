@@ -40,6 +40,8 @@ void print_value(Value value)
     case VAL_OBJ:
         print_object(value);
         break;
+    case VAL_UNDEFINED:
+        break;
     }
 #endif
 }
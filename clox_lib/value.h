@@ -9,6 +9,8 @@ typedef struct Obj Obj;
 typedef struct ObjString ObjString;
 typedef struct Vm Vm;
 
+// Besides the values Lox has, UNDEFINED_VAL marks the slots of global variables that have not been defined yet.
+
 #ifdef NAN_BOXING
 
 #define SIGN_BIT ((uint64_t)0x8000000000000000)
@@ -17,6 +19,7 @@ typedef struct Vm Vm;
 #define TAG_NIL 1
 #define TAG_FALSE 2
 #define TAG_TRUE 3
+#define TAG_UNDEFINED 4
 
 typedef uint64_t Value;
 
@@ -24,6 +27,7 @@ typedef uint64_t Value;
 #define IS_BOOL(value) (((value) | 1) == TRUE_VAL)
 #define IS_NUMBER(value) (((value) & QNAN) != QNAN)
 #define IS_OBJ(value) (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+#define IS_UNDEFINED(value) ((value) == UNDEFINED_VAL)
 
 #define AS_BOOL(value) ((value) == TRUE_VAL)
 #define AS_NUMBER(value) value_to_num(value)
@@ -32,6 +36,7 @@ typedef uint64_t Value;
 #define FALSE_VAL ((Value)(uint64_t)(QNAN | TAG_FALSE))
 #define TRUE_VAL ((Value)(uint64_t)(QNAN | TAG_TRUE))
 #define NIL_VAL ((Value)(uint64_t)(QNAN | TAG_NIL))
+#define UNDEFINED_VAL ((Value)(uint64_t)(QNAN | TAG_UNDEFINED))
 #define BOOL_VAL(b) ((b) ? TRUE_VAL : FALSE_VAL)
 #define NUMBER_VAL(num) num_to_value(num)
 #define OBJ_VAL(obj) (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(obj))
@@ -58,6 +63,7 @@ typedef enum
     VAL_BOOL,
     VAL_NUMBER,
     VAL_OBJ,
+    VAL_UNDEFINED,
 } ValueType;
 
 typedef struct
@@ -75,6 +81,7 @@ typedef struct
 #define IS_BOOL(value) ((value.type) == VAL_BOOL)
 #define IS_NUMBER(value) ((value.type) == VAL_NUMBER)
 #define IS_OBJ(value) ((value.type) == VAL_OBJ)
+#define IS_UNDEFINED(value) ((value).type == VAL_UNDEFINED)
 
 #define AS_BOOL(value) ((value).as.boolean)
 #define AS_NUMBER(value) ((value).as.number)
@@ -84,6 +91,7 @@ typedef struct
 #define BOOL_VAL(value) ((Value){VAL_BOOL, {.boolean = value}})
 #define NUMBER_VAL(value) ((Value){VAL_NUMBER, {.number = value}})
 #define OBJ_VAL(value) ((Value){VAL_OBJ, {.obj = (Obj *)value}})
+#define UNDEFINED_VAL ((Value){VAL_UNDEFINED, {.number = 0.}})
 
 #endif
 
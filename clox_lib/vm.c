@@ -2,61 +2,19 @@
 
 #include "compiler.h"
 #include "memory.h"
-#ifdef DEBUG_TRACE_EXECUTION
+#if defined(DEBUG_PRINT_CODE) || defined(DEBUG_TRACE_EXECUTION) || defined(DEBUG_COUNT_OPCODE_PAIRS) ||                \
+    defined(DEBUG_COUNT_SPECIALIZATIONS) || defined(DEBUG_COUNT_INLINE_CACHES)
 #include "debug.h"
 #endif
 
-#include <time.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-static bool clock_native(Vm *vm, int arg_count, Value *args)
-{
-    args[-1] = NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
-    return true;
-}
-
-static bool err_native(Vm *vm, int arg_count, Value *args)
-{
-    args[-1] = OBJ_VAL(copy_string(vm, "Error!", 6));
-    return false;
-}
-
-static bool has_field_native(Vm *vm, int arg_count, Value *args)
-{
-    if (!IS_INSTANCE(args[0]))
-    {
-        args[-1] = OBJ_VAL(copy_string(vm, "Expect instance.", 16));
-        return false;
-    }
-    if (!IS_STRING(args[1]))
-    {
-        args[-1] = OBJ_VAL(copy_string(vm, "Expect string.", 14));
-        return false;
-    }
-    ObjInstance *instance = AS_INSTANCE(args[0]);
-    Value dummy;
-    args[-1] = BOOL_VAL(table_get(&instance->fields, AS_STRING(args[1]), &dummy));
-    return true;
-}
-
-static bool delete_field_native(Vm *vm, int arg_count, Value *args)
+static const char *err_native(Vm *vm, int arg_count, Value *args, Value *result)
 {
-    if (!IS_INSTANCE(args[0]))
-    {
-        args[-1] = OBJ_VAL(copy_string(vm, "Expect instance.", 16));
-        return false;
-    }
-    if (!IS_STRING(args[1]))
-    {
-        args[-1] = OBJ_VAL(copy_string(vm, "Expect string.", 14));
-        return false;
-    }
-    ObjInstance *instance = AS_INSTANCE(args[0]);
-    table_delete(&instance->fields, AS_STRING(args[1]));
-    args[-1] = NIL_VAL;
-    return true;
+    return "Error!";
 }
 
 void push(Vm *vm, Value value)
@@ -71,6 +29,10 @@ Value pop(Vm *vm)
     return *vm->stack_top;
 }
 
+// The global variable in slot, which the compiler put in the instruction as its operand.
+#define GLOBAL(slot) (vm->global_values.values[slot])
+#define GLOBAL_NAME(slot) (AS_CSTRING(vm->global_names.values[slot]))
+
 static Value peek(Vm *vm, int distance)
 {
     return vm->stack_top[-1 - distance];
@@ -78,9 +40,12 @@ static Value peek(Vm *vm, int distance)
 
 static void reset_stack(Vm *vm)
 {
-    vm->stack_top = (Value *)&vm->stack;
+    vm->stack_top = vm->stack;
     vm->frame_count = 0;
     vm->open_upvalues = NULL;
+#ifdef TRACING_JIT
+    stop_recording(vm);
+#endif
 }
 
 static void runtime_error(Vm *vm, const char *format, ...)
@@ -91,11 +56,19 @@ static void runtime_error(Vm *vm, const char *format, ...)
     va_end(args);
     fputs("\n", stderr);
 
+    // A runaway recursion would print every one of its frames, so a deep trace keeps only its ends.
     for (int i = vm->frame_count - 1; i >= 0; i--)
     {
+        if (vm->frame_count > 2 * TRACE_EDGE_FRAMES && i == vm->frame_count - 1 - TRACE_EDGE_FRAMES)
+        {
+            fprintf(stderr, "... %d more frames\n", vm->frame_count - 2 * TRACE_EDGE_FRAMES);
+            i = TRACE_EDGE_FRAMES - 1;
+        }
         CallFrame *frame = &vm->frames[i];
         ObjFunction *function = frame->closure->function;
-        size_t instruction = frame->ip - frame->closure->function->chunk.code - 1;
+        int instruction = vm->backend == BACKEND_REGISTER && i < vm->register_frames
+                              ? function->chunk.registers.offsets[frame->pc - 1 - function->chunk.registers.code]
+                              : code_offset(&function->chunk, frame->ip - 1);
         int line = get_line(&function->chunk, instruction);
         fprintf(stderr, "[line %d] in ", line);
         if (function->name == NULL)
@@ -111,15 +84,155 @@ static void runtime_error(Vm *vm, const char *format, ...)
     reset_stack(vm);
 }
 
-static void define_native(Vm *vm, const char *name, int arity, NativeFn function)
+int global_slot(Vm *vm, ObjString *name)
+{
+    if (name->global == -1)
+    {
+        write_value_array(vm, &vm->global_names, OBJ_VAL(name));
+        write_value_array(vm, &vm->global_values, UNDEFINED_VAL);
+        name->global = vm->global_values.count - 1;
+    }
+    return name->global;
+}
+
+void define_native(Vm *vm, const char *name, int min_arity, int max_arity, uint8_t flags, NativeFn function)
 {
     push(vm, OBJ_VAL(copy_string(vm, name, (int)strlen(name))));
-    push(vm, OBJ_VAL(new_native(vm, arity, function)));
-    table_set(vm, &vm->globals, AS_STRING(vm->stack[0]), vm->stack[1]);
-    pop(vm);
+    invalidate_intrinsic(vm, AS_STRING(vm->stack[0]));
+    int slot = global_slot(vm, AS_STRING(vm->stack[0]));
+    vm->global_values.values[slot] = OBJ_VAL(new_native(vm, min_arity, max_arity, flags, function));
     pop(vm);
 }
 
+static void init_stacks(Vm *vm)
+{
+    vm->frames = (CallFrame *)malloc(sizeof(CallFrame) * FRAMES_INITIAL);
+    vm->stack = (Value *)malloc(sizeof(Value) * (STACK_INITIAL + STACK_SLACK));
+    if (vm->frames == NULL || vm->stack == NULL)
+    {
+        exit(1);
+    }
+    vm->frame_capacity = FRAMES_INITIAL;
+    vm->stack_limit = vm->stack + STACK_INITIAL;
+}
+
+static void free_stacks(Vm *vm)
+{
+    free(vm->frames);
+    free(vm->stack);
+    vm->frames = NULL;
+    vm->stack = NULL;
+}
+
+// Grows the stacks to hold at least frame_count frames and slot_count values. The value stack is copied to its new
+// place and the pointers into it, the frames' slots, the open upvalues and the stack top, are moved along.
+static bool grow_stacks(Vm *vm, int frame_count, int slot_count)
+{
+    if (frame_count > FRAMES_MAX || slot_count > STACK_MAX)
+    {
+        runtime_error(vm, "Stack overflow.");
+        return false;
+    }
+
+    if (frame_count > vm->frame_capacity)
+    {
+        int capacity = vm->frame_capacity * 2 < FRAMES_MAX ? vm->frame_capacity * 2 : FRAMES_MAX;
+        CallFrame *frames = (CallFrame *)realloc(vm->frames, sizeof(CallFrame) * capacity);
+        if (frames == NULL)
+        {
+            exit(1);
+        }
+        vm->frames = frames;
+        vm->frame_capacity = capacity;
+    }
+
+    int stack_capacity = (int)(vm->stack_limit - vm->stack);
+    if (slot_count > stack_capacity)
+    {
+        while (stack_capacity < slot_count)
+        {
+            stack_capacity *= 2;
+        }
+        Value *stack = (Value *)malloc(sizeof(Value) * (stack_capacity + STACK_SLACK));
+        if (stack == NULL)
+        {
+            exit(1);
+        }
+        memcpy(stack, vm->stack, sizeof(Value) * (vm->stack_top - vm->stack));
+        for (int i = 0; i < vm->frame_count; i++)
+        {
+            vm->frames[i].slots = stack + (vm->frames[i].slots - vm->stack);
+        }
+        for (ObjUpvalue *upvalue = vm->open_upvalues; upvalue != NULL; upvalue = upvalue->next)
+        {
+            upvalue->location = stack + (upvalue->location - vm->stack);
+        }
+        vm->stack_top = stack + (vm->stack_top - vm->stack);
+        free(vm->stack);
+        vm->stack = stack;
+        vm->stack_limit = stack + stack_capacity;
+    }
+    return true;
+}
+
+// Makes sure there is one more frame and room for function's slots from slots on, which is the only overflow check a
+// call needs. Returns the slots, which have moved if the stacks had to grow, or NULL on overflow.
+static Value *reserve_frame(Vm *vm, Value *slots, ObjFunction *function, int frame_count)
+{
+    if (frame_count <= vm->frame_capacity && slots + function->max_slots <= vm->stack_limit)
+    {
+        return slots;
+    }
+    int base = (int)(slots - vm->stack);
+    if (!grow_stacks(vm, frame_count, base + function->max_slots))
+    {
+        return NULL;
+    }
+    return vm->stack + base;
+}
+
+static void start_frame(CallFrame *frame, ObjClosure *closure)
+{
+    frame->closure = closure;
+    frame->ip = chunk_entry(&closure->function->chunk);
+    frame->pc = closure->function->chunk.registers.code;
+}
+
+// Every call native code makes nests C activations, so deep recursion goes on in the interpreter instead. Measuring
+// the C stack rather than counting native frames keeps native calls free of bookkeeping, and lets the C compiler turn
+// them into tail calls. The stack grows down on every target the JIT supports. A leaf calls nothing and cannot nest
+// any deeper.
+static bool native_stack_exhausted(Vm *vm, ObjFunction *function)
+{
+    char here;
+    return !function->is_leaf && vm->native_stack_base - (uintptr_t)&here > NATIVE_STACK_MAX;
+}
+
+static bool enter_frame(Vm *vm, CallFrame *frame)
+{
+    ObjFunction *function = frame->closure->function;
+    if (native_stack_exhausted(vm, function))
+    {
+        warm_up(function);
+        return true;
+    }
+    if (function->compiled != NULL)
+    {
+        return function->compiled(vm, frame);
+    }
+#ifdef BASELINE_JIT
+    // Hot functions run as native code, which returns once the frame has been popped again or has deoptimized.
+    NativeEntry native = tier_up_call(vm, function);
+    if (native != NULL)
+    {
+        return native(vm, frame);
+    }
+#else
+    warm_up(function);
+#endif
+    return true;
+}
+
 static bool call(Vm *vm, ObjClosure *closure, int arg_count)
 {
     if (arg_count != closure->function->arity)
@@ -128,19 +241,101 @@ static bool call(Vm *vm, ObjClosure *closure, int arg_count)
         return false;
     }
 
-    if (vm->frame_count == FRAMES_MAX)
+    Value *slots = reserve_frame(vm, vm->stack_top - arg_count - 1, closure->function, vm->frame_count + 1);
+    if (slots == NULL)
     {
-        runtime_error(vm, "Stack overflow.");
         return false;
     }
 
+    CallFrame *frame = &vm->frames[vm->frame_count++];
+    frame->slots = slots;
+    start_frame(frame, closure);
+    return enter_frame(vm, frame);
+}
+
+// The lean half of call() for the interpreter loop: when closure gets the right number of arguments, fits into the
+// stacks as they are and stays interpreted, pushes its frame and returns it without storing an ip, which the loop
+// keeps in a local and saves when it has to. Returns NULL for everything else, which goes through call().
+static inline CallFrame *push_frame(Vm *vm, ObjClosure *closure, int arg_count)
+{
+    ObjFunction *function = closure->function;
+    Value *slots = vm->stack_top - arg_count - 1;
+    if (arg_count != function->arity || vm->frame_count == vm->frame_capacity ||
+        slots + function->max_slots > vm->stack_limit || function->compiled != NULL)
+    {
+        return NULL;
+    }
+#ifdef BASELINE_JIT
+    if (function->tier == TIER_NATIVE || (vm->jit_enabled && function->hotness >= JIT_THRESHOLD))
+    {
+        return NULL;
+    }
+#endif
+    warm_up(function);
     CallFrame *frame = &vm->frames[vm->frame_count++];
     frame->closure = closure;
-    frame->ip = closure->function->chunk.code;
-    frame->slots = vm->stack_top - arg_count - 1;
+    frame->slots = slots;
+    return frame;
+}
+
+static bool accepts_arguments(ObjNative *native, int arg_count)
+{
+    return arg_count >= native->min_arity && (native->max_arity == NATIVE_VARIADIC || arg_count <= native->max_arity);
+}
+
+static void native_arity_error(Vm *vm, ObjNative *native, int arg_count)
+{
+    if (native->min_arity == native->max_arity)
+    {
+        runtime_error(vm, "Expected %d arguments but got %d.", native->min_arity, arg_count);
+    }
+    else if (native->max_arity == NATIVE_VARIADIC)
+    {
+        runtime_error(vm, "Expected at least %d arguments but got %d.", native->min_arity, arg_count);
+    }
+    else
+    {
+        runtime_error(vm, "Expected %d to %d arguments but got %d.", native->min_arity, native->max_arity, arg_count);
+    }
+}
+
+// The native's result replaces it and its arguments on the stack.
+static bool call_native(Vm *vm, ObjNative *native, int arg_count)
+{
+    if (!accepts_arguments(native, arg_count))
+    {
+        native_arity_error(vm, native, arg_count);
+        return false;
+    }
+    Value *args = vm->stack_top - arg_count;
+    const char *error = native->function(vm, arg_count, args, args - 1);
+    if (error != NULL)
+    {
+        runtime_error(vm, "%s", error);
+        return false;
+    }
+    vm->stack_top = args;
     return true;
 }
 
+// The builtin itself while its global is intact, otherwise whatever the global holds now.
+static bool get_intrinsic(Vm *vm, int intrinsic, Value *value)
+{
+    if (vm->intrinsic_intact[intrinsic])
+    {
+        *value = OBJ_VAL(vm->intrinsics[intrinsic]);
+        return true;
+    }
+    *value = vm->global_values.values[vm->intrinsic_names[intrinsic]->global];
+    return !IS_UNDEFINED(*value);
+}
+
+// Guards an intrinsic call: the callee the compiler assumed may have been replaced after the call was compiled.
+static inline bool is_intrinsic(Vm *vm, Value callee, int intrinsic)
+{
+    return IS_OBJ(callee) && AS_OBJ(callee) == (Obj *)vm->intrinsics[intrinsic];
+}
+
 static bool call_value(Vm *vm, Value callee, int arg_count)
 {
     if (IS_OBJ(callee))
@@ -158,10 +353,9 @@ static bool call_value(Vm *vm, Value callee, int arg_count)
         {
             ObjClass *klass = AS_CLASS(callee);
             vm->stack_top[-arg_count - 1] = OBJ_VAL(new_instance(vm, klass));
-            Value initializer;
-            if (table_get(&klass->methods, vm->init_string, &initializer))
+            if (klass->initializer != NULL)
             {
-                return call(vm, AS_CLOSURE(initializer), arg_count);
+                return call(vm, klass->initializer, arg_count);
             }
             else if (arg_count != 0)
             {
@@ -172,26 +366,7 @@ static bool call_value(Vm *vm, Value callee, int arg_count)
             break;
         }
         case OBJ_NATIVE:
-        {
-            ObjNative *native = AS_NATIVE(callee);
-
-            if (arg_count != native->arity)
-            {
-                runtime_error(vm, "Expected %d arguments but got %d.", native->arity, arg_count);
-                return false;
-            }
-
-            if (native->function(vm, arg_count, vm->stack_top - arg_count))
-            {
-                vm->stack_top -= arg_count;
-                return true;
-            }
-            else
-            {
-                runtime_error(vm, AS_STRING(vm->stack_top[-arg_count - 1])->chars);
-                return false;
-            }
-        }
+            return call_native(vm, AS_NATIVE(callee), arg_count);
         case OBJ_CLOSURE:
             return call(vm, AS_CLOSURE(callee), arg_count);
         default:
@@ -202,18 +377,224 @@ static bool call_value(Vm *vm, Value callee, int arg_count)
     return false;
 }
 
-static bool invoke_from_class(Vm *vm, ObjClass *klass, ObjString *name, int arg_count)
+static bool bind_method(Vm *vm, ObjClass *klass, ObjString *name)
 {
-    Value method;
-    if (!table_get(&klass->methods, name, &method))
+    ObjClosure *method = class_method(klass, name);
+    if (method == NULL)
     {
         runtime_error(vm, "Undefined property '%s'.", name->chars);
         return false;
     }
-    return call(vm, AS_CLOSURE(method), arg_count);
+
+    ObjBoundMethod *bound = new_bound_method(vm, peek(vm, 0), method);
+    pop(vm);
+    push(vm, OBJ_VAL(bound));
+    return true;
+}
+
+#ifdef DEBUG_COUNT_INLINE_CACHES
+#define COUNT_CACHE(cache, outcome) ((cache)->outcome++)
+#else
+#define COUNT_CACHE(cache, outcome) ((void)0)
+#endif
+
+static inline bool get_method(ObjClass *klass, ObjString *name, Value *value)
+{
+    ObjClosure *method = class_method(klass, name);
+    if (method == NULL)
+    {
+        return false;
+    }
+    *value = OBJ_VAL(method);
+    return true;
+}
+
+// The field a property site names, if the instance has the shape the site last found it in.
+static inline bool get_cached_field(InlineCache *cache, ObjInstance *instance, Value *value)
+{
+    if (instance->shape == cache->shape && cache->slot != -1)
+    {
+        COUNT_CACHE(cache, hits);
+        *value = *instance_slot(instance, cache->slot);
+        return true;
+    }
+    return false;
+}
+
+// Whether an instance has only ever gained fields the way its class predicts, and the predicted slot of a site on this
+// names its field in that layout. Such a site knows the slot without looking at the shape.
+static inline bool follows_layout(InlineCache *cache, ObjInstance *instance)
+{
+    ObjClass *klass = instance->klass;
+    int slot = cache->predicted;
+    if (slot < 0 || slot + 1 >= klass->layout_count || instance->shape == NULL)
+    {
+        return false;
+    }
+    int count = instance->shape->slot_count;
+    return count < klass->layout_count && klass->layout[count] == instance->shape &&
+           klass->layout[slot + 1]->name == cache->name;
+}
+
+// Finishes a property read that missed the field cache and refills the cache with whatever the name turned out to
+// be. A shape without the field is a shape whose instances don't shadow the method, so a method hit needs no field
+// lookup. A method comes back unbound, with *is_method set. Instances in dictionary mode are never cached.
+static bool get_property(InlineCache *cache, ObjInstance *instance, Value *value, bool *is_method)
+{
+    ObjShape *shape = instance->shape;
+    *is_method = false;
+    if (shape == NULL)
+    {
+        COUNT_CACHE(cache, misses);
+        if (table_get(&instance->dictionary, cache->name, value))
+        {
+            return true;
+        }
+        *is_method = true;
+        return get_method(instance->klass, cache->name, value);
+    }
+    if (shape == cache->shape)
+    {
+        COUNT_CACHE(cache, hits);
+        *is_method = true;
+        *value = cache->method;
+        return true;
+    }
+    COUNT_CACHE(cache, misses);
+    int slot;
+    if (follows_layout(cache, instance))
+    {
+        slot = cache->predicted < shape->slot_count ? cache->predicted : -1;
+    }
+    else
+    {
+        slot = shape_slot(shape, cache->name);
+    }
+    if (slot != -1)
+    {
+        cache->shape = shape;
+        cache->slot = slot;
+        cache->transition = NULL;
+        *value = *instance_slot(instance, slot);
+        return true;
+    }
+    *is_method = true;
+    if (!get_method(instance->klass, cache->name, value))
+    {
+        return false;
+    }
+    cache->shape = shape;
+    cache->slot = -1;
+    cache->transition = NULL;
+    cache->method = *value;
+    return true;
+}
+
+// A store to a field the cached shape has needs no lookup, and neither does one that adds the field the way the site
+// last saw, as long as the new slot fits in the values the instance has. Misses on instances that follow the predicted
+// layout store to the predicted slot, moving the instance on to the next predicted shape if the field is new.
+static inline void set_property(Vm *vm, InlineCache *cache, ObjInstance *instance, Value value)
+{
+    ObjShape *shape = instance->shape;
+    if (shape == cache->shape && cache->slot != -1 &&
+        (cache->transition == NULL || cache->slot < instance->capacity))
+    {
+        COUNT_CACHE(cache, hits);
+        *instance_slot(instance, cache->slot) = value;
+        if (cache->transition != NULL)
+        {
+            instance->shape = cache->transition;
+            count_fields(instance->klass, cache->transition->slot_count);
+        }
+        return;
+    }
+    COUNT_CACHE(cache, misses);
+    int slot;
+    if (follows_layout(cache, instance) && cache->predicted <= shape->slot_count &&
+        cache->predicted < instance->capacity)
+    {
+        slot = cache->predicted;
+        *instance_slot(instance, slot) = value;
+        if (slot == shape->slot_count)
+        {
+            instance->shape = instance->klass->layout[slot + 1];
+        }
+    }
+    else
+    {
+        instance_set(vm, instance, cache->name, value);
+        if (shape == NULL || instance->shape == NULL)
+        {
+            return;
+        }
+        slot = shape_slot(instance->shape, cache->name);
+    }
+    cache->shape = shape;
+    cache->slot = slot;
+    cache->transition = instance->shape == shape ? NULL : instance->shape;
+}
+
+static inline MethodCacheEntry *method_cache_entry(Vm *vm, ObjShape *shape, ObjString *name)
+{
+    uintptr_t hash = (uintptr_t)shape >> 4 ^ name->hash;
+    return &vm->method_cache[hash & (METHOD_CACHE_SIZE - 1)];
+}
+
+// The method an invoke site has called on receivers of shape before, or NULL. Sites with a full cache also look in the
+// megamorphic cache.
+static inline ObjClosure *cached_method(Vm *vm, InvokeCache *cache, ObjShape *shape)
+{
+    for (int i = 0; i < cache->count; i++)
+    {
+        if (cache->entries[i].shape == shape)
+        {
+            COUNT_CACHE(cache, hits);
+            return cache->entries[i].method;
+        }
+    }
+    if (cache->count == INVOKE_CACHE_ENTRIES)
+    {
+        MethodCacheEntry *entry = method_cache_entry(vm, shape, cache->name);
+        if (entry->shape == shape && entry->name == cache->name)
+        {
+            COUNT_CACHE(cache, hits);
+            return entry->method;
+        }
+    }
+    COUNT_CACHE(cache, misses);
+    return NULL;
+}
+
+// Looks the method up in klass and remembers it for receivers of shape, in the site's own cache while it has room and
+// in the megamorphic cache after that. Receivers in dictionary mode have no shape and are never cached.
+static ObjClosure *find_method(Vm *vm, InvokeCache *cache, ObjClass *klass, ObjShape *shape)
+{
+    ObjClosure *method = class_method(klass, cache->name);
+    if (method == NULL)
+    {
+        runtime_error(vm, "Undefined property '%s'.", cache->name->chars);
+        return NULL;
+    }
+    if (shape == NULL)
+    {
+        return method;
+    }
+    if (cache->count < INVOKE_CACHE_ENTRIES)
+    {
+        cache->entries[cache->count].shape = shape;
+        cache->entries[cache->count].method = method;
+        cache->count++;
+        return method;
+    }
+    MethodCacheEntry *entry = method_cache_entry(vm, shape, cache->name);
+    entry->shape = shape;
+    entry->name = cache->name;
+    entry->method = method;
+    return method;
 }
 
-static bool invoke(Vm *vm, ObjString *name, int arg_count)
+// A callable field shadows the method, which is why misses probe the fields before the class.
+static bool invoke(Vm *vm, InvokeCache *cache, int arg_count)
 {
     Value receiver = peek(vm, arg_count);
     if (!IS_INSTANCE(receiver))
@@ -222,28 +603,36 @@ static bool invoke(Vm *vm, ObjString *name, int arg_count)
         return false;
     }
     ObjInstance *instance = AS_INSTANCE(receiver);
-    Value value;
-    if (table_get(&instance->fields, name, &value))
+    ObjClosure *method = cached_method(vm, cache, instance->shape);
+    if (method == NULL)
     {
-        vm->stack_top[-arg_count - 1] = value;
-        return call_value(vm, value, arg_count);
+        Value value;
+        if (instance_get(instance, cache->name, &value))
+        {
+            vm->stack_top[-arg_count - 1] = value;
+            return call_value(vm, value, arg_count);
+        }
+        method = find_method(vm, cache, instance->klass, instance->shape);
+        if (method == NULL)
+        {
+            return false;
+        }
     }
-    return invoke_from_class(vm, instance->klass, name, arg_count);
+    return call(vm, method, arg_count);
 }
 
-static bool bind_method(Vm *vm, ObjClass *klass, ObjString *name)
+static bool super_invoke(Vm *vm, InvokeCache *cache, ObjClass *superclass, int arg_count)
 {
-    Value method;
-    if (!table_get(&klass->methods, name, &method))
+    ObjClosure *method = cached_method(vm, cache, superclass->shape);
+    if (method == NULL)
     {
-        runtime_error(vm, "Undefined property %s.");
-        return false;
+        method = find_method(vm, cache, superclass, superclass->shape);
+        if (method == NULL)
+        {
+            return false;
+        }
     }
-
-    ObjBoundMethod *bound = new_bound_method(vm, peek(vm, 0), AS_CLOSURE(method));
-    pop(vm);
-    push(vm, OBJ_VAL(bound));
-    return true;
+    return call(vm, method, arg_count);
 }
 
 static ObjUpvalue *capture_upvalue(Vm *vm, Value *local)
@@ -285,401 +674,2377 @@ static void close_upvalues(Vm *vm, Value *last)
     }
 }
 
-static void define_method(Vm *vm, ObjString *name)
+// The closure a tail call to callee runs in the caller's frame, or NULL if callee is not a closure or bound method.
+static ObjClosure *tail_callee(Vm *vm, Value callee, int arg_count)
 {
-    Value method = peek(vm, 0);
-    ObjClass *klass = AS_CLASS(peek(vm, 1));
-    table_set(vm, &klass->methods, name, method);
-    pop(vm);
+    if (IS_CLOSURE(callee))
+    {
+        return AS_CLOSURE(callee);
+    }
+    if (IS_BOUND_METHOD(callee))
+    {
+        ObjBoundMethod *bound = AS_BOUND_METHOD(callee);
+        vm->stack_top[-arg_count - 1] = bound->receiver;
+        return bound->method;
+    }
+    return NULL;
 }
 
-static bool is_falsey(Value value)
+// Moves the callee and its arguments down over the frame on top, which closure then starts over in.
+static bool reuse_frame(Vm *vm, ObjClosure *closure, int arg_count)
 {
-    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
-}
-
-static void concatenate(Vm *vm)
+    if (arg_count != closure->function->arity)
+    {
+        runtime_error(vm, "Expected %d arguments but got %d.", closure->function->arity, arg_count);
+        return false;
+    }
+
+    if (reserve_frame(vm, vm->frames[vm->frame_count - 1].slots, closure->function, vm->frame_count) == NULL)
+    {
+        return false;
+    }
+
+    CallFrame *frame = &vm->frames[vm->frame_count - 1];
+    close_upvalues(vm, frame->slots);
+    memmove(frame->slots, vm->stack_top - arg_count - 1, sizeof(Value) * (arg_count + 1));
+    vm->stack_top = frame->slots + arg_count + 1;
+    start_frame(frame, closure);
+    return true;
+}
+
+// Like call_value, except that a closure takes over the frame of the function making the call instead of pushing its
+// own. Anything else is called as usual and the caller's OP_RETURN returns its result.
+static bool tail_call_value(Vm *vm, Value callee, int arg_count)
+{
+    ObjClosure *closure = tail_callee(vm, callee, arg_count);
+    if (closure == NULL)
+    {
+        return call_value(vm, callee, arg_count);
+    }
+    return reuse_frame(vm, closure, arg_count) && enter_frame(vm, &vm->frames[vm->frame_count - 1]);
+}
+
+static void define_method(Vm *vm, ObjString *name)
+{
+    define_class_method(vm, AS_CLASS(peek(vm, 1)), name, AS_CLOSURE(peek(vm, 0)));
+    pop(vm);
+}
+
+static bool is_falsey(Value value)
+{
+    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
+static ObjString *concatenate_strings(Vm *vm, ObjString *a, ObjString *b)
 {
-    ObjString *b = AS_STRING(peek(vm, 0));
-    ObjString *a = AS_STRING(peek(vm, 1));
     int length = a->length + b->length;
     char *chars = ALLOCATE(char, length + 1);
     memcpy(chars, a->chars, a->length);
     memcpy(chars + a->length, b->chars, b->length);
     chars[length] = '\0';
+    return take_string(vm, chars, length);
+}
+
+static void concatenate(Vm *vm)
+{
+    ObjString *b = AS_STRING(peek(vm, 0));
+    ObjString *a = AS_STRING(peek(vm, 1));
+    ObjString *result = concatenate_strings(vm, a, b);
+    pop(vm);
+    pop(vm);
+    push(vm, OBJ_VAL(result));
+}
+
+#ifdef DEBUG_TRACE_EXECUTION
+static void trace_execution(Vm *vm, CallFrame *frame, Code *ip)
+{
+    printf("Stack   | ");
+    for (Value *slot = vm->stack; slot < vm->stack_top; slot++)
+    {
+        printf("[ ");
+        print_value(*slot);
+        printf(" ]");
+    }
+    printf("\n");
+
+    printf("Globals | ");
+    for (int i = 0; i < vm->global_values.count; i++)
+    {
+        if (!IS_UNDEFINED(vm->global_values.values[i]))
+        {
+            printf("[ %s -> ", AS_CSTRING(vm->global_names.values[i]));
+            print_value(vm->global_values.values[i]);
+            printf(" ]");
+        }
+    }
+    printf("\n");
+
+    printf("Strings | ");
+    print_table(&vm->strings);
+    printf("\n");
+
+    disassemble_instruction(vm, &frame->closure->function->chunk, code_offset(&frame->closure->function->chunk, ip));
+}
+#endif
+
+#ifdef DIRECT_THREADING
+static void predecode_function(Vm *vm, ObjFunction *function)
+{
+    predecode_chunk(vm, &function->chunk, vm->handlers);
+    for (int i = 0; i < function->chunk.constants.count; i++)
+    {
+        if (IS_FUNCTION(function->chunk.constants.values[i]))
+        {
+            predecode_function(vm, AS_FUNCTION(function->chunk.constants.values[i]));
+        }
+    }
+}
+#endif
+
+// Runs until the frame count drops back to exit_depth. The native code passes its own depth to run the interpreted
+// frames it calls.
+static InterpretResult run(Vm *vm, int exit_depth)
+{
+    CallFrame *frame;
+    Code *ip;
+    Value *slots;
+#ifndef DIRECT_THREADING
+    Value *constants;
+    int wide_index;
+#endif
+    Value *sp;
+#ifdef TOS_CACHING
+    Value tos;
+    Value popped;
+#endif
+
+// With DIRECT_THREADING, ip walks the chunk's predecoded cells: every instruction is a handler address followed by its
+// operands already resolved to constants, strings, slot numbers and absolute jump targets.
+#ifdef DIRECT_THREADING
+#define READ_BYTE() ((ip++)->operand)
+#define READ_CONSTANT() ((ip++)->value)
+#define READ_3_BYTES() READ_BYTE()
+#define READ_CONSTANT_LONG() READ_CONSTANT()
+#define READ_STRING() ((ip++)->string)
+#define READ_CACHE() ((ip++)->cache)
+#define READ_INVOKE_CACHE() ((ip++)->invoke_cache)
+#define PROPERTY_UNITS 3
+#define READ_JUMP() ((ip++)->target)
+#define READ_LOOP() ((ip++)->target)
+#define LOAD_CONSTANTS() ((void)0)
+#else
+#define READ_BYTE() (*ip++)
+#define READ_3_BYTES() (ip += 3, ((uint32_t)(ip[-3]) | (uint32_t)(ip[-2]) << 8 | (uint32_t)(ip[-1]) << 16))
+#define READ_CONSTANT() (constants[READ_BYTE()])
+#define READ_CONSTANT_LONG() (constants[READ_3_BYTES()])
+#define READ_STRING() AS_STRING(READ_CONSTANT())
+#define READ_CACHE() (ip += 2, &frame->closure->function->chunk.caches[(uint16_t)(ip[-2]) << 8 | (uint16_t)(ip[-1])])
+#define READ_INVOKE_CACHE()                                                                                            \
+    (ip += 2, &frame->closure->function->chunk.invoke_caches[(uint16_t)(ip[-2]) << 8 | (uint16_t)(ip[-1])])
+#define PROPERTY_UNITS 4
+#define READ_DISTANCE() ((int)(ip[-2]) << 8 | (int)(ip[-1]))
+#define READ_JUMP() (ip += 2, ip + READ_DISTANCE())
+#define READ_LOOP() (ip += 2, ip - READ_DISTANCE())
+#define LOAD_CONSTANTS() (constants = frame->closure->function->chunk.constants.values)
+#endif
+
+// OP_WIDE reads the three-byte index or jump distance of the instruction it prefixes into wide_index and jumps into
+// that instruction's handler right after the point where it reads its narrow operands, so narrow instructions pay
+// nothing for the prefix. assignment puts the wide index in place of the narrow one and reads the operands after it,
+// where a cache index is three bytes too. Predecoding folds the prefix into the cells instead.
+#ifdef DIRECT_THREADING
+#define WIDE_ENTRY(op, assignment) ((void)0)
+#else
+#define WIDE_STRING() AS_STRING(constants[wide_index])
+#define WIDE_JUMP() (ip + wide_index)
+#define WIDE_CACHE() (&frame->closure->function->chunk.caches[READ_3_BYTES()])
+#define WIDE_INVOKE_CACHE() (&frame->closure->function->chunk.invoke_caches[READ_3_BYTES()])
+#define WIDE_LOOP() (ip - wide_index)
+#define WIDE_ENTRY(op, assignment) \
+    if (false)                     \
+    {                              \
+    WIDE_##op:                     \
+        assignment;                \
+    }
+#endif
+
+// ip, slots and constants are cached in locals: write ip back before calls and errors, reload after frame switches.
+#define SAVE_FRAME() (frame->ip = ip)
+#define LOAD_FRAME()                              \
+    do                                            \
+    {                                             \
+        frame = &vm->frames[vm->frame_count - 1]; \
+        ip = frame->ip;                           \
+        slots = frame->slots;                     \
+        LOAD_CONSTANTS();                         \
+    } while (false)
+
+// The stack pointer is cached in a local too. With TOS_CACHING the top value additionally lives in tos and sp points
+// at the slot it belongs to, so everything below sp is in memory. SPILL publishes the whole stack to the vm before
+// anything that reads vm->stack (helpers, natives, the GC) and FILL picks it up again afterwards.
+#ifdef TOS_CACHING
+#define PUSH(value) (*sp++ = tos, tos = (value))
+#define POP() (popped = tos, tos = *--sp, popped)
+#define DROP() (tos = *--sp)
+#define PEEK(distance) ((distance) == 0 ? tos : sp[-(distance)])
+#define SET_TOP(value) (tos = (value))
+#define TRUNCATE_AND_PUSH(base, value) (sp = (base), tos = (value))
+#define SPILL() (*sp = tos, vm->stack_top = sp + 1)
+#define FILL() (sp = vm->stack_top - 1, tos = *sp)
+#else
+#define PUSH(value) (*sp++ = (value))
+#define POP() (*--sp)
+#define DROP() (--sp)
+#define PEEK(distance) (sp[-1 - (distance)])
+#define SET_TOP(value) (sp[-1] = (value))
+#define TRUNCATE_AND_PUSH(base, value) (sp = (base), *sp++ = (value))
+#define SPILL() (vm->stack_top = sp)
+#define FILL() (sp = vm->stack_top)
+#endif
+
+// Reads a local slot directly, without pushing it first. The slot may be the cached top of the stack.
+#ifdef TOS_CACHING
+#define LOCAL(slot) (&slots[slot] == sp ? tos : slots[slot])
+#else
+#define LOCAL(slot) (slots[slot])
+#endif
+
+#define SAVE_STATE() (SAVE_FRAME(), SPILL())
+#define LOAD_STATE() \
+    do               \
+    {                \
+        LOAD_FRAME(); \
+        FILL();      \
+    } while (false)
+
+#define RUNTIME_ERROR(...)              \
+    do                                  \
+    {                                   \
+        SAVE_FRAME();                   \
+        runtime_error(vm, __VA_ARGS__); \
+        return INTERPRET_RUNTIME_ERROR; \
+    } while (false)
+
+#define BINARY_OP(value_type, op)                        \
+    do                                                   \
+    {                                                    \
+        if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1)))  \
+        {                                                \
+            RUNTIME_ERROR("Operands must be numbers.");  \
+        }                                                \
+        double b = AS_NUMBER(POP());                     \
+        double a = AS_NUMBER(PEEK(0));                   \
+        SET_TOP(value_type(a op b));                     \
+    } while (false)
+
+#define NOT_BOOL_VAL(value) BOOL_VAL(!(value))
+
+// Switches straight to the frame push_frame() gives the callee: its slots start below the arguments already on the
+// stack, so the stack pointer stays where it is and only the new frame's ip, slots and constants are set.
+#define CALL_CLOSURE(closure, arg_count)                                  \
+    do                                                                    \
+    {                                                                     \
+        SAVE_STATE();                                                     \
+        CallFrame *callee_frame = push_frame(vm, (closure), (arg_count)); \
+        if (callee_frame == NULL)                                         \
+        {                                                                 \
+            if (!call(vm, (closure), (arg_count)))                        \
+            {                                                             \
+                return INTERPRET_RUNTIME_ERROR;                           \
+            }                                                             \
+            LOAD_STATE();                                                 \
+            break;                                                        \
+        }                                                                 \
+        frame = callee_frame;                                             \
+        ip = chunk_entry(&(closure)->function->chunk);                    \
+        slots = frame->slots;                                             \
+        LOAD_CONSTANTS();                                                 \
+    } while (false)
+
+#define COMPARE_AND_JUMP(target, op, jump_if)            \
+    do                                                   \
+    {                                                    \
+        if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1)))  \
+        {                                                \
+            RUNTIME_ERROR("Operands must be numbers.");  \
+        }                                                \
+        double b = AS_NUMBER(PEEK(0));                   \
+        double a = AS_NUMBER(PEEK(1));                   \
+        DROP();                                          \
+        DROP();                                          \
+        if ((a op b) == (jump_if))                       \
+        {                                                \
+            ip = target;                                 \
+        }                                                \
+    } while (false)
+
+#define LOCALS_BINARY_OP(op)                               \
+    do                                                     \
+    {                                                      \
+        uint8_t left = READ_BYTE();                        \
+        uint8_t right = READ_BYTE();                       \
+        Value a = LOCAL(left);                             \
+        Value b = LOCAL(right);                            \
+        if (!IS_NUMBER(a) || !IS_NUMBER(b))                \
+        {                                                  \
+            RUNTIME_ERROR("Operands must be numbers.");    \
+        }                                                  \
+        PUSH(NUMBER_VAL(AS_NUMBER(a) op AS_NUMBER(b)));    \
+    } while (false)
+
+#ifdef DEBUG_TRACE_EXECUTION
+#define TRACE_EXECUTION() (SPILL(), trace_execution(vm, frame, ip))
+#else
+#define TRACE_EXECUTION() ((void)0)
+#endif
+
+// While a loop is being recorded, every instruction is shown to the recorder before it executes.
+#ifdef TRACING_JIT
+#define RECORD_TRACE() (vm->recorder.active ? (SAVE_FRAME(), SPILL(), record_instruction(vm)) : (void)0)
+#else
+#define RECORD_TRACE() ((void)0)
+#endif
+
+// With QUICKENING, generic instructions of functions in the quickened tier rewrite themselves in place into a
+// type-specialized form once they have seen their operands. distance is the number of code units from the opcode to
+// ip. A specialized instruction whose guard fails rewrites itself back to the generic form and executes again.
+#ifdef DIRECT_THREADING
+#define REWRITE(distance, op) (ip[-(distance)].handler = dispatch_table[op])
+#else
+#define REWRITE(distance, op) (ip[-(distance)] = (op))
+#endif
+
+#ifdef DEBUG_COUNT_SPECIALIZATIONS
+#define COUNT_SPECIALIZED(op) (vm->specialized[op]++)
+#define COUNT_GUARD_FAILURE(op) (vm->guard_failures[op]++)
+#else
+#define COUNT_SPECIALIZED(op) ((void)0)
+#define COUNT_GUARD_FAILURE(op) ((void)0)
+#endif
+
+#ifdef QUICKENING
+#define SPECIALIZE(distance, op)                                 \
+    (frame->closure->function->tier >= TIER_QUICKENED             \
+         ? (void)(REWRITE(distance, op), COUNT_SPECIALIZED(op))   \
+         : (void)0)
+#else
+#define SPECIALIZE(distance, op) ((void)0)
+#endif
+#define DESPECIALIZE(distance, from, op) (REWRITE(distance, op), COUNT_GUARD_FAILURE(from), ip -= (distance))
+
+#ifdef DEBUG_COUNT_INSTRUCTIONS
+#define COUNT_INSTRUCTION() (vm->instruction_count++)
+#else
+#define COUNT_INSTRUCTION() ((void)0)
+#endif
+
+#ifdef DEBUG_COUNT_OPCODE_PAIRS
+#define COUNT_OPCODE(op) (vm->opcode_pairs[vm->previous_opcode][op]++, vm->previous_opcode = (op))
+#else
+#define COUNT_OPCODE(op) ((void)0)
+#endif
+
+#ifdef THREADED_DISPATCH
+    static void *dispatch_table[] = {
+        [OP_CONSTANT] = &&CASE_OP_CONSTANT,
+        [OP_CONSTANT_LONG] = &&CASE_OP_CONSTANT_LONG,
+        [OP_NIL] = &&CASE_OP_NIL,
+        [OP_TRUE] = &&CASE_OP_TRUE,
+        [OP_FALSE] = &&CASE_OP_FALSE,
+        [OP_POP] = &&CASE_OP_POP,
+        [OP_GET_LOCAL] = &&CASE_OP_GET_LOCAL,
+        [OP_SET_LOCAL] = &&CASE_OP_SET_LOCAL,
+        [OP_GET_GLOBAL] = &&CASE_OP_GET_GLOBAL,
+        [OP_DEFINE_GLOBAL] = &&CASE_OP_DEFINE_GLOBAL,
+        [OP_SET_GLOBAL] = &&CASE_OP_SET_GLOBAL,
+        [OP_GET_UPVALUE] = &&CASE_OP_GET_UPVALUE,
+        [OP_SET_UPVALUE] = &&CASE_OP_SET_UPVALUE,
+        [OP_GET_PROPERTY] = &&CASE_OP_GET_PROPERTY,
+        [OP_SET_PROPERTY] = &&CASE_OP_SET_PROPERTY,
+        [OP_GET_SUPER] = &&CASE_OP_GET_SUPER,
+        [OP_EQUAL] = &&CASE_OP_EQUAL,
+        [OP_GREATER] = &&CASE_OP_GREATER,
+        [OP_LESS] = &&CASE_OP_LESS,
+        [OP_ADD] = &&CASE_OP_ADD,
+        [OP_SUBTRACT] = &&CASE_OP_SUBTRACT,
+        [OP_MULTIPLY] = &&CASE_OP_MULTIPLY,
+        [OP_DIVIDE] = &&CASE_OP_DIVIDE,
+        [OP_NOT] = &&CASE_OP_NOT,
+        [OP_NEGATE] = &&CASE_OP_NEGATE,
+        [OP_PRINT] = &&CASE_OP_PRINT,
+        [OP_JUMP] = &&CASE_OP_JUMP,
+        [OP_JUMP_IF_FALSE] = &&CASE_OP_JUMP_IF_FALSE,
+        [OP_LOOP] = &&CASE_OP_LOOP,
+        [OP_CALL] = &&CASE_OP_CALL,
+        [OP_TAIL_CALL] = &&CASE_OP_TAIL_CALL,
+        [OP_INVOKE] = &&CASE_OP_INVOKE,
+        [OP_SUPER_INVOKE] = &&CASE_OP_SUPER_INVOKE,
+        [OP_CLOSURE] = &&CASE_OP_CLOSURE,
+        [OP_CLOSE_UPVALUE] = &&CASE_OP_CLOSE_UPVALUE,
+        [OP_RETURN] = &&CASE_OP_RETURN,
+        [OP_CLASS] = &&CASE_OP_CLASS,
+        [OP_INHERIT] = &&CASE_OP_INHERIT,
+        [OP_METHOD] = &&CASE_OP_METHOD,
+        [OP_FIELD] = &&CASE_OP_FIELD,
+        [OP_NOT_EQUAL] = &&CASE_OP_NOT_EQUAL,
+        [OP_NOT_GREATER] = &&CASE_OP_NOT_GREATER,
+        [OP_NOT_LESS] = &&CASE_OP_NOT_LESS,
+        [OP_POP_JUMP_IF_FALSE] = &&CASE_OP_POP_JUMP_IF_FALSE,
+        [OP_JUMP_IF_EQUAL] = &&CASE_OP_JUMP_IF_EQUAL,
+        [OP_JUMP_IF_NOT_EQUAL] = &&CASE_OP_JUMP_IF_NOT_EQUAL,
+        [OP_JUMP_IF_GREATER] = &&CASE_OP_JUMP_IF_GREATER,
+        [OP_JUMP_IF_NOT_GREATER] = &&CASE_OP_JUMP_IF_NOT_GREATER,
+        [OP_JUMP_IF_LESS] = &&CASE_OP_JUMP_IF_LESS,
+        [OP_JUMP_IF_NOT_LESS] = &&CASE_OP_JUMP_IF_NOT_LESS,
+        [OP_GET_THIS_PROPERTY] = &&CASE_OP_GET_THIS_PROPERTY,
+        [OP_SET_THIS_PROPERTY] = &&CASE_OP_SET_THIS_PROPERTY,
+        [OP_ADD_LOCALS] = &&CASE_OP_ADD_LOCALS,
+        [OP_SUBTRACT_LOCALS] = &&CASE_OP_SUBTRACT_LOCALS,
+        [OP_MULTIPLY_LOCALS] = &&CASE_OP_MULTIPLY_LOCALS,
+        [OP_DIVIDE_LOCALS] = &&CASE_OP_DIVIDE_LOCALS,
+        [OP_ADD_NUM] = &&CASE_OP_ADD_NUM,
+        [OP_ADD_STR] = &&CASE_OP_ADD_STR,
+        [OP_GET_FIELD] = &&CASE_OP_GET_FIELD,
+        [OP_CALL_CLOSURE] = &&CASE_OP_CALL_CLOSURE,
+        [OP_GET_INTRINSIC] = &&CASE_OP_GET_INTRINSIC,
+        [OP_INTRINSIC] = &&CASE_OP_INTRINSIC,
+        [OP_WIDE] = &&CASE_OP_WIDE,
+    };
+
+#ifdef DIRECT_THREADING
+#define DISPATCH()                  \
+    do                              \
+    {                               \
+        TRACE_EXECUTION();          \
+        RECORD_TRACE();             \
+        goto *(ip++)->handler;      \
+    } while (false)
+#else
+#define DISPATCH()                         \
+    do                                     \
+    {                                      \
+        TRACE_EXECUTION();                 \
+        RECORD_TRACE();                    \
+        goto *dispatch_table[READ_BYTE()]; \
+    } while (false)
+#endif
+#define INTERPRET_LOOP DISPATCH();
+#define CASE(op) CASE_##op: COUNT_INSTRUCTION(); COUNT_OPCODE(op);
+#define NEXT DISPATCH()
+#else
+#define INTERPRET_LOOP \
+    for (;;)           \
+        switch (TRACE_EXECUTION(), RECORD_TRACE(), READ_BYTE())
+#define CASE(op) case op: COUNT_INSTRUCTION(); COUNT_OPCODE(op);
+#define NEXT break
+#endif
+
+#ifdef DIRECT_THREADING
+    if (vm->frame_count == 0)
+    {
+        vm->handlers = (const void *const *)dispatch_table;
+        return INTERPRET_OK;
+    }
+#endif
+
+    LOAD_STATE();
+
+    INTERPRET_LOOP
+    {
+        CASE(OP_CONSTANT)
+        {
+            Value constant = READ_CONSTANT();
+            PUSH(constant);
+            NEXT;
+        }
+        CASE(OP_CONSTANT_LONG)
+        {
+            Value constant = READ_CONSTANT_LONG();
+            PUSH(constant);
+            NEXT;
+        }
+        CASE(OP_NIL)
+        {
+            PUSH(NIL_VAL);
+            NEXT;
+        }
+        CASE(OP_TRUE)
+        {
+            PUSH(BOOL_VAL(true));
+            NEXT;
+        }
+        CASE(OP_FALSE)
+        {
+            PUSH(BOOL_VAL(false));
+            NEXT;
+        }
+        CASE(OP_GET_LOCAL)
+        {
+            int slot = READ_BYTE();
+            WIDE_ENTRY(OP_GET_LOCAL, slot = wide_index);
+            PUSH(slots[slot]);
+            NEXT;
+        }
+        CASE(OP_SET_LOCAL)
+        {
+            int slot = READ_BYTE();
+            WIDE_ENTRY(OP_SET_LOCAL, slot = wide_index);
+            slots[slot] = PEEK(0);
+            NEXT;
+        }
+        CASE(OP_GET_GLOBAL)
+        {
+            int slot = READ_BYTE();
+            WIDE_ENTRY(OP_GET_GLOBAL, slot = wide_index);
+            Value value = GLOBAL(slot);
+            if (IS_UNDEFINED(value))
+            {
+                RUNTIME_ERROR("Undefined variable '%s'.", GLOBAL_NAME(slot));
+            }
+            PUSH(value);
+            NEXT;
+        }
+        CASE(OP_DEFINE_GLOBAL)
+        {
+            int slot = READ_BYTE();
+            WIDE_ENTRY(OP_DEFINE_GLOBAL, slot = wide_index);
+            GLOBAL(slot) = PEEK(0);
+            DROP();
+            NEXT;
+        }
+        CASE(OP_SET_GLOBAL)
+        {
+            int slot = READ_BYTE();
+            WIDE_ENTRY(OP_SET_GLOBAL, slot = wide_index);
+            if (IS_UNDEFINED(GLOBAL(slot)))
+            {
+                RUNTIME_ERROR("Undefined variable '%s'.", GLOBAL_NAME(slot));
+            }
+            GLOBAL(slot) = PEEK(0);
+            NEXT;
+        }
+        CASE(OP_POP)
+        {
+            DROP();
+            NEXT;
+        }
+        CASE(OP_GET_UPVALUE)
+        {
+            int slot = READ_BYTE();
+            WIDE_ENTRY(OP_GET_UPVALUE, slot = wide_index);
+            PUSH(*frame->closure->upvalues[slot]->location);
+            NEXT;
+        }
+        CASE(OP_SET_UPVALUE)
+        {
+            int slot = READ_BYTE();
+            WIDE_ENTRY(OP_SET_UPVALUE, slot = wide_index);
+            *frame->closure->upvalues[slot]->location = PEEK(0);
+            NEXT;
+        }
+        CASE(OP_GET_PROPERTY)
+        {
+            // Wide instructions are not quickened.
+            bool narrow = true;
+            ObjString *name = READ_STRING();
+            InlineCache *cache = READ_CACHE();
+            WIDE_ENTRY(OP_GET_PROPERTY, (name = WIDE_STRING(), cache = WIDE_CACHE(), narrow = false));
+            if (!IS_INSTANCE(PEEK(0)))
+            {
+                RUNTIME_ERROR("Only instances have properties.");
+            }
+
+            ObjInstance *instance = AS_INSTANCE(PEEK(0));
+            Value value;
+            if (get_cached_field(cache, instance, &value))
+            {
+                if (narrow)
+                {
+                    SPECIALIZE(PROPERTY_UNITS, OP_GET_FIELD);
+                }
+                SET_TOP(value);
+                NEXT;
+            }
+            bool is_method;
+            if (!get_property(cache, instance, &value, &is_method))
+            {
+                RUNTIME_ERROR("Undefined property '%s'.", name->chars);
+            }
+            if (!is_method)
+            {
+                SET_TOP(value);
+                NEXT;
+            }
+
+            SAVE_STATE();
+            ObjBoundMethod *bound = new_bound_method(vm, peek(vm, 0), AS_CLOSURE(value));
+            vm->stack_top[-1] = OBJ_VAL(bound);
+            FILL();
+            NEXT;
+        }
+        CASE(OP_SET_PROPERTY)
+        {
+            (void)READ_STRING();
+            InlineCache *cache = READ_CACHE();
+            WIDE_ENTRY(OP_SET_PROPERTY, cache = WIDE_CACHE());
+            if (!IS_INSTANCE(PEEK(1)))
+            {
+                RUNTIME_ERROR("Only instances have properties.");
+            }
+
+            ObjInstance *instance = AS_INSTANCE(PEEK(1));
+            SPILL();
+            set_property(vm, cache, instance, PEEK(0));
+            Value value = POP();
+            SET_TOP(value);
+            NEXT;
+        }
+        CASE(OP_GET_SUPER)
+        {
+            ObjString *name = READ_STRING();
+            WIDE_ENTRY(OP_GET_SUPER, name = WIDE_STRING());
+            ObjClass *superclass = AS_CLASS(POP());
+            SAVE_STATE();
+            if (!bind_method(vm, superclass, name))
+            {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            FILL();
+            NEXT;
+        }
+        CASE(OP_EQUAL)
+        {
+            Value b = POP();
+            Value a = PEEK(0);
+            SET_TOP(BOOL_VAL(values_equal(a, b)));
+            NEXT;
+        }
+        CASE(OP_GREATER)
+        {
+            BINARY_OP(BOOL_VAL, >);
+            NEXT;
+        }
+        CASE(OP_LESS)
+        {
+            BINARY_OP(BOOL_VAL, <);
+            NEXT;
+        }
+        CASE(OP_ADD)
+        {
+            if (IS_STRING(PEEK(0)) && IS_STRING(PEEK(1)))
+            {
+                SPECIALIZE(1, OP_ADD_STR);
+                SPILL();
+                concatenate(vm);
+                FILL();
+            }
+            else if (IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1)))
+            {
+                SPECIALIZE(1, OP_ADD_NUM);
+                double b = AS_NUMBER(POP());
+                double a = AS_NUMBER(PEEK(0));
+                SET_TOP(NUMBER_VAL(a + b));
+            }
+            else
+            {
+                RUNTIME_ERROR("Operands must be two numbers or two strings.");
+            }
+            NEXT;
+        }
+        CASE(OP_SUBTRACT)
+        {
+            BINARY_OP(NUMBER_VAL, -);
+            NEXT;
+        }
+        CASE(OP_MULTIPLY)
+        {
+            BINARY_OP(NUMBER_VAL, *);
+            NEXT;
+        }
+        CASE(OP_DIVIDE)
+        {
+            BINARY_OP(NUMBER_VAL, /);
+            NEXT;
+        }
+        CASE(OP_NOT)
+        {
+            SET_TOP(BOOL_VAL(is_falsey(PEEK(0))));
+            NEXT;
+        }
+        CASE(OP_NEGATE)
+        {
+            if (!IS_NUMBER(PEEK(0)))
+            {
+                RUNTIME_ERROR("Operand must be a number.");
+            }
+            SET_TOP(NUMBER_VAL(-AS_NUMBER(PEEK(0))));
+            NEXT;
+        }
+        CASE(OP_PRINT)
+        {
+            print_value(POP());
+            printf("\n");
+            NEXT;
+        }
+        CASE(OP_JUMP)
+        {
+            Code *target = READ_JUMP();
+            WIDE_ENTRY(OP_JUMP, target = WIDE_JUMP());
+            ip = target;
+            NEXT;
+        }
+        CASE(OP_JUMP_IF_FALSE)
+        {
+            Code *target = READ_JUMP();
+            WIDE_ENTRY(OP_JUMP_IF_FALSE, target = WIDE_JUMP());
+            if (is_falsey(PEEK(0)))
+            {
+                ip = target;
+            }
+            NEXT;
+        }
+        CASE(OP_LOOP)
+        {
+            Code *target = READ_LOOP();
+            WIDE_ENTRY(OP_LOOP, target = WIDE_LOOP());
+            ip = target;
+            ObjFunction *function = frame->closure->function;
+#ifdef BASELINE_JIT
+            // A hot loop continues in native code: a trace that returns at its first failing guard, or the whole
+            // function entered at the loop header, which may also run the frame to completion.
+            NativeEntry native = NULL;
+            if (native_stack_exhausted(vm, function))
+            {
+                warm_up(function);
+            }
+            else
+            {
+                native = tier_up_loop(vm, function, code_offset(&function->chunk, ip));
+            }
+            if (native != NULL)
+            {
+                SAVE_STATE();
+                if (!native(vm, frame))
+                {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                if (vm->frame_count == exit_depth)
+                {
+                    if (exit_depth == 0)
+                    {
+                        vm->stack_top = vm->stack;
+                    }
+                    return INTERPRET_OK;
+                }
+                LOAD_STATE();
+            }
+#else
+            warm_up(function);
+#endif
+            NEXT;
+        }
+        CASE(OP_CALL)
+        {
+            int arg_count = READ_BYTE();
+            if (IS_CLOSURE(PEEK(arg_count)))
+            {
+                SPECIALIZE(2, OP_CALL_CLOSURE);
+                CALL_CLOSURE(AS_CLOSURE(PEEK(arg_count)), arg_count);
+                NEXT;
+            }
+            if (IS_NATIVE(PEEK(arg_count)) && (AS_NATIVE(PEEK(arg_count))->flags & NATIVE_NO_ALLOC) &&
+                accepts_arguments(AS_NATIVE(PEEK(arg_count)), arg_count))
+            {
+                // Nothing the native does can collect, so it runs without saving the frame or reloading it after.
+                // Only the arguments have to be in memory.
+                ObjNative *native = AS_NATIVE(PEEK(arg_count));
+                SPILL();
+                Value *args = vm->stack_top - arg_count;
+                const char *error = native->function(vm, arg_count, args, args - 1);
+                if (error != NULL)
+                {
+                    RUNTIME_ERROR("%s", error);
+                }
+                TRUNCATE_AND_PUSH(args - 1, args[-1]);
+                NEXT;
+            }
+            SAVE_STATE();
+            if (!call_value(vm, PEEK(arg_count), arg_count))
+            {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            LOAD_STATE();
+            NEXT;
+        }
+        CASE(OP_TAIL_CALL)
+        {
+            int arg_count = READ_BYTE();
+            SAVE_STATE();
+            if (!tail_call_value(vm, PEEK(arg_count), arg_count))
+            {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            if (vm->frame_count == exit_depth)
+            {
+                // Native code ran the callee to completion in the frame this run was started for.
+                if (exit_depth == 0)
+                {
+                    vm->stack_top = vm->stack;
+                }
+                return INTERPRET_OK;
+            }
+            LOAD_STATE();
+            NEXT;
+        }
+        CASE(OP_INVOKE)
+        {
+            (void)READ_STRING();
+            int arg_count = READ_BYTE();
+            InvokeCache *cache = READ_INVOKE_CACHE();
+            WIDE_ENTRY(OP_INVOKE, (arg_count = READ_BYTE(), cache = WIDE_INVOKE_CACHE()));
+            SAVE_STATE();
+            if (!invoke(vm, cache, arg_count))
+            {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            LOAD_STATE();
+            NEXT;
+        }
+        CASE(OP_SUPER_INVOKE)
+        {
+            (void)READ_STRING();
+            int arg_count = READ_BYTE();
+            InvokeCache *cache = READ_INVOKE_CACHE();
+            WIDE_ENTRY(OP_SUPER_INVOKE, (arg_count = READ_BYTE(), cache = WIDE_INVOKE_CACHE()));
+            ObjClass *superclass = AS_CLASS(POP());
+            SAVE_STATE();
+            if (!super_invoke(vm, cache, superclass, arg_count))
+            {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            LOAD_STATE();
+            NEXT;
+        }
+        CASE(OP_CLOSURE)
+        {
+            // The captures of a wide closure have wide indices too.
+            bool narrow = true;
+            ObjFunction *function = AS_FUNCTION(READ_CONSTANT());
+            WIDE_ENTRY(OP_CLOSURE, (function = AS_FUNCTION(constants[wide_index]), narrow = false));
+            SPILL();
+            ObjClosure *closure = new_closure(vm, function);
+            PUSH(OBJ_VAL(closure));
+            SPILL();
+            for (int i = 0; i < closure->upvalue_count; i++)
+            {
+                int is_local = READ_BYTE();
+                int index = narrow ? READ_BYTE() : (int)READ_3_BYTES();
+                if (is_local)
+                {
+                    closure->upvalues[i] = capture_upvalue(vm, slots + index);
+                }
+                else
+                {
+                    closure->upvalues[i] = frame->closure->upvalues[index];
+                }
+            }
+            NEXT;
+        }
+        CASE(OP_CLOSE_UPVALUE)
+        {
+            SPILL();
+            close_upvalues(vm, vm->stack_top - 1);
+            DROP();
+            NEXT;
+        }
+        CASE(OP_RETURN)
+        {
+            // The result goes straight from the top of the stack into the callee's slot, which becomes the caller's
+            // top of stack. Only a function that captured a local can have upvalues into its frame left to close.
+            Value result = PEEK(0);
+            if (frame->closure->function->captures_locals)
+            {
+                SPILL();
+                close_upvalues(vm, slots);
+            }
+            vm->frame_count--;
+            TRUNCATE_AND_PUSH(slots, result);
+            if (vm->frame_count == exit_depth)
+            {
+                // The script's result is dropped; a nested run leaves the callee's result for its native caller.
+                if (exit_depth == 0)
+                {
+                    vm->stack_top = slots;
+                }
+                else
+                {
+                    SPILL();
+                }
+                return INTERPRET_OK;
+            }
+
+            // The caller's frame is the one right below, so the frame pointer steps down instead of being reloaded.
+            frame--;
+            ip = frame->ip;
+            slots = frame->slots;
+            LOAD_CONSTANTS();
+            NEXT;
+        }
+        CASE(OP_CLASS)
+        {
+            ObjString *name = READ_STRING();
+            WIDE_ENTRY(OP_CLASS, name = WIDE_STRING());
+            SPILL();
+            PUSH(OBJ_VAL(new_class(vm, name)));
+            NEXT;
+        }
+        CASE(OP_INHERIT)
+        {
+            Value superclass = PEEK(1);
+            if (!IS_CLASS(superclass))
+            {
+                RUNTIME_ERROR("Superclass must be a class.");
+            }
+            ObjClass *subclass = AS_CLASS(PEEK(0));
+            SPILL();
+            inherit_methods(vm, subclass, AS_CLASS(superclass));
+            DROP();
+            NEXT;
+        }
+        CASE(OP_METHOD)
+        {
+            ObjString *name = READ_STRING();
+            WIDE_ENTRY(OP_METHOD, name = WIDE_STRING());
+            SPILL();
+            define_method(vm, name);
+            FILL();
+            NEXT;
+        }
+        CASE(OP_FIELD)
+        {
+            ObjString *name = READ_STRING();
+            WIDE_ENTRY(OP_FIELD, name = WIDE_STRING());
+            ObjClass *klass = AS_CLASS(PEEK(0));
+            SPILL();
+            define_class_field(vm, klass, name);
+            FILL();
+            NEXT;
+        }
+        CASE(OP_NOT_EQUAL)
+        {
+            Value b = POP();
+            Value a = PEEK(0);
+            SET_TOP(BOOL_VAL(!values_equal(a, b)));
+            NEXT;
+        }
+        CASE(OP_NOT_GREATER)
+        {
+            BINARY_OP(NOT_BOOL_VAL, >);
+            NEXT;
+        }
+        CASE(OP_NOT_LESS)
+        {
+            BINARY_OP(NOT_BOOL_VAL, <);
+            NEXT;
+        }
+        CASE(OP_POP_JUMP_IF_FALSE)
+        {
+            Code *target = READ_JUMP();
+            WIDE_ENTRY(OP_POP_JUMP_IF_FALSE, target = WIDE_JUMP());
+            if (is_falsey(POP()))
+            {
+                ip = target;
+            }
+            NEXT;
+        }
+        CASE(OP_JUMP_IF_EQUAL)
+        {
+            Code *target = READ_JUMP();
+            WIDE_ENTRY(OP_JUMP_IF_EQUAL, target = WIDE_JUMP());
+            Value b = POP();
+            Value a = POP();
+            if (values_equal(a, b))
+            {
+                ip = target;
+            }
+            NEXT;
+        }
+        CASE(OP_JUMP_IF_NOT_EQUAL)
+        {
+            Code *target = READ_JUMP();
+            WIDE_ENTRY(OP_JUMP_IF_NOT_EQUAL, target = WIDE_JUMP());
+            Value b = POP();
+            Value a = POP();
+            if (!values_equal(a, b))
+            {
+                ip = target;
+            }
+            NEXT;
+        }
+        CASE(OP_JUMP_IF_GREATER)
+        {
+            Code *target = READ_JUMP();
+            WIDE_ENTRY(OP_JUMP_IF_GREATER, target = WIDE_JUMP());
+            COMPARE_AND_JUMP(target, >, true);
+            NEXT;
+        }
+        CASE(OP_JUMP_IF_NOT_GREATER)
+        {
+            Code *target = READ_JUMP();
+            WIDE_ENTRY(OP_JUMP_IF_NOT_GREATER, target = WIDE_JUMP());
+            COMPARE_AND_JUMP(target, >, false);
+            NEXT;
+        }
+        CASE(OP_JUMP_IF_LESS)
+        {
+            Code *target = READ_JUMP();
+            WIDE_ENTRY(OP_JUMP_IF_LESS, target = WIDE_JUMP());
+            COMPARE_AND_JUMP(target, <, true);
+            NEXT;
+        }
+        CASE(OP_JUMP_IF_NOT_LESS)
+        {
+            Code *target = READ_JUMP();
+            WIDE_ENTRY(OP_JUMP_IF_NOT_LESS, target = WIDE_JUMP());
+            COMPARE_AND_JUMP(target, <, false);
+            NEXT;
+        }
+        CASE(OP_GET_THIS_PROPERTY)
+        {
+            ObjString *name = READ_STRING();
+            InlineCache *cache = READ_CACHE();
+            WIDE_ENTRY(OP_GET_THIS_PROPERTY, (name = WIDE_STRING(), cache = WIDE_CACHE()));
+            Value receiver = LOCAL(0);
+            if (!IS_INSTANCE(receiver))
+            {
+                RUNTIME_ERROR("Only instances have properties.");
+            }
+
+            ObjInstance *instance = AS_INSTANCE(receiver);
+            Value value;
+            bool is_method = false;
+            if (!get_cached_field(cache, instance, &value) && !get_property(cache, instance, &value, &is_method))
+            {
+                RUNTIME_ERROR("Undefined property '%s'.", name->chars);
+            }
+            if (!is_method)
+            {
+                PUSH(value);
+                NEXT;
+            }
+
+            PUSH(receiver);
+            SAVE_STATE();
+            ObjBoundMethod *bound = new_bound_method(vm, receiver, AS_CLOSURE(value));
+            vm->stack_top[-1] = OBJ_VAL(bound);
+            FILL();
+            NEXT;
+        }
+        CASE(OP_SET_THIS_PROPERTY)
+        {
+            (void)READ_STRING();
+            InlineCache *cache = READ_CACHE();
+            WIDE_ENTRY(OP_SET_THIS_PROPERTY, cache = WIDE_CACHE());
+            Value receiver = LOCAL(0);
+            if (!IS_INSTANCE(receiver))
+            {
+                RUNTIME_ERROR("Only instances have properties.");
+            }
+
+            SPILL();
+            set_property(vm, cache, AS_INSTANCE(receiver), PEEK(0));
+            NEXT;
+        }
+        CASE(OP_ADD_LOCALS)
+        {
+            uint8_t left = READ_BYTE();
+            uint8_t right = READ_BYTE();
+            Value a = LOCAL(left);
+            Value b = LOCAL(right);
+            if (IS_NUMBER(a) && IS_NUMBER(b))
+            {
+                PUSH(NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b)));
+            }
+            else if (IS_STRING(a) && IS_STRING(b))
+            {
+                PUSH(a);
+                PUSH(b);
+                SPILL();
+                concatenate(vm);
+                FILL();
+            }
+            else
+            {
+                RUNTIME_ERROR("Operands must be two numbers or two strings.");
+            }
+            NEXT;
+        }
+        CASE(OP_SUBTRACT_LOCALS)
+        {
+            LOCALS_BINARY_OP(-);
+            NEXT;
+        }
+        CASE(OP_MULTIPLY_LOCALS)
+        {
+            LOCALS_BINARY_OP(*);
+            NEXT;
+        }
+        CASE(OP_DIVIDE_LOCALS)
+        {
+            LOCALS_BINARY_OP(/);
+            NEXT;
+        }
+        CASE(OP_ADD_NUM)
+        {
+            if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1)))
+            {
+                DESPECIALIZE(1, OP_ADD_NUM, OP_ADD);
+                NEXT;
+            }
+            double b = AS_NUMBER(POP());
+            double a = AS_NUMBER(PEEK(0));
+            SET_TOP(NUMBER_VAL(a + b));
+            NEXT;
+        }
+        CASE(OP_ADD_STR)
+        {
+            if (!IS_STRING(PEEK(0)) || !IS_STRING(PEEK(1)))
+            {
+                DESPECIALIZE(1, OP_ADD_STR, OP_ADD);
+                NEXT;
+            }
+            SPILL();
+            concatenate(vm);
+            FILL();
+            NEXT;
+        }
+        CASE(OP_GET_FIELD)
+        {
+            (void)READ_STRING();
+            InlineCache *cache = READ_CACHE();
+            Value value;
+            if (!IS_INSTANCE(PEEK(0)) || !get_cached_field(cache, AS_INSTANCE(PEEK(0)), &value))
+            {
+                DESPECIALIZE(PROPERTY_UNITS, OP_GET_FIELD, OP_GET_PROPERTY);
+                NEXT;
+            }
+            SET_TOP(value);
+            NEXT;
+        }
+        CASE(OP_CALL_CLOSURE)
+        {
+            int arg_count = READ_BYTE();
+            Value callee = PEEK(arg_count);
+            if (!IS_CLOSURE(callee))
+            {
+                DESPECIALIZE(2, OP_CALL_CLOSURE, OP_CALL);
+                NEXT;
+            }
+            CALL_CLOSURE(AS_CLOSURE(callee), arg_count);
+            NEXT;
+        }
+        CASE(OP_GET_INTRINSIC)
+        {
+            int intrinsic = READ_BYTE();
+            Value value;
+            if (!get_intrinsic(vm, intrinsic, &value))
+            {
+                RUNTIME_ERROR("Undefined variable '%s'.", vm->intrinsic_names[intrinsic]->chars);
+            }
+            PUSH(value);
+            NEXT;
+        }
+        CASE(OP_INTRINSIC)
+        {
+            int intrinsic = READ_BYTE();
+            int arg_count = READ_BYTE();
+            if (is_intrinsic(vm, PEEK(arg_count), intrinsic))
+            {
+                // The compiler has checked the arity, and no intrinsic can collect.
+                SPILL();
+                Value *args = vm->stack_top - arg_count;
+                const char *error = run_intrinsic(vm, intrinsic, arg_count, args, args - 1);
+                if (error != NULL)
+                {
+                    RUNTIME_ERROR("%s", error);
+                }
+                TRUNCATE_AND_PUSH(args - 1, args[-1]);
+                NEXT;
+            }
+            SAVE_STATE();
+            if (!call_value(vm, PEEK(arg_count), arg_count))
+            {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            LOAD_STATE();
+            NEXT;
+        }
+        CASE(OP_WIDE)
+        {
+#ifndef DIRECT_THREADING
+            uint8_t instruction = READ_BYTE();
+            wide_index = (int)READ_3_BYTES();
+            switch (instruction)
+            {
+            case OP_GET_LOCAL:
+                goto WIDE_OP_GET_LOCAL;
+            case OP_SET_LOCAL:
+                goto WIDE_OP_SET_LOCAL;
+            case OP_GET_GLOBAL:
+                goto WIDE_OP_GET_GLOBAL;
+            case OP_DEFINE_GLOBAL:
+                goto WIDE_OP_DEFINE_GLOBAL;
+            case OP_SET_GLOBAL:
+                goto WIDE_OP_SET_GLOBAL;
+            case OP_GET_UPVALUE:
+                goto WIDE_OP_GET_UPVALUE;
+            case OP_SET_UPVALUE:
+                goto WIDE_OP_SET_UPVALUE;
+            case OP_GET_PROPERTY:
+                goto WIDE_OP_GET_PROPERTY;
+            case OP_SET_PROPERTY:
+                goto WIDE_OP_SET_PROPERTY;
+            case OP_GET_SUPER:
+                goto WIDE_OP_GET_SUPER;
+            case OP_INVOKE:
+                goto WIDE_OP_INVOKE;
+            case OP_SUPER_INVOKE:
+                goto WIDE_OP_SUPER_INVOKE;
+            case OP_CLOSURE:
+                goto WIDE_OP_CLOSURE;
+            case OP_CLASS:
+                goto WIDE_OP_CLASS;
+            case OP_METHOD:
+                goto WIDE_OP_METHOD;
+            case OP_FIELD:
+                goto WIDE_OP_FIELD;
+            case OP_GET_THIS_PROPERTY:
+                goto WIDE_OP_GET_THIS_PROPERTY;
+            case OP_SET_THIS_PROPERTY:
+                goto WIDE_OP_SET_THIS_PROPERTY;
+            case OP_JUMP:
+                goto WIDE_OP_JUMP;
+            case OP_JUMP_IF_FALSE:
+                goto WIDE_OP_JUMP_IF_FALSE;
+            case OP_LOOP:
+                goto WIDE_OP_LOOP;
+            case OP_POP_JUMP_IF_FALSE:
+                goto WIDE_OP_POP_JUMP_IF_FALSE;
+            case OP_JUMP_IF_EQUAL:
+                goto WIDE_OP_JUMP_IF_EQUAL;
+            case OP_JUMP_IF_NOT_EQUAL:
+                goto WIDE_OP_JUMP_IF_NOT_EQUAL;
+            case OP_JUMP_IF_GREATER:
+                goto WIDE_OP_JUMP_IF_GREATER;
+            case OP_JUMP_IF_NOT_GREATER:
+                goto WIDE_OP_JUMP_IF_NOT_GREATER;
+            case OP_JUMP_IF_LESS:
+                goto WIDE_OP_JUMP_IF_LESS;
+            case OP_JUMP_IF_NOT_LESS:
+                goto WIDE_OP_JUMP_IF_NOT_LESS;
+            default:
+                break;
+            }
+#endif
+            NEXT;
+        }
+    }
+
+    return INTERPRET_RUNTIME_ERROR;
+
+#undef NEXT
+#undef CASE
+#undef INTERPRET_LOOP
+#undef DISPATCH
+#undef COUNT_OPCODE
+#undef COUNT_INSTRUCTION
+#undef DESPECIALIZE
+#undef SPECIALIZE
+#undef COUNT_GUARD_FAILURE
+#undef COUNT_SPECIALIZED
+#undef REWRITE
+#undef TRACE_EXECUTION
+#undef RECORD_TRACE
+#undef LOCALS_BINARY_OP
+#undef COMPARE_AND_JUMP
+#undef NOT_BOOL_VAL
+#undef BINARY_OP
+#undef RUNTIME_ERROR
+#undef LOAD_STATE
+#undef SAVE_STATE
+#undef LOCAL
+#undef FILL
+#undef SPILL
+#undef TRUNCATE_AND_PUSH
+#undef SET_TOP
+#undef PEEK
+#undef DROP
+#undef POP
+#undef PUSH
+#undef LOAD_FRAME
+#undef SAVE_FRAME
+#undef LOAD_CONSTANTS
+#undef WIDE_ENTRY
+#undef WIDE_STRING
+#undef WIDE_JUMP
+#undef WIDE_CACHE
+#undef WIDE_INVOKE_CACHE
+#undef WIDE_LOOP
+#undef READ_LOOP
+#undef READ_JUMP
+#undef READ_DISTANCE
+#undef READ_STRING
+#undef READ_CACHE
+#undef READ_INVOKE_CACHE
+#undef PROPERTY_UNITS
+#undef READ_CONSTANT_LONG
+#undef READ_CONSTANT
+#undef READ_3_BYTES
+#undef READ_BYTE
+}
+
+// Runtime entry points of the native code. Each does what the matching case of run() does on the vm's stack.
+
+bool jit_get_global(Vm *vm, int slot)
+{
+    Value value = GLOBAL(slot);
+    if (IS_UNDEFINED(value))
+    {
+        runtime_error(vm, "Undefined variable '%s'.", GLOBAL_NAME(slot));
+        return false;
+    }
+    push(vm, value);
+    return true;
+}
+
+void jit_define_global(Vm *vm, int slot)
+{
+    GLOBAL(slot) = pop(vm);
+}
+
+bool jit_set_global(Vm *vm, int slot)
+{
+    if (IS_UNDEFINED(GLOBAL(slot)))
+    {
+        runtime_error(vm, "Undefined variable '%s'.", GLOBAL_NAME(slot));
+        return false;
+    }
+    GLOBAL(slot) = peek(vm, 0);
+    return true;
+}
+
+bool jit_get_property(Vm *vm, InlineCache *cache)
+{
+    if (!IS_INSTANCE(peek(vm, 0)))
+    {
+        runtime_error(vm, "Only instances have properties.");
+        return false;
+    }
+
+    ObjInstance *instance = AS_INSTANCE(peek(vm, 0));
+    Value value;
+    bool is_method = false;
+    if (!get_cached_field(cache, instance, &value) && !get_property(cache, instance, &value, &is_method))
+    {
+        runtime_error(vm, "Undefined property '%s'.", cache->name->chars);
+        return false;
+    }
+    if (is_method)
+    {
+        value = OBJ_VAL(new_bound_method(vm, peek(vm, 0), AS_CLOSURE(value)));
+    }
+    vm->stack_top[-1] = value;
+    return true;
+}
+
+bool jit_set_property(Vm *vm, InlineCache *cache)
+{
+    if (!IS_INSTANCE(peek(vm, 1)))
+    {
+        runtime_error(vm, "Only instances have properties.");
+        return false;
+    }
+
+    set_property(vm, cache, AS_INSTANCE(peek(vm, 1)), peek(vm, 0));
+    Value value = pop(vm);
+    pop(vm);
+    push(vm, value);
+    return true;
+}
+
+bool jit_get_super(Vm *vm, ObjString *name)
+{
+    ObjClass *superclass = AS_CLASS(pop(vm));
+    return bind_method(vm, superclass, name);
+}
+
+bool jit_set_this_property(Vm *vm, InlineCache *cache)
+{
+    Value receiver = vm->frames[vm->frame_count - 1].slots[0];
+    if (!IS_INSTANCE(receiver))
+    {
+        runtime_error(vm, "Only instances have properties.");
+        return false;
+    }
+
+    set_property(vm, cache, AS_INSTANCE(receiver), peek(vm, 0));
+    return true;
+}
+
+bool jit_add(Vm *vm)
+{
+    if (IS_STRING(peek(vm, 0)) && IS_STRING(peek(vm, 1)))
+    {
+        concatenate(vm);
+        return true;
+    }
+    runtime_error(vm, "Operands must be two numbers or two strings.");
+    return false;
+}
+
+bool jit_numbers_error(Vm *vm)
+{
+    runtime_error(vm, "Operands must be numbers.");
+    return false;
+}
+
+bool jit_number_error(Vm *vm)
+{
+    runtime_error(vm, "Operand must be a number.");
+    return false;
+}
+
+void jit_print(Vm *vm)
+{
+    print_value(pop(vm));
+    printf("\n");
+}
+
+// A call that pushed an interpreted frame runs it here, so the native caller continues only once the result is on the
+// stack.
+static bool finish_call(Vm *vm, int frame_count)
+{
+    return vm->frame_count == frame_count || run(vm, frame_count) == INTERPRET_OK;
+}
+
+bool jit_call(Vm *vm, int arg_count)
+{
+    int frame_count = vm->frame_count;
+    return call_value(vm, peek(vm, arg_count), arg_count) && finish_call(vm, frame_count);
+}
+
+// A closure takes over the frame and is left for the interpreter to run, as after a deoptimization, so a chain of tail
+// calls does not nest native activations. Anything else is called and returned from here. Either way the native caller
+// is done with its frame.
+bool jit_tail_call(Vm *vm, int arg_count)
+{
+    ObjClosure *closure = tail_callee(vm, peek(vm, arg_count), arg_count);
+    if (closure != NULL)
+    {
+        return reuse_frame(vm, closure, arg_count);
+    }
+
+    int frame_count = vm->frame_count;
+    if (!call_value(vm, peek(vm, arg_count), arg_count) || !finish_call(vm, frame_count))
+    {
+        return false;
+    }
+    jit_return(vm);
+    return true;
+}
+
+bool jit_get_intrinsic(Vm *vm, int intrinsic)
+{
+    Value value;
+    if (!get_intrinsic(vm, intrinsic, &value))
+    {
+        runtime_error(vm, "Undefined variable '%s'.", vm->intrinsic_names[intrinsic]->chars);
+        return false;
+    }
+    push(vm, value);
+    return true;
+}
+
+bool jit_intrinsic(Vm *vm, int intrinsic, int arg_count)
+{
+    if (!is_intrinsic(vm, peek(vm, arg_count), intrinsic))
+    {
+        return jit_call(vm, arg_count);
+    }
+    Value *args = vm->stack_top - arg_count;
+    const char *error = run_intrinsic(vm, intrinsic, arg_count, args, args - 1);
+    if (error != NULL)
+    {
+        runtime_error(vm, "%s", error);
+        return false;
+    }
+    vm->stack_top = args;
+    return true;
+}
+
+bool jit_invoke(Vm *vm, InvokeCache *cache, int arg_count)
+{
+    int frame_count = vm->frame_count;
+    return invoke(vm, cache, arg_count) && finish_call(vm, frame_count);
+}
+
+bool jit_super_invoke(Vm *vm, InvokeCache *cache, int arg_count)
+{
+    int frame_count = vm->frame_count;
+    ObjClass *superclass = AS_CLASS(pop(vm));
+    return super_invoke(vm, cache, superclass, arg_count) && finish_call(vm, frame_count);
+}
+
+void jit_closure(Vm *vm, ObjFunction *function, const uint8_t *instruction)
+{
+    CallFrame *frame = &vm->frames[vm->frame_count - 1];
+    ObjClosure *closure = new_closure(vm, function);
+    push(vm, OBJ_VAL(closure));
+    for (int i = 0; i < closure->upvalue_count; i++)
+    {
+        bool is_local;
+        int index = capture_operand(instruction, 0, i, &is_local);
+        if (is_local)
+        {
+            closure->upvalues[i] = capture_upvalue(vm, frame->slots + index);
+        }
+        else
+        {
+            closure->upvalues[i] = frame->closure->upvalues[index];
+        }
+    }
+}
+
+void jit_close_upvalue(Vm *vm)
+{
+    close_upvalues(vm, vm->stack_top - 1);
+    pop(vm);
+}
+
+void jit_return(Vm *vm)
+{
+    CallFrame *frame = &vm->frames[vm->frame_count - 1];
+    Value result = pop(vm);
+    if (frame->closure->function->captures_locals)
+    {
+        close_upvalues(vm, frame->slots);
+    }
+    vm->frame_count--;
+    vm->stack_top = frame->slots;
+    push(vm, result);
+}
+
+void jit_class(Vm *vm, ObjString *name)
+{
+    push(vm, OBJ_VAL(new_class(vm, name)));
+}
+
+bool jit_inherit(Vm *vm)
+{
+    Value superclass = peek(vm, 1);
+    if (!IS_CLASS(superclass))
+    {
+        runtime_error(vm, "Superclass must be a class.");
+        return false;
+    }
+    inherit_methods(vm, AS_CLASS(peek(vm, 0)), AS_CLASS(superclass));
+    pop(vm);
+    return true;
+}
+
+void jit_method(Vm *vm, ObjString *name)
+{
+    define_method(vm, name);
+}
+
+void jit_field(Vm *vm, ObjString *name)
+{
+    define_class_field(vm, AS_CLASS(peek(vm, 0)), name);
+}
+
+static void enter_register_frame(Vm *vm, CallFrame *frame)
+{
+    ObjFunction *function = frame->closure->function;
+    Value *end = frame->slots + function->chunk.registers.frame_size;
+    for (Value *slot = frame->slots + function->arity + 1; slot < end; slot++)
+    {
+        *slot = NIL_VAL;
+    }
+    vm->stack_top = end;
+}
+
+// Brings back the window of the caller once a call has finished. Everything above the result register belonged to the
+// call and may have been collected while stack_top was lowered, so it is cleared before the GC can see it again.
+static void resume_register_frame(Vm *vm, CallFrame *frame, Value *result)
+{
+    Value *end = frame->slots + frame->closure->function->chunk.registers.frame_size;
+    for (Value *slot = result + 1; slot < end; slot++)
+    {
+        *slot = NIL_VAL;
+    }
+    vm->stack_top = end;
+}
+
+#ifdef DEBUG_TRACE_EXECUTION
+static void trace_registers(Vm *vm, CallFrame *frame, RegInstruction *pc)
+{
+    printf("Registers | ");
+    for (Value *slot = frame->slots; slot < vm->stack_top; slot++)
+    {
+        printf("[ ");
+        print_value(*slot);
+        printf(" ]");
+    }
+    printf("\n");
+
+    RegisterCode *code = &frame->closure->function->chunk.registers;
+    disassemble_register_instruction(vm, &frame->closure->function->chunk, (int)(pc - code->code));
+}
+#endif
+
+// Interpreter loop for the register backend. Every frame owns a window of frame_size registers starting at its slots,
+// and vm->stack_top stays at the end of the window of the running frame so that the GC sees all of it. Calls lower
+// stack_top to the end of the arguments, exactly as the stack machine would have it, and restore it afterwards.
+static inline bool has_register_code(ObjFunction *function)
+{
+    return function->chunk.registers.code != NULL;
+}
+
+// Runs the frame a register frame has just pushed for a function without register code, along with everything it
+// calls, on the stack interpreter until it returns its result into the callee's slot.
+static bool run_on_stack(Vm *vm, int depth)
+{
+    vm->register_frames = depth;
+    InterpretResult result = run(vm, depth);
+    vm->register_frames = FRAMES_MAX;
+    return result == INTERPRET_OK;
+}
+
+static InterpretResult run_registers(Vm *vm)
+{
+    CallFrame *frame;
+    RegInstruction *code;
+    RegInstruction *pc;
+    RegInstruction *in;
+    Value *slots;
+    Value *constants;
+    int depth;
+
+#define R(index) (slots[index])
+#define K(index) (constants[index])
+#define K_STRING(index) AS_STRING(constants[index])
+#define CACHE(index) (&frame->closure->function->chunk.caches[index])
+#define INVOKE_CACHE(index) (&frame->closure->function->chunk.invoke_caches[index])
+#define NOT_BOOL_VAL(value) BOOL_VAL(!(value))
+
+#define SAVE_FRAME() (frame->pc = pc)
+#define LOAD_FRAME()                                               \
+    do                                                             \
+    {                                                              \
+        depth = vm->frame_count;                                   \
+        frame = &vm->frames[depth - 1];                            \
+        code = frame->closure->function->chunk.registers.code;     \
+        pc = frame->pc;                                            \
+        slots = frame->slots;                                      \
+        constants = frame->closure->function->chunk.constants.values; \
+    } while (false)
+
+// Picks up the callee after a call: either a new frame was pushed, or the call completed in place (natives, classes
+// without an initializer, functions without register code) and the window of the current frame must be restored.
+// Either way the stacks may have moved.
+#define RESUME_AFTER_CALL()                                                                 \
+    do                                                                                      \
+    {                                                                                       \
+        bool entered = vm->frame_count != depth;                                            \
+        if (entered && !has_register_code(vm->frames[depth].closure->function))             \
+        {                                                                                   \
+            if (!run_on_stack(vm, depth))                                                   \
+            {                                                                               \
+                return INTERPRET_RUNTIME_ERROR;                                             \
+            }                                                                               \
+            entered = false;                                                                \
+        }                                                                                   \
+        LOAD_FRAME();                                                                       \
+        if (entered)                                                                        \
+        {                                                                                   \
+            enter_register_frame(vm, frame);                                                \
+        }                                                                                   \
+        else                                                                                \
+        {                                                                                   \
+            resume_register_frame(vm, frame, &R(in->a));                                    \
+        }                                                                                   \
+    } while (false)
+
+#define RUNTIME_ERROR(...)              \
+    do                                  \
+    {                                   \
+        SAVE_FRAME();                   \
+        runtime_error(vm, __VA_ARGS__); \
+        return INTERPRET_RUNTIME_ERROR; \
+    } while (false)
+
+#define BINARY_OP(value_type, op, left, right)                      \
+    do                                                              \
+    {                                                               \
+        Value a = (left);                                           \
+        Value b = (right);                                          \
+        if (!IS_NUMBER(a) || !IS_NUMBER(b))                         \
+        {                                                           \
+            RUNTIME_ERROR("Operands must be numbers.");             \
+        }                                                           \
+        R(in->a) = value_type(AS_NUMBER(a) op AS_NUMBER(b));        \
+    } while (false)
 
-    ObjString *result = take_string(vm, chars, length);
-    pop(vm);
-    pop(vm);
-    push(vm, OBJ_VAL(result));
-}
+#define ADD_OP(left, right)                                                                  \
+    do                                                                                       \
+    {                                                                                        \
+        Value a = (left);                                                                    \
+        Value b = (right);                                                                   \
+        if (IS_NUMBER(a) && IS_NUMBER(b))                                                    \
+        {                                                                                    \
+            R(in->a) = NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b));                              \
+        }                                                                                    \
+        else if (IS_STRING(a) && IS_STRING(b))                                               \
+        {                                                                                    \
+            R(in->a) = OBJ_VAL(concatenate_strings(vm, AS_STRING(a), AS_STRING(b)));         \
+        }                                                                                    \
+        else                                                                                 \
+        {                                                                                    \
+            RUNTIME_ERROR("Operands must be two numbers or two strings.");                   \
+        }                                                                                    \
+    } while (false)
 
-static InterpretResult run(Vm *vm)
-{
-    CallFrame *frame = &vm->frames[vm->frame_count - 1];
-#define READ_BYTE() (*frame->ip++)
-#define READ_SHORT() (frame->ip += 2, ((uint16_t)(frame->ip[-2]) << 8 | (uint16_t)(frame->ip[-1])))
-#define READ_3_BYTES() (frame->ip += 3, ((uint32_t)(frame->ip[-2]) << 16 | (uint32_t)(frame->ip[-2]) << 8 | (uint32_t)(frame->ip[-1])))
-#define READ_CONSTANT() (frame->closure->function->chunk.constants.values[READ_BYTE()])
-#define READ_CONSTANT_LONG() (frame->closure->function->chunk.constants.values[READ_3_BYTES()])
-#define READ_STRING() AS_STRING(READ_CONSTANT())
-#define BINARY_OP(value_type, op)                               \
-    do                                                          \
-    {                                                           \
-        if (!IS_NUMBER(peek(vm, 0)) || !IS_NUMBER(peek(vm, 1))) \
-        {                                                       \
-            runtime_error(vm, "Operands must be numbers.");     \
-            return INTERPRET_RUNTIME_ERROR;                     \
-        }                                                       \
-        double b = AS_NUMBER(pop(vm));                          \
-        double a = AS_NUMBER(pop(vm));                          \
-        push(vm, value_type(a op b));                           \
+#define COMPARE_AND_JUMP(op, jump_if, left, right)                  \
+    do                                                              \
+    {                                                               \
+        Value a = (left);                                           \
+        Value b = (right);                                          \
+        if (!IS_NUMBER(a) || !IS_NUMBER(b))                         \
+        {                                                           \
+            RUNTIME_ERROR("Operands must be numbers.");             \
+        }                                                           \
+        if ((AS_NUMBER(a) op AS_NUMBER(b)) == (jump_if))            \
+        {                                                           \
+            pc = code + in->k;                                      \
+        }                                                           \
+    } while (false)
+
+#define GET_PROPERTY(receiver)                                                   \
+    do                                                                           \
+    {                                                                            \
+        Value object = (receiver);                                               \
+        if (!IS_INSTANCE(object))                                                \
+        {                                                                        \
+            RUNTIME_ERROR("Only instances have properties.");                    \
+        }                                                                        \
+        ObjInstance *instance = AS_INSTANCE(object);                             \
+        InlineCache *cache = CACHE(in->k);                                       \
+        Value value;                                                             \
+        bool is_method = false;                                                  \
+        if (!get_cached_field(cache, instance, &value) &&                        \
+            !get_property(cache, instance, &value, &is_method))                  \
+        {                                                                        \
+            RUNTIME_ERROR("Undefined property '%s'.", cache->name->chars);       \
+        }                                                                        \
+        if (is_method)                                                           \
+        {                                                                        \
+            value = OBJ_VAL(new_bound_method(vm, object, AS_CLOSURE(value)));    \
+        }                                                                        \
+        R(in->a) = value;                                                        \
     } while (false)
 
-    for (;;)
-    {
 #ifdef DEBUG_TRACE_EXECUTION
-        printf("Stack   | ");
-        for (Value *slot = vm->stack; slot < vm->stack_top; slot++)
-        {
-            printf("[ ");
-            print_value(*slot);
-            printf(" ]");
-        }
-        printf("\n");
+#define TRACE_EXECUTION() trace_registers(vm, frame, pc)
+#else
+#define TRACE_EXECUTION() ((void)0)
+#endif
 
-        printf("Globals | ");
-        print_table(&vm->globals);
-        printf("\n");
+#ifdef DEBUG_COUNT_INSTRUCTIONS
+#define COUNT_INSTRUCTION() (vm->instruction_count++)
+#else
+#define COUNT_INSTRUCTION() ((void)0)
+#endif
 
-        printf("Strings | ");
-        print_table(&vm->strings);
-        printf("\n");
+#ifdef THREADED_DISPATCH
+    static void *dispatch_table[] = {
+        [ROP_MOVE] = &&CASE_ROP_MOVE,
+        [ROP_LOAD_CONSTANT] = &&CASE_ROP_LOAD_CONSTANT,
+        [ROP_NIL] = &&CASE_ROP_NIL,
+        [ROP_TRUE] = &&CASE_ROP_TRUE,
+        [ROP_FALSE] = &&CASE_ROP_FALSE,
+        [ROP_GET_GLOBAL] = &&CASE_ROP_GET_GLOBAL,
+        [ROP_DEFINE_GLOBAL] = &&CASE_ROP_DEFINE_GLOBAL,
+        [ROP_SET_GLOBAL] = &&CASE_ROP_SET_GLOBAL,
+        [ROP_GET_UPVALUE] = &&CASE_ROP_GET_UPVALUE,
+        [ROP_SET_UPVALUE] = &&CASE_ROP_SET_UPVALUE,
+        [ROP_GET_PROPERTY] = &&CASE_ROP_GET_PROPERTY,
+        [ROP_SET_PROPERTY] = &&CASE_ROP_SET_PROPERTY,
+        [ROP_GET_SUPER] = &&CASE_ROP_GET_SUPER,
+        [ROP_GET_THIS_PROPERTY] = &&CASE_ROP_GET_THIS_PROPERTY,
+        [ROP_SET_THIS_PROPERTY] = &&CASE_ROP_SET_THIS_PROPERTY,
+        [ROP_EQUAL] = &&CASE_ROP_EQUAL,
+        [ROP_NOT_EQUAL] = &&CASE_ROP_NOT_EQUAL,
+        [ROP_GREATER] = &&CASE_ROP_GREATER,
+        [ROP_NOT_GREATER] = &&CASE_ROP_NOT_GREATER,
+        [ROP_LESS] = &&CASE_ROP_LESS,
+        [ROP_NOT_LESS] = &&CASE_ROP_NOT_LESS,
+        [ROP_ADD] = &&CASE_ROP_ADD,
+        [ROP_SUBTRACT] = &&CASE_ROP_SUBTRACT,
+        [ROP_MULTIPLY] = &&CASE_ROP_MULTIPLY,
+        [ROP_DIVIDE] = &&CASE_ROP_DIVIDE,
+        [ROP_ADD_K] = &&CASE_ROP_ADD_K,
+        [ROP_SUBTRACT_K] = &&CASE_ROP_SUBTRACT_K,
+        [ROP_MULTIPLY_K] = &&CASE_ROP_MULTIPLY_K,
+        [ROP_DIVIDE_K] = &&CASE_ROP_DIVIDE_K,
+        [ROP_NOT] = &&CASE_ROP_NOT,
+        [ROP_NEGATE] = &&CASE_ROP_NEGATE,
+        [ROP_PRINT] = &&CASE_ROP_PRINT,
+        [ROP_JUMP] = &&CASE_ROP_JUMP,
+        [ROP_JUMP_IF_FALSE] = &&CASE_ROP_JUMP_IF_FALSE,
+        [ROP_JUMP_IF_EQUAL] = &&CASE_ROP_JUMP_IF_EQUAL,
+        [ROP_JUMP_IF_NOT_EQUAL] = &&CASE_ROP_JUMP_IF_NOT_EQUAL,
+        [ROP_JUMP_IF_GREATER] = &&CASE_ROP_JUMP_IF_GREATER,
+        [ROP_JUMP_IF_NOT_GREATER] = &&CASE_ROP_JUMP_IF_NOT_GREATER,
+        [ROP_JUMP_IF_LESS] = &&CASE_ROP_JUMP_IF_LESS,
+        [ROP_JUMP_IF_NOT_LESS] = &&CASE_ROP_JUMP_IF_NOT_LESS,
+        [ROP_JUMP_IF_EQUAL_K] = &&CASE_ROP_JUMP_IF_EQUAL_K,
+        [ROP_JUMP_IF_NOT_EQUAL_K] = &&CASE_ROP_JUMP_IF_NOT_EQUAL_K,
+        [ROP_JUMP_IF_GREATER_K] = &&CASE_ROP_JUMP_IF_GREATER_K,
+        [ROP_JUMP_IF_NOT_GREATER_K] = &&CASE_ROP_JUMP_IF_NOT_GREATER_K,
+        [ROP_JUMP_IF_LESS_K] = &&CASE_ROP_JUMP_IF_LESS_K,
+        [ROP_JUMP_IF_NOT_LESS_K] = &&CASE_ROP_JUMP_IF_NOT_LESS_K,
+        [ROP_CALL] = &&CASE_ROP_CALL,
+        [ROP_TAIL_CALL] = &&CASE_ROP_TAIL_CALL,
+        [ROP_INVOKE] = &&CASE_ROP_INVOKE,
+        [ROP_SUPER_INVOKE] = &&CASE_ROP_SUPER_INVOKE,
+        [ROP_CLOSURE] = &&CASE_ROP_CLOSURE,
+        [ROP_CAPTURE] = &&CASE_ROP_CAPTURE,
+        [ROP_CLOSE_UPVALUE] = &&CASE_ROP_CLOSE_UPVALUE,
+        [ROP_RETURN] = &&CASE_ROP_RETURN,
+        [ROP_CLASS] = &&CASE_ROP_CLASS,
+        [ROP_INHERIT] = &&CASE_ROP_INHERIT,
+        [ROP_METHOD] = &&CASE_ROP_METHOD,
+        [ROP_FIELD] = &&CASE_ROP_FIELD,
+        [ROP_GET_INTRINSIC] = &&CASE_ROP_GET_INTRINSIC,
+        [ROP_INTRINSIC] = &&CASE_ROP_INTRINSIC,
+    };
 
-        disassemble_instruction(&frame->closure->function->chunk, (int)(frame->ip - frame->closure->function->chunk.code));
+#define DISPATCH()                      \
+    do                                  \
+    {                                   \
+        TRACE_EXECUTION();              \
+        in = pc++;                      \
+        goto *dispatch_table[in->op];   \
+    } while (false)
+#define INTERPRET_LOOP DISPATCH();
+#define CASE(op) CASE_##op: COUNT_INSTRUCTION();
+#define NEXT DISPATCH()
+#else
+#define INTERPRET_LOOP \
+    for (;;)           \
+        switch (TRACE_EXECUTION(), in = pc++, in->op)
+#define CASE(op) case op: COUNT_INSTRUCTION();
+#define NEXT break
 #endif
-        uint8_t instruction;
-        switch (instruction = READ_BYTE())
+
+    LOAD_FRAME();
+    enter_register_frame(vm, frame);
+
+    INTERPRET_LOOP
+    {
+        CASE(ROP_MOVE)
         {
-        case OP_CONSTANT:
+            R(in->a) = R(in->b);
+            NEXT;
+        }
+        CASE(ROP_LOAD_CONSTANT)
         {
-            Value constant = READ_CONSTANT();
-            push(vm, constant);
-            break;
+            R(in->a) = K(in->k);
+            NEXT;
         }
-        case OP_CONSTANT_LONG:
+        CASE(ROP_NIL)
         {
-            Value constant = READ_CONSTANT_LONG();
-            push(vm, constant);
-            break;
+            R(in->a) = NIL_VAL;
+            NEXT;
         }
-        case OP_NIL:
-            push(vm, NIL_VAL);
-            break;
-        case OP_TRUE:
-            push(vm, BOOL_VAL(true));
-            break;
-        case OP_FALSE:
-            push(vm, BOOL_VAL(false));
-            break;
-        case OP_GET_LOCAL:
+        CASE(ROP_TRUE)
         {
-            uint8_t slot = READ_BYTE();
-            push(vm, frame->slots[slot]);
-            break;
+            R(in->a) = BOOL_VAL(true);
+            NEXT;
         }
-        case OP_SET_LOCAL:
+        CASE(ROP_FALSE)
         {
-            uint8_t slot = READ_BYTE();
-            frame->slots[slot] = peek(vm, 0);
-            break;
+            R(in->a) = BOOL_VAL(false);
+            NEXT;
         }
-        case OP_GET_GLOBAL:
+        CASE(ROP_GET_GLOBAL)
         {
-            ObjString *name = READ_STRING();
-            Value value;
-            if (!table_get(&vm->globals, name, &value))
+            Value value = GLOBAL(in->k);
+            if (IS_UNDEFINED(value))
             {
-                runtime_error(vm, "Undefined variable '%s'.", name->chars);
-                return INTERPRET_RUNTIME_ERROR;
+                RUNTIME_ERROR("Undefined variable '%s'.", GLOBAL_NAME(in->k));
             }
-            push(vm, value);
-            break;
+            R(in->a) = value;
+            NEXT;
         }
-        case OP_DEFINE_GLOBAL:
+        CASE(ROP_DEFINE_GLOBAL)
         {
-            ObjString *name = READ_STRING();
-            table_set(vm, &vm->globals, name, peek(vm, 0));
-            pop(vm);
-            break;
+            GLOBAL(in->k) = R(in->a);
+            NEXT;
         }
-        case OP_SET_GLOBAL:
+        CASE(ROP_SET_GLOBAL)
         {
-            ObjString *name = READ_STRING();
-            if (table_set(vm, &vm->globals, name, peek(vm, 0)))
+            if (IS_UNDEFINED(GLOBAL(in->k)))
             {
-                table_delete(&vm->globals, name);
-                runtime_error(vm, "Undefined variable '%s'.", name->chars);
-                return INTERPRET_RUNTIME_ERROR;
+                RUNTIME_ERROR("Undefined variable '%s'.", GLOBAL_NAME(in->k));
             }
-            break;
+            GLOBAL(in->k) = R(in->a);
+            NEXT;
         }
-        case OP_POP:
-            pop(vm);
-            break;
-        case OP_GET_UPVALUE:
+        CASE(ROP_GET_UPVALUE)
         {
-            uint8_t slot = READ_BYTE();
-            push(vm, *frame->closure->upvalues[slot]->location);
-            break;
+            R(in->a) = *frame->closure->upvalues[in->b]->location;
+            NEXT;
         }
-        case OP_SET_UPVALUE:
+        CASE(ROP_SET_UPVALUE)
         {
-            uint8_t slot = READ_BYTE();
-            *frame->closure->upvalues[slot]->location = peek(vm, 0);
-            break;
+            *frame->closure->upvalues[in->b]->location = R(in->a);
+            NEXT;
         }
-        case OP_GET_PROPERTY:
+        CASE(ROP_GET_PROPERTY)
         {
-            if (!IS_INSTANCE(peek(vm, 0)))
-            {
-                runtime_error(vm, "Only instances have properties.");
-                return INTERPRET_RUNTIME_ERROR;
-            }
-
-            ObjInstance *instance = AS_INSTANCE(peek(vm, 0));
-            ObjString *name = READ_STRING();
-
-            Value value;
-            if (table_get(&instance->fields, name, &value))
+            GET_PROPERTY(R(in->b));
+            NEXT;
+        }
+        CASE(ROP_SET_PROPERTY)
+        {
+            if (!IS_INSTANCE(R(in->b)))
             {
-                pop(vm);
-                push(vm, value);
-                break;
+                RUNTIME_ERROR("Only instances have properties.");
             }
-
-            if (!bind_method(vm, instance->klass, name))
+            set_property(vm, CACHE(in->k), AS_INSTANCE(R(in->b)), R(in->c));
+            R(in->a) = R(in->c);
+            NEXT;
+        }
+        CASE(ROP_GET_SUPER)
+        {
+            ObjString *name = K_STRING(in->k);
+            ObjClosure *method = class_method(AS_CLASS(R(in->c)), name);
+            if (method == NULL)
             {
-                return INTERPRET_RUNTIME_ERROR;
+                RUNTIME_ERROR("Undefined property '%s'.", name->chars);
             }
-
-            break;
+            R(in->a) = OBJ_VAL(new_bound_method(vm, R(in->b), method));
+            NEXT;
+        }
+        CASE(ROP_GET_THIS_PROPERTY)
+        {
+            GET_PROPERTY(R(0));
+            NEXT;
         }
-        case OP_SET_PROPERTY:
+        CASE(ROP_SET_THIS_PROPERTY)
         {
-            if (!IS_INSTANCE(peek(vm, 1)))
+            if (!IS_INSTANCE(R(0)))
             {
-                runtime_error(vm, "Only instances have properties.");
-                return INTERPRET_RUNTIME_ERROR;
+                RUNTIME_ERROR("Only instances have properties.");
             }
-
-            ObjInstance *instance = AS_INSTANCE(peek(vm, 1));
-            table_set(vm, &instance->fields, READ_STRING(), peek(vm, 0));
-            Value value = pop(vm);
-            pop(vm);
-            push(vm, value);
-            break;
+            set_property(vm, CACHE(in->k), AS_INSTANCE(R(0)), R(in->a));
+            NEXT;
         }
-        case OP_GET_SUPER:
+        CASE(ROP_EQUAL)
         {
-            ObjString *name = READ_STRING();
-            ObjClass *superclass = AS_CLASS(pop(vm));
-            if (!bind_method(vm, superclass, name))
+            R(in->a) = BOOL_VAL(values_equal(R(in->b), R(in->c)));
+            NEXT;
+        }
+        CASE(ROP_NOT_EQUAL)
+        {
+            R(in->a) = BOOL_VAL(!values_equal(R(in->b), R(in->c)));
+            NEXT;
+        }
+        CASE(ROP_GREATER)
+        {
+            BINARY_OP(BOOL_VAL, >, R(in->b), R(in->c));
+            NEXT;
+        }
+        CASE(ROP_NOT_GREATER)
+        {
+            BINARY_OP(NOT_BOOL_VAL, >, R(in->b), R(in->c));
+            NEXT;
+        }
+        CASE(ROP_LESS)
+        {
+            BINARY_OP(BOOL_VAL, <, R(in->b), R(in->c));
+            NEXT;
+        }
+        CASE(ROP_NOT_LESS)
+        {
+            BINARY_OP(NOT_BOOL_VAL, <, R(in->b), R(in->c));
+            NEXT;
+        }
+        CASE(ROP_ADD)
+        {
+            ADD_OP(R(in->b), R(in->c));
+            NEXT;
+        }
+        CASE(ROP_SUBTRACT)
+        {
+            BINARY_OP(NUMBER_VAL, -, R(in->b), R(in->c));
+            NEXT;
+        }
+        CASE(ROP_MULTIPLY)
+        {
+            BINARY_OP(NUMBER_VAL, *, R(in->b), R(in->c));
+            NEXT;
+        }
+        CASE(ROP_DIVIDE)
+        {
+            BINARY_OP(NUMBER_VAL, /, R(in->b), R(in->c));
+            NEXT;
+        }
+        CASE(ROP_ADD_K)
+        {
+            ADD_OP(R(in->b), K(in->k));
+            NEXT;
+        }
+        CASE(ROP_SUBTRACT_K)
+        {
+            BINARY_OP(NUMBER_VAL, -, R(in->b), K(in->k));
+            NEXT;
+        }
+        CASE(ROP_MULTIPLY_K)
+        {
+            BINARY_OP(NUMBER_VAL, *, R(in->b), K(in->k));
+            NEXT;
+        }
+        CASE(ROP_DIVIDE_K)
+        {
+            BINARY_OP(NUMBER_VAL, /, R(in->b), K(in->k));
+            NEXT;
+        }
+        CASE(ROP_NOT)
+        {
+            R(in->a) = BOOL_VAL(is_falsey(R(in->b)));
+            NEXT;
+        }
+        CASE(ROP_NEGATE)
+        {
+            if (!IS_NUMBER(R(in->b)))
             {
-                return INTERPRET_RUNTIME_ERROR;
+                RUNTIME_ERROR("Operand must be a number.");
             }
-            break;
+            R(in->a) = NUMBER_VAL(-AS_NUMBER(R(in->b)));
+            NEXT;
         }
-        case OP_EQUAL:
+        CASE(ROP_PRINT)
         {
-            Value b = pop(vm);
-            Value a = pop(vm);
-            push(vm, BOOL_VAL(values_equal(a, b)));
-            break;
+            print_value(R(in->a));
+            printf("\n");
+            NEXT;
         }
-        case OP_GREATER:
-            BINARY_OP(BOOL_VAL, >);
-            break;
-        case OP_LESS:
-            BINARY_OP(BOOL_VAL, <);
-            break;
-        case OP_ADD:
-            if (IS_STRING(peek(vm, 0)) && IS_STRING(peek(vm, 1)))
+        CASE(ROP_JUMP)
+        {
+            pc = code + in->k;
+            NEXT;
+        }
+        CASE(ROP_JUMP_IF_FALSE)
+        {
+            if (is_falsey(R(in->a)))
             {
-                concatenate(vm);
+                pc = code + in->k;
             }
-            else if (IS_NUMBER(peek(vm, 0)) && IS_NUMBER(peek(vm, 1)))
+            NEXT;
+        }
+        CASE(ROP_JUMP_IF_EQUAL)
+        {
+            if (values_equal(R(in->a), R(in->b)))
             {
-                double b = AS_NUMBER(pop(vm));
-                double a = AS_NUMBER(pop(vm));
-                push(vm, NUMBER_VAL(a + b));
+                pc = code + in->k;
             }
-            else
+            NEXT;
+        }
+        CASE(ROP_JUMP_IF_NOT_EQUAL)
+        {
+            if (!values_equal(R(in->a), R(in->b)))
             {
-                runtime_error(vm, "Operands must be two numbers or two strings.");
-                return INTERPRET_RUNTIME_ERROR;
+                pc = code + in->k;
             }
-            break;
-        case OP_SUBTRACT:
-            BINARY_OP(NUMBER_VAL, -);
-            break;
-        case OP_MULTIPLY:
-            BINARY_OP(NUMBER_VAL, *);
-            break;
-        case OP_DIVIDE:
-            BINARY_OP(NUMBER_VAL, /);
-            break;
-        case OP_NOT:
-            push(vm, BOOL_VAL(is_falsey(pop(vm))));
-            break;
-        case OP_NEGATE:
-            if (!IS_NUMBER(peek(vm, 0)))
+            NEXT;
+        }
+        CASE(ROP_JUMP_IF_GREATER)
+        {
+            COMPARE_AND_JUMP(>, true, R(in->a), R(in->b));
+            NEXT;
+        }
+        CASE(ROP_JUMP_IF_NOT_GREATER)
+        {
+            COMPARE_AND_JUMP(>, false, R(in->a), R(in->b));
+            NEXT;
+        }
+        CASE(ROP_JUMP_IF_LESS)
+        {
+            COMPARE_AND_JUMP(<, true, R(in->a), R(in->b));
+            NEXT;
+        }
+        CASE(ROP_JUMP_IF_NOT_LESS)
+        {
+            COMPARE_AND_JUMP(<, false, R(in->a), R(in->b));
+            NEXT;
+        }
+        CASE(ROP_JUMP_IF_EQUAL_K)
+        {
+            if (values_equal(R(in->a), K(in->c)))
             {
-                runtime_error(vm, "Operand must be a number.");
-                return INTERPRET_RUNTIME_ERROR;
+                pc = code + in->k;
             }
-            push(vm, NUMBER_VAL(-AS_NUMBER(pop(vm))));
-            break;
-        case OP_PRINT:
-            print_value(pop(vm));
-            printf("\n");
-            break;
-        case OP_JUMP:
-        {
-            uint16_t offset = READ_SHORT();
-            frame->ip += offset;
-            break;
+            NEXT;
         }
-        case OP_JUMP_IF_FALSE:
+        CASE(ROP_JUMP_IF_NOT_EQUAL_K)
         {
-            uint16_t offset = READ_SHORT();
-            if (is_falsey(peek(vm, 0)))
+            if (!values_equal(R(in->a), K(in->c)))
             {
-                frame->ip += offset;
+                pc = code + in->k;
             }
-            break;
+            NEXT;
         }
-        case OP_LOOP:
+        CASE(ROP_JUMP_IF_GREATER_K)
         {
-            uint16_t offset = READ_SHORT();
-            frame->ip -= offset;
-            break;
+            COMPARE_AND_JUMP(>, true, R(in->a), K(in->c));
+            NEXT;
         }
-        case OP_CALL:
+        CASE(ROP_JUMP_IF_NOT_GREATER_K)
         {
-            int arg_count = READ_BYTE();
-            if (!call_value(vm, peek(vm, arg_count), arg_count))
+            COMPARE_AND_JUMP(>, false, R(in->a), K(in->c));
+            NEXT;
+        }
+        CASE(ROP_JUMP_IF_LESS_K)
+        {
+            COMPARE_AND_JUMP(<, true, R(in->a), K(in->c));
+            NEXT;
+        }
+        CASE(ROP_JUMP_IF_NOT_LESS_K)
+        {
+            COMPARE_AND_JUMP(<, false, R(in->a), K(in->c));
+            NEXT;
+        }
+        CASE(ROP_CALL)
+        {
+            vm->stack_top = &R(in->a) + in->b + 1;
+            SAVE_FRAME();
+            if (!call_value(vm, R(in->a), in->b))
             {
                 return INTERPRET_RUNTIME_ERROR;
             }
-            frame = &vm->frames[vm->frame_count - 1];
-            break;
+            RESUME_AFTER_CALL();
+            NEXT;
         }
-        case OP_INVOKE:
+        CASE(ROP_TAIL_CALL)
         {
-            ObjString *method = READ_STRING();
-            int arg_count = READ_BYTE();
-            if (!invoke(vm, method, arg_count))
+            vm->stack_top = &R(in->a) + in->b + 1;
+            SAVE_FRAME();
+            ObjClosure *closure = tail_callee(vm, R(in->a), in->b);
+            if (closure == NULL || !has_register_code(closure->function))
+            {
+                // A callee that runs on the stack interpreter is called normally, and the return after the call
+                // passes its result on.
+                if (closure == NULL ? !call_value(vm, R(in->a), in->b) : !call(vm, closure, in->b))
+                {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                RESUME_AFTER_CALL();
+                NEXT;
+            }
+            if (!reuse_frame(vm, closure, in->b) || !enter_frame(vm, &vm->frames[vm->frame_count - 1]))
             {
                 return INTERPRET_RUNTIME_ERROR;
             }
-            frame = &vm->frames[vm->frame_count - 1];
-            break;
+            LOAD_FRAME();
+            enter_register_frame(vm, frame);
+            NEXT;
         }
-        case OP_SUPER_INVOKE:
+        CASE(ROP_INVOKE)
         {
-            ObjString *method = READ_STRING();
-            int argCount = READ_BYTE();
-            ObjClass *superclass = AS_CLASS(pop(vm));
-            if (!invoke_from_class(vm, superclass, method, argCount))
+            vm->stack_top = &R(in->a) + in->b + 1;
+            SAVE_FRAME();
+            if (!invoke(vm, INVOKE_CACHE(in->k), in->b))
             {
                 return INTERPRET_RUNTIME_ERROR;
             }
-            frame = &vm->frames[vm->frame_count - 1];
-            break;
+            RESUME_AFTER_CALL();
+            NEXT;
         }
-        case OP_CLOSURE:
+        CASE(ROP_SUPER_INVOKE)
         {
-            ObjFunction *function = AS_FUNCTION(READ_CONSTANT());
-            ObjClosure *closure = new_closure(vm, function);
-            push(vm, OBJ_VAL(closure));
+            ObjClass *superclass = AS_CLASS(R(in->c));
+            vm->stack_top = &R(in->a) + in->b + 1;
+            SAVE_FRAME();
+            if (!super_invoke(vm, INVOKE_CACHE(in->k), superclass, in->b))
+            {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            RESUME_AFTER_CALL();
+            NEXT;
+        }
+        CASE(ROP_CLOSURE)
+        {
+            ObjClosure *closure = new_closure(vm, AS_FUNCTION(K(in->k)));
+            R(in->a) = OBJ_VAL(closure);
             for (int i = 0; i < closure->upvalue_count; i++)
             {
-                uint8_t is_local = READ_BYTE();
-                uint8_t index = READ_BYTE();
-                if (is_local)
+                RegInstruction *capture = pc++;
+                if (capture->a)
                 {
-                    closure->upvalues[i] = capture_upvalue(vm, frame->slots + index);
+                    closure->upvalues[i] = capture_upvalue(vm, slots + capture->b);
                 }
                 else
                 {
-                    closure->upvalues[i] = frame->closure->upvalues[index];
+                    closure->upvalues[i] = frame->closure->upvalues[capture->b];
                 }
             }
-            break;
+            NEXT;
         }
-        case OP_CLOSE_UPVALUE:
+        CASE(ROP_CAPTURE)
         {
-            close_upvalues(vm, vm->stack_top - 1);
-            pop(vm);
-            break;
+            NEXT;
+        }
+        CASE(ROP_CLOSE_UPVALUE)
+        {
+            close_upvalues(vm, &R(in->a));
+            NEXT;
         }
-        case OP_RETURN:
+        CASE(ROP_RETURN)
         {
-            Value result = pop(vm);
-            close_upvalues(vm, frame->slots);
+            Value result = R(in->a);
+            if (frame->closure->function->captures_locals)
+            {
+                close_upvalues(vm, slots);
+            }
             vm->frame_count--;
             if (vm->frame_count == 0)
             {
-                pop(vm);
+                vm->stack_top = slots;
                 return INTERPRET_OK;
             }
 
-            vm->stack_top = frame->slots;
-            push(vm, result);
-            frame = &vm->frames[vm->frame_count - 1];
-            break;
+            *slots = result;
+            Value *result_slot = slots;
+            LOAD_FRAME();
+            resume_register_frame(vm, frame, result_slot);
+            NEXT;
         }
-        case OP_CLASS:
+        CASE(ROP_CLASS)
         {
-            push(vm, OBJ_VAL(new_class(vm, READ_STRING())));
-            break;
+            R(in->a) = OBJ_VAL(new_class(vm, K_STRING(in->k)));
+            NEXT;
         }
-        case OP_INHERIT:
+        CASE(ROP_INHERIT)
         {
-            Value superclass = peek(vm, 1);
-            if (!IS_CLASS(superclass))
+            if (!IS_CLASS(R(in->a)))
             {
-                runtime_error(vm, "Superclass must be a class.");
-                return INTERPRET_RUNTIME_ERROR;
+                RUNTIME_ERROR("Superclass must be a class.");
             }
-            ObjClass *subclass = AS_CLASS(peek(vm, 0));
-            table_add_all(vm, &AS_CLASS(superclass)->methods, &subclass->methods);
-            pop(vm);
-            break;
+            inherit_methods(vm, AS_CLASS(R(in->b)), AS_CLASS(R(in->a)));
+            NEXT;
         }
-        case OP_METHOD:
+        CASE(ROP_METHOD)
         {
-            define_method(vm, READ_STRING());
-            break;
+            define_class_method(vm, AS_CLASS(R(in->a)), K_STRING(in->k), AS_CLOSURE(R(in->b)));
+            NEXT;
         }
+        CASE(ROP_FIELD)
+        {
+            define_class_field(vm, AS_CLASS(R(in->a)), K_STRING(in->k));
+            NEXT;
+        }
+        CASE(ROP_GET_INTRINSIC)
+        {
+            if (!get_intrinsic(vm, in->k, &R(in->a)))
+            {
+                RUNTIME_ERROR("Undefined variable '%s'.", vm->intrinsic_names[in->k]->chars);
+            }
+            NEXT;
+        }
+        CASE(ROP_INTRINSIC)
+        {
+            if (is_intrinsic(vm, R(in->a), in->c))
+            {
+                const char *error = run_intrinsic(vm, in->c, in->b, &R(in->a) + 1, &R(in->a));
+                if (error != NULL)
+                {
+                    RUNTIME_ERROR("%s", error);
+                }
+                NEXT;
+            }
+            vm->stack_top = &R(in->a) + in->b + 1;
+            SAVE_FRAME();
+            if (!call_value(vm, R(in->a), in->b))
+            {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            RESUME_AFTER_CALL();
+            NEXT;
         }
     }
 
+    return INTERPRET_RUNTIME_ERROR;
+
+#undef NEXT
+#undef CASE
+#undef INTERPRET_LOOP
+#undef DISPATCH
+#undef COUNT_INSTRUCTION
+#undef TRACE_EXECUTION
+#undef GET_PROPERTY
+#undef COMPARE_AND_JUMP
+#undef ADD_OP
 #undef BINARY_OP
-#undef READ_STRING
-#undef READ_CONSTANT_LONG
-#undef READ_CONSTANT
-#undef READ_3_BYTES
-#undef READ_SHORT
-#undef READ_BYTE
+#undef RUNTIME_ERROR
+#undef RESUME_AFTER_CALL
+#undef LOAD_FRAME
+#undef SAVE_FRAME
+#undef NOT_BOOL_VAL
+#undef CACHE
+#undef INVOKE_CACHE
+#undef K_STRING
+#undef K
+#undef R
+}
+
+// Functions the register backend cannot express are left without register code and run on the stack interpreter.
+static void translate_function(Vm *vm, ObjFunction *function)
+{
+    if (translate_chunk(vm, &function->chunk, function->arity))
+    {
+        if (function->chunk.registers.frame_size > function->max_slots)
+        {
+            function->max_slots = function->chunk.registers.frame_size;
+        }
+#ifdef DEBUG_PRINT_CODE
+        disassemble_register_code(vm, &function->chunk, function->name != NULL ? function->name->chars : "<script>");
+#endif
+    }
+    for (int i = 0; i < function->chunk.constants.count; i++)
+    {
+        if (IS_FUNCTION(function->chunk.constants.values[i]))
+        {
+            translate_function(vm, AS_FUNCTION(function->chunk.constants.values[i]));
+        }
+    }
 }
 
 void init_vm(Vm *vm)
 {
     vm->compiler = NULL;
+    vm->backend = BACKEND_STACK;
+    vm->register_frames = FRAMES_MAX;
+#ifdef BASELINE_JIT
+    vm->jit_enabled = true;
+#endif
+    vm->native_stack_base = 0;
+    init_stacks(vm);
     reset_stack(vm);
-    init_table(vm, &vm->globals);
+    init_value_array(vm, &vm->global_values);
+    init_value_array(vm, &vm->global_names);
+    init_table(vm, &vm->global_constants);
     init_table(vm, &vm->strings);
     vm->bytes_allocated = 0;
     vm->next_gc = 1024 * 1024;
@@ -688,12 +3053,36 @@ void init_vm(Vm *vm)
     vm->gray_count = 0;
     vm->gray_stack = NULL;
     vm->init_string = NULL;
+    vm->selector_count = 0;
+    vm->columnar_classes = NULL;
+    memset(vm->intrinsics, 0, sizeof(vm->intrinsics));
+    memset(vm->intrinsic_names, 0, sizeof(vm->intrinsic_names));
+    memset(vm->method_cache, 0, sizeof(vm->method_cache));
     vm->init_string = copy_string(vm, "init", 4);
+#ifdef DEBUG_COUNT_OPCODE_PAIRS
+    vm->previous_opcode = OP_CALL;
+    memset(vm->opcode_pairs, 0, sizeof(vm->opcode_pairs));
+#endif
+#ifdef DEBUG_COUNT_INSTRUCTIONS
+    vm->instruction_count = 0;
+#endif
+#ifdef DEBUG_COUNT_SPECIALIZATIONS
+    memset(vm->specialized, 0, sizeof(vm->specialized));
+    memset(vm->guard_failures, 0, sizeof(vm->guard_failures));
+#endif
+#ifdef BASELINE_JIT
+    memset(&vm->tier_stats, 0, sizeof(vm->tier_stats));
+#endif
+#ifdef TRACING_JIT
+    memset(&vm->trace_stats, 0, sizeof(vm->trace_stats));
+#endif
 
-    define_native(vm, "clock", 0, clock_native);
-    define_native(vm, "err", 0, err_native);
-    define_native(vm, "has_field", 2, has_field_native);
-    define_native(vm, "delete_field", 2, delete_field_native);
+    define_intrinsics(vm);
+    define_native(vm, "err", 0, 0, NATIVE_NO_ALLOC, err_native);
+
+#ifdef DIRECT_THREADING
+    run(vm, 0);
+#endif
 }
 
 void free_vm(Vm *vm)
@@ -702,7 +3091,22 @@ void free_vm(Vm *vm)
     vm->init_string = NULL;
     free_objects(vm);
     free_table(vm, &vm->strings);
-    free_table(vm, &vm->globals);
+    free_value_array(vm, &vm->global_values);
+    free_value_array(vm, &vm->global_names);
+    free_table(vm, &vm->global_constants);
+    free_stacks(vm);
+}
+
+void list_functions(Vm *vm, ObjFunction *function, ValueArray *functions)
+{
+    write_value_array(vm, functions, OBJ_VAL(function));
+    for (int i = 0; i < function->chunk.constants.count; i++)
+    {
+        if (IS_FUNCTION(function->chunk.constants.values[i]))
+        {
+            list_functions(vm, AS_FUNCTION(function->chunk.constants.values[i]), functions);
+        }
+    }
 }
 
 InterpretResult interpret(Vm *vm, const char *source)
@@ -716,26 +3120,79 @@ InterpretResult interpret(Vm *vm, const char *source)
     vm->compiler = &compiler;
 
     ObjFunction *function = compile(&compiler);
-
-    if (function == NULL)
+    InterpretResult result = INTERPRET_COMPILE_ERROR;
+    if (function != NULL)
     {
-        free_compiler(&compiler);
-        free_scanner(&scanner);
-        free_parser(&parser);
-        return INTERPRET_COMPILE_ERROR;
+        push(vm, OBJ_VAL(function));
+        result = interpret_function(vm, function);
     }
 
-    push(vm, OBJ_VAL(function));
-    ObjClosure *closure = new_closure(vm, function);
-    pop(vm);
-    push(vm, OBJ_VAL(closure));
-    call(vm, closure, 0);
-
-    InterpretResult result = run(vm);
-
     free_compiler(&compiler);
     vm->compiler = NULL;
     free_scanner(&scanner);
     free_parser(&parser);
     return result;
 }
+
+InterpretResult interpret_function(Vm *vm, ObjFunction *function)
+{
+#ifdef DIRECT_THREADING
+    predecode_function(vm, function);
+#endif
+    if (vm->backend == BACKEND_REGISTER)
+    {
+        translate_function(vm, function);
+    }
+    ObjClosure *closure = new_closure(vm, function);
+    pop(vm);
+    push(vm, OBJ_VAL(closure));
+    char stack_base;
+    vm->native_stack_base = (uintptr_t)&stack_base;
+    InterpretResult result;
+    if (!call(vm, closure, 0))
+    {
+        result = INTERPRET_RUNTIME_ERROR;
+    }
+    else if (vm->frame_count == 0)
+    {
+        // The script ran to completion as native code.
+        reset_stack(vm);
+        result = INTERPRET_OK;
+    }
+    else
+    {
+        vm->register_frames = has_register_code(function) ? FRAMES_MAX : 0;
+        result = vm->backend == BACKEND_REGISTER && has_register_code(function) ? run_registers(vm) : run(vm, 0);
+    }
+#ifdef DEBUG_COUNT_INSTRUCTIONS
+    fprintf(stderr, "== %llu instructions dispatched ==\n", (unsigned long long)vm->instruction_count);
+#endif
+#ifdef DEBUG_COUNT_OPCODE_PAIRS
+    print_opcode_pairs(vm->opcode_pairs, 20);
+#endif
+#ifdef DEBUG_COUNT_SPECIALIZATIONS
+    print_specializations(vm->specialized, vm->guard_failures);
+#endif
+#ifdef DEBUG_COUNT_INLINE_CACHES
+    fprintf(stderr, "== inline caches ==\n");
+    for (Obj *object = vm->objects; object != NULL; object = object->next)
+    {
+        if (object->type == OBJ_FUNCTION)
+        {
+            ObjFunction *function = (ObjFunction *)object;
+            print_inline_caches(&function->chunk, function->name == NULL ? "script" : function->name->chars);
+        }
+    }
+#endif
+#ifdef DEBUG_COUNT_TIERS
+    fprintf(stderr, "== %llu functions compiled, %llu loop entries, %llu deoptimizations ==\n",
+            (unsigned long long)vm->tier_stats.compiled, (unsigned long long)vm->tier_stats.osr_entries,
+            (unsigned long long)vm->tier_stats.deoptimized);
+#endif
+#ifdef DEBUG_COUNT_TRACES
+    fprintf(stderr, "== %llu traces recorded, %llu aborted, %llu trace exits ==\n",
+            (unsigned long long)vm->trace_stats.recorded, (unsigned long long)vm->trace_stats.aborted,
+            (unsigned long long)vm->trace_stats.exits);
+#endif
+    return result;
+}
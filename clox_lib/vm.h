@@ -1,32 +1,87 @@
 #ifndef CLOX_VM_H
 #define CLOX_VM_H
 
+#include "intrinsic.h"
 #include "object.h"
 #include "table.h"
+#include "tier.h"
 #include "value.h"
 
-#define FRAMES_MAX 64
+// Both stacks start out small and grow on demand, up to FRAMES_MAX frames, which is the recursion limit.
+#define FRAMES_INITIAL 8
+#define FRAMES_MAX (1 << 16)
+#define STACK_INITIAL UINT8_COUNT
+// Frames reserve only the slots their bytecode uses, but the runtime pushes a few temporaries of its own above them to
+// keep new objects alive, so the value stack always has this many slots past stack_limit.
+#define STACK_SLACK 4
 #define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
+// Native code nests C activations for every call it makes, so calls are interpreted once they have used this much of
+// the C stack.
+#define NATIVE_STACK_MAX (256 * 1024)
+#define METHOD_CACHE_SIZE 1024
+// Stack traces deeper than twice this show only this many frames at either end.
+#define TRACE_EDGE_FRAMES 10
 
 typedef struct Compiler Compiler;
 
 typedef struct CallFrame
 {
     ObjClosure *closure;
-    uint8_t *ip;
+    Code *ip;
+    RegInstruction *pc;
     Value *slots;
 } CallFrame;
 
+typedef struct MethodCacheEntry
+{
+    ObjShape *shape;
+    ObjString *name;
+    ObjClosure *method;
+} MethodCacheEntry;
+
+typedef enum
+{
+    BACKEND_STACK,
+    BACKEND_REGISTER,
+} Backend;
+
 typedef struct Vm
 {
     Compiler *compiler;
-    CallFrame frames[FRAMES_MAX];
+    Backend backend;
+    // With the register backend, how many frames from the bottom run register code. A function without register code
+    // runs on the stack interpreter together with everything it calls, so the frames above these do too.
+    int register_frames;
+#ifdef BASELINE_JIT
+    bool jit_enabled;
+#endif
+    // Growing either stack moves it, so a pointer to a frame or into the stack is only good until the next call.
+    CallFrame *frames;
     int frame_count;
-    Value stack[STACK_MAX];
+    int frame_capacity;
+    Value *stack;
     Value *stack_top;
-    Table globals;
+    Value *stack_limit;
+    // Where the C stack was when the script started running.
+    uintptr_t native_stack_base;
+    // The global variables, by the slot global_slot gives their name; UNDEFINED_VAL until they are defined. Named
+    // strings stay alive in global_names, so a slot never changes hands.
+    ValueArray global_values;
+    ValueArray global_names;
+    // The values of the global constants compiled so far, by name, which the compiler puts in place of reading them.
+    // UNDEFINED_VAL for those whose value it does not know.
+    Table global_constants;
     Table strings;
     ObjString *init_string;
+    int selector_count;
+    ObjClass *columnar_classes;
+    // The natives behind the intrinsics, and whether their globals have never been assigned since.
+    ObjNative *intrinsics[INTRINSIC_COUNT];
+    ObjString *intrinsic_names[INTRINSIC_COUNT];
+    bool intrinsic_intact[INTRINSIC_COUNT];
+    // The methods megamorphic invoke sites have found, by receiver shape and name. Every collection empties it, since
+    // a freed shape's address may come back as a different shape.
+    MethodCacheEntry method_cache[METHOD_CACHE_SIZE];
     ObjUpvalue *open_upvalues;
     size_t bytes_allocated;
     size_t next_gc;
@@ -34,6 +89,27 @@ typedef struct Vm
     int gray_count;
     int gray_capacity;
     Obj **gray_stack;
+#ifdef DIRECT_THREADING
+    const void *const *handlers;
+#endif
+#ifdef DEBUG_COUNT_OPCODE_PAIRS
+    uint8_t previous_opcode;
+    uint64_t opcode_pairs[OPCODE_COUNT][OPCODE_COUNT];
+#endif
+#ifdef DEBUG_COUNT_SPECIALIZATIONS
+    uint64_t specialized[OPCODE_COUNT];
+    uint64_t guard_failures[OPCODE_COUNT];
+#endif
+#ifdef DEBUG_COUNT_INSTRUCTIONS
+    uint64_t instruction_count;
+#endif
+#ifdef BASELINE_JIT
+    TierStats tier_stats;
+#endif
+#ifdef TRACING_JIT
+    TraceRecorder recorder;
+    TraceStats trace_stats;
+#endif
 } Vm;
 
 typedef enum
@@ -48,5 +124,13 @@ void free_vm(Vm *vm);
 void push(Vm *vm, Value value);
 Value pop(Vm *vm);
 InterpretResult interpret(Vm *vm, const char *source);
+// The slot of the global variable called name, which the first call gives it. The name has to be reachable.
+int global_slot(Vm *vm, ObjString *name);
+// Makes function a global called name, which takes min_arity to max_arity arguments. flags is NATIVE_NO_ALLOC or 0.
+void define_native(Vm *vm, const char *name, int min_arity, int max_arity, uint8_t flags, NativeFn function);
+// Runs a script compiled before, which has to be on top of the stack and is popped.
+InterpretResult interpret_function(Vm *vm, ObjFunction *function);
+// Appends a function and, depth first, every function declared inside it.
+void list_functions(Vm *vm, ObjFunction *function, ValueArray *functions);
 
 #endif
@@ -0,0 +1,15 @@
+def lox_binary(name, src, **kwargs):
+    """Compiles the Lox script src ahead of time into the native executable name."""
+    native.genrule(
+        name=name + "_c",
+        srcs=[src],
+        outs=[name + ".c"],
+        cmd="$(location //loxc) $< $@ > /dev/null",
+        tools=["//loxc"],
+    )
+    native.cc_binary(
+        name=name,
+        srcs=[name + ".c"],
+        deps=["//clox_lib"],
+        **kwargs
+    )
@@ -0,0 +1,640 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "clox_lib/chunk.h"
+#include "clox_lib/common.h"
+#include "clox_lib/compiler.h"
+#include "clox_lib/intrinsic.h"
+#include "clox_lib/object.h"
+#include "clox_lib/scanner.h"
+#include "clox_lib/vm.h"
+
+// Compiles a Lox script to C. The script is compiled to bytecode as usual and every function is translated
+// instruction by instruction into a C function on top of the runtime in clox_lib/aot.h. The generated program carries
+// the bytecode, constants and line numbers of the functions and the names of the globals as static data, which it
+// loads at startup without compiling anything, then runs the C in place of the bytecode.
+
+static char *read_file(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Could not open file \"%s\".\n", path);
+        exit(74);
+    }
+
+    fseek(file, 0L, SEEK_END);
+    size_t file_size = ftell(file);
+    rewind(file);
+
+    char *buffer = (char *)malloc(file_size + 1);
+    if (buffer == NULL)
+    {
+        fprintf(stderr, "Not enough memory to read file \"%s\".\n", path);
+        exit(74);
+    }
+
+    size_t bytes_read = fread(buffer, sizeof(char), file_size, file);
+    if (bytes_read < file_size)
+    {
+        fprintf(stderr, "Could not read file \"%s\".\n", path);
+        exit(74);
+    }
+
+    buffer[bytes_read] = '\0';
+
+    fclose(file);
+    return buffer;
+}
+
+static void emit_string(FILE *out, const char *chars, int length)
+{
+    fputc('"', out);
+    for (const char *c = chars; c < chars + length; c++)
+    {
+        switch (*c)
+        {
+        case '\n':
+            fprintf(out, "\\n");
+            break;
+        case '"':
+        case '\\':
+        case '?':
+            fprintf(out, "\\%c", *c);
+            break;
+        default:
+            if (*c >= ' ' && *c <= '~')
+            {
+                fputc(*c, out);
+            }
+            else
+            {
+                fprintf(out, "\\%03o", (unsigned char)*c);
+            }
+            break;
+        }
+    }
+    fputc('"', out);
+}
+
+// Replays the bytecode with a static stack depth like the register translator does, recording the depth before every
+// instruction and which instructions are jumped to. Code after an unconditional jump continues at the depth of the
+// jump that reaches it. A frame starts out holding the callee and its arguments.
+static void analyze(ObjFunction *function, int *depths, bool *targets)
+{
+    Chunk *chunk = &function->chunk;
+    for (int offset = 0; offset <= chunk->count; offset++)
+    {
+        depths[offset] = -1;
+        targets[offset] = false;
+    }
+
+    int depth = function->arity + 1;
+    bool reachable = true;
+    for (int offset = 0; offset < chunk->count; offset += instruction_length(chunk, offset))
+    {
+        if (!reachable && depths[offset] >= 0)
+        {
+            depth = depths[offset];
+        }
+        depths[offset] = depth;
+        reachable = true;
+
+        uint8_t op = opcode_at(chunk->code, offset);
+        depth += stack_effect(chunk, offset);
+        if (is_forward_jump(op))
+        {
+            int target = jump_target(chunk->code, offset);
+            targets[target] = true;
+            depths[target] = depth;
+        }
+        if (op == OP_LOOP)
+        {
+            targets[jump_target(chunk->code, offset)] = true;
+        }
+        if (op == OP_JUMP || op == OP_LOOP || op == OP_RETURN)
+        {
+            reachable = false;
+        }
+    }
+}
+
+static const char *arithmetic_operator(uint8_t op)
+{
+    switch (op)
+    {
+    case OP_ADD:
+    case OP_ADD_NUM:
+    case OP_ADD_STR:
+    case OP_ADD_LOCALS:
+        return "+";
+    case OP_SUBTRACT:
+    case OP_SUBTRACT_LOCALS:
+        return "-";
+    case OP_MULTIPLY:
+    case OP_MULTIPLY_LOCALS:
+        return "*";
+    default:
+        return "/";
+    }
+}
+
+static const char *arithmetic_slow_path(uint8_t op)
+{
+    switch (op)
+    {
+    case OP_ADD:
+    case OP_ADD_NUM:
+    case OP_ADD_STR:
+    case OP_ADD_LOCALS:
+        return "jit_add(vm)";
+    default:
+        return "jit_numbers_error(vm)";
+    }
+}
+
+static void emit_instruction(FILE *out, ObjFunction *function, int offset, int depth)
+{
+    Chunk *chunk = &function->chunk;
+    uint8_t *code = chunk->code;
+    uint8_t op = opcode_at(code, offset);
+    int operand = instruction_length(chunk, offset) > 1 ? index_operand(code, offset) : 0;
+
+    switch (op)
+    {
+    case OP_CONSTANT:
+        fprintf(out, "    slots[%d] = constants[%d];\n", depth, operand);
+        break;
+    case OP_CONSTANT_LONG:
+        fprintf(out, "    slots[%d] = constants[%d];\n", depth,
+                code[offset + 1] | code[offset + 2] << 8 | code[offset + 3] << 16);
+        break;
+    case OP_NIL:
+        fprintf(out, "    slots[%d] = NIL_VAL;\n", depth);
+        break;
+    case OP_TRUE:
+        fprintf(out, "    slots[%d] = BOOL_VAL(true);\n", depth);
+        break;
+    case OP_FALSE:
+        fprintf(out, "    slots[%d] = BOOL_VAL(false);\n", depth);
+        break;
+    case OP_POP:
+        break;
+    case OP_GET_LOCAL:
+        fprintf(out, "    slots[%d] = slots[%d];\n", depth, operand);
+        break;
+    case OP_SET_LOCAL:
+        fprintf(out, "    slots[%d] = slots[%d];\n", operand, depth - 1);
+        break;
+    case OP_GET_GLOBAL:
+        fprintf(out, "    AOT_TRY(%d, %d, jit_get_global(vm, AOT_GLOBAL(%d)));\n", offset, depth, offset);
+        break;
+    case OP_DEFINE_GLOBAL:
+        fprintf(out, "    AOT_DO(%d, %d, jit_define_global(vm, AOT_GLOBAL(%d)));\n", offset, depth, offset);
+        break;
+    case OP_SET_GLOBAL:
+        fprintf(out, "    AOT_TRY(%d, %d, jit_set_global(vm, AOT_GLOBAL(%d)));\n", offset, depth, offset);
+        break;
+    case OP_GET_UPVALUE:
+        fprintf(out, "    slots[%d] = AOT_UPVALUE(%d);\n", depth, operand);
+        break;
+    case OP_SET_UPVALUE:
+        fprintf(out, "    AOT_UPVALUE(%d) = slots[%d];\n", operand, depth - 1);
+        break;
+    case OP_GET_PROPERTY:
+    case OP_GET_FIELD:
+        fprintf(out, "    AOT_TRY(%d, %d, jit_get_property(vm, AOT_CACHE(%d)));\n", offset, depth,
+                cache_index(code, offset));
+        break;
+    case OP_SET_PROPERTY:
+        fprintf(out, "    AOT_TRY(%d, %d, jit_set_property(vm, AOT_CACHE(%d)));\n", offset, depth,
+                cache_index(code, offset));
+        break;
+    case OP_GET_SUPER:
+        fprintf(out, "    AOT_TRY(%d, %d, jit_get_super(vm, AOT_STRING(%d)));\n", offset, depth, operand);
+        break;
+    case OP_GET_THIS_PROPERTY:
+        fprintf(out, "    slots[%d] = slots[0];\n", depth);
+        fprintf(out, "    AOT_TRY(%d, %d, jit_get_property(vm, AOT_CACHE(%d)));\n", offset, depth + 1,
+                cache_index(code, offset));
+        break;
+    case OP_SET_THIS_PROPERTY:
+        fprintf(out, "    AOT_TRY(%d, %d, jit_set_this_property(vm, AOT_CACHE(%d)));\n", offset, depth,
+                cache_index(code, offset));
+        break;
+    case OP_EQUAL:
+    case OP_NOT_EQUAL:
+        fprintf(out, "    slots[%d] = BOOL_VAL(%svalues_equal(slots[%d], slots[%d]));\n", depth - 2,
+                op == OP_NOT_EQUAL ? "!" : "", depth - 2, depth - 1);
+        break;
+    case OP_GREATER:
+        fprintf(out, "    AOT_COMPARE(%d, %d, >);\n", offset, depth);
+        break;
+    case OP_NOT_GREATER:
+        fprintf(out, "    AOT_COMPARE_NOT(%d, %d, >);\n", offset, depth);
+        break;
+    case OP_LESS:
+        fprintf(out, "    AOT_COMPARE(%d, %d, <);\n", offset, depth);
+        break;
+    case OP_NOT_LESS:
+        fprintf(out, "    AOT_COMPARE_NOT(%d, %d, <);\n", offset, depth);
+        break;
+    case OP_ADD:
+    case OP_ADD_NUM:
+    case OP_ADD_STR:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+        fprintf(out, "    AOT_BINARY(%d, %d, %s, %s);\n", offset, depth, arithmetic_operator(op),
+                arithmetic_slow_path(op));
+        break;
+    case OP_ADD_LOCALS:
+    case OP_SUBTRACT_LOCALS:
+    case OP_MULTIPLY_LOCALS:
+    case OP_DIVIDE_LOCALS:
+        fprintf(out, "    AOT_LOCALS_BINARY(%d, %d, %d, %d, %s, %s);\n", offset, depth, operand, code[offset + 2],
+                arithmetic_operator(op), arithmetic_slow_path(op));
+        break;
+    case OP_NOT:
+        fprintf(out, "    slots[%d] = BOOL_VAL(AOT_FALSEY(slots[%d]));\n", depth - 1, depth - 1);
+        break;
+    case OP_NEGATE:
+        fprintf(out, "    AOT_NEGATE(%d, %d);\n", offset, depth);
+        break;
+    case OP_PRINT:
+        fprintf(out, "    AOT_DO(%d, %d, jit_print(vm));\n", offset, depth);
+        break;
+    case OP_JUMP:
+        fprintf(out, "    goto L%d;\n", jump_target(code, offset));
+        break;
+    case OP_LOOP:
+        fprintf(out, "    goto L%d;\n", jump_target(code, offset));
+        break;
+    case OP_JUMP_IF_FALSE:
+    case OP_POP_JUMP_IF_FALSE:
+        fprintf(out, "    if (AOT_FALSEY(slots[%d]))\n    {\n        goto L%d;\n    }\n", depth - 1,
+                jump_target(code, offset));
+        break;
+    case OP_JUMP_IF_EQUAL:
+    case OP_JUMP_IF_NOT_EQUAL:
+        fprintf(out, "    if (%svalues_equal(slots[%d], slots[%d]))\n    {\n        goto L%d;\n    }\n",
+                op == OP_JUMP_IF_NOT_EQUAL ? "!" : "", depth - 2, depth - 1, jump_target(code, offset));
+        break;
+    case OP_JUMP_IF_GREATER:
+        fprintf(out, "    AOT_JUMP_IF_COMPARE(%d, %d, >, L%d);\n", offset, depth, jump_target(code, offset));
+        break;
+    case OP_JUMP_IF_NOT_GREATER:
+        fprintf(out, "    AOT_JUMP_IF_NOT_COMPARE(%d, %d, >, L%d);\n", offset, depth, jump_target(code, offset));
+        break;
+    case OP_JUMP_IF_LESS:
+        fprintf(out, "    AOT_JUMP_IF_COMPARE(%d, %d, <, L%d);\n", offset, depth, jump_target(code, offset));
+        break;
+    case OP_JUMP_IF_NOT_LESS:
+        fprintf(out, "    AOT_JUMP_IF_NOT_COMPARE(%d, %d, <, L%d);\n", offset, depth, jump_target(code, offset));
+        break;
+    case OP_CALL:
+    case OP_CALL_CLOSURE:
+        fprintf(out, "    AOT_CALL(%d, %d, jit_call(vm, %d));\n", offset, depth, operand);
+        break;
+    case OP_TAIL_CALL:
+        fprintf(out, "    AOT_TRY(%d, %d, jit_tail_call(vm, %d));\n    return true;\n", offset, depth, operand);
+        break;
+    case OP_GET_INTRINSIC:
+        fprintf(out, "    AOT_TRY(%d, %d, jit_get_intrinsic(vm, %d));\n", offset, depth, operand);
+        break;
+    case OP_INTRINSIC:
+        fprintf(out, "    AOT_CALL(%d, %d, jit_intrinsic(vm, %d, %d));\n", offset, depth, operand, code[offset + 2]);
+        break;
+    case OP_INVOKE:
+        fprintf(out, "    AOT_CALL(%d, %d, jit_invoke(vm, AOT_INVOKE_CACHE(%d), %d));\n", offset, depth,
+                invoke_cache_index(code, offset), code[after_index(code, offset)]);
+        break;
+    case OP_SUPER_INVOKE:
+        fprintf(out, "    AOT_CALL(%d, %d, jit_super_invoke(vm, AOT_INVOKE_CACHE(%d), %d));\n", offset, depth,
+                invoke_cache_index(code, offset), code[after_index(code, offset)]);
+        break;
+    case OP_CLOSURE:
+        fprintf(out, "    AOT_DO(%d, %d, jit_closure(vm, AS_FUNCTION(constants[%d]), chunk->code + %d));\n", offset,
+                depth, operand, offset);
+        break;
+    case OP_CLOSE_UPVALUE:
+        fprintf(out, "    AOT_DO(%d, %d, jit_close_upvalue(vm));\n", offset, depth);
+        break;
+    case OP_RETURN:
+        if (!function->captures_locals)
+        {
+            fprintf(out, "    AOT_RETURN(%d);\n", depth);
+            break;
+        }
+        fprintf(out, "    AOT_DO(%d, %d, jit_return(vm));\n    return true;\n", offset, depth);
+        break;
+    case OP_CLASS:
+        fprintf(out, "    AOT_DO(%d, %d, jit_class(vm, AOT_STRING(%d)));\n", offset, depth, operand);
+        break;
+    case OP_INHERIT:
+        fprintf(out, "    AOT_TRY(%d, %d, jit_inherit(vm));\n", offset, depth);
+        break;
+    case OP_METHOD:
+        fprintf(out, "    AOT_DO(%d, %d, jit_method(vm, AOT_STRING(%d)));\n", offset, depth, operand);
+        break;
+    case OP_FIELD:
+        fprintf(out, "    AOT_DO(%d, %d, jit_field(vm, AOT_STRING(%d)));\n", offset, depth, operand);
+        break;
+    default:
+        fprintf(stderr, "Unknown opcode %d.\n", op);
+        exit(70);
+    }
+}
+
+static void emit_function(FILE *out, ObjFunction *function, int index)
+{
+    Chunk *chunk = &function->chunk;
+    int *depths = malloc(sizeof(int) * (chunk->count + 1));
+    bool *targets = malloc(sizeof(bool) * (chunk->count + 1));
+    if (depths == NULL || targets == NULL)
+    {
+        fprintf(stderr, "Not enough memory to compile the script.\n");
+        exit(74);
+    }
+    analyze(function, depths, targets);
+
+    fprintf(out, "// %s\n", function->name == NULL ? "script" : function->name->chars);
+    fprintf(out, "static bool function_%d(Vm *vm, CallFrame *frame)\n{\n    AOT_ENTER();\n", index);
+    for (int offset = 0; offset < chunk->count; offset += instruction_length(chunk, offset))
+    {
+        if (targets[offset])
+        {
+            fprintf(out, "L%d:;\n", offset);
+        }
+        emit_instruction(out, function, offset, depths[offset]);
+    }
+    fprintf(out, "}\n\n");
+
+    free(depths);
+    free(targets);
+}
+
+static int function_index(ValueArray *functions, ObjFunction *function)
+{
+    for (int i = 0; i < functions->count; i++)
+    {
+        if (AS_FUNCTION(functions->values[i]) == function)
+        {
+            return i;
+        }
+    }
+    fprintf(stderr, "Unknown function in the constants.\n");
+    exit(70);
+}
+
+// The constant that holds name, which is where the compiler got the name of every cache from.
+static int name_constant(Chunk *chunk, ObjString *name)
+{
+    for (int i = 0; i < chunk->constants.count; i++)
+    {
+        if (IS_STRING(chunk->constants.values[i]) && AS_STRING(chunk->constants.values[i]) == name)
+        {
+            return i;
+        }
+    }
+    fprintf(stderr, "Unknown cache name \"%s\".\n", name->chars);
+    exit(70);
+}
+
+static void emit_number(FILE *out, double number)
+{
+    if (isnan(number))
+    {
+        fprintf(out, "NAN");
+    }
+    else if (isinf(number))
+    {
+        fprintf(out, number < 0 ? "-INFINITY" : "INFINITY");
+    }
+    else
+    {
+        // Hexadecimal floating point reads back exactly.
+        fprintf(out, "%a", number);
+    }
+}
+
+static void emit_constant(FILE *out, Value value, ValueArray *functions)
+{
+    if (IS_NIL(value))
+    {
+        fprintf(out, "    {AOT_NIL},\n");
+    }
+    else if (IS_BOOL(value))
+    {
+        fprintf(out, "    {AOT_BOOL, .index = %d},\n", AS_BOOL(value));
+    }
+    else if (IS_NUMBER(value))
+    {
+        fprintf(out, "    {AOT_NUMBER, .number = ");
+        emit_number(out, AS_NUMBER(value));
+        fprintf(out, "},\n");
+    }
+    else if (IS_STRING(value))
+    {
+        fprintf(out, "    {AOT_STRING, .chars = ");
+        emit_string(out, AS_CSTRING(value), AS_STRING(value)->length);
+        fprintf(out, ", .length = %d},\n", AS_STRING(value)->length);
+    }
+    else if (IS_FUNCTION(value))
+    {
+        fprintf(out, "    {AOT_FUNCTION, .index = %d},\n", function_index(functions, AS_FUNCTION(value)));
+    }
+    else if (IS_CLOSURE(value))
+    {
+        fprintf(out, "    {AOT_CLOSURE, .index = %d},\n", function_index(functions, AS_CLOSURE(value)->function));
+    }
+    else
+    {
+        fprintf(stderr, "Unknown constant type.\n");
+        exit(70);
+    }
+}
+
+// The bytecode and tables of function, which the C of the function reads through its chunk once they are loaded.
+static void emit_data(FILE *out, ObjFunction *function, int index, ValueArray *functions)
+{
+    Chunk *chunk = &function->chunk;
+    fprintf(out, "static const uint8_t code_%d[] = {", index);
+    for (int i = 0; i < chunk->count; i++)
+    {
+        fprintf(out, "%s%d,", i % 16 == 0 ? "\n    " : " ", chunk->code[i]);
+    }
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out, "static const LineStart lines_%d[] = {", index);
+    for (int i = 0; i < chunk->lines.count; i++)
+    {
+        fprintf(out, "%s{%d, %d},", i % 8 == 0 ? "\n    " : " ", chunk->lines.values[i].offset,
+                chunk->lines.values[i].line);
+    }
+    fprintf(out, "\n};\n\n");
+
+    if (chunk->constants.count > 0)
+    {
+        fprintf(out, "static const AotConstant constants_%d[] = {\n", index);
+        for (int i = 0; i < chunk->constants.count; i++)
+        {
+            emit_constant(out, chunk->constants.values[i], functions);
+        }
+        fprintf(out, "};\n\n");
+    }
+    if (chunk->cache_count > 0)
+    {
+        fprintf(out, "static const AotCache caches_%d[] = {\n", index);
+        for (int i = 0; i < chunk->cache_count; i++)
+        {
+            fprintf(out, "    {%d, %d},\n", name_constant(chunk, chunk->caches[i].name), chunk->caches[i].predicted);
+        }
+        fprintf(out, "};\n\n");
+    }
+    if (chunk->invoke_cache_count > 0)
+    {
+        fprintf(out, "static const int invoke_caches_%d[] = {", index);
+        for (int i = 0; i < chunk->invoke_cache_count; i++)
+        {
+            fprintf(out, "%s%d,", i % 16 == 0 ? "\n    " : " ", name_constant(chunk, chunk->invoke_caches[i].name));
+        }
+        fprintf(out, "\n};\n\n");
+    }
+}
+
+// Refers to the table called name of the function with the given index, or NULL if the function has none.
+static void emit_table(FILE *out, const char *name, const char *count_name, int index, int count)
+{
+    if (count > 0)
+    {
+        fprintf(out, "        .%s = %s_%d,\n        .%s = %d,\n", name, name, index, count_name, count);
+    }
+    else
+    {
+        fprintf(out, "        .%s = NULL,\n        .%s = 0,\n", name, count_name);
+    }
+}
+
+static void emit_function_entry(FILE *out, ObjFunction *function, int index)
+{
+    Chunk *chunk = &function->chunk;
+    fprintf(out, "    {\n        .name = ");
+    if (function->name == NULL)
+    {
+        fprintf(out, "NULL");
+    }
+    else
+    {
+        emit_string(out, function->name->chars, function->name->length);
+    }
+    fprintf(out, ",\n        .arity = %d,\n        .upvalue_count = %d,\n        .max_slots = %d,\n", function->arity,
+            function->upvalue_count, function->max_slots);
+    fprintf(out, "        .captures_locals = %s,\n        .is_leaf = %s,\n        .entry = function_%d,\n",
+            function->captures_locals ? "true" : "false", function->is_leaf ? "true" : "false", index);
+    emit_table(out, "code", "code_count", index, chunk->count);
+    emit_table(out, "lines", "line_count", index, chunk->lines.count);
+    emit_table(out, "constants", "constant_count", index, chunk->constants.count);
+    emit_table(out, "caches", "cache_count", index, chunk->cache_count);
+    emit_table(out, "invoke_caches", "invoke_cache_count", index, chunk->invoke_cache_count);
+    fprintf(out, "    },\n");
+}
+
+static void emit_program(FILE *out, Vm *vm, const char *path, ValueArray *functions)
+{
+    fprintf(out, "// Generated by loxc from %s.\n\n#include \"clox_lib/aot.h\"\n\n", path);
+    for (int i = 0; i < functions->count; i++)
+    {
+        emit_function(out, AS_FUNCTION(functions->values[i]), i);
+        emit_data(out, AS_FUNCTION(functions->values[i]), i, functions);
+    }
+
+    fprintf(out, "static const AotFunction functions[] = {\n");
+    for (int i = 0; i < functions->count; i++)
+    {
+        emit_function_entry(out, AS_FUNCTION(functions->values[i]), i);
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "static const char *const globals[] = {\n");
+    for (int i = 0; i < vm->global_names.count; i++)
+    {
+        ObjString *name = AS_STRING(vm->global_names.values[i]);
+        fprintf(out, "    ");
+        emit_string(out, name->chars, name->length);
+        fprintf(out, ",\n");
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "static const AotProgram program = {\n    functions,\n    %d,\n    globals,\n    %d,\n    {",
+            functions->count, vm->global_names.count);
+    for (int i = 0; i < INTRINSIC_COUNT; i++)
+    {
+        fprintf(out, "%s%s", i == 0 ? "" : ", ", vm->intrinsic_intact[i] ? "true" : "false");
+    }
+    fprintf(out, "},\n};\n\n");
+    fprintf(out, "int main(void)\n{\n    return aot_main(&program);\n}\n");
+}
+
+static int compile_file(Vm *vm, const char *path, const char *out_path)
+{
+    char *source = read_file(path);
+    Scanner scanner;
+    init_scanner(&scanner, source);
+    Parser parser;
+    init_parser(&parser);
+    Compiler compiler;
+    init_compiler(&compiler, &scanner, &parser, vm, TYPE_SCRIPT);
+    vm->compiler = &compiler;
+
+    ObjFunction *function = compile(&compiler);
+    int status = 0;
+    if (function == NULL)
+    {
+        status = 65;
+    }
+    else
+    {
+        push(vm, OBJ_VAL(function));
+        ValueArray functions;
+        init_value_array(vm, &functions);
+        list_functions(vm, function, &functions);
+
+        FILE *out = fopen(out_path, "w");
+        if (out == NULL)
+        {
+            fprintf(stderr, "Could not open file \"%s\".\n", out_path);
+            status = 74;
+        }
+        else
+        {
+            emit_program(out, vm, path, &functions);
+            fclose(out);
+        }
+        free_value_array(vm, &functions);
+        pop(vm);
+    }
+
+    free_compiler(&compiler);
+    vm->compiler = NULL;
+    free_scanner(&scanner);
+    free_parser(&parser);
+    free(source);
+    return status;
+}
+
+int main(int argc, const char *argv[])
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "Usage: loxc path output\n");
+        exit(64);
+    }
+
+    Vm vm;
+    init_vm(&vm);
+    int status = compile_file(&vm, argv[1], argv[2]);
+    free_vm(&vm);
+    return status;
+}